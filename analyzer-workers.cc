@@ -0,0 +1,309 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "analyzer-workers.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_join.h>
+#include <absl/strings/str_split.h>
+
+// Messages start with the request id. Results then have one byte telling
+// if the analysis succeeded, followed by the result or error message.
+static constexpr size_t kIdSize = sizeof(uint64_t);
+
+// A worker dying sooner than this after start is suspicious; if it happens
+// a few times in a row, something is broken and we stop restarting it.
+static constexpr std::chrono::seconds kMinWorkerLifetime(1);
+static constexpr int kMaxQuickDeaths = 3;
+
+static absl::Status ErrnoStatus(absl::string_view what) {
+  return absl::InternalError(absl::StrCat(what, ": ", strerror(errno)));
+}
+
+AnalyzerWorkers::AnalyzerWorkers(int worker_count,
+                                 const StartWorkerFun &start_worker,
+                                 std::chrono::milliseconds request_timeout)
+    : worker_count_(worker_count),
+      start_worker_(start_worker),
+      request_timeout_(request_timeout) {}
+
+AnalyzerWorkers::~AnalyzerWorkers() {
+  Shutdown();
+  for (auto &worker : workers_) {
+    if (worker->pidfd >= 0) close(worker->pidfd);
+    if (worker->timeout_fd >= 0) close(worker->timeout_fd);
+  }
+}
+
+absl::Status AnalyzerWorkers::Start(FileEventDispatcher *dispatcher) {
+  dispatcher_ = dispatcher;
+  for (int i = 0; i < worker_count_; ++i) {
+    auto worker = std::make_unique<Worker>();
+    absl::Status status =
+        SharedRing::Create(kRingCapacity, &worker->requests);
+    if (status.ok()) {
+      status = SharedRing::Create(kRingCapacity, &worker->results);
+    }
+    if (status.ok()) {
+      worker->timeout_fd =
+          timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+      if (worker->timeout_fd < 0) status = ErrnoStatus("timerfd_create()");
+    }
+    if (status.ok()) status = Spawn(worker.get());
+    if (!status.ok()) return status;
+    Worker *const w = worker.get();
+    dispatcher_->RunOnReadable(w->results->doorbell_fd(), [this, w]() {
+      w->results->ResetDoorbell();
+      DeliverResults(w);
+      return true;
+    });
+    w->results->ArmDoorbell();
+    dispatcher_->RunOnReadable(w->timeout_fd, [this, w]() {
+      uint64_t expirations;
+      if (read(w->timeout_fd, &expirations, sizeof(expirations)) < 0) {
+        // Re-armed meanwhile; nothing due.
+      }
+      HandleTimeout(w);
+      return true;
+    });
+    workers_.push_back(std::move(worker));
+  }
+  return absl::OkStatus();
+}
+
+absl::Status AnalyzerWorkers::Spawn(Worker *worker) {
+  const int channel_fds[] = {
+      worker->requests->memory_fd(), worker->requests->doorbell_fd(),
+      worker->results->memory_fd(), worker->results->doorbell_fd()};
+  const std::string channel = absl::StrJoin(channel_fds, ",");
+  const pid_t parent = getpid();
+  const pid_t pid = fork();
+  if (pid < 0) return ErrnoStatus("fork()");
+  if (pid == 0) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);  // Don't outlive us.
+    if (getppid() != parent) _exit(1);
+    for (const int fd : channel_fds) fcntl(fd, F_SETFD, 0);  // Inherit.
+    start_worker_(channel);
+    _exit(1);
+  }
+
+  worker->pid = pid;
+  worker->started = std::chrono::steady_clock::now();
+  worker->pidfd = syscall(SYS_pidfd_open, pid, 0);
+  if (worker->pidfd < 0) {
+    const absl::Status status = ErrnoStatus("pidfd_open()");
+    kill(pid, SIGKILL);
+    waitpid(pid, nullptr, 0);
+    worker->pid = -1;
+    return status;
+  }
+  dispatcher_->RunOnReadable(worker->pidfd,
+                             [this, worker]() { return HandleExit(worker); });
+  return absl::OkStatus();
+}
+
+bool AnalyzerWorkers::Submit(const std::vector<absl::string_view> &parts,
+                             const ResultFun &done) {
+  Worker *least_busy = nullptr;
+  for (auto &worker : workers_) {
+    if (worker->pid < 0) continue;
+    if (!least_busy ||
+        worker->in_flight.size() < least_busy->in_flight.size()) {
+      least_busy = worker.get();
+    }
+  }
+  if (!least_busy) return false;
+
+  const uint64_t id = next_request_id_++;
+  std::vector<absl::string_view> message = {
+      {reinterpret_cast<const char *>(&id), kIdSize}};
+  message.insert(message.end(), parts.begin(), parts.end());
+  if (!least_busy->requests->Push(message)) return false;
+  if (least_busy->in_flight.empty()) {
+    least_busy->busy_since = std::chrono::steady_clock::now();
+    least_busy->in_flight[id] = done;
+    ArmTimeout(least_busy);
+  } else {
+    least_busy->in_flight[id] = done;
+  }
+  return true;
+}
+
+void AnalyzerWorkers::ArmTimeout(Worker *worker) {
+  struct itimerspec timeout = {};  // All zero: disarmed.
+  if (!worker->in_flight.empty()) {
+    const auto remaining = std::max<std::chrono::nanoseconds>(
+        worker->busy_since + request_timeout_ -
+            std::chrono::steady_clock::now(),
+        std::chrono::nanoseconds(1));
+    timeout.it_value.tv_sec = remaining.count() / 1000000000;
+    timeout.it_value.tv_nsec = remaining.count() % 1000000000;
+  }
+  timerfd_settime(worker->timeout_fd, 0, &timeout, nullptr);
+}
+
+// Killing the worker makes it exit; HandleExit() fails its requests.
+void AnalyzerWorkers::HandleTimeout(Worker *worker) {
+  if (worker->pid < 0 || worker->in_flight.empty() || worker->timed_out) {
+    return;
+  }
+  if (std::chrono::steady_clock::now() - worker->busy_since <
+      request_timeout_) {
+    ArmTimeout(worker);  // Made progress since the timer was armed.
+    return;
+  }
+  worker->timed_out = true;
+  ++stats_timeouts_;
+  kill(worker->pid, SIGKILL);
+}
+
+void AnalyzerWorkers::DeliverResults(Worker *worker) {
+  const size_t in_flight_before = worker->in_flight.size();
+  do {
+    absl::string_view message;
+    while (worker->results->Peek(&message)) {
+      uint64_t id;
+      if (message.size() > kIdSize) {
+        memcpy(&id, message.data(), kIdSize);
+        auto found = worker->in_flight.find(id);
+        if (found != worker->in_flight.end()) {
+          const ResultFun done = std::move(found->second);
+          worker->in_flight.erase(found);
+          const bool ok = message[kIdSize];
+          const absl::string_view result = message.substr(kIdSize + 1);
+          if (ok) {
+            ++stats_completed_;
+            done(absl::OkStatus(), result);
+          } else {
+            ++stats_failed_;
+            done(absl::InternalError(result), "");
+          }
+        }
+      }
+      worker->results->Pop();
+    }
+  } while (!worker->results->ArmDoorbell());
+  if (worker->in_flight.size() != in_flight_before) {
+    // Next request only started now.
+    worker->busy_since = std::chrono::steady_clock::now();
+    ArmTimeout(worker);
+  }
+}
+
+bool AnalyzerWorkers::HandleExit(Worker *worker) {
+  if (worker->pid < 0) return false;  // After Shutdown().
+  waitpid(worker->pid, nullptr, 0);
+  worker->pid = -1;
+  const int old_pidfd = worker->pidfd;
+  worker->pidfd = -1;
+
+  DeliverResults(worker);  // What it finished before going away.
+  std::map<uint64_t, ResultFun> lost;
+  lost.swap(worker->in_flight);
+  ArmTimeout(worker);
+  const absl::Status lost_status =
+      worker->timed_out
+          ? absl::DeadlineExceededError("Analyzer worker took too long")
+          : absl::AbortedError("Analyzer worker exited");
+  worker->timed_out = false;
+  worker->requests->Reset();
+  worker->results->Reset();
+  worker->results->ArmDoorbell();
+
+  const auto now = std::chrono::steady_clock::now();
+  worker->quick_deaths =
+      (now - worker->started < kMinWorkerLifetime) ? worker->quick_deaths + 1
+                                                   : 0;
+  if (worker->quick_deaths < kMaxQuickDeaths && Spawn(worker).ok()) {
+    ++stats_restarts_;
+  }
+  close(old_pidfd);  // Only now, so that the new pidfd has another number.
+
+  for (auto &request : lost) {
+    ++stats_failed_;
+    request.second(lost_status, "");
+  }
+  return false;
+}
+
+void AnalyzerWorkers::Shutdown() {
+  for (auto &worker : workers_) {
+    if (worker->pid < 0) continue;
+    kill(worker->pid, SIGTERM);
+    waitpid(worker->pid, nullptr, 0);
+    worker->pid = -1;
+    worker->in_flight.clear();
+  }
+}
+
+/*static*/ int AnalyzerWorkers::RunWorker(const std::string &channel,
+                                          const AnalyzeFun &analyze) {
+  std::vector<int> fds;
+  for (absl::string_view fd_string : absl::StrSplit(channel, ',')) {
+    int fd;
+    if (!absl::SimpleAtoi(fd_string, &fd)) return 1;
+    fds.push_back(fd);
+  }
+  std::unique_ptr<SharedRing> requests;
+  std::unique_ptr<SharedRing> results;
+  if (fds.size() != 4 || !SharedRing::Attach(fds[0], fds[1], &requests).ok() ||
+      !SharedRing::Attach(fds[2], fds[3], &results).ok()) {
+    return 1;
+  }
+
+  const pid_t parent = getppid();
+  while (getppid() == parent) {
+    absl::string_view request;
+    if (!requests->Peek(&request)) {
+      if (requests->ArmDoorbell()) requests->WaitDoorbell(1000);
+      continue;
+    }
+    if (request.size() < kIdSize) {
+      requests->Pop();
+      continue;
+    }
+    std::string result;
+    char ok = 1;
+    try {
+      result = analyze(request.substr(kIdSize));
+    } catch (const std::exception &e) {
+      result = e.what();
+      ok = 0;
+    }
+    if (result.size() + kIdSize + 1 > results->max_message_size()) {
+      result = "Result too large";
+      ok = 0;
+    }
+    const std::vector<absl::string_view> message = {
+        request.substr(0, kIdSize), {&ok, 1}, result};
+    while (!results->Push(message) && getppid() == parent) {
+      usleep(1000);  // Parent busy; rare, so no doorbell this direction.
+    }
+    requests->Pop();
+  }
+  return 0;
+}
@@ -0,0 +1,130 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef ANALYZER_WORKERS_H
+#define ANALYZER_WORKERS_H
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/strings/string_view.h>
+
+#include "file-event-dispatcher.h"
+#include "shared-ring.h"
+
+// Pool of worker processes for analyses that are expensive or might crash.
+// Workers use all cores without sharing our heap, and a crash only costs
+// the requests in flight, not the editor session.
+//
+// Requests and results pass through a SharedRing in each direction: the
+// data is copied once into shared memory and the worker reads it in place,
+// no serialization or pipe in between. Results are delivered from the
+// FileEventDispatcher loop. Workers that go away are restarted; so are
+// those that take too long, e.g. caught in an endless loop.
+class AnalyzerWorkers {
+ public:
+  // Runs in the worker: analyze request and return result.
+  using AnalyzeFun = std::function<std::string(absl::string_view request)>;
+
+  // Receives the result of a request, or an error if the worker died.
+  using ResultFun =
+      std::function<void(const absl::Status &status, absl::string_view result)>;
+
+  // Runs in the forked child to become the worker for "channel" (a
+  // description of the shared memory and doorbells to attach to). Typically
+  // exec()s a binary that passes "channel" on to RunWorker(). Must not
+  // return.
+  using StartWorkerFun = std::function<void(const std::string &channel)>;
+
+  static constexpr size_t kRingCapacity = 32 << 20;
+
+  // A worker not finishing a request within this time is killed.
+  static constexpr std::chrono::milliseconds kDefaultRequestTimeout{10000};
+
+  AnalyzerWorkers(
+      int worker_count, const StartWorkerFun &start_worker,
+      std::chrono::milliseconds request_timeout = kDefaultRequestTimeout);
+  AnalyzerWorkers(const AnalyzerWorkers &) = delete;
+  ~AnalyzerWorkers();  // Terminates workers.
+
+  // Start workers; results and exits are handled in "dispatcher".
+  absl::Status Start(FileEventDispatcher *dispatcher);
+
+  // Send request, made of the concatenated "parts", to the least busy
+  // worker; "done" is called with the result later. If the worker takes
+  // longer than the request timeout once it started with the request, it
+  // is killed and "done" receives a kDeadlineExceeded error. Returns false
+  // if the request can't be taken right now (too large, queues full or no
+  // workers); the caller might run it in-process instead.
+  bool Submit(const std::vector<absl::string_view> &parts,
+              const ResultFun &done);
+
+  // Terminate all workers, e.g. before exec(). Requests in flight are
+  // dropped without calling their ResultFun.
+  void Shutdown();
+
+  // Worker side: serve requests arriving on "channel" with "analyze" until
+  // the parent goes away. Returns exit code.
+  static int RunWorker(const std::string &channel, const AnalyzeFun &analyze);
+
+  // -- Statistical data
+
+  int64_t StatCompleted() const { return stats_completed_; }
+  int64_t StatFailed() const { return stats_failed_; }
+  int StatRestarts() const { return stats_restarts_; }
+  int64_t StatTimeouts() const { return stats_timeouts_; }
+
+ private:
+  struct Worker {
+    pid_t pid = -1;
+    int pidfd = -1;  // Readable once the process is gone.
+    std::chrono::steady_clock::time_point started;
+    int quick_deaths = 0;  // In a row.
+    std::unique_ptr<SharedRing> requests;
+    std::unique_ptr<SharedRing> results;
+    std::map<uint64_t, ResultFun> in_flight;
+    // Requests are worked on in order; the first in flight since then.
+    std::chrono::steady_clock::time_point busy_since;
+    int timeout_fd = -1;  // timerfd, readable once busy for too long.
+    bool timed_out = false;  // Killed for that.
+  };
+
+  absl::Status Spawn(Worker *worker);
+  void DeliverResults(Worker *worker);
+  bool HandleExit(Worker *worker);  // Returns if still watching old pidfd.
+  void ArmTimeout(Worker *worker);    // Disarms if nothing in flight.
+  void HandleTimeout(Worker *worker);
+
+  const int worker_count_;
+  const StartWorkerFun start_worker_;
+  const std::chrono::milliseconds request_timeout_;
+  FileEventDispatcher *dispatcher_ = nullptr;
+  std::vector<std::unique_ptr<Worker>> workers_;
+  uint64_t next_request_id_ = 0;
+
+  int64_t stats_completed_ = 0;
+  int64_t stats_failed_ = 0;
+  int stats_restarts_ = 0;
+  int64_t stats_timeouts_ = 0;
+};
+
+#endif  // ANALYZER_WORKERS_H
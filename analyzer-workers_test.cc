@@ -0,0 +1,155 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "analyzer-workers.h"
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <absl/strings/ascii.h>
+
+#include "gtest/gtest.h"
+
+// Allow to run the loop step by step.
+class SteppingDispatcher : public FileEventDispatcher {
+ public:
+  using FileEventDispatcher::FileEventDispatcher;
+  using FileEventDispatcher::SingleCycle;
+};
+
+// Test worker: upper-cases the request; some requests are trouble.
+static std::string Analyze(absl::string_view request) {
+  if (request == "crash") abort();
+  if (request == "throw") throw std::runtime_error("can't handle this");
+  if (request == "hang") {
+    for (;;) sleep(1);
+  }
+  return absl::AsciiStrToUpper(request);
+}
+
+// The forked child becomes the worker right away instead of exec()ing.
+static void StartWorker(const std::string &channel) {
+  _exit(AnalyzerWorkers::RunWorker(channel, Analyze));
+}
+
+// Step the loop until "done" returns true or we give up.
+template <typename Condition>
+static bool LoopUntil(SteppingDispatcher *loop, const Condition &done) {
+  const auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  while (!done()) {
+    if (std::chrono::steady_clock::now() > deadline) return false;
+    loop->SingleCycle(10);
+  }
+  return true;
+}
+
+TEST(AnalyzerWorkers, ResultsAreDeliveredInLoop) {
+  static constexpr int kRequests = 100;
+  SteppingDispatcher loop(10);
+  AnalyzerWorkers workers(2, StartWorker);
+  ASSERT_TRUE(workers.Start(&loop).ok());
+
+  int received = 0;
+  for (int i = 0; i < kRequests; ++i) {
+    const std::string number = std::to_string(i);
+    ASSERT_TRUE(workers.Submit(
+        {"request ", number},
+        [&, number](const absl::Status &status, absl::string_view result) {
+          EXPECT_TRUE(status.ok()) << status;
+          EXPECT_EQ(result, "REQUEST " + number);
+          ++received;
+        }));
+  }
+  ASSERT_TRUE(LoopUntil(&loop, [&]() { return received == kRequests; }));
+  EXPECT_EQ(workers.StatCompleted(), kRequests);
+}
+
+TEST(AnalyzerWorkers, ExceptionIsReportedAsError) {
+  SteppingDispatcher loop(10);
+  AnalyzerWorkers workers(1, StartWorker);
+  ASSERT_TRUE(workers.Start(&loop).ok());
+
+  absl::Status received_status;
+  bool received = false;
+  ASSERT_TRUE(workers.Submit(
+      {"throw"}, [&](const absl::Status &status, absl::string_view) {
+        received_status = status;
+        received = true;
+      }));
+  ASSERT_TRUE(LoopUntil(&loop, [&]() { return received; }));
+  EXPECT_EQ(received_status.message(), "can't handle this");
+  EXPECT_EQ(workers.StatRestarts(), 0);
+}
+
+TEST(AnalyzerWorkers, CrashedWorkerIsRestarted) {
+  SteppingDispatcher loop(10);
+  AnalyzerWorkers workers(1, StartWorker);
+  ASSERT_TRUE(workers.Start(&loop).ok());
+
+  absl::Status crash_status;
+  bool crash_reported = false;
+  ASSERT_TRUE(workers.Submit(
+      {"crash"}, [&](const absl::Status &status, absl::string_view) {
+        crash_status = status;
+        crash_reported = true;
+      }));
+  ASSERT_TRUE(LoopUntil(&loop, [&]() { return crash_reported; }));
+  EXPECT_TRUE(absl::IsAborted(crash_status)) << crash_status;
+  EXPECT_EQ(workers.StatRestarts(), 1);
+
+  std::string result;
+  ASSERT_TRUE(workers.Submit(
+      {"still here"}, [&](const absl::Status &status, absl::string_view r) {
+        EXPECT_TRUE(status.ok());
+        result = std::string(r);
+      }));
+  ASSERT_TRUE(LoopUntil(&loop, [&]() { return !result.empty(); }));
+  EXPECT_EQ(result, "STILL HERE");
+}
+
+TEST(AnalyzerWorkers, WorkerTakingTooLongIsKilled) {
+  SteppingDispatcher loop(10);
+  AnalyzerWorkers workers(1, StartWorker, std::chrono::milliseconds(200));
+  ASSERT_TRUE(workers.Start(&loop).ok());
+
+  std::vector<absl::Status> statuses;
+  for (const char *request : {"hang", "queued behind"}) {
+    ASSERT_TRUE(workers.Submit(
+        {request}, [&](const absl::Status &status, absl::string_view) {
+          statuses.push_back(status);
+        }));
+  }
+  ASSERT_TRUE(LoopUntil(&loop, [&]() { return statuses.size() == 2; }));
+  for (const absl::Status &status : statuses) {
+    EXPECT_TRUE(absl::IsDeadlineExceeded(status)) << status;
+  }
+  EXPECT_EQ(workers.StatTimeouts(), 1);
+  EXPECT_EQ(workers.StatRestarts(), 1);
+
+  std::string result;
+  ASSERT_TRUE(workers.Submit(
+      {"still here"}, [&](const absl::Status &status, absl::string_view r) {
+        EXPECT_TRUE(status.ok());
+        result = std::string(r);
+      }));
+  ASSERT_TRUE(LoopUntil(&loop, [&]() { return !result.empty(); }));
+  EXPECT_EQ(result, "STILL HERE");
+  EXPECT_EQ(workers.StatTimeouts(), 1);
+}
@@ -0,0 +1,140 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffer-lint.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include <absl/strings/ascii.h>
+
+// Buffers with at least this many lines are linted in parallel chunks.
+static constexpr int kParallelLintMinLines = 50000;
+
+void LintLines(const EditTextBuffer::LineVector &lines, int first, int last,
+               const RegexLintRules *rules,
+               std::vector<DiagnosticFixPair> *result) {
+  // We complain about all words that are ... "wrong" :)
+  static constexpr absl::string_view kComplainWord = "wrong";
+  for (int pos_line = first; pos_line < last; ++pos_line) {
+    const EditTextBuffer::Line &line = *lines[pos_line];
+    for (absl::string_view token : line.tokens()) {
+      const int token_col = token.data() - line.text().data();
+      size_t pos = 0;
+      while ((pos = token.find(kComplainWord, pos)) !=
+             absl::string_view::npos) {
+        const int col = token_col + pos;
+        Range r = {{pos_line, col},
+                   {pos_line, col + (int)kComplainWord.length()}};
+        result->emplace_back(DiagnosticFixPair{
+            .diagnostic =
+                {
+                    .range = r,
+                    .message = "That word is wrong :)",
+                },
+            .fixes = {},
+        });
+        result->back().fixes.emplace_back(
+            TitledFix{.title = "Better Word",
+                      .edit = {{.range = r, .newText = "correct"}}});
+        result->back().fixes.emplace_back(
+            TitledFix{.title = "Ambiguous but same length",
+                      .edit = {{.range = r, .newText = "right"}}});
+        pos += kComplainWord.length();
+      }
+    }
+    if (!rules) continue;
+    std::vector<RegexLintRules::Match> matches;
+    rules->MatchLine(absl::StripTrailingAsciiWhitespace(line.text()),
+                     &matches);
+    for (const RegexLintRules::Match &m : matches) {
+      result->emplace_back(DiagnosticFixPair{
+          .diagnostic =
+              {
+                  .range = {{pos_line, m.start}, {pos_line, m.end}},
+                  .message = rules->message(m.rule),
+              },
+          .fixes = {},
+      });
+    }
+  }
+}
+
+// With a limit on findings, lint blocks of lines that double in size each
+// time, starting with this many lines. So tokenizing up to each block end,
+// which looks at all lines before, adds up to linear time in total.
+static constexpr int kLimitedLintFirstBlockLines = 4096;
+
+// Lint lines [first, last), in parallel chunks if worth it.
+static void LintRange(const EditTextBuffer::LineVector &lines, int first,
+                      int last, const LintContext &context,
+                      std::vector<DiagnosticFixPair> *result) {
+  const int line_count = last - first;
+  if (!context.thread_pool || line_count < kParallelLintMinLines) {
+    LintLines(lines, first, last, context.rules, result);
+    return;
+  }
+
+  // Lines are a read-only snapshot while we're in the RequestTokenizedLines()
+  // callback, so they can be linted in parallel. A few more chunks than
+  // threads to even out chunks that take longer. Results are merged in line
+  // order.
+  const int chunk_count = context.thread_pool->thread_count() * 4;
+  const int chunk_lines = (line_count + chunk_count - 1) / chunk_count;
+  std::vector<std::vector<DiagnosticFixPair>> chunk_results(chunk_count);
+  std::vector<std::future<void>> work;
+  for (int chunk = 0; chunk < chunk_count; ++chunk) {
+    const int chunk_first = first + chunk * chunk_lines;
+    const int chunk_last = std::min(chunk_first + chunk_lines, last);
+    if (chunk_first >= chunk_last) break;
+    work.emplace_back(
+        context.thread_pool->ExecAsync([&, chunk, chunk_first, chunk_last]() {
+          LintLines(lines, chunk_first, chunk_last, context.rules,
+                    &chunk_results[chunk]);
+        }));
+  }
+  WaitAll(&work);  // Chunks write to chunk_results until done.
+  for (auto &chunk_result : chunk_results) {
+    std::move(chunk_result.begin(), chunk_result.end(),
+              std::back_inserter(*result));
+  }
+}
+
+std::vector<DiagnosticFixPair> RunLint(const EditTextBuffer &buffer,
+                                       const LintContext &context) {
+  std::vector<DiagnosticFixPair> result;
+  if (context.max_findings == 0) {
+    buffer.RequestTokenizedLines([&](const EditTextBuffer::LineVector &lines) {
+      LintRange(lines, 0, lines.size(), context, &result);
+    });
+    return result;
+  }
+
+  const int line_count = buffer.lines();
+  int first = 0;
+  int block_lines = kLimitedLintFirstBlockLines;
+  while (first < line_count && result.size() < context.max_findings) {
+    const int last = std::min(first + block_lines, line_count);
+    buffer.RequestTokenizedLines(
+        last, [&](const EditTextBuffer::LineVector &lines) {
+          LintRange(lines, first, last, context, &result);
+        });
+    first = last;
+    block_lines *= 2;
+  }
+  if (result.size() > context.max_findings) {
+    result.resize(context.max_findings);
+  }
+  return result;
+}
@@ -0,0 +1,51 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef BUFFER_LINT_H
+#define BUFFER_LINT_H
+
+#include <vector>
+
+#include "lint-rules.h"
+#include "lsp-protocol.h"
+#include "lsp-text-buffer.h"
+#include "thread-pool.h"
+
+// Everything RunLint() needs to know besides the buffer to lint.
+struct LintContext {
+  // Rules loaded from a user-provided rule file. Optional.
+  const RegexLintRules *rules = nullptr;
+
+  // If set, large buffers are split into chunks of lines that are linted
+  // in parallel. Must not be a pool RunLint() itself is running on.
+  ThreadPool *thread_pool = nullptr;
+
+  // If non-zero, stop after this many findings. Lines are then tokenized
+  // and linted from the start of the document only as far as needed, so
+  // large documents don't have to be processed as a whole.
+  size_t max_findings = 0;
+};
+
+// Lint lines [first, last) and append findings to "result". Lines need to
+// be tokenized, i.e. called within RequestTokenizedLines().
+void LintLines(const EditTextBuffer::LineVector &lines, int first, int last,
+               const RegexLintRules *rules,
+               std::vector<DiagnosticFixPair> *result);
+
+// Run lint on the buffer. Besides the built-in check, apply the
+// user-provided rules if given in the context. Findings are in line order.
+std::vector<DiagnosticFixPair> RunLint(const EditTextBuffer &buffer,
+                                       const LintContext &context);
+
+#endif  // BUFFER_LINT_H
@@ -0,0 +1,76 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lint of a single buffer of a million lines, in one go and split into
+// chunks linted in parallel on a growing number of threads. Cold is the
+// first lint of a freshly opened buffer, which tokenizes it on the way;
+// that is done in one go before the chunks fan out, as the lexer state
+// carries from line to line. Warm is with the tokens already cached.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "buffer-lint.h"
+
+static constexpr int kLines = 1000000;
+static constexpr int kRuns = 3;
+
+// Best of a few runs, in seconds.
+static double TimeLint(const std::string &text, bool cold, ThreadPool *pool,
+                       size_t *findings) {
+  const LintContext context = {.rules = nullptr, .thread_pool = pool};
+  std::unique_ptr<EditTextBuffer> buffer;
+  double best = 1e9;
+  for (int run = 0; run < kRuns; ++run) {
+    if (cold || !buffer) {
+      buffer = std::make_unique<EditTextBuffer>(text);  // Not measured.
+      if (!cold) RunLint(*buffer, context);
+    }
+    const auto start = std::chrono::steady_clock::now();
+    *findings = RunLint(*buffer, context).size();
+    const std::chrono::duration<double> duration =
+        std::chrono::steady_clock::now() - start;
+    best = std::min(best, duration.count());
+  }
+  return best;
+}
+
+int main() {
+  std::string text;
+  for (int i = 0; i < kLines; ++i) {
+    text.append(i % 10 == 0 ? "Some text with a wrong word in it\n"
+                            : "Some text with nothing to complain about\n");
+  }
+  size_t findings;
+  const int cores = std::max(1u, std::thread::hardware_concurrency());
+  const double single_cold = TimeLint(text, true, nullptr, &findings);
+  const double single_warm = TimeLint(text, false, nullptr, &findings);
+  fprintf(stderr, "%d lines, %zu findings; %d cores.\n", kLines, findings,
+          cores);
+  fprintf(stderr, "%8s %10s %8s %10s %8s\n", "Threads", "Cold (ms)",
+          "Speedup", "Warm (ms)", "Speedup");
+  fprintf(stderr, "%8s %10.1f %8.2f %10.1f %8.2f\n", "none",
+          single_cold * 1000, 1.0, single_warm * 1000, 1.0);
+  for (int threads = 1; threads <= std::max(8, 2 * cores); threads *= 2) {
+    ThreadPool pool(threads);
+    const double cold = TimeLint(text, true, &pool, &findings);
+    const double warm = TimeLint(text, false, &pool, &findings);
+    fprintf(stderr, "%8d %10.1f %8.2f %10.1f %8.2f\n", threads, cold * 1000,
+            single_cold / cold, warm * 1000, single_warm / warm);
+  }
+}
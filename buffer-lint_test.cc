@@ -0,0 +1,64 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "buffer-lint.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+TEST(BufferLint, FindsWrongWordsWithFixes) {
+  const EditTextBuffer buffer("all good\nthis is wrong\n");
+  const std::vector<DiagnosticFixPair> result = RunLint(buffer, {});
+  ASSERT_EQ(result.size(), 1);
+  EXPECT_EQ(result[0].diagnostic.range.start.line, 1);
+  EXPECT_EQ(result[0].diagnostic.range.start.character, 8);
+  EXPECT_EQ(result[0].diagnostic.range.end.character, 13);
+  EXPECT_EQ(result[0].fixes.size(), 2);
+}
+
+TEST(BufferLint, ParallelChunksResultInSameOrder) {
+  std::string text;
+  for (int i = 0; i < 100000; ++i) {
+    text.append(i % 7 == 0 ? "wrong and wrong\n" : "fine\n");
+  }
+  const EditTextBuffer buffer(text);
+  const std::vector<DiagnosticFixPair> single = RunLint(buffer, {});
+  ThreadPool pool(3);
+  const std::vector<DiagnosticFixPair> parallel =
+      RunLint(buffer, {.rules = nullptr, .thread_pool = &pool});
+  ASSERT_EQ(parallel.size(), single.size());
+  for (size_t i = 0; i < single.size(); ++i) {
+    ASSERT_EQ(parallel[i].diagnostic.range.start.line,
+              single[i].diagnostic.range.start.line);
+    ASSERT_EQ(parallel[i].diagnostic.range.start.character,
+              single[i].diagnostic.range.start.character);
+  }
+}
+
+TEST(BufferLint, MaxFindingsStopsEarly) {
+  std::string text;
+  for (int i = 0; i < 100000; ++i) {
+    text.append("wrong\n");
+  }
+  const EditTextBuffer buffer(text);
+  const std::vector<DiagnosticFixPair> result =
+      RunLint(buffer, {.rules = nullptr, .thread_pool = nullptr,
+                       .max_findings = 10});
+  ASSERT_EQ(result.size(), 10);
+  EXPECT_EQ(result.back().diagnostic.range.start.line, 9);
+
+  // Only the first block of lines had to be looked at.
+  EXPECT_LT(buffer.StatLinesTokenized(), 10000);
+}
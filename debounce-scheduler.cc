@@ -0,0 +1,100 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "debounce-scheduler.h"
+
+#include <algorithm>
+
+// Weight of the latest interval in the average typing cadence.
+static constexpr double kIntervalWeight = 0.25;
+
+// Cadence assumed as long as we haven't seen a buffer being edited
+// repeatedly; with a slow lint, this waits for the same 300ms pause that
+// used to be fixed.
+static constexpr double kDefaultIntervalMs = 150;
+
+// Linting counts as cheap if running it after every keystroke would keep
+// us busy for at most this fraction of the time.
+static constexpr double kCheapLintFraction = 0.25;
+
+void DebounceScheduler::RecordEdit(const std::string &uri,
+                                   Clock::time_point now) {
+  BufferTiming &timing = buffers_[uri];
+  if (timing.has_edit) {
+    const double interval_ms =
+        std::chrono::duration<double, std::milli>(now - timing.last_edit)
+            .count();
+    if (interval_ms <= kMaxTypingInterval.count()) {
+      timing.interval_ms =
+          (timing.interval_ms < 0)
+              ? interval_ms
+              : kIntervalWeight * interval_ms +
+                    (1 - kIntervalWeight) * timing.interval_ms;
+    }
+  }
+  timing.last_edit = now;
+  timing.has_edit = true;
+  timing.pending = true;
+  timing.debounce = ChooseDebounce(timing, &timing.waits_for_pause);
+  timing.due = now + timing.debounce;
+}
+
+void DebounceScheduler::RecordLintCost(const std::string &uri,
+                                       Clock::duration cost) {
+  buffers_[uri].lint_cost_ms =
+      std::chrono::duration<double, std::milli>(cost).count();
+}
+
+std::vector<std::string> DebounceScheduler::TakeDue(Clock::time_point now) {
+  std::vector<std::string> result;
+  for (auto &[uri, timing] : buffers_) {
+    if (!timing.pending || timing.due > now) continue;
+    timing.pending = false;
+    ++(timing.waits_for_pause ? stats_after_pause_ : stats_right_away_);
+    stats_total_debounce_ += timing.debounce;
+    result.push_back(uri);
+  }
+  return result;
+}
+
+bool DebounceScheduler::NextDue(Clock::time_point *due) const {
+  bool pending = false;
+  for (const auto &[uri, timing] : buffers_) {
+    if (!timing.pending) continue;
+    if (!pending || timing.due < *due) *due = timing.due;
+    pending = true;
+  }
+  return pending;
+}
+
+DebounceScheduler::Duration DebounceScheduler::Debounce(
+    const std::string &uri) const {
+  auto found = buffers_.find(uri);
+  const BufferTiming timing =
+      (found == buffers_.end()) ? BufferTiming() : found->second;
+  bool waits_for_pause;
+  return ChooseDebounce(timing, &waits_for_pause);
+}
+
+DebounceScheduler::Duration DebounceScheduler::ChooseDebounce(
+    const BufferTiming &timing, bool *waits_for_pause) const {
+  const double interval_ms =
+      (timing.interval_ms < 0) ? kDefaultIntervalMs : timing.interval_ms;
+  const double cheap_debounce_ms = timing.lint_cost_ms / kCheapLintFraction;
+  *waits_for_pause = (cheap_debounce_ms > interval_ms);
+  const double debounce_ms =
+      *waits_for_pause ? 2 * interval_ms : cheap_debounce_ms;
+  return std::clamp(Duration(static_cast<int64_t>(debounce_ms)), kMinDebounce,
+                    kMaxDebounce);
+}
@@ -0,0 +1,105 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DEBOUNCE_SCHEDULER_H
+#define DEBOUNCE_SCHEDULER_H
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Decides when to lint a buffer after it has been edited.
+//
+// The debounce is chosen per buffer from the cadence the user is typing in
+// (an exponentially weighted average of the time between edits) and what
+// the last lint of that buffer cost:
+//
+//  * If linting is cheap compared to the typing cadence, it runs right
+//    away, in between keystrokes, so diagnostics show up while typing.
+//  * Otherwise, linting waits until the user pauses, i.e. didn't edit for
+//    twice the usual time between edits, so that expensive lint runs don't
+//    hold up processing of the next edits.
+//
+// All time is passed in, so the scheduler itself never looks at a clock.
+class DebounceScheduler {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using Duration = std::chrono::milliseconds;
+
+  // Bounds of the debounce chosen.
+  static constexpr Duration kMinDebounce{20};
+  static constexpr Duration kMaxDebounce{2000};
+
+  // Edits further apart than this are pauses, not the typing cadence.
+  static constexpr Duration kMaxTypingInterval{1000};
+
+  DebounceScheduler() = default;
+  DebounceScheduler(const DebounceScheduler &) = delete;
+
+  // Buffer "uri" has been edited at time "now". Lint is due after the
+  // debounce chosen for it unless there are more edits.
+  void RecordEdit(const std::string &uri, Clock::time_point now);
+
+  // Lint of buffer "uri" took "cost" to run.
+  void RecordLintCost(const std::string &uri, Clock::duration cost);
+
+  // Return the buffers whose lint is due at "now". These won't be returned
+  // again until there are new edits.
+  std::vector<std::string> TakeDue(Clock::time_point now);
+
+  // Earliest time a lint becomes due. Returns false if none is pending.
+  bool NextDue(Clock::time_point *due) const;
+
+  // Forget everything about buffer "uri", e.g. once it is closed.
+  void Forget(const std::string &uri) { buffers_.erase(uri); }
+
+  // Debounce that would be chosen for an edit of "uri" now.
+  Duration Debounce(const std::string &uri) const;
+
+  // -- Statistical data about decisions taken.
+
+  // Lint runs that were due right away as lint is cheap...
+  int64_t StatDueRightAway() const { return stats_right_away_; }
+
+  // ... and those that waited for the user to pause typing.
+  int64_t StatDueAfterPause() const { return stats_after_pause_; }
+
+  // Sum of debounce of all due lint runs; to determine the average.
+  Duration StatTotalDebounce() const { return stats_total_debounce_; }
+
+ private:
+  struct BufferTiming {
+    Clock::time_point last_edit;
+    bool has_edit = false;        // last_edit is valid.
+    double interval_ms = -1;      // Average time between edits; < 0: unknown.
+    double lint_cost_ms = 0;      // Of last lint run.
+    bool pending = false;         // Edited, but lint not yet due.
+    Clock::time_point due;        // If pending: when lint is due.
+    Duration debounce{0};         // Chosen for the pending lint.
+    bool waits_for_pause = false;  // Kind of decision for the pending lint.
+  };
+
+  Duration ChooseDebounce(const BufferTiming &timing,
+                          bool *waits_for_pause) const;
+
+  std::unordered_map<std::string, BufferTiming> buffers_;
+
+  int64_t stats_right_away_ = 0;
+  int64_t stats_after_pause_ = 0;
+  Duration stats_total_debounce_{0};
+};
+
+#endif  // DEBOUNCE_SCHEDULER_H
@@ -0,0 +1,99 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "debounce-scheduler.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+using std::chrono::milliseconds;
+using Clock = DebounceScheduler::Clock;
+using Uris = std::vector<std::string>;
+
+// Fixed point in time plus "ms" milliseconds.
+static Clock::time_point At(int ms) {
+  return Clock::time_point() + milliseconds(ms);
+}
+
+TEST(DebounceSchedulerTest, CheapLintIsDueRightAway) {
+  DebounceScheduler scheduler;
+  scheduler.RecordEdit("a", At(1000));
+  EXPECT_TRUE(scheduler.TakeDue(At(1010)).empty());
+  EXPECT_EQ(scheduler.TakeDue(At(1020)), Uris({"a"}));
+  EXPECT_TRUE(scheduler.TakeDue(At(2000)).empty());  // Only once per edit.
+
+  scheduler.RecordLintCost("a", milliseconds(10));
+  EXPECT_EQ(scheduler.Debounce("a"), milliseconds(40));
+  EXPECT_EQ(scheduler.StatDueRightAway(), 1);
+  EXPECT_EQ(scheduler.StatDueAfterPause(), 0);
+  EXPECT_EQ(scheduler.StatTotalDebounce(), milliseconds(20));
+}
+
+TEST(DebounceSchedulerTest, ExpensiveLintWaitsForPauseInTyping) {
+  DebounceScheduler scheduler;
+  scheduler.RecordLintCost("a", milliseconds(100));
+  // Without knowing the typing cadence, wait for a typical pause.
+  EXPECT_EQ(scheduler.Debounce("a"), milliseconds(300));
+
+  // Typing every 100ms: a pause is 200ms without edit.
+  for (int t = 0; t <= 1000; t += 100) {
+    scheduler.RecordEdit("a", At(t));
+    EXPECT_TRUE(scheduler.TakeDue(At(t + 99)).empty());
+  }
+  EXPECT_EQ(scheduler.Debounce("a"), milliseconds(200));
+  EXPECT_TRUE(scheduler.TakeDue(At(1199)).empty());
+  EXPECT_EQ(scheduler.TakeDue(At(1200)), Uris({"a"}));
+  EXPECT_EQ(scheduler.StatDueRightAway(), 0);
+  EXPECT_EQ(scheduler.StatDueAfterPause(), 1);
+}
+
+TEST(DebounceSchedulerTest, LongPausesAreNotTypingCadence) {
+  DebounceScheduler scheduler;
+  scheduler.RecordLintCost("a", milliseconds(100));
+  scheduler.RecordEdit("a", At(0));
+  scheduler.RecordEdit("a", At(5000));
+  EXPECT_EQ(scheduler.Debounce("a"), milliseconds(300));
+}
+
+TEST(DebounceSchedulerTest, BuffersAreScheduledIndependently) {
+  DebounceScheduler scheduler;
+  scheduler.RecordLintCost("slow", milliseconds(500));
+  scheduler.RecordEdit("slow", At(0));
+  scheduler.RecordEdit("fast", At(0));
+  EXPECT_EQ(scheduler.TakeDue(At(20)), Uris({"fast"}));
+  EXPECT_TRUE(scheduler.TakeDue(At(299)).empty());
+  EXPECT_EQ(scheduler.TakeDue(At(300)), Uris({"slow"}));
+
+  scheduler.RecordEdit("fast", At(400));
+  scheduler.Forget("fast");
+  EXPECT_TRUE(scheduler.TakeDue(At(1000)).empty());
+}
+
+TEST(DebounceSchedulerTest, NextDueIsEarliestPending) {
+  DebounceScheduler scheduler;
+  Clock::time_point due;
+  EXPECT_FALSE(scheduler.NextDue(&due));
+  scheduler.RecordLintCost("slow", milliseconds(500));
+  scheduler.RecordEdit("slow", At(0));
+  scheduler.RecordEdit("fast", At(0));
+  ASSERT_TRUE(scheduler.NextDue(&due));
+  EXPECT_EQ(due, At(20));
+  EXPECT_EQ(scheduler.TakeDue(due), Uris({"fast"}));
+  ASSERT_TRUE(scheduler.NextDue(&due));
+  EXPECT_EQ(due, At(300));
+  EXPECT_EQ(scheduler.TakeDue(due), Uris({"slow"}));
+  EXPECT_FALSE(scheduler.NextDue(&due));
+}
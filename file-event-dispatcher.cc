@@ -25,13 +25,17 @@ bool FileEventDispatcher::RunOnReadable(int fd, const Handler &handler) {
   return read_handlers_.insert({fd, handler}).second;
 }
 
+bool FileEventDispatcher::RunOnWritable(int fd, const Handler &handler) {
+  return write_handlers_.insert({fd, handler}).second;
+}
+
 void FileEventDispatcher::RunOnIdle(const Handler &handler) {
   idle_handlers_.push_back(handler);
 }
 
-static void CallHandlers(
-    fd_set *to_call_fd_set, int available_fds,
-    std::map<int, FileEventDispatcher::Handler> *handlers) {
+// Returns number of available_fds that are left to be handled.
+static int CallHandlers(fd_set *to_call_fd_set, int available_fds,
+                        std::map<int, FileEventDispatcher::Handler> *handlers) {
   for (auto it = handlers->begin(); available_fds && it != handlers->end();) {
     bool keep_handler = true;
     if (FD_ISSET(it->first, to_call_fd_set)) {
@@ -40,10 +44,12 @@ static void CallHandlers(
     }
     it = keep_handler ? std::next(it) : handlers->erase(it);
   }
+  return available_fds;
 }
 
-bool FileEventDispatcher::SingleCycle(unsigned int timeout_ms) {
+bool FileEventDispatcher::SingleCycle(int timeout_ms) {
   fd_set read_fds;
+  fd_set write_fds;
 
   struct timeval timeout;
   timeout.tv_sec = timeout_ms / 1000;
@@ -51,11 +57,16 @@ bool FileEventDispatcher::SingleCycle(unsigned int timeout_ms) {
 
   int maxfd = -1;
   FD_ZERO(&read_fds);
+  FD_ZERO(&write_fds);
 
   for (const auto &it : read_handlers_) {
     maxfd = std::max(maxfd, it.first);
     FD_SET(it.first, &read_fds);
   }
+  for (const auto &it : write_handlers_) {
+    maxfd = std::max(maxfd, it.first);
+    FD_SET(it.first, &write_fds);
+  }
 
   if (maxfd < 0) {
     // file descriptors only can be registred from within handlers
@@ -64,8 +75,10 @@ bool FileEventDispatcher::SingleCycle(unsigned int timeout_ms) {
     return false;
   }
 
-  int fds_ready = select(maxfd + 1, &read_fds, nullptr, nullptr, &timeout);
+  int fds_ready = select(maxfd + 1, &read_fds, &write_fds, nullptr,
+                         timeout_ms < 0 ? nullptr : &timeout);
   if (fds_ready < 0) {
+    if (errno == EINTR) return true;  // Signal; handler might set flags.
     perror("select() failed");
     return false;
   }
@@ -78,14 +91,14 @@ bool FileEventDispatcher::SingleCycle(unsigned int timeout_ms) {
     return true;
   }
 
-  CallHandlers(&read_fds, fds_ready, &read_handlers_);
+  fds_ready = CallHandlers(&read_fds, fds_ready, &read_handlers_);
+  CallHandlers(&write_fds, fds_ready, &write_handlers_);
 
   return true;
 }
 
 void FileEventDispatcher::Loop() {
-  const unsigned timeout = idle_ms_;
-
-  while (SingleCycle(timeout)) {
+  while (!stop_requested_ &&
+         SingleCycle(idle_timeout_fun_ ? idle_timeout_fun_() : idle_ms_)) {
   }
 }
@@ -33,28 +33,53 @@ class FileEventDispatcher {
   // Returns false if that filedescriptor is already registered.
   bool RunOnReadable(int fd, const Handler &handler);
 
+  // Handler called when fd is ready to be written to without blocking.
+  // As long as the fd stays writable, this is called on every cycle, so
+  // only register while there is something to write.
+  // Returns false if that filedescriptor is already registered.
+  bool RunOnWritable(int fd, const Handler &handler);
+
   // Handler called regularly every idle_ms in case there's nothing to do.
   void RunOnIdle(const Handler &handler);
 
+  // Instead of a fixed idle_ms, ask "timeout_fun" before each cycle how
+  // long to wait before calling the idle handlers. If it returns a negative
+  // value, there is nothing to do when idle and we wait until a file
+  // descriptor becomes ready.
+  void SetIdleTimeout(const std::function<int()> &timeout_fun) {
+    idle_timeout_fun_ = timeout_fun;
+  }
+
   // Run the main loop. Blocks while there is still a filedescriptor
   // registered.
   void Loop();
 
+  // Let Loop() return after the current cycle, even if filedescriptors
+  // are still registered (e.g. a listening socket that is only serving
+  // on the side). To be called from a handler.
+  void Stop() { stop_requested_ = true; }
+
  protected:
   // Run a single cycle resulting in exactly one call of a handler function.
   // This means that one of these happened:
   //   (1) The next file descriptor became ready and its Handler is called
   //   (2) We encountered a timeout and the idle-Handler has been called.
-  //   (3) Signal received or select() issue. Returns false in this case.
+  //       A negative "timeout_ms" waits without timeout.
+  //   (3) Signal received; returns true, so that handlers can act on flags
+  //       the signal handler set.
+  //   (4) select() issue. Returns false in this case.
   //
   // This is broken out to make it simple to test steps in unit tests.
-  bool SingleCycle(unsigned timeout_ms);
+  bool SingleCycle(int timeout_ms);
 
  private:
   typedef std::map<int, Handler> HandlerMap;
 
   const unsigned idle_ms_;
+  std::function<int()> idle_timeout_fun_;
+  bool stop_requested_ = false;
   HandlerMap read_handlers_;
+  HandlerMap write_handlers_;
   std::list<Handler> idle_handlers_;
 };
 
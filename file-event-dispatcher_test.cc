@@ -69,3 +69,99 @@ TEST(FdMuxTest, IdleAndReadableCallHandled) {
   EXPECT_TRUE(idle_was_called);
   EXPECT_TRUE(read_was_called);
 }
+
+TEST(FdMuxTest, IdleTimeoutIsAskedForEachCycle) {
+  FileEventDispatcher fdmux;
+  int read_write_pipe[2];
+  ASSERT_EQ(pipe(read_write_pipe), 0);
+
+  // Once the idle handler did its work, there is nothing to do when idle
+  // anymore, so we block until the pipe is readable.
+  int idle_calls = 0;
+  int timeout_asked = 0;
+  fdmux.SetIdleTimeout([&]() {
+    ++timeout_asked;
+    return idle_calls == 0 ? 5 : -1;
+  });
+  const int write_fd = read_write_pipe[1];
+  fdmux.RunOnIdle([write_fd, &idle_calls]() {
+    ++idle_calls;
+    write(write_fd, "x", 1);
+    return true;
+  });
+  const int read_fd = read_write_pipe[0];
+  bool read_was_called = false;
+  fdmux.RunOnReadable(read_fd, [read_fd, &read_was_called]() {
+    char c;
+    EXPECT_EQ(read(read_fd, &c, 1), 1);
+    read_was_called = true;
+    return false;
+  });
+
+  fdmux.Loop();
+
+  EXPECT_EQ(idle_calls, 1);
+  EXPECT_TRUE(read_was_called);
+  EXPECT_GE(timeout_asked, 2);
+}
+
+TEST(FdMuxTest, WritableCallHandled) {
+  static constexpr absl::string_view kMessage = "Hello";
+
+  FileEventDispatcher fdmux(1000);  // Should never get to idle.
+  fdmux.RunOnIdle([]() {
+    ADD_FAILURE() << "Writable pipe should be handled before idle";
+    return false;
+  });
+
+  int read_write_pipe[2];
+  ASSERT_EQ(pipe(read_write_pipe), 0);
+
+  // Empty pipe is ready to be written to; as soon as the message is in,
+  // the reader is woken up. Both handlers only want to be called once.
+  bool write_was_called = false;
+  bool read_was_called = false;
+
+  const int write_fd = read_write_pipe[1];
+  fdmux.RunOnWritable(write_fd, [write_fd, &write_was_called]() {
+    write(write_fd, kMessage.data(), kMessage.length());
+    write_was_called = true;
+    return false;
+  });
+  EXPECT_FALSE(fdmux.RunOnWritable(write_fd, []() { return false; }));
+
+  const int read_fd = read_write_pipe[0];
+  fdmux.RunOnReadable(read_fd, [read_fd, &read_was_called]() {
+    char buffer[32];
+    const int r = read(read_fd, buffer, sizeof(buffer));
+    EXPECT_EQ(absl::string_view(buffer, r), kMessage);
+    read_was_called = true;
+    return false;
+  });
+
+  fdmux.Loop();
+
+  EXPECT_TRUE(write_was_called);
+  EXPECT_TRUE(read_was_called);
+}
+
+TEST(FdMuxTest, StopEndsLoopWithHandlersRegistered) {
+  FileEventDispatcher fdmux(1);
+
+  int read_write_pipe[2];
+  ASSERT_EQ(pipe(read_write_pipe), 0);
+  // Nothing ever written; this would keep the loop running forever.
+  fdmux.RunOnReadable(read_write_pipe[0], []() { return true; });
+
+  int idle_calls = 0;
+  fdmux.RunOnIdle([&]() {
+    if (++idle_calls == 3) fdmux.Stop();
+    return true;
+  });
+
+  fdmux.Loop();
+  EXPECT_EQ(idle_calls, 3);
+
+  close(read_write_pipe[0]);
+  close(read_write_pipe[1]);
+}
@@ -0,0 +1,194 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "flight-recorder.h"
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+// Line assembled without allocation, as we might be in a signal handler.
+class LineBuffer {
+ public:
+  void Append(absl::string_view s) {
+    const size_t len = std::min(s.size(), sizeof(buffer_) - len_);
+    memcpy(buffer_ + len_, s.data(), len);
+    len_ += len;
+  }
+
+  // Only printable ASCII; everything else is shown as '.'.
+  void AppendPrintable(absl::string_view s) {
+    for (const char c : s) {
+      if (len_ == sizeof(buffer_)) return;
+      buffer_[len_++] = (c >= 0x20 && c < 0x7f) ? c : '.';
+    }
+  }
+
+  void AppendNumber(uint64_t value, int min_digits = 1) {
+    char digits[20];
+    int count = 0;
+    do {
+      digits[count++] = '0' + value % 10;
+      value /= 10;
+    } while (value || count < min_digits);
+    while (count && len_ < sizeof(buffer_)) buffer_[len_++] = digits[--count];
+  }
+
+  bool WriteTo(int fd) {
+    const char *data = buffer_;
+    size_t remaining = len_;
+    while (remaining) {
+      const ssize_t w = write(fd, data, remaining);
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) return false;
+      data += w;
+      remaining -= w;
+    }
+    len_ = 0;
+    return true;
+  }
+
+ private:
+  char buffer_[512];
+  size_t len_ = 0;
+};
+
+static size_t CopyTruncated(absl::string_view from, char *to, size_t max) {
+  const size_t len = std::min(from.size(), max);
+  memcpy(to, from.data(), len);
+  return len;
+}
+
+static uint32_t Micros(FlightRecorder::Duration d) {
+  const int64_t us =
+      std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  return std::clamp<int64_t>(us, 0, UINT32_MAX);
+}
+
+FlightRecorder::FlightRecorder(size_t capacity)
+    : capacity_(std::max<size_t>(1, capacity)), slots_(new Slot[capacity_]) {}
+
+void FlightRecorder::Record(const Message &message) {
+  const uint64_t index = next_.load(std::memory_order_relaxed);
+  Slot &slot = slots_[index % capacity_];
+  const uint64_t sequence = slot.sequence.load(std::memory_order_relaxed);
+  slot.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  Entry &entry = slot.entry;
+  entry.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                           std::chrono::system_clock::now().time_since_epoch())
+                           .count();
+  entry.message_bytes = message.message_bytes;
+  entry.response_bytes = message.response_bytes;
+  entry.parse_us = Micros(message.parse_time);
+  entry.handle_us = Micros(message.handle_time);
+  entry.write_us = Micros(message.write_time);
+  entry.method_length =
+      CopyTruncated(message.method, entry.method, kMaxMethodLength);
+  entry.id_length = CopyTruncated(message.id, entry.id, kMaxIdLength);
+  entry.payload_length =
+      CopyTruncated(message.payload, entry.payload, kMaxPayloadLength);
+
+  slot.sequence.store(sequence + 2, std::memory_order_release);
+  next_.store(index + 1, std::memory_order_release);
+}
+
+bool FlightRecorder::DumpTo(int fd) const {
+  const uint64_t end = next_.load(std::memory_order_acquire);
+  const uint64_t begin = (end > capacity_) ? end - capacity_ : 0;
+
+  LineBuffer line;
+  line.Append("# bare-lsp flight recorder: last ");
+  line.AppendNumber(end - begin);
+  line.Append(" of ");
+  line.AppendNumber(end);
+  line.Append(" messages. Time, method, id, bytes, microseconds, payload\n");
+  if (!line.WriteTo(fd)) return false;
+
+  for (uint64_t i = begin; i < end; ++i) {
+    const Slot &slot = slots_[i % capacity_];
+    const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence & 1) continue;  // Interrupted while writing it.
+    const Entry entry = slot.entry;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence) continue;
+
+    line.AppendNumber(entry.timestamp_us / 1000000);
+    line.Append(".");
+    line.AppendNumber(entry.timestamp_us % 1000000, 6);
+    line.Append(" ");
+    line.AppendPrintable({entry.method, entry.method_length});
+    line.Append(" id=");
+    line.AppendPrintable({entry.id, entry.id_length});
+    line.Append(" in=");
+    line.AppendNumber(entry.message_bytes);
+    line.Append(" out=");
+    line.AppendNumber(entry.response_bytes);
+    line.Append(" parse=");
+    line.AppendNumber(entry.parse_us);
+    line.Append(" handle=");
+    line.AppendNumber(entry.handle_us);
+    line.Append(" write=");
+    line.AppendNumber(entry.write_us);
+    line.Append(" | ");
+    line.AppendPrintable({entry.payload, entry.payload_length});
+    line.Append("\n");
+    if (!line.WriteTo(fd)) return false;
+  }
+  return true;
+}
+
+bool FlightRecorder::DumpToFile(const char *path) const {
+  const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) return false;
+  const bool success = DumpTo(fd);
+  return close(fd) == 0 && success;
+}
+
+static const FlightRecorder *signal_recorder = nullptr;
+static const char *signal_dump_path = nullptr;
+
+static void DumpAndCrash(int signo) {
+  signal_recorder->DumpToFile(signal_dump_path);
+  signal(signo, SIG_DFL);
+  raise(signo);  // Delivered once we return from this handler.
+}
+
+static void DumpAndContinue(int) {
+  const int saved_errno = errno;  // Don't disturb the interrupted code.
+  signal_recorder->DumpToFile(signal_dump_path);
+  errno = saved_errno;
+}
+
+void FlightRecorder::DumpOnCrash(const char *path) {
+  signal_recorder = this;
+  signal_dump_path = path;
+  for (const int signo : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT}) {
+    signal(signo, DumpAndCrash);
+  }
+}
+
+void FlightRecorder::DumpOnSignal(int signo, const char *path) {
+  signal_recorder = this;
+  signal_dump_path = path;
+  struct sigaction action = {};
+  action.sa_handler = DumpAndContinue;
+  action.sa_flags = SA_RESTART;
+  sigaction(signo, &action, nullptr);
+}
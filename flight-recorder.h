@@ -0,0 +1,103 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef FLIGHT_RECORDER_H
+#define FLIGHT_RECORDER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+#include <absl/strings/string_view.h>
+
+// Keeps a record of the last messages handled with their sizes and timings,
+// to have something to go on when a user reports that the server was stuck.
+// Recording copies into a fixed-size ring, so it is cheap enough to be
+// always on. The ring can be dumped at any time, also from a signal handler
+// while the process is crashing.
+class FlightRecorder {
+ public:
+  using Duration = std::chrono::steady_clock::duration;
+
+  // What is recorded about a message. The payload is truncated; it is
+  // meant to give an idea of the parameters.
+  struct Message {
+    absl::string_view method;
+    absl::string_view id;
+    absl::string_view payload;
+    size_t message_bytes = 0;
+    size_t response_bytes = 0;
+    Duration parse_time = Duration::zero();
+    Duration handle_time = Duration::zero();
+    Duration write_time = Duration::zero();
+  };
+
+  static constexpr size_t kMaxMethodLength = 63;
+  static constexpr size_t kMaxIdLength = 23;
+  static constexpr size_t kMaxPayloadLength = 160;
+
+  // Remember the last "capacity" messages.
+  explicit FlightRecorder(size_t capacity = 512);
+  FlightRecorder(const FlightRecorder &) = delete;
+
+  // Record message. To be called from one thread only.
+  void Record(const Message &message);
+
+  // Write recorded messages, oldest first, one line each, to "fd".
+  // Async-signal safe. Returns false on write error.
+  bool DumpTo(int fd) const;
+
+  // Same, writing to a file at "path" that is created or truncated.
+  bool DumpToFile(const char *path) const;
+
+  // On a fatal signal, dump to "path", which has to stay valid, then
+  // continue to crash. Only one recorder can be registered.
+  void DumpOnCrash(const char *path);
+
+  // Dump to "path" whenever "signo" arrives. Written right from the signal
+  // handler, so this works even while the process is stuck. Registers this
+  // recorder and path the same as DumpOnCrash().
+  void DumpOnSignal(int signo, const char *path);
+
+  uint64_t StatRecorded() const { return next_; }
+
+ private:
+  struct Entry {
+    int64_t timestamp_us;  // Wall clock, when recorded.
+    uint32_t message_bytes;
+    uint32_t response_bytes;
+    uint32_t parse_us;
+    uint32_t handle_us;
+    uint32_t write_us;
+    uint8_t method_length;
+    uint8_t id_length;
+    uint8_t payload_length;
+    char method[kMaxMethodLength];
+    char id[kMaxIdLength];
+    char payload[kMaxPayloadLength];
+  };
+
+  // Odd sequence number while the entry is being written.
+  struct Slot {
+    std::atomic<uint64_t> sequence{0};
+    Entry entry;
+  };
+
+  const size_t capacity_;
+  std::unique_ptr<Slot[]> slots_;
+  std::atomic<uint64_t> next_{0};
+};
+
+#endif  // FLIGHT_RECORDER_H
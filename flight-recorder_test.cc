@@ -0,0 +1,126 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "flight-recorder.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <absl/strings/str_split.h>
+
+#include "gtest/gtest.h"
+
+using std::chrono::microseconds;
+
+static std::vector<std::string> Dump(const FlightRecorder &recorder) {
+  FILE *const file = tmpfile();
+  EXPECT_TRUE(recorder.DumpTo(fileno(file)));
+  std::string content(8192, '\0');
+  rewind(file);
+  content.resize(fread(content.data(), 1, content.size(), file));
+  fclose(file);
+  return absl::StrSplit(content, '\n', absl::SkipEmpty());
+}
+
+TEST(FlightRecorder, KeepsMostRecentMessages) {
+  FlightRecorder recorder(3);
+  for (int i = 0; i < 5; ++i) {
+    const std::string id = std::to_string(i);
+    recorder.Record({.method = "textDocument/hover",
+                     .id = id,
+                     .payload = "{}",
+                     .message_bytes = 100,
+                     .response_bytes = 42,
+                     .parse_time = microseconds(3),
+                     .handle_time = microseconds(1500),
+                     .write_time = microseconds(7)});
+  }
+  EXPECT_EQ(recorder.StatRecorded(), 5);
+
+  const std::vector<std::string> lines = Dump(recorder);
+  ASSERT_EQ(lines.size(), 4);
+  EXPECT_NE(lines[0].find("last 3 of 5"), std::string::npos) << lines[0];
+  for (int i = 0; i < 3; ++i) {
+    const std::string &line = lines[i + 1];
+    const std::string expected =
+        " textDocument/hover id=" + std::to_string(i + 2) +
+        " in=100 out=42 parse=3 handle=1500 write=7 | {}";
+    EXPECT_NE(line.find(expected), std::string::npos) << line;
+  }
+}
+
+TEST(FlightRecorder, LongFieldsAreTruncatedAndMadePrintable) {
+  FlightRecorder recorder;
+  const std::string method(200, 'm');
+  const std::string payload = "line\nbreak" + std::string(1000, 'p');
+  recorder.Record({.method = method, .id = "", .payload = payload});
+
+  const std::vector<std::string> lines = Dump(recorder);
+  ASSERT_EQ(lines.size(), 2);
+  const std::string &line = lines[1];
+  EXPECT_NE(line.find(" " + std::string(FlightRecorder::kMaxMethodLength,
+                                        'm') + " id= "),
+            std::string::npos)
+      << line;
+  EXPECT_NE(line.find("| line.break"), std::string::npos) << line;
+  EXPECT_EQ(line.size() - line.find("| ") - 2,
+            FlightRecorder::kMaxPayloadLength);
+}
+
+TEST(FlightRecorder, DumpedOnCrash) {
+  char path[] = "/tmp/flight-recorder-test-XXXXXX";
+  close(mkstemp(path));
+  EXPECT_EXIT(
+      {
+        FlightRecorder recorder;
+        recorder.Record(
+            {.method = "crashing/method", .id = "7", .payload = "{}"});
+        recorder.DumpOnCrash(path);
+        abort();
+      },
+      testing::KilledBySignal(SIGABRT), "");
+
+  FILE *const file = fopen(path, "r");
+  ASSERT_NE(file, nullptr);
+  char content[1024];
+  content[fread(content, 1, sizeof(content) - 1, file)] = '\0';
+  fclose(file);
+  unlink(path);
+  EXPECT_NE(std::string(content).find("crashing/method id=7"),
+            std::string::npos)
+      << content;
+}
+
+TEST(FlightRecorder, DumpedFromSignalHandler) {
+  char path[] = "/tmp/flight-recorder-test-XXXXXX";
+  close(mkstemp(path));
+  FlightRecorder recorder;
+  recorder.Record({.method = "stuck/method", .id = "8", .payload = "{}"});
+  recorder.DumpOnSignal(SIGUSR2, path);
+  raise(SIGUSR2);  // Written before raise() returns; no loop involved.
+  signal(SIGUSR2, SIG_DFL);
+
+  FILE *const file = fopen(path, "r");
+  ASSERT_NE(file, nullptr);
+  char content[1024];
+  content[fread(content, 1, sizeof(content) - 1, file)] = '\0';
+  fclose(file);
+  unlink(path);
+  EXPECT_NE(std::string(content).find("stuck/method id=8"), std::string::npos)
+      << content;
+}
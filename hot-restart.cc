@@ -0,0 +1,84 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hot-restart.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+#include <filesystem>
+
+#include <absl/strings/str_cat.h>
+
+static absl::Status ErrnoStatus(absl::string_view what) {
+  return absl::InternalError(absl::StrCat(what, ": ", strerror(errno)));
+}
+
+absl::Status CreateStateMemfd(absl::string_view state, int *fd) {
+  *fd = memfd_create("bare-lsp-state", 0);  // No MFD_CLOEXEC: to be passed.
+  if (*fd < 0) return ErrnoStatus("memfd_create()");
+  while (!state.empty()) {
+    const ssize_t w = write(*fd, state.data(), state.size());
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) {
+      const absl::Status status = ErrnoStatus("Writing state");
+      close(*fd);
+      return status;
+    }
+    state.remove_prefix(w);
+  }
+  if (lseek(*fd, 0, SEEK_SET) < 0) {
+    const absl::Status status = ErrnoStatus("Rewinding state");
+    close(*fd);
+    return status;
+  }
+  return absl::OkStatus();
+}
+
+absl::Status ReadStateFromFd(int fd, std::string *state) {
+  state->clear();
+  char buffer[65536];
+  for (;;) {
+    const ssize_t r = read(fd, buffer, sizeof(buffer));
+    if (r < 0 && errno == EINTR) continue;
+    if (r < 0) {
+      const absl::Status status = ErrnoStatus("Reading state");
+      close(fd);
+      return status;
+    }
+    if (r == 0) break;
+    state->append(buffer, r);
+  }
+  close(fd);
+  return absl::OkStatus();
+}
+
+std::string CurrentExecutablePath() {
+  std::error_code error;
+  const auto path = std::filesystem::read_symlink("/proc/self/exe", error);
+  return error ? "" : path.string();
+}
+
+absl::Status ExecBinary(const std::string &binary,
+                        const std::vector<std::string> &args) {
+  std::vector<char *> argv;
+  for (const std::string &arg : args) {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+  execv(binary.c_str(), argv.data());
+  return ErrnoStatus(absl::StrCat("Executing ", binary));
+}
@@ -0,0 +1,46 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+#include <string>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/strings/string_view.h>
+
+// Hot restart replaces the running server with a (possibly upgraded)
+// binary without the client noticing. The file descriptors connecting us to
+// the client stay open across exec(); the state the new process needs is
+// handed over in an anonymous in-memory file (memfd) whose descriptor
+// number is passed on the command line.
+
+// Create a memory file with "state" as content, positioned at the start.
+// Unlike other descriptors we open, it is inherited across exec().
+absl::Status CreateStateMemfd(absl::string_view state, int *fd);
+
+// Read the full content of "fd" into "state", then close it.
+absl::Status ReadStateFromFd(int fd, std::string *state);
+
+// Path of the binary this process runs. Good to remember at startup; by the
+// time we restart, the file might have been replaced with a new version.
+std::string CurrentExecutablePath();
+
+// Replace this process with "binary", passing "args" as argv.
+// Only returns if that was not possible.
+absl::Status ExecBinary(const std::string &binary,
+                        const std::vector<std::string> &args);
+
+#endif  // HOT_RESTART_H
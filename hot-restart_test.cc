@@ -0,0 +1,80 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "hot-restart.h"
+
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <filesystem>
+
+#include "gtest/gtest.h"
+#include "sampling-profiler.h"
+
+TEST(HotRestart, StateRoundTripThroughMemfd) {
+  std::string state = "Hello";
+  state.append(1, '\0');  // Binary content is fine.
+  state.append(100000, 'x');
+
+  int fd = -1;
+  ASSERT_TRUE(CreateStateMemfd(state, &fd).ok());
+  ASSERT_GE(fd, 0);
+  EXPECT_EQ(fcntl(fd, F_GETFD) & FD_CLOEXEC, 0);  // Survives exec()
+
+  std::string received;
+  ASSERT_TRUE(ReadStateFromFd(fd, &received).ok());
+  EXPECT_EQ(received, state);
+  EXPECT_EQ(fcntl(fd, F_GETFD), -1);  // Closed after reading.
+}
+
+TEST(HotRestart, ReadingInvalidFdFails) {
+  std::string received;
+  EXPECT_FALSE(ReadStateFromFd(-1, &received).ok());
+}
+
+TEST(HotRestart, CurrentExecutableIsThisTest) {
+  const std::string path = CurrentExecutablePath();
+  EXPECT_TRUE(std::filesystem::exists(path)) << path;
+}
+
+TEST(HotRestart, ExecNonExistingBinaryReturnsError) {
+  const absl::Status status =
+      ExecBinary("/non/existing/binary", {"binary", "--flag"});
+  EXPECT_FALSE(status.ok());
+  EXPECT_NE(status.message().find("/non/existing/binary"), std::string::npos);
+}
+
+TEST(HotRestart, ExecWhileProfilingSurvivesOnceProfilerStopped) {
+  const pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0) {
+    SamplingProfiler profiler;
+    if (!profiler.Start(1000).ok()) _exit(2);
+    for (volatile int i = 0; i < 10000000; ++i) {
+    }
+    profiler.Stop();
+    // New image burns CPU time for many profiling timer intervals; a timer
+    // left running would kill it with SIGPROF.
+    ExecBinary("/bin/sh", {"sh", "-c",
+                           "i=0; while [ $i -lt 100000 ]; do i=$((i+1)); "
+                           "done"})
+        .IgnoreError();
+    _exit(3);
+  }
+  int status = 0;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  ASSERT_TRUE(WIFEXITED(status)) << "Killed by signal " << WTERMSIG(status);
+  EXPECT_EQ(WEXITSTATUS(status), 0);
+}
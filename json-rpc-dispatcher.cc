@@ -14,26 +14,95 @@
 
 #include "json-rpc-dispatcher.h"
 
-#include <iomanip>
+static nlohmann::json ParseMessage(absl::string_view data,
+                                   JsonRpcDispatcher::Encoding encoding) {
+  switch (encoding) {
+    case JsonRpcDispatcher::Encoding::kCbor:
+      return nlohmann::json::from_cbor(data.begin(), data.end());
+    case JsonRpcDispatcher::Encoding::kMessagePack:
+      return nlohmann::json::from_msgpack(data.begin(), data.end());
+    default:
+      return nlohmann::json::parse(data);
+  }
+}
 
-void JsonRpcDispatcher::DispatchMessage(absl::string_view data) {
+// Strings might originate from files that are not valid UTF-8. Rather than
+// failing the whole message, invalid bytes are replaced with U+FFFD.
+static std::string ToJsonText(const nlohmann::json &j) {
+  return j.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+}
+
+// Lets the observer know about the method for the lifetime of this object.
+class ObservedMethod {
+ public:
+  ObservedMethod(const JsonRpcDispatcher::MethodObserverFun &observer,
+                 const std::string &method)
+      : observer_(observer) {
+    if (observer_) observer_(method.c_str());
+  }
+  ~ObservedMethod() {
+    if (observer_) observer_(nullptr);
+  }
+
+ private:
+  const JsonRpcDispatcher::MethodObserverFun &observer_;
+};
+
+void JsonRpcDispatcher::DispatchMessage(absl::string_view data,
+                                        Encoding encoding) {
+  const Clock::time_point received = Clock::now();
+  encoding_ = encoding;
+  write_time_ = Clock::duration::zero();
+  response_bytes_ = 0;
+  dispatched_handler_ = nullptr;
   nlohmann::json request;
+  bool parse_ok = false;
+  std::string parse_error;
   try {
-    request = nlohmann::json::parse(data);
+    request = ParseMessage(data, encoding);
+    parse_ok = true;
   } catch (const std::exception &e) {
-    statistic_counters_[e.what()]++;
+    parse_error = e.what();
+  }
+  const Clock::time_point parsed = Clock::now();
+
+  // Only the parsing is guarded here: handlers report their own exceptions,
+  // and must not be answered with a parse error.
+  if (parse_ok) {
+    DispatchRequest(request, received);
+  } else {
+    statistic_counters_[parse_error]++;
     ++exception_count_;
-    SendReply(CreateError(request, kParseError, e.what()));
-    return;
+    SendReply(CreateError(request, kParseError, parse_error));
   }
 
-  if (request.find("method") == request.end()) {
+  if (!trace_listener_) return;
+  const auto method = request.find("method");
+  const auto id = request.find("id");
+  trace_listener_({
+      .message = data,
+      .method = (method != request.end() && method->is_string())
+                    ? method->get_ref<const std::string &>()
+                    : absl::string_view(),
+      .handler = dispatched_handler_,
+      .id = (id != request.end()) ? &*id : nullptr,
+      .response_bytes = response_bytes_,
+      .parse_time = parsed - received,
+      .handle_time = Clock::now() - parsed - write_time_,
+      .write_time = write_time_,
+  });
+}
+
+void JsonRpcDispatcher::DispatchRequest(const nlohmann::json &request,
+                                        Clock::time_point received) {
+  const auto found_method = request.find("method");
+  if (found_method == request.end() || !found_method->is_string()) {
     SendReply(
         CreateError(request, kMethodNotFound, "Method required in request"));
     statistic_counters_["Request without method"]++;
     return;
   }
-  const std::string &method = request["method"];
+  const std::string &method = found_method->get_ref<const std::string &>();
 
   // Direct dispatch, later maybe send to an executor that returns futures ?
   const bool is_notification = (request.find("id") == request.end());
@@ -41,17 +110,36 @@ void JsonRpcDispatcher::DispatchMessage(absl::string_view data) {
   if (is_notification) {
     handled = CallNotification(request, method);
   } else {
+    const auto deadline = deadlines_.find(method);
+    if (deadline != deadlines_.end()) {
+      current_deadline_ = received + deadline->second;
+    }
     handled = CallRequestHandler(request, method);
+    if (current_deadline_exceeded_) {
+      ++degraded_count_;
+      statistic_counters_[method + " (degraded)"]++;
+    }
+    current_deadline_ = Clock::time_point::max();
+    current_deadline_exceeded_ = false;
   }
   statistic_counters_[method + (handled ? "" : " (unhandled)") +
                       (is_notification ? "  ev" : " RPC")]++;
 }
 
+bool JsonRpcDispatcher::DeadlineExceeded() const {
+  if (!current_deadline_exceeded_ && Clock::now() >= current_deadline_) {
+    current_deadline_exceeded_ = true;
+  }
+  return current_deadline_exceeded_;
+}
+
 bool JsonRpcDispatcher::CallNotification(const nlohmann::json &req,
                                          const std::string &method) {
   const auto &found = notifications_.find(method);
   if (found == notifications_.end()) return false;
+  dispatched_handler_ = found->first.c_str();
   try {
+    const ObservedMethod observed(method_observer_, found->first);
     found->second(req["params"]);
     return true;
   } catch (const std::exception &e) {
@@ -63,6 +151,21 @@ bool JsonRpcDispatcher::CallNotification(const nlohmann::json &req,
 
 bool JsonRpcDispatcher::CallRequestHandler(const nlohmann::json &req,
                                            const std::string &method) {
+  const auto &found_streaming = streaming_handlers_.find(method);
+  if (found_streaming != streaming_handlers_.end()) {
+    dispatched_handler_ = found_streaming->first.c_str();
+    try {
+      const ObservedMethod observed(method_observer_, found_streaming->first);
+      CallStreamingRequestHandler(req, found_streaming->second);
+      return true;
+    } catch (const std::exception &e) {
+      ++exception_count_;
+      statistic_counters_[method + " : " + e.what()]++;
+      SendReply(CreateError(req, kInternalError, e.what()));
+    }
+    return false;
+  }
+
   const auto &found = handlers_.find(method);
   if (found == handlers_.end()) {
     SendReply(CreateError(req, kMethodNotFound,
@@ -70,7 +173,9 @@ bool JsonRpcDispatcher::CallRequestHandler(const nlohmann::json &req,
     return false;
   }
 
+  dispatched_handler_ = found->first.c_str();
   try {
+    const ObservedMethod observed(method_observer_, found->first);
     SendReply(MakeResponse(req, found->second(req["params"])));
     return true;
   } catch (const std::exception &e) {
@@ -81,6 +186,58 @@ bool JsonRpcDispatcher::CallRequestHandler(const nlohmann::json &req,
   return false;
 }
 
+// Assemble the response envelope around the result array directly in the
+// output buffer while the handler emits elements. Only the serialized
+// bytes are kept, never the json representation of the whole result; with
+// a chunk writer, only the bytes of the current chunk.
+void JsonRpcDispatcher::CallStreamingRequestHandler(
+    const nlohmann::json &req, const RPCStreamingCallHandler &handler) {
+  if (encoding_ != Encoding::kJson) {
+    // Binary encodings are length-prefixed, so we can't append elements to
+    // an open array. Regular reply with the collected result.
+    nlohmann::json result = nlohmann::json::array();
+    handler(req["params"],
+            [&result](const nlohmann::json &e) { result.push_back(e); });
+    SendReply(MakeResponse(req, result));
+    return;
+  }
+
+  std::string out_bytes = R"({"jsonrpc":"2.0","id":)";
+  out_bytes.append(req["id"].dump()).append(R"(,"result":[)");
+  bool first_element = true;
+  bool chunk_written = false;
+  const auto write_chunk = [&]() {
+    const Clock::time_point start = Clock::now();
+    chunk_write_fun_(out_bytes);
+    response_bytes_ += out_bytes.size();
+    write_time_ += Clock::now() - start;
+    out_bytes.clear();
+    chunk_written = true;
+  };
+  try {
+    handler(req["params"], [&](const nlohmann::json &element) {
+      if (!first_element) out_bytes.append(",");
+      out_bytes.append(ToJsonText(element));
+      first_element = false;
+      if (chunk_write_fun_ && out_bytes.size() >= kStreamChunkBytes) {
+        write_chunk();
+      }
+    });
+  } catch (...) {
+    if (chunk_written) {
+      out_bytes = "\n";  // Client can't parse the line; error follows.
+      write_chunk();
+    }
+    throw;
+  }
+  out_bytes.append("]}\n");
+  if (chunk_write_fun_) {
+    write_chunk();
+  } else {
+    Write(out_bytes, Clock::now());
+  }
+}
+
 void JsonRpcDispatcher::SendNotification(const std::string &method,
                                          const nlohmann::json &notification) {
   nlohmann::json result = {{"jsonrpc", "2.0"}};
@@ -116,8 +273,35 @@ void JsonRpcDispatcher::SendNotification(const std::string &method,
   return result;
 }
 
+// Encoding counts as part of writing.
 void JsonRpcDispatcher::SendReply(const nlohmann::json &response) {
-  std::stringstream out_bytes;
-  out_bytes << std::setw(2) << response << "\n";
-  write_fun_(out_bytes.str());
+  const Clock::time_point start = Clock::now();
+  std::string out_bytes;
+  std::vector<uint8_t> binary_bytes;
+  absl::string_view bytes;
+  switch (encoding_) {
+    case Encoding::kCbor:
+      nlohmann::json::to_cbor(response, binary_bytes);
+      bytes = {reinterpret_cast<const char *>(binary_bytes.data()),
+               binary_bytes.size()};
+      break;
+    case Encoding::kMessagePack:
+      nlohmann::json::to_msgpack(response, binary_bytes);
+      bytes = {reinterpret_cast<const char *>(binary_bytes.data()),
+               binary_bytes.size()};
+      break;
+    default:
+      out_bytes = ToJsonText(response);
+      out_bytes.append("\n");
+      bytes = out_bytes;
+      break;
+  }
+  Write(bytes, start);
+}
+
+void JsonRpcDispatcher::Write(absl::string_view bytes,
+                              Clock::time_point start) {
+  write_fun_(bytes);
+  response_bytes_ += bytes.size();
+  write_time_ += Clock::now() - start;
 }
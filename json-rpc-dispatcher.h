@@ -17,6 +17,7 @@
 
 #include <functional>
 #include <map>
+#include <chrono>
 #include <sstream>
 #include <string>
 #include <unordered_map>
@@ -37,6 +38,10 @@
 // All receiving (call to DispatchMessage()) and writing of response (WriteFun)
 // is abstracted out to make the dispatcher agnostic of the transport layer.
 //
+// Besides JSON text, messages can be exchanged in the binary CBOR or
+// MessagePack encoding. Replies and notifications are sent in the encoding
+// of the most recently received message.
+//
 // The RPCHandlers take and return json objects, but since nlohmann::json
 // provides ways to auto-convert objects to json, it is possible to
 // register properly typed handlers. To create the boilerplate for custom
@@ -59,6 +64,11 @@ class JsonRpcDispatcher {
   static constexpr int kMethodNotFound = -32601;
   static constexpr int kInternalError = -32603;
 
+  // Serialization format of messages on the wire.
+  enum class Encoding { kJson, kCbor, kMessagePack };
+
+  using Clock = std::chrono::steady_clock;
+
   // A notification receives a request, but does not return anything
   using RPCNotification = std::function<void(const nlohmann::json &r)>;
 
@@ -67,11 +77,51 @@ class JsonRpcDispatcher {
   // change this to absl::StatusOr<nlohmann::json> as return value.
   using RPCCallHandler = std::function<nlohmann::json(const nlohmann::json &)>;
 
+  // Function handed to a streaming call handler to emit the next element
+  // of its array result.
+  using ElementEmitFun = std::function<void(const nlohmann::json &element)>;
+
+  // A RPC call whose result is an array, but that is not returned in
+  // one piece: each element is emitted and immediately serialized into the
+  // outgoing response, so the result is never materialized as json. With a
+  // ChunkWriteFun, the response is written in chunks while elements are
+  // emitted; otherwise its serialized bytes are collected to be written in
+  // one piece, as the WriteFun needs to know the size up front.
+  using RPCStreamingCallHandler = std::function<void(
+      const nlohmann::json &params, const ElementEmitFun &emit)>;
+
   // A function of type WriteFun is called by the dispatcher to send the
   // string-formatted json response. The user of the JsonRpcDispatcher then
   // can wire that to the underlying transport.
   using WriteFun = std::function<void(absl::string_view response)>;
 
+  // Writes part of a response; the parts of a response are written one
+  // after another, the last one ends with a newline. Only for transports
+  // that don't need to know the size of a message before writing it, such
+  // as newline-delimited framing.
+  using ChunkWriteFun = std::function<void(absl::string_view chunk)>;
+
+  // Called with the name of a method right before its handler runs and
+  // with nullptr once it returned. The name stays valid as long as the
+  // handler is registered, so can be kept e.g. to attribute profile samples.
+  using MethodObserverFun = std::function<void(const char *method)>;
+
+  // Sizes and timing of a message that has been dispatched.
+  struct MessageTrace {
+    absl::string_view message;    // As received.
+    absl::string_view method;     // Empty if not parseable.
+    // Registered method the message was dispatched to; nullptr if there is
+    // none. Stays valid as long as the handler is registered.
+    const char *handler;
+    const nlohmann::json *id;     // nullptr for notifications.
+    size_t response_bytes;        // Total written while handling.
+    Clock::duration parse_time;   // Decoding the message.
+    Clock::duration handle_time;  // Handler, without writing responses.
+    Clock::duration write_time;   // Encoding and writing responses.
+  };
+
+  using MessageTraceFun = std::function<void(const MessageTrace &trace)>;
+
   // Some statistical counters of method calls or exceptions encountered.
   using StatsMap = std::map<std::string, int>;
 
@@ -79,13 +129,30 @@ class JsonRpcDispatcher {
   explicit JsonRpcDispatcher(const WriteFun &out) : write_fun_(out) {}
   JsonRpcDispatcher(const JsonRpcDispatcher &) = delete;
 
+  // Write results of streaming handlers in JSON encoding with "fun" in
+  // chunks of about kStreamChunkBytes, so that not even their serialized
+  // bytes are kept. If a handler fails after a chunk is written, the
+  // response is cut off with a newline before the error is sent. Handlers
+  // must not send other messages while emitting elements.
+  static constexpr size_t kStreamChunkBytes = 64 << 10;
+  void SetChunkWriter(const ChunkWriteFun &fun) { chunk_write_fun_ = fun; }
+
   // Add a request handler for RPC calls that receive data and send a response.
   // Returns successful registration, false if that name is already registered.
   bool AddRequestHandler(const std::string &method_name,
                          const RPCCallHandler &fun) {
+    if (streaming_handlers_.count(method_name)) return false;
     return handlers_.insert({method_name, fun}).second;
   }
 
+  // Add a request handler that streams the elements of its array result.
+  // Returns successful registration, false if that name is already registered.
+  bool AddStreamingRequestHandler(const std::string &method_name,
+                                  const RPCStreamingCallHandler &fun) {
+    if (handlers_.count(method_name)) return false;
+    return streaming_handlers_.insert({method_name, fun}).second;
+  }
+
   // Add a request handler for RPC Notifications, that are receive-only events.
   // Returns successful registration, false if that name is already registered.
   bool AddNotificationHandler(const std::string &method_name,
@@ -93,10 +160,41 @@ class JsonRpcDispatcher {
     return notifications_.insert({method_name, fun}).second;
   }
 
-  // Dispatch incoming message, a string view with json data.
+  // Give requests of "method" a time budget, starting when the message is
+  // received. Meant for requests that block the user interface: their
+  // handlers check DeadlineExceeded() and rather return a partial result
+  // than keep the client waiting.
+  void SetRequestDeadline(const std::string &method, Clock::duration budget) {
+    deadlines_[method] = budget;
+  }
+
+  // To be called from a request handler: returns true if the deadline of
+  // the request currently handled has passed. Always false for requests
+  // without deadline or outside of handlers.
+  // If a handler saw this returning true, its response is counted as
+  // degraded.
+  bool DeadlineExceeded() const;
+
+  void SetMethodObserver(const MethodObserverFun &observer) {
+    method_observer_ = observer;
+  }
+
+  // Called after each message with its trace. Meant to be cheap; used to
+  // keep track of what happened recently for post-mortem analysis.
+  void SetMessageTraceListener(const MessageTraceFun &listener) {
+    trace_listener_ = listener;
+  }
+
+  // Dispatch incoming message, a string view with json data (or its binary
+  // representation given by "encoding").
   // Call this with the content of exactly one message.
   // If this is an RPC call, response will call WriteFun.
-  void DispatchMessage(absl::string_view data);
+  void DispatchMessage(absl::string_view data,
+                       Encoding encoding = Encoding::kJson);
+
+  // Encoding of the most recently received message; replies and
+  // notifications are written in it.
+  Encoding encoding() const { return encoding_; }
 
   // Send a notification to the client side. Parameters will be wrapped
   // in in a JSON-RPC message and pushed out to the WriteFun
@@ -113,10 +211,19 @@ class JsonRpcDispatcher {
   // exception message.
   int exception_count() const { return exception_count_; }
 
+  // Number of responses that were degraded because the handler ran out of
+  // time. The counters returned by GetStatsCounters() report them by method.
+  int degraded_count() const { return degraded_count_; }
+
  private:
+  void DispatchRequest(const nlohmann::json &request,
+                       Clock::time_point received);
   bool CallNotification(const nlohmann::json &req, const std::string &method);
   bool CallRequestHandler(const nlohmann::json &req, const std::string &method);
+  void CallStreamingRequestHandler(const nlohmann::json &req,
+                                   const RPCStreamingCallHandler &handler);
   void SendReply(const nlohmann::json &response);
+  void Write(absl::string_view bytes, Clock::time_point start);
 
   static nlohmann::json CreateError(const nlohmann::json &request, int code,
                                     absl::string_view message);
@@ -124,10 +231,25 @@ class JsonRpcDispatcher {
                                      const nlohmann::json &call_result);
 
   const WriteFun write_fun_;
+  ChunkWriteFun chunk_write_fun_;
+  Encoding encoding_ = Encoding::kJson;  // Of last message; used for replies.
+
+  std::unordered_map<std::string, Clock::duration> deadlines_;
+  Clock::time_point current_deadline_ = Clock::time_point::max();
+  mutable bool current_deadline_exceeded_ = false;
+
+  MethodObserverFun method_observer_;
+
+  MessageTraceFun trace_listener_;
+  Clock::duration write_time_;  // Of current message.
+  size_t response_bytes_ = 0;
+  const char *dispatched_handler_ = nullptr;  // Of current message.
 
   std::unordered_map<std::string, RPCCallHandler> handlers_;
+  std::unordered_map<std::string, RPCStreamingCallHandler> streaming_handlers_;
   std::unordered_map<std::string, RPCNotification> notifications_;
   int exception_count_ = 0;
+  int degraded_count_ = 0;
   StatsMap statistic_counters_;
 };
 #endif  // JSON_RPC_DISPATCHER_H
@@ -0,0 +1,184 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Replay of a synthetic editing session through the JsonRpcDispatcher in
+// each encoding: JSON text, CBOR and MessagePack. Measures decoding the
+// messages, dispatching them to handlers and encoding the replies, and
+// the bytes on the wire either way.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+
+#include "json-rpc-dispatcher.h"
+
+static constexpr int kEdits = 2000;
+static constexpr std::chrono::milliseconds kRunTime(1000);
+
+using Encoding = JsonRpcDispatcher::Encoding;
+
+// Opening a document, then typing with the occasional hover and request
+// of the document outline, which has a large result.
+static std::vector<nlohmann::json> CreateSession() {
+  std::vector<nlohmann::json> session;
+  std::string text;
+  for (int i = 0; i < 2000; ++i) {
+    absl::StrAppend(&text, "Line ", i, " with some words and a variable\n");
+  }
+  session.push_back({{"jsonrpc", "2.0"},
+                     {"method", "textDocument/didOpen"},
+                     {"params",
+                      {{"textDocument",
+                        {{"uri", "file:///benchmark.txt"},
+                         {"version", 1},
+                         {"text", text}}}}}});
+  for (int i = 0; i < kEdits; ++i) {
+    const nlohmann::json position = {{"line", i % 2000}, {"character", 7}};
+    session.push_back(
+        {{"jsonrpc", "2.0"},
+         {"method", "textDocument/didChange"},
+         {"params",
+          {{"textDocument", {{"uri", "file:///benchmark.txt"}, {"version", i}}},
+           {"contentChanges",
+            {{{"range", {{"start", position}, {"end", position}}},
+              {"text", "x"}}}}}}});
+    if (i % 5 == 0) {
+      session.push_back({{"jsonrpc", "2.0"},
+                         {"id", i},
+                         {"method", "textDocument/hover"},
+                         {"params",
+                          {{"textDocument", {{"uri", "file:///benchmark.txt"}}},
+                           {"position", position}}}});
+    }
+    if (i % 100 == 0) {
+      session.push_back(
+          {{"jsonrpc", "2.0"},
+           {"id", i + 1000000},
+           {"method", "textDocument/documentSymbol"},
+           {"params", {{"textDocument", {{"uri", "file:///benchmark.txt"}}}}}});
+    }
+  }
+  return session;
+}
+
+static std::vector<std::string> Encode(
+    const std::vector<nlohmann::json> &session, Encoding encoding) {
+  std::vector<std::string> result;
+  for (const nlohmann::json &message : session) {
+    std::vector<uint8_t> bytes;
+    switch (encoding) {
+      case Encoding::kCbor:
+        bytes = nlohmann::json::to_cbor(message);
+        break;
+      case Encoding::kMessagePack:
+        bytes = nlohmann::json::to_msgpack(message);
+        break;
+      default:
+        result.push_back(message.dump());
+        continue;
+    }
+    result.emplace_back(bytes.begin(), bytes.end());
+  }
+  return result;
+}
+
+struct Result {
+  double messages_per_second;
+  double bytes_in;   // Per session.
+  double bytes_out;  // Per session.
+};
+
+static Result RunBenchmark(const std::vector<nlohmann::json> &session,
+                           Encoding encoding) {
+  const std::vector<std::string> messages = Encode(session, encoding);
+  int64_t bytes_out = 0;
+  JsonRpcDispatcher dispatcher(
+      [&](absl::string_view reply) { bytes_out += reply.size(); });
+
+  // Handlers look at their parameters like the real ones would.
+  int64_t chars_seen = 0;
+  dispatcher.AddNotificationHandler(
+      "textDocument/didOpen", [&](const nlohmann::json &p) {
+        const auto &text = p["textDocument"]["text"];
+        chars_seen += text.get_ref<const std::string &>().size();
+      });
+  dispatcher.AddNotificationHandler(
+      "textDocument/didChange", [&](const nlohmann::json &p) {
+        for (const auto &change : p["contentChanges"]) {
+          chars_seen += change["text"].get_ref<const std::string &>().size();
+        }
+      });
+  dispatcher.AddRequestHandler(
+      "textDocument/hover", [](const nlohmann::json &p) -> nlohmann::json {
+        return {{"contents",
+                 {{"kind", "markdown"},
+                  {"value", absl::StrCat("Line ",
+                                         p["position"]["line"].get<int>())}}}};
+      });
+  dispatcher.AddRequestHandler(
+      "textDocument/documentSymbol",
+      [](const nlohmann::json &) -> nlohmann::json {
+        nlohmann::json result = nlohmann::json::array();
+        for (int line = 0; line < 2000; ++line) {
+          const nlohmann::json range = {
+              {"start", {{"line", line}, {"character", 33}}},
+              {"end", {{"line", line}, {"character", 41}}}};
+          result.push_back({{"name", "Some Variable"},
+                            {"kind", 13},
+                            {"range", range},
+                            {"selectionRange", range}});
+        }
+        return result;
+      });
+
+  int64_t bytes_in = 0;
+  int64_t dispatched = 0;
+  int sessions = 0;
+  const auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < kRunTime) {
+    for (const std::string &message : messages) {
+      dispatcher.DispatchMessage(message, encoding);
+      bytes_in += message.size();
+    }
+    dispatched += messages.size();
+    ++sessions;
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  if (dispatcher.exception_count() > 0 || chars_seen == 0) {
+    fprintf(stderr, "Unexpected: messages were not handled.\n");
+  }
+  return {dispatched / seconds, (double)bytes_in / sessions,
+          (double)bytes_out / sessions};
+}
+
+int main() {
+  const std::vector<nlohmann::json> session = CreateSession();
+  fprintf(stderr, "Session of %zu messages.\n", session.size());
+  fprintf(stderr, "%-12s %14s %16s %16s\n", "Encoding", "Messages/s",
+          "Bytes in/session", "Bytes out/session");
+  const std::pair<const char *, Encoding> encodings[] = {
+      {"JSON", Encoding::kJson},
+      {"CBOR", Encoding::kCbor},
+      {"MessagePack", Encoding::kMessagePack}};
+  for (const auto &encoding : encodings) {
+    const Result r = RunBenchmark(session, encoding.second);
+    fprintf(stderr, "%-12s %14.0f %16.0f %16.0f\n", encoding.first,
+            r.messages_per_second, r.bytes_in, r.bytes_out);
+  }
+}
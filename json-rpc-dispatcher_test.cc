@@ -21,6 +21,8 @@
 
 #include <algorithm>
 #include <exception>
+#include <string>
+#include <vector>
 
 using nlohmann::json;
 
@@ -63,6 +65,22 @@ TEST(JsonRpcDispatcherTest, Call_MissingMethodInRequest) {
   EXPECT_EQ(dispatcher.exception_count(), 0);
 }
 
+TEST(JsonRpcDispatcherTest, Call_NonStringMethodInRequest) {
+  // A method that is not a string is as good as none, not a parse error.
+  int write_fun_called = 0;
+
+  JsonRpcDispatcher dispatcher([&](absl::string_view s) {
+    const json j = json::parse(s);
+    EXPECT_EQ(j["error"]["code"], JsonRpcDispatcher::kMethodNotFound) << s;
+    ++write_fun_called;
+  });
+
+  dispatcher.DispatchMessage(R"({"jsonrpc":"2.0","id":1,"method":42})");
+
+  EXPECT_EQ(write_fun_called, 1);
+  EXPECT_EQ(dispatcher.exception_count(), 0);
+}
+
 TEST(JsonRpcDispatcherTest, CallNotification) {
   int write_fun_called = 0;
   int notification_fun_called = 0;
@@ -156,6 +174,165 @@ TEST(JsonRpcDispatcherTest, CallRpcHandler) {
   EXPECT_EQ(dispatcher.exception_count(), 0);
 }
 
+TEST(JsonRpcDispatcherTest, CallStreamingRpcHandler) {
+  int write_fun_called = 0;
+  int rpc_fun_called = 0;
+
+  JsonRpcDispatcher dispatcher([&](absl::string_view s) {
+    const json j = json::parse(s);
+    EXPECT_EQ(j["id"], 1);
+    EXPECT_EQ(j["result"], json::parse(R"([{"a":1}, "two", [3]])"));
+    EXPECT_TRUE(j.find("error") == j.end());
+    ++write_fun_called;
+  });
+  const bool registered = dispatcher.AddStreamingRequestHandler(
+      "foo", [&](const json &j, const JsonRpcDispatcher::ElementEmitFun &emit) {
+        EXPECT_EQ(j, json::parse(R"({ "hello":"world"})"));
+        ++rpc_fun_called;
+        emit(json::parse(R"({"a":1})"));
+        emit("two");
+        emit(json::array({3}));
+      });
+  EXPECT_TRUE(registered);
+
+  // Method names are shared between regular and streaming handlers.
+  EXPECT_FALSE(dispatcher.AddRequestHandler(
+      "foo", [](const json &j) -> json { return nullptr; }));
+  EXPECT_FALSE(dispatcher.AddStreamingRequestHandler(
+      "foo", [](const json &, const JsonRpcDispatcher::ElementEmitFun &) {}));
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{"hello":"world"}})");
+
+  EXPECT_EQ(rpc_fun_called, 1);
+  EXPECT_EQ(write_fun_called, 1);
+  EXPECT_EQ(dispatcher.exception_count(), 0);
+}
+
+TEST(JsonRpcDispatcherTest, CallStreamingRpcHandler_EmptyResult) {
+  int write_fun_called = 0;
+
+  JsonRpcDispatcher dispatcher([&](absl::string_view s) {
+    const json j = json::parse(s);
+    EXPECT_EQ(j["result"], json::array());
+    ++write_fun_called;
+  });
+  dispatcher.AddStreamingRequestHandler(
+      "foo", [&](const json &, const JsonRpcDispatcher::ElementEmitFun &) {});
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{}})");
+
+  EXPECT_EQ(write_fun_called, 1);
+}
+
+TEST(JsonRpcDispatcherTest, InvalidUtf8IsReplacedInReply) {
+  int write_fun_called = 0;
+
+  JsonRpcDispatcher dispatcher([&](absl::string_view s) {
+    const json j = json::parse(s);
+    EXPECT_EQ(j["result"], json::array({"caf\xef\xbf\xbd"}));  // U+FFFD
+    ++write_fun_called;
+  });
+  dispatcher.AddStreamingRequestHandler(
+      "foo", [&](const json &, const JsonRpcDispatcher::ElementEmitFun &emit) {
+        emit("caf\xe9");  // Latin-1, not UTF-8
+      });
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{}})");
+
+  EXPECT_EQ(write_fun_called, 1);
+  EXPECT_EQ(dispatcher.exception_count(), 0);
+}
+
+TEST(JsonRpcDispatcherTest, CallStreamingRpcHandler_ReportInternalError) {
+  int write_fun_called = 0;
+
+  // A handler failing halfway only reports the error, no partial result.
+  JsonRpcDispatcher dispatcher([&](absl::string_view s) {
+    const json j = json::parse(s);
+    EXPECT_TRUE(j.find("result") == j.end());
+    EXPECT_EQ(j["error"]["code"], JsonRpcDispatcher::kInternalError) << s;
+    ++write_fun_called;
+  });
+  dispatcher.AddStreamingRequestHandler(
+      "foo", [&](const json &, const JsonRpcDispatcher::ElementEmitFun &emit) {
+        emit("first");
+        throw std::runtime_error("Okay, Houston, we've had a problem here");
+      });
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{}})");
+
+  EXPECT_EQ(write_fun_called, 1);
+  EXPECT_EQ(dispatcher.exception_count(), 1);
+}
+
+TEST(JsonRpcDispatcherTest, CallStreamingRpcHandler_WritesInChunks) {
+  static constexpr int kElements = 10000;
+  JsonRpcDispatcher dispatcher([&](absl::string_view s) {
+    ADD_FAILURE() << "Expected to be written in chunks";
+  });
+  std::vector<std::string> chunks;
+  dispatcher.SetChunkWriter(
+      [&](absl::string_view chunk) { chunks.emplace_back(chunk); });
+  size_t largest_chunk_while_emitting = 0;
+  dispatcher.AddStreamingRequestHandler(
+      "foo", [&](const json &, const JsonRpcDispatcher::ElementEmitFun &emit) {
+        for (int i = 0; i < kElements; ++i) {
+          emit(json{{"element", i}, {"padding", std::string(20, 'x')}});
+          if (!chunks.empty()) {
+            largest_chunk_while_emitting =
+                std::max(largest_chunk_while_emitting, chunks.back().size());
+          }
+        }
+      });
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{}})");
+
+  // Written while the handler is still emitting; one chunk at a time.
+  EXPECT_GT(chunks.size(), 2);
+  EXPECT_LT(largest_chunk_while_emitting,
+            JsonRpcDispatcher::kStreamChunkBytes + 100);
+  std::string response;
+  for (const std::string &chunk : chunks) response.append(chunk);
+  ASSERT_EQ(response.back(), '\n');
+  const json j = json::parse(response);
+  EXPECT_EQ(j["id"], 1);
+  ASSERT_EQ(j["result"].size(), kElements);
+  EXPECT_EQ(j["result"][kElements - 1]["element"], kElements - 1);
+}
+
+TEST(JsonRpcDispatcherTest, CallStreamingRpcHandler_ChunkedInternalError) {
+  std::vector<std::string> writes;
+  JsonRpcDispatcher dispatcher(
+      [&](absl::string_view s) { writes.emplace_back(s); });
+  std::string partial;
+  dispatcher.SetChunkWriter([&](absl::string_view chunk) {
+    partial.append(chunk.data(), chunk.size());
+  });
+  dispatcher.AddStreamingRequestHandler(
+      "foo", [&](const json &, const JsonRpcDispatcher::ElementEmitFun &emit) {
+        const std::string large(JsonRpcDispatcher::kStreamChunkBytes, 'x');
+        emit(large);
+        throw std::runtime_error("Okay, Houston, we've had a problem here");
+      });
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{}})");
+
+  // The partial response is cut off, so the error is on a line of its own.
+  ASSERT_FALSE(partial.empty());
+  EXPECT_EQ(partial.back(), '\n');
+  EXPECT_FALSE(json::accept(partial));
+  ASSERT_EQ(writes.size(), 1);
+  const json j = json::parse(writes[0]);
+  EXPECT_EQ(j["id"], 1);
+  EXPECT_EQ(j["error"]["code"], JsonRpcDispatcher::kInternalError);
+}
+
 TEST(JsonRpcDispatcherTest, CallRpcHandler_ReportInternalError) {
   int write_fun_called = 0;
   int rpc_fun_called = 0;
@@ -197,3 +374,150 @@ TEST(JsonRpcDispatcherTest, CallRpcHandler_MissingMethodImplemented) {
   EXPECT_EQ(write_fun_called, 1);  // Reported error.
   EXPECT_EQ(dispatcher.exception_count(), 0);
 }
+
+TEST(JsonRpcDispatcherTest, CallRpcHandler_DeadlineDegradesResponse) {
+  JsonRpcDispatcher dispatcher([](absl::string_view) {});
+  EXPECT_FALSE(dispatcher.DeadlineExceeded());  // Not in a handler.
+
+  // A zero budget is exceeded right away; no deadline is never exceeded.
+  dispatcher.SetRequestDeadline("hurry", std::chrono::milliseconds(0));
+  dispatcher.SetRequestDeadline("relaxed", std::chrono::hours(1));
+  int checked_deadline = 0;
+  for (const char *method : {"hurry", "relaxed", "no-deadline"}) {
+    const bool expect_exceeded = (method == std::string("hurry"));
+    dispatcher.AddRequestHandler(method, [&, expect_exceeded](const json &) {
+      EXPECT_EQ(dispatcher.DeadlineExceeded(), expect_exceeded);
+      ++checked_deadline;
+      return nullptr;
+    });
+  }
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"hurry","params":{}})");
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":2,"method":"relaxed","params":{}})");
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":3,"method":"no-deadline","params":{}})");
+
+  EXPECT_EQ(checked_deadline, 3);
+  EXPECT_EQ(dispatcher.degraded_count(), 1);
+  EXPECT_EQ(dispatcher.GetStatCounters().at("hurry (degraded)"), 1);
+  EXPECT_FALSE(dispatcher.DeadlineExceeded());  // Reset after request.
+}
+
+TEST(JsonRpcDispatcherTest, CallRpcHandler_BinaryEncodingReplyInKind) {
+  using Encoding = JsonRpcDispatcher::Encoding;
+  const json request =
+      json::parse(R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{}})");
+
+  for (const Encoding encoding : {Encoding::kCbor, Encoding::kMessagePack}) {
+    int write_fun_called = 0;
+    JsonRpcDispatcher dispatcher([&](absl::string_view s) {
+      const json j = (encoding == Encoding::kCbor)
+                         ? json::from_cbor(s.begin(), s.end())
+                         : json::from_msgpack(s.begin(), s.end());
+      EXPECT_EQ(j["result"], json::array({"some", "response"}));
+      ++write_fun_called;
+    });
+    dispatcher.AddRequestHandler("foo", [](const json &j) -> json {
+      return json::array({"some", "response"});
+    });
+    // Streaming handlers fall back to a regular reply in binary encodings.
+    dispatcher.AddStreamingRequestHandler(
+        "bar", [](const json &, const JsonRpcDispatcher::ElementEmitFun &emit) {
+          emit("some");
+          emit("response");
+        });
+
+    std::vector<uint8_t> binary_request = (encoding == Encoding::kCbor)
+                                              ? json::to_cbor(request)
+                                              : json::to_msgpack(request);
+    const absl::string_view message(
+        reinterpret_cast<const char *>(binary_request.data()),
+        binary_request.size());
+    dispatcher.DispatchMessage(message, encoding);
+
+    json streaming_request = request;
+    streaming_request["method"] = "bar";
+    binary_request = (encoding == Encoding::kCbor)
+                         ? json::to_cbor(streaming_request)
+                         : json::to_msgpack(streaming_request);
+    dispatcher.DispatchMessage(
+        {reinterpret_cast<const char *>(binary_request.data()),
+         binary_request.size()},
+        encoding);
+
+    EXPECT_EQ(write_fun_called, 2);
+    EXPECT_EQ(dispatcher.exception_count(), 0);
+  }
+}
+
+TEST(JsonRpcDispatcherTest, Call_GarbledBinaryRequest) {
+  int write_fun_called = 0;
+
+  JsonRpcDispatcher dispatcher([&](absl::string_view s) {
+    const json j = json::from_cbor(s.begin(), s.end());
+    EXPECT_EQ(j["error"]["code"], JsonRpcDispatcher::kParseError);
+    ++write_fun_called;
+  });
+
+  dispatcher.DispatchMessage("\xff\xff garbage",
+                             JsonRpcDispatcher::Encoding::kCbor);
+
+  EXPECT_EQ(write_fun_called, 1);
+  EXPECT_EQ(dispatcher.exception_count(), 1);
+}
+
+TEST(JsonRpcDispatcherTest, MethodObserverSeesHandlersRunning) {
+  JsonRpcDispatcher dispatcher([](absl::string_view) {});
+  std::vector<std::string> observed;
+  dispatcher.SetMethodObserver([&](const char *method) {
+    observed.push_back(method ? method : "(none)");
+  });
+
+  dispatcher.AddRequestHandler("foo", [&](const json &) {
+    EXPECT_EQ(observed.back(), "foo");  // Observer told before we run.
+    return nullptr;
+  });
+  dispatcher.AddNotificationHandler("bar", [](const json &) {
+    throw std::runtime_error("Failing handlers are done, too");
+  });
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{}})");
+  dispatcher.DispatchMessage(R"({"jsonrpc":"2.0","method":"bar","params":{}})");
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":2,"method":"baz","params":{}})");
+
+  EXPECT_EQ(observed,
+            std::vector<std::string>({"foo", "(none)", "bar", "(none)"}));
+}
+
+TEST(JsonRpcDispatcherTest, MessageTraceReportsEveryMessage) {
+  size_t bytes_written = 0;
+  JsonRpcDispatcher dispatcher(
+      [&](absl::string_view s) { bytes_written += s.size(); });
+  std::vector<std::string> traced;
+  dispatcher.SetMessageTraceListener(
+      [&](const JsonRpcDispatcher::MessageTrace &trace) {
+        traced.push_back(std::string(trace.method) + " " +
+                         (trace.handler ? trace.handler : "-") + " " +
+                         (trace.id ? trace.id->dump() : "-") + " " +
+                         std::to_string(trace.message.size()));
+        EXPECT_EQ(trace.response_bytes, bytes_written);
+        EXPECT_GE(trace.handle_time.count(), 0);
+        bytes_written = 0;
+      });
+
+  dispatcher.AddRequestHandler("foo", [](const json &) { return 42; });
+  dispatcher.AddNotificationHandler("bar", [](const json &) {});
+
+  dispatcher.DispatchMessage(
+      R"({"jsonrpc":"2.0","id":1,"method":"foo","params":{}})");
+  dispatcher.DispatchMessage(R"({"jsonrpc":"2.0","method":"bar","params":{}})");
+  dispatcher.DispatchMessage(R"({"jsonrpc":"2.0","id":2,"method":"baz"})");
+  dispatcher.DispatchMessage("garbage");
+
+  EXPECT_EQ(traced, std::vector<std::string>({"foo foo 1 51", "bar bar - 44",
+                                              "baz - 2 39", " - - 7"}));
+}
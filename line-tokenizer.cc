@@ -0,0 +1,31 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "line-tokenizer.h"
+
+#include <ctype.h>
+
+LexerState TokenizeLine(absl::string_view line, LexerState state,
+                        LineTokens *tokens) {
+  const char *const end = line.data() + line.size();
+  const char *pos = line.data();
+  for (;;) {
+    while (pos < end && isspace(*pos)) ++pos;
+    if (pos == end) break;
+    const char *const token_start = pos;
+    while (pos < end && !isspace(*pos)) ++pos;
+    tokens->emplace_back(token_start, pos - token_start);
+  }
+  return state;
+}
@@ -0,0 +1,40 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LINE_TOKENIZER_H
+#define LINE_TOKENIZER_H
+
+#include <vector>
+
+//
+#include <absl/strings/string_view.h>
+
+// Tokens of a line; string_views pointing into the line they were found in.
+using LineTokens = std::vector<absl::string_view>;
+
+// The lexer state at a line boundary. Languages with constructs that span
+// multiple lines (block comments, multi-line strings) need to know where the
+// previous line left off to tokenize the next.
+//
+// The demo language here is just whitespace separated words, so the only
+// state ever is kInitialLexerState.
+using LexerState = int;
+static constexpr LexerState kInitialLexerState = 0;
+
+// Split "line" into tokens, starting in lexer state "state". Tokens are
+// appended to "tokens". Returns the lexer state at the end of the line.
+LexerState TokenizeLine(absl::string_view line, LexerState state,
+                        LineTokens *tokens);
+
+#endif  // LINE_TOKENIZER_H
@@ -0,0 +1,47 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "line-tokenizer.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using ::testing::ElementsAre;
+
+TEST(LineTokenizerTest, EmptyAndWhitespaceOnlyLines) {
+  for (absl::string_view line : {"", "\n", "  \t \r\n"}) {
+    LineTokens tokens;
+    EXPECT_EQ(TokenizeLine(line, kInitialLexerState, &tokens),
+              kInitialLexerState);
+    EXPECT_TRUE(tokens.empty());
+  }
+}
+
+TEST(LineTokenizerTest, SplitOnWhitespace) {
+  static constexpr absl::string_view kLine = "  Hello\tbrave  new_world!\n";
+  LineTokens tokens;
+  TokenizeLine(kLine, kInitialLexerState, &tokens);
+  EXPECT_THAT(tokens, ElementsAre("Hello", "brave", "new_world!"));
+
+  // Tokens point into the original line, so positions can be derived.
+  EXPECT_EQ(tokens[0].data() - kLine.data(), 2);
+  EXPECT_EQ(tokens[2].data() - kLine.data(), 15);
+}
+
+TEST(LineTokenizerTest, TokensAreAppended) {
+  LineTokens tokens;
+  TokenizeLine("foo", kInitialLexerState, &tokens);
+  TokenizeLine("bar baz", kInitialLexerState, &tokens);
+  EXPECT_THAT(tokens, ElementsAre("foo", "bar", "baz"));
+}
@@ -0,0 +1,98 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lint-rules.h"
+
+#include <algorithm>
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_split.h>
+
+static re2::StringPiece ToStringPiece(absl::string_view s) {
+  return {s.data(), s.size()};
+}
+
+RegexLintRules::Rule::Rule(absl::string_view pattern, absl::string_view msg)
+    : pattern(pattern),
+      message(msg.empty() ? pattern : msg),
+      regex(ToStringPiece(pattern), RE2::Quiet) {}
+
+absl::Status RegexLintRules::ParseRules(absl::string_view rule_file_content) {
+  // Parse and combine into locals first, so that an error leaves the rules
+  // we have untouched.
+  std::vector<std::unique_ptr<Rule>> parsed;
+  int line_no = 0;
+  for (absl::string_view line : absl::StrSplit(rule_file_content, '\n')) {
+    ++line_no;
+    line = absl::StripTrailingAsciiWhitespace(line);
+    if (line.empty() || line[0] == '#') continue;
+    const std::pair<absl::string_view, absl::string_view> pattern_message =
+        absl::StrSplit(line, absl::MaxSplits('\t', 1));
+    auto rule = std::make_unique<Rule>(
+        pattern_message.first,
+        absl::StripLeadingAsciiWhitespace(pattern_message.second));
+    if (!rule->regex.ok()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Lint rule line ", line_no, ": '", rule->pattern,
+                       "': ", rule->regex.error()));
+    }
+    parsed.push_back(std::move(rule));
+  }
+
+  // Build the combined automaton of all rules, old and new.
+  auto all_rules = std::make_unique<RE2::Set>(RE2::Quiet, RE2::UNANCHORED);
+  for (const auto *rules : {&rules_, &parsed}) {
+    for (const auto &rule : *rules) {
+      if (all_rules->Add(ToStringPiece(rule->pattern), nullptr) < 0) {
+        return absl::InvalidArgumentError(
+            absl::StrCat("Lint rule '", rule->pattern, "' not combinable"));
+      }
+    }
+  }
+  if (!all_rules->Compile()) {
+    return absl::ResourceExhaustedError("Lint rules too complex to combine");
+  }
+
+  for (auto &rule : parsed) rules_.push_back(std::move(rule));
+  all_rules_ = std::move(all_rules);
+  return absl::OkStatus();
+}
+
+void RegexLintRules::MatchLine(absl::string_view line,
+                               std::vector<Match> *matches) const {
+  if (!all_rules_) return;
+  stats_bytes_scanned_.fetch_add(line.size(), std::memory_order_relaxed);
+
+  // One pass over the line tells us which rules match at all.
+  std::vector<int> matching_rules;
+  if (!all_rules_->Match(ToStringPiece(line), &matching_rules)) return;
+
+  // Only now find the exact positions of the matching rules.
+  std::sort(matching_rules.begin(), matching_rules.end());
+  for (const int rule_index : matching_rules) {
+    const Rule &rule = *rules_[rule_index];
+    size_t pos = 0;
+    re2::StringPiece found;
+    while (pos <= line.size() &&
+           rule.regex.Match(ToStringPiece(line), pos, line.size(),
+                            RE2::UNANCHORED, &found, 1)) {
+      const int start = found.data() - line.data();
+      const int end = start + found.size();
+      matches->push_back({rule_index, start, end});
+      rule.match_count.fetch_add(1, std::memory_order_relaxed);
+      pos = (end > start) ? end : end + 1;  // Progress on empty matches.
+    }
+  }
+}
@@ -0,0 +1,85 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LINT_RULES_H
+#define LINT_RULES_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+//
+#include <absl/status/status.h>
+#include <absl/strings/string_view.h>
+#include <re2/re2.h>
+#include <re2/set.h>
+
+// A set of lint rules, each a regular expression with a message to report
+// where it matches.
+//
+// All rules are compiled into one combined automaton (RE2::Set), so a line
+// is scanned once in linear time for all rules at the same time. Only for
+// the (rare) lines that match, the individual rules are run to find the
+// exact match positions.
+//
+// Matching is thread-safe; statistic counters are updated atomically.
+class RegexLintRules {
+ public:
+  // A match of rule with index "rule" in columns [start, end) of a line.
+  struct Match {
+    int rule;
+    int start;
+    int end;
+  };
+
+  RegexLintRules() = default;
+  RegexLintRules(const RegexLintRules &) = delete;
+
+  // Parse rules from the content of a rule file and compile them; can be
+  // called multiple times to add rules from multiple files.
+  // Each non-empty line not starting with '#' contains a regular expression,
+  // a tab, and the message to report for matches. Without message, the
+  // pattern itself is reported.
+  // Returns kInvalidArgument status if a pattern can not be compiled; the
+  // rules parsed before stay in effect then.
+  absl::Status ParseRules(absl::string_view rule_file_content);
+
+  // Find all matches of all rules in "line" and append to "matches".
+  void MatchLine(absl::string_view line, std::vector<Match> *matches) const;
+
+  size_t rule_count() const { return rules_.size(); }
+  const std::string &pattern(int rule) const { return rules_[rule]->pattern; }
+  const std::string &message(int rule) const { return rules_[rule]->message; }
+
+  // -- Statistical data
+
+  int64_t StatMatchCount(int rule) const { return rules_[rule]->match_count; }
+  int64_t StatBytesScanned() const { return stats_bytes_scanned_; }
+
+ private:
+  struct Rule {
+    Rule(absl::string_view pattern, absl::string_view message);
+    const std::string pattern;
+    const std::string message;
+    const RE2 regex;
+    mutable std::atomic<int64_t> match_count{0};
+  };
+
+  std::vector<std::unique_ptr<Rule>> rules_;  // Rule is not movable.
+  std::unique_ptr<RE2::Set> all_rules_;
+  mutable std::atomic<int64_t> stats_bytes_scanned_{0};
+};
+
+#endif  // LINT_RULES_H
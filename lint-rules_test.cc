@@ -0,0 +1,92 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "lint-rules.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+using ::testing::HasSubstr;
+
+TEST(RegexLintRulesTest, ParseRuleFile) {
+  RegexLintRules rules;
+  EXPECT_TRUE(rules
+                  .ParseRules("# Comment and empty lines are ignored\n"
+                              "\n"
+                              "fo+\tToo many o\n"
+                              "ba[rz]\n")
+                  .ok());
+  ASSERT_EQ(rules.rule_count(), 2);
+  EXPECT_EQ(rules.pattern(0), "fo+");
+  EXPECT_EQ(rules.message(0), "Too many o");
+  EXPECT_EQ(rules.message(1), "ba[rz]");  // No message: pattern reported.
+}
+
+TEST(RegexLintRulesTest, InvalidPatternIsReported) {
+  RegexLintRules rules;
+  const absl::Status status = rules.ParseRules("good\nba(d\tunbalanced\n");
+  EXPECT_EQ(status.code(), absl::StatusCode::kInvalidArgument);
+  EXPECT_THAT(status.message(), HasSubstr("line 2"));
+  EXPECT_EQ(rules.rule_count(), 0);  // None of the file taken.
+}
+
+TEST(RegexLintRulesTest, FailedParseKeepsEarlierRules) {
+  RegexLintRules rules;
+  ASSERT_TRUE(rules.ParseRules("fo+\n").ok());
+  EXPECT_FALSE(rules.ParseRules("bar\nba(d\n").ok());
+  ASSERT_EQ(rules.rule_count(), 1);
+
+  std::vector<RegexLintRules::Match> matches;
+  rules.MatchLine("foo bar", &matches);
+  ASSERT_EQ(matches.size(), 1);
+  EXPECT_EQ(matches[0].rule, 0);
+
+  ASSERT_TRUE(rules.ParseRules("bar\n").ok());  // Still combines with new.
+  matches.clear();
+  rules.MatchLine("foo bar", &matches);
+  EXPECT_EQ(matches.size(), 2);
+}
+
+TEST(RegexLintRulesTest, MatchAllRulesInLine) {
+  RegexLintRules rules;
+  ASSERT_TRUE(rules.ParseRules("fo+\nbar\nnever-matches\n").ok());
+
+  std::vector<RegexLintRules::Match> matches;
+  rules.MatchLine("bar foooo fo", &matches);
+  ASSERT_EQ(matches.size(), 3);
+  EXPECT_EQ(matches[0].rule, 0);
+  EXPECT_EQ(matches[0].start, 4);
+  EXPECT_EQ(matches[0].end, 9);
+  EXPECT_EQ(matches[1].rule, 0);
+  EXPECT_EQ(matches[1].start, 10);
+  EXPECT_EQ(matches[2].rule, 1);
+  EXPECT_EQ(matches[2].start, 0);
+  EXPECT_EQ(matches[2].end, 3);
+
+  matches.clear();
+  rules.MatchLine("nothing to see here", &matches);
+  EXPECT_TRUE(matches.empty());
+
+  EXPECT_EQ(rules.StatMatchCount(0), 2);
+  EXPECT_EQ(rules.StatMatchCount(1), 1);
+  EXPECT_EQ(rules.StatMatchCount(2), 0);
+  EXPECT_EQ(rules.StatBytesScanned(), 12 + 19);
+}
+
+TEST(RegexLintRulesTest, NoRulesNoMatches) {
+  RegexLintRules rules;
+  std::vector<RegexLintRules::Match> matches;
+  rules.MatchLine("foo", &matches);
+  EXPECT_TRUE(matches.empty());
+}
@@ -0,0 +1,243 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logger.h"
+
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+static std::atomic<uint64_t> next_logger_id{1};
+static std::atomic<Logger *> default_logger{nullptr};
+
+bool LogSite::Admit() {
+  const int64_t now = std::chrono::duration_cast<std::chrono::seconds>(
+                          std::chrono::steady_clock::now().time_since_epoch())
+                          .count();
+  int64_t second = second_.load(std::memory_order_relaxed);
+  if (second != now && second_.compare_exchange_strong(second, now)) {
+    count_ = 0;
+  }
+  if (count_.fetch_add(1, std::memory_order_relaxed) < kMaxPerSecond) {
+    return true;
+  }
+  ++suppressed_;
+  return false;
+}
+
+// Formatted similar to glog: "I1018 12:34:56.123456 main.cc:42] message"
+static std::string FormatMessage(std::chrono::system_clock::time_point time,
+                                 const LogSite &site,
+                                 const std::string &message, int suppressed) {
+  const time_t seconds = std::chrono::system_clock::to_time_t(time);
+  const int64_t micros = std::chrono::duration_cast<std::chrono::microseconds>(
+                             time.time_since_epoch())
+                             .count() %
+                         1000000;
+  struct tm local;
+  localtime_r(&seconds, &local);
+  char prefix[64];
+  const size_t len = strftime(prefix, sizeof(prefix), "%m%d %H:%M:%S", &local);
+  const char *const file = strrchr(site.file(), '/');
+  std::string result = absl::StrCat(
+      absl::string_view("DIWE" + static_cast<int>(site.level()), 1),
+      absl::string_view(prefix, len), ".",
+      absl::Dec(micros, absl::kZeroPad6), " ", file ? file + 1 : site.file(),
+      ":", site.line(), "] ", message);
+  if (suppressed > 0) {
+    absl::StrAppend(&result, " [", suppressed, " more suppressed]");
+  }
+  result.append("\n");
+  return result;
+}
+
+static void WriteFully(int fd, absl::string_view text) {
+  while (!text.empty()) {
+    const ssize_t w = write(fd, text.data(), text.size());
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return;
+    text.remove_prefix(w);
+  }
+}
+
+Logger::Logger(const Options &options)
+    : options_(options), id_(next_logger_id++) {
+  if (options_.path.empty()) {
+    fd_ = STDERR_FILENO;
+  } else {
+    OpenFile();
+  }
+  writer_ = std::thread([this]() { WriterLoop(); });
+}
+
+Logger::~Logger() {
+  Logger *self = this;
+  default_logger.compare_exchange_strong(self, nullptr);
+  {
+    std::unique_lock<std::mutex> l(wakeup_mutex_);
+    stop_ = true;
+  }
+  wakeup_.notify_all();
+  writer_.join();
+  if (fd_ != STDERR_FILENO) close(fd_);
+}
+
+void Logger::SetDefault(Logger *logger) { default_logger = logger; }
+
+void Logger::Log(LogSite *site, std::string message) {
+  Logger *const logger = default_logger.load(std::memory_order_acquire);
+  if (logger) {
+    logger->Enqueue(site, std::move(message));
+    return;
+  }
+  WriteFully(STDERR_FILENO,
+             FormatMessage(std::chrono::system_clock::now(), *site, message,
+                           site->TakeSuppressed()));
+}
+
+Logger::ThreadQueue *Logger::QueueOfThisThread() {
+  thread_local uint64_t registered_with = 0;
+  thread_local ThreadQueue *queue = nullptr;
+  if (registered_with != id_) {
+    std::lock_guard<std::mutex> l(queues_mutex_);
+    queues_.emplace_back(new ThreadQueue());
+    queue = queues_.back().get();
+    registered_with = id_;
+  }
+  return queue;
+}
+
+void Logger::Enqueue(LogSite *site, std::string message) {
+  ThreadQueue *const queue = QueueOfThisThread();
+  const size_t head = queue->head.load(std::memory_order_relaxed);
+  if (head - queue->tail.load(std::memory_order_acquire) ==
+      ThreadQueue::kCapacity) {
+    ++dropped_;
+    return;
+  }
+  queue->records[head % ThreadQueue::kCapacity] = {
+      std::chrono::system_clock::now(), site, std::move(message)};
+  queue->head.store(head + 1, std::memory_order_release);
+  ++enqueued_;
+  // The writer announces to sleep before it checks enqueued_ a last time,
+  // so if it missed this message, we see it sleeping. Holding the lock
+  // makes sure it is actually waiting when notified.
+  if (writer_sleeping_.load() && writer_sleeping_.exchange(false)) {
+    const std::lock_guard<std::mutex> l(wakeup_mutex_);
+    wakeup_.notify_all();
+  }
+}
+
+void Logger::Flush() {
+  const uint64_t target = enqueued_;
+  std::unique_lock<std::mutex> l(wakeup_mutex_);
+  flush_requested_ = true;
+  wakeup_.notify_all();
+  flushed_.wait(l, [&]() { return written_ >= target || stop_; });
+}
+
+void Logger::WriterLoop() {
+  std::unique_lock<std::mutex> l(wakeup_mutex_);
+  for (;;) {
+    writer_sleeping_ = true;
+    wakeup_.wait(l, [this]() {
+      return stop_ || flush_requested_ || !writer_sleeping_ ||
+             enqueued_ > written_;
+    });
+    writer_sleeping_ = false;
+    flush_requested_ = false;
+    const bool stopping = stop_;
+    l.unlock();
+    WritePending();
+    l.lock();
+    flushed_.notify_all();
+    if (stopping) return;
+  }
+}
+
+void Logger::WritePending() {
+  std::vector<Record> batch;
+  {
+    std::lock_guard<std::mutex> l(queues_mutex_);
+    for (const auto &queue : queues_) {
+      const size_t head = queue->head.load(std::memory_order_acquire);
+      size_t tail = queue->tail.load(std::memory_order_relaxed);
+      for (/**/; tail != head; ++tail) {
+        batch.push_back(
+            std::move(queue->records[tail % ThreadQueue::kCapacity]));
+      }
+      queue->tail.store(tail, std::memory_order_release);
+    }
+  }
+
+  // Messages of different threads in the order they were logged.
+  std::stable_sort(batch.begin(), batch.end(),
+                   [](const Record &a, const Record &b) {
+                     return a.time < b.time;
+                   });
+  std::string text;
+  for (const Record &record : batch) {
+    const int suppressed = record.site->TakeSuppressed();
+    suppressed_ += suppressed;
+    text.append(
+        FormatMessage(record.time, *record.site, record.message, suppressed));
+  }
+  const uint64_t dropped = dropped_;
+  if (dropped > dropped_reported_) {
+    absl::StrAppend(&text, "Logger: ", dropped - dropped_reported_,
+                    " messages dropped; queue full.\n");
+    dropped_reported_ = dropped;
+  }
+  if (!text.empty()) WriteOut(text);
+  written_ += batch.size();
+}
+
+void Logger::WriteOut(const std::string &text) {
+  WriteFully(fd_, text);
+  if (fd_ == STDERR_FILENO) return;
+  file_bytes_ += text.size();
+  if (file_bytes_ > options_.max_file_bytes) Rotate();
+}
+
+void Logger::OpenFile() {
+  fd_ = open(options_.path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC,
+             0644);
+  if (fd_ < 0) {
+    const std::string error = absl::StrCat(
+        "Can't open log file ", options_.path, ": ", strerror(errno), "\n");
+    WriteFully(STDERR_FILENO, error);
+    fd_ = STDERR_FILENO;
+    return;
+  }
+  file_bytes_ = lseek(fd_, 0, SEEK_END);
+}
+
+void Logger::Rotate() {
+  close(fd_);
+  const std::string &path = options_.path;
+  for (int i = options_.max_files - 1; i >= 1; --i) {
+    rename(absl::StrCat(path, ".", i).c_str(),
+           absl::StrCat(path, ".", i + 1).c_str());
+  }
+  if (options_.max_files > 0) {
+    rename(path.c_str(), absl::StrCat(path, ".1").c_str());
+  } else {
+    unlink(path.c_str());
+  }
+  OpenFile();
+}
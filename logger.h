@@ -0,0 +1,166 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+
+enum class LogLevel { kDebug, kInfo, kWarning, kError };
+
+// Log sites below this level are compiled out, including the evaluation of
+// their arguments. Override with -DBARE_LSP_MIN_LOG_LEVEL=0 to get debug
+// messages.
+#ifndef BARE_LSP_MIN_LOG_LEVEL
+#define BARE_LSP_MIN_LOG_LEVEL 1
+#endif
+inline constexpr LogLevel kMinLogLevel =
+    static_cast<LogLevel>(BARE_LSP_MIN_LOG_LEVEL);
+
+// Log the concatenation of the arguments (anything absl::StrCat() takes),
+// e.g. LSP_LOG(kWarning, "Can't open ", filename);
+// Never blocks: the message is queued and written by a background thread
+// of the default Logger. Each log site only lets through a limited number
+// of messages per second; further ones are counted but not even formatted.
+#define LSP_LOG(level, ...)                                             \
+  do {                                                                  \
+    if constexpr (LogLevel::level >= kMinLogLevel) {                    \
+      static LogSite lsp_log_site(LogLevel::level, __FILE__, __LINE__); \
+      if (lsp_log_site.Admit()) {                                       \
+        Logger::Log(&lsp_log_site, absl::StrCat(__VA_ARGS__));          \
+      }                                                                 \
+    }                                                                   \
+  } while (0)
+
+// Place in the code that logs; keeps track of the rate of messages.
+class LogSite {
+ public:
+  static constexpr int kMaxPerSecond = 20;
+
+  LogSite(LogLevel level, const char *file, int line)
+      : level_(level), file_(file), line_(line) {}
+
+  // Returns true if the next message should be logged, false if there have
+  // been too many from this site within the current second.
+  bool Admit();
+
+  // Number of messages not admitted since last call.
+  int TakeSuppressed() { return suppressed_.exchange(0); }
+
+  LogLevel level() const { return level_; }
+  const char *file() const { return file_; }
+  int line() const { return line_; }
+
+ private:
+  const LogLevel level_;
+  const char *const file_;
+  const int line_;
+  std::atomic<int64_t> second_{0};
+  std::atomic<int> count_{0};
+  std::atomic<int> suppressed_{0};
+};
+
+// Writes log messages in a background thread to stderr or a file that is
+// rotated once it gets too large. Each thread that logs gets its own
+// bounded queue, so logging never waits on the output; if a queue is full,
+// messages are dropped and counted. The writer thread sleeps while there
+// is nothing to write; only a message that finds it asleep briefly takes a
+// lock to wake it up.
+class Logger {
+ public:
+  struct Options {
+    std::string path;  // Empty: write to stderr.
+    int64_t max_file_bytes = 10 << 20;
+    int max_files = 3;  // Rotated files kept as path.1 ... path.<n>
+  };
+
+  explicit Logger(const Options &options);
+  Logger(const Logger &) = delete;
+  ~Logger();  // Writes all pending messages.
+
+  // Make this the logger LSP_LOG() writes to. Without default logger,
+  // messages are written to stderr right away.
+  static void SetDefault(Logger *logger);
+
+  // Queue message of "site" to the default logger.
+  static void Log(LogSite *site, std::string message);
+
+  // Queue message to this logger.
+  void Enqueue(LogSite *site, std::string message);
+
+  // Wait until all messages queued so far are written.
+  void Flush();
+
+  uint64_t StatWritten() const { return written_; }
+  uint64_t StatDropped() const { return dropped_; }
+  uint64_t StatSuppressed() const { return suppressed_; }
+
+ private:
+  struct Record {
+    std::chrono::system_clock::time_point time;
+    LogSite *site;
+    std::string message;
+  };
+
+  // Single producer, single consumer ring.
+  struct ThreadQueue {
+    static constexpr size_t kCapacity = 1024;
+    Record records[kCapacity];
+    std::atomic<size_t> head{0};  // Advanced by the logging thread.
+    std::atomic<size_t> tail{0};  // Advanced by the writer thread.
+  };
+
+  ThreadQueue *QueueOfThisThread();
+  void WriterLoop();
+  void WritePending();
+  void WriteOut(const std::string &text);
+  void OpenFile();
+  void Rotate();
+
+  const Options options_;
+  const uint64_t id_;  // Distinguish loggers in thread local registration.
+
+  std::mutex queues_mutex_;  // Only for registration of new queues.
+  std::vector<std::unique_ptr<ThreadQueue>> queues_;
+
+  std::atomic<uint64_t> enqueued_{0};
+  std::atomic<uint64_t> written_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> suppressed_{0};
+
+  // Only accessed by the writer thread.
+  int fd_ = -1;
+  int64_t file_bytes_ = 0;
+  uint64_t dropped_reported_ = 0;
+
+  std::mutex wakeup_mutex_;
+  std::condition_variable wakeup_;
+  std::atomic<bool> writer_sleeping_{false};
+  std::condition_variable flushed_;
+  bool flush_requested_ = false;
+  bool stop_ = false;
+  std::thread writer_;
+};
+
+#endif  // LOGGER_H
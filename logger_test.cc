@@ -0,0 +1,152 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "logger.h"
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <absl/strings/match.h>
+#include <absl/strings/str_split.h>
+
+#include "gtest/gtest.h"
+
+namespace fs = std::filesystem;
+
+static std::string ReadFile(const fs::path &path) {
+  std::ifstream file(path);
+  std::stringstream content;
+  content << file.rdbuf();
+  return content.str();
+}
+
+class LoggerTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    char dir_template[] = "/tmp/logger-test-XXXXXX";
+    dir_ = mkdtemp(dir_template);
+  }
+  void TearDown() override { fs::remove_all(dir_); }
+
+  fs::path dir_;
+};
+
+TEST_F(LoggerTest, MessagesAreFormattedWithSite) {
+  const std::string path = dir_ / "log";
+  {
+    Logger logger({.path = path});
+    LogSite site(LogLevel::kWarning, "/some/dir/file.cc", 42);
+    logger.Enqueue(&site, "Hello");
+  }  // Written at the latest on destruction.
+  const std::string content = ReadFile(path);
+  EXPECT_TRUE(absl::StartsWith(content, "W")) << content;
+  EXPECT_TRUE(absl::EndsWith(content, " file.cc:42] Hello\n")) << content;
+}
+
+TEST_F(LoggerTest, MessagesAreWrittenWithoutFlush) {
+  Logger logger({.path = dir_ / "log"});
+  LogSite site(LogLevel::kWarning, "file.cc", 42);
+  for (uint64_t i = 1; i <= 3; ++i) {  // Writer goes idle in between.
+    logger.Enqueue(&site, "Hello");
+    const auto give_up =
+        std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (logger.StatWritten() < i &&
+           std::chrono::steady_clock::now() < give_up) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(logger.StatWritten(), i);
+  }
+}
+
+TEST_F(LoggerTest, FilesAreRotated) {
+  const std::string path = dir_ / "log";
+  Logger logger({.path = path, .max_file_bytes = 500, .max_files = 2});
+  LogSite site(LogLevel::kInfo, "file.cc", 1);
+  for (int i = 0; i < 100; ++i) {
+    logger.Enqueue(&site, absl::StrCat("Message ", i));
+    if (i % 10 == 9) logger.Flush();  // Rotation happens per batch written.
+  }
+  logger.Flush();
+  EXPECT_EQ(logger.StatWritten(), 100);
+
+  EXPECT_TRUE(fs::exists(path + ".1"));
+  EXPECT_TRUE(fs::exists(path + ".2"));
+  EXPECT_FALSE(fs::exists(path + ".3"));
+  EXPECT_LE(fs::file_size(path + ".1"), 1000);
+  const std::string newest = ReadFile(path).empty() ? ReadFile(path + ".1")
+                                                    : ReadFile(path);
+  EXPECT_TRUE(absl::StrContains(newest, "Message 99\n")) << newest;
+}
+
+TEST_F(LoggerTest, MessagesOfAllThreadsAreWritten) {
+  const std::string path = dir_ / "log";
+  Logger logger({.path = path});
+  LogSite site(LogLevel::kInfo, "file.cc", 1);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      for (int i = 0; i < 100; ++i) {
+        logger.Enqueue(&site, absl::StrCat("Thread ", t, " ", i));
+      }
+    });
+  }
+  for (auto &t : threads) t.join();
+  logger.Flush();
+
+  EXPECT_EQ(logger.StatWritten(), 400);
+  EXPECT_EQ(logger.StatDropped(), 0);
+  const std::vector<absl::string_view> lines =
+      absl::StrSplit(ReadFile(path), '\n', absl::SkipEmpty());
+  EXPECT_EQ(lines.size(), 400);
+}
+
+TEST(LogSiteTest, RepeatedMessagesAreRateLimited) {
+  LogSite site(LogLevel::kError, "file.cc", 1);
+  int admitted = 0;
+  for (int i = 0; i < 1000; ++i) {
+    if (site.Admit()) ++admitted;
+  }
+  // Might have crossed into the next second while looping.
+  EXPECT_GE(admitted, LogSite::kMaxPerSecond);
+  EXPECT_LE(admitted, 2 * LogSite::kMaxPerSecond);
+  EXPECT_EQ(site.TakeSuppressed(), 1000 - admitted);
+  EXPECT_EQ(site.TakeSuppressed(), 0);
+}
+
+TEST_F(LoggerTest, DisabledLevelsCostNothing) {
+  const std::string path = dir_ / "log";
+  Logger logger({.path = path});
+  Logger::SetDefault(&logger);
+  int evaluated = 0;
+  const auto expensive = [&]() {
+    ++evaluated;
+    return "value";
+  };
+  LSP_LOG(kDebug, "Debug ", expensive());
+  LSP_LOG(kInfo, "Info ", expensive());
+  logger.Flush();
+  Logger::SetDefault(nullptr);
+
+  EXPECT_EQ(evaluated, 1);
+  const std::string content = ReadFile(path);
+  EXPECT_FALSE(absl::StrContains(content, "Debug")) << content;
+  EXPECT_TRUE(absl::StrContains(content, "] Info value\n")) << content;
+}
@@ -0,0 +1,538 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Synthetic load for lsp-server: opens a number of documents, then types
+// into them at a fixed rate, with occasional multi-cursor edits and bursts
+// of hover/highlight requests as the cursor moves. Reports the achieved
+// throughput and latency percentiles per method.
+//
+// Events follow a fixed schedule, and latency is measured from the time an
+// event was scheduled, not when we got around to sending it; a server that
+// falls behind can't hide it by slowing us down. The same --seed gives the
+// same sequence of messages.
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+#include <nlohmann/json.hpp>
+
+#include "message-stream-splitter.h"
+#include "shared-memory-transport.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct LoadOptions {
+  const char *server = "./lsp-server";
+  std::vector<std::string> server_args;
+  bool ndjson = false;
+  bool shared_memory = false;  // Instead of pipes.
+  int documents = 10;
+  int document_lines = 1000;
+  double duration_seconds = 10;
+  double typing_rate = 20;         // Keystrokes per second.
+  double multi_cursor_ratio = 0.1;  // Keystrokes that are multi-cursor.
+  int cursors = 3;
+  double move_ratio = 0.2;  // Keystrokes followed by moving the cursor.
+  int burst = 5;            // Positions visited in a cursor move.
+  unsigned seed = 1;
+};
+
+// Client end of the connection to the server. Requests are sent from the
+// load thread, responses are picked up by a reader thread. Messages go
+// through the pipes or, if given, the "shared_memory".
+class ServerConnection {
+ public:
+  ServerConnection(int to_server, int from_server, bool ndjson,
+                   std::unique_ptr<SharedMemoryTransport> shared_memory)
+      : to_server_(to_server),
+        from_server_(from_server),
+        ndjson_(ndjson),
+        shared_memory_(std::move(shared_memory)),
+        splitter_(1 << 24,
+                  ndjson ? MessageStreamSplitter::Framing::kNewlineDelimited
+                         : MessageStreamSplitter::Framing::kContentLength) {
+    splitter_.SetMessageProcessor(
+        [this](absl::string_view, absl::string_view body) {
+          HandleMessage(body);
+        });
+    reader_ = std::thread([this]() { ReadLoop(); });
+  }
+
+  ~ServerConnection() {
+    if (shared_memory_) shared_memory_->CloseWrite().IgnoreError();
+    close(to_server_);  // Server sees EOF and exits, so reader finishes.
+    reader_.join();
+  }
+
+  // Send request; its latency is measured from "scheduled".
+  bool SendRequest(const std::string &method, const nlohmann::json &params,
+                   Clock::time_point scheduled) {
+    const int id = next_id_++;
+    {
+      const std::lock_guard<std::mutex> l(mutex_);
+      outstanding_[id] = {method, scheduled};
+    }
+    return Send({{"jsonrpc", "2.0"},
+                 {"id", id},
+                 {"method", method},
+                 {"params", params}});
+  }
+
+  bool SendNotification(const std::string &method,
+                        const nlohmann::json &params) {
+    return Send({{"jsonrpc", "2.0"}, {"method", method}, {"params", params}});
+  }
+
+  // Wait until all requests are answered. Returns false on timeout.
+  bool WaitForResponses(Clock::duration timeout) {
+    std::unique_lock<std::mutex> l(mutex_);
+    return all_answered_.wait_for(
+        l, timeout, [this]() { return outstanding_.empty() || eof_; });
+  }
+
+  // Latencies in seconds of all answered requests by method.
+  std::map<std::string, std::vector<double>> latencies() const {
+    const std::lock_guard<std::mutex> l(mutex_);
+    return latencies_;
+  }
+  int64_t notifications_received() const {
+    const std::lock_guard<std::mutex> l(mutex_);
+    return notifications_received_;
+  }
+  int64_t errors_received() const {
+    const std::lock_guard<std::mutex> l(mutex_);
+    return errors_received_;
+  }
+  int64_t bytes_sent() const { return bytes_sent_; }
+
+ private:
+  struct Outstanding {
+    std::string method;
+    Clock::time_point scheduled;
+  };
+
+  bool Send(const nlohmann::json &message) {
+    std::string bytes = message.dump();
+    if (ndjson_) {
+      bytes.append("\n");
+    } else {
+      bytes = absl::StrCat("Content-Length: ", bytes.size(), "\r\n\r\n",
+                           bytes);
+    }
+    bytes_sent_ += bytes.size();
+    if (shared_memory_) return shared_memory_->Write(bytes).ok();
+    for (absl::string_view remaining = bytes; !remaining.empty();) {
+      const ssize_t w = write(to_server_, remaining.data(), remaining.size());
+      if (w < 0) return false;
+      remaining.remove_prefix(w);
+    }
+    return true;
+  }
+
+  void ReadLoop() {
+    absl::Status status;
+    do {
+      status = splitter_.PullFrom([this](char *buf, int size) {
+        return shared_memory_ ? shared_memory_->Read(buf, size)
+                              : read(from_server_, buf, size);
+      });
+    } while (status.ok());
+    const std::lock_guard<std::mutex> l(mutex_);
+    eof_ = true;
+    all_answered_.notify_all();
+  }
+
+  void HandleMessage(absl::string_view body) {
+    const Clock::time_point now = Clock::now();
+    const nlohmann::json message = nlohmann::json::parse(body, nullptr, false);
+    const std::lock_guard<std::mutex> l(mutex_);
+    const auto id = message.find("id");
+    if (message.contains("method") || id == message.end() ||
+        !id->is_number()) {
+      ++notifications_received_;
+      return;
+    }
+    const auto found = outstanding_.find(id->get<int>());
+    if (found == outstanding_.end()) return;
+    if (message.contains("error")) ++errors_received_;
+    latencies_[found->second.method].push_back(
+        std::chrono::duration<double>(now - found->second.scheduled).count());
+    outstanding_.erase(found);
+    if (outstanding_.empty()) all_answered_.notify_all();
+  }
+
+  const int to_server_;
+  const int from_server_;
+  const bool ndjson_;
+  const std::unique_ptr<SharedMemoryTransport> shared_memory_;
+  MessageStreamSplitter splitter_;  // Only used by the reader thread.
+  int next_id_ = 1;
+  int64_t bytes_sent_ = 0;
+  std::thread reader_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable all_answered_;
+  std::map<int, Outstanding> outstanding_;
+  std::map<std::string, std::vector<double>> latencies_;
+  int64_t notifications_received_ = 0;
+  int64_t errors_received_ = 0;
+  bool eof_ = false;
+};
+
+// Start server with its stdin/stdout connected to pipes. With
+// "shared_memory", messages go through that instead; the stdin pipe only
+// tells the server when we are gone.
+static pid_t StartServer(const LoadOptions &options,
+                         SharedMemoryTransport *shared_memory, int *to_server,
+                         int *from_server) {
+  int in_pipe[2];
+  int out_pipe[2];
+  if (pipe(in_pipe) != 0 || pipe(out_pipe) != 0) return -1;
+  const pid_t pid = fork();
+  if (pid < 0) return -1;
+  if (pid == 0) {
+    dup2(in_pipe[0], STDIN_FILENO);
+    dup2(out_pipe[1], STDOUT_FILENO);
+    close(in_pipe[0]);
+    close(in_pipe[1]);
+    close(out_pipe[0]);
+    close(out_pipe[1]);
+    std::vector<char *> argv = {const_cast<char *>(options.server)};
+    for (const std::string &arg : options.server_args) {
+      argv.push_back(const_cast<char *>(arg.c_str()));
+    }
+    if (options.ndjson) argv.push_back(const_cast<char *>("--ndjson"));
+    std::string channel;
+    if (shared_memory) {
+      shared_memory->KeepChannelOpenOnExec();
+      channel = shared_memory->channel();
+      argv.push_back(const_cast<char *>("--shared-memory"));
+      argv.push_back(const_cast<char *>(channel.c_str()));
+    }
+    argv.push_back(nullptr);
+    execv(options.server, argv.data());
+    perror(options.server);
+    _exit(1);
+  }
+  close(in_pipe[0]);
+  close(out_pipe[1]);
+  *to_server = in_pipe[1];
+  *from_server = out_pipe[0];
+  return pid;
+}
+
+// The document as we expect the server to see it, so that edits and cursor
+// positions stay within the text.
+struct SimulatedDocument {
+  std::string uri;
+  std::vector<std::string> lines;
+  int version = 1;
+  int cursor_line = 0;
+  int cursor_column = 0;
+
+  std::string Text() const {
+    std::string result;
+    for (const std::string &line : lines) result.append(line).append("\n");
+    return result;
+  }
+};
+
+static std::string RandomLine(std::mt19937 *rnd) {
+  static constexpr const char *kWords[] = {
+      "hello", "world", "wrong", "quick", "brown", "fox",   "jumps",
+      "over",  "lazy",  "dog",   "lorem", "ipsum", "dolor", "sit"};
+  static constexpr int kWordCount = sizeof(kWords) / sizeof(kWords[0]);
+  std::string line;
+  const int words = (*rnd)() % 12;
+  for (int i = 0; i < words; ++i) {
+    if (i > 0) line.append(" ");
+    line.append(kWords[(*rnd)() % kWordCount]);
+  }
+  return line;
+}
+
+static nlohmann::json Position(int line, int column) {
+  return {{"line", line}, {"character", column}};
+}
+
+class LoadGenerator {
+ public:
+  LoadGenerator(const LoadOptions &options, ServerConnection *connection)
+      : options_(options), connection_(connection), rnd_(options.seed) {
+    for (int d = 0; d < options.documents; ++d) {
+      SimulatedDocument &doc = documents_.emplace_back();
+      doc.uri = absl::StrCat("file:///load/document-", d, ".txt");
+      for (int i = 0; i < options.document_lines; ++i) {
+        doc.lines.push_back(RandomLine(&rnd_));
+      }
+    }
+  }
+
+  // Returns false if the connection broke.
+  bool Initialize() {
+    const nlohmann::json no_params = nlohmann::json::object();
+    if (!connection_->SendRequest("initialize", {{"capabilities", no_params}},
+                                  Clock::now()) ||
+        !connection_->SendNotification("initialized", no_params)) {
+      return false;
+    }
+    for (const SimulatedDocument &doc : documents_) {
+      if (!connection_->SendNotification(
+              "textDocument/didOpen",
+              {{"textDocument",
+                {{"uri", doc.uri},
+                 {"languageId", "text"},
+                 {"version", doc.version},
+                 {"text", doc.Text()}}}})) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Run the keystroke schedule for the configured duration. Returns
+  // the number of keystrokes sent.
+  int64_t Run() {
+    const Clock::time_point start = Clock::now();
+    const auto interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(1.0 / options_.typing_rate));
+    const Clock::time_point end =
+        start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(options_.duration_seconds));
+    std::uniform_real_distribution<double> chance(0, 1);
+    int64_t keystrokes = 0;
+    for (Clock::time_point scheduled = start; scheduled < end;
+         scheduled += interval) {
+      std::this_thread::sleep_until(scheduled);
+      const int cursors =
+          chance(rnd_) < options_.multi_cursor_ratio ? options_.cursors : 1;
+      if (!TypeCharacter(cursors)) break;
+      ++keystrokes;
+      if (chance(rnd_) < options_.move_ratio && !MoveCursor(scheduled)) break;
+    }
+    return keystrokes;
+  }
+
+ private:
+  // Insert a character at the cursor and, for multi-cursor edits, the
+  // same column of the following lines.
+  bool TypeCharacter(int cursors) {
+    SimulatedDocument &doc = documents_[active_document_];
+    static constexpr char kTyped[] = "abcdefghijklmnopqrstuvwxyz    ";
+    const std::string text(1, kTyped[rnd_() % (sizeof(kTyped) - 1)]);
+    nlohmann::json changes = nlohmann::json::array();
+    for (int c = 0; c < cursors; ++c) {
+      const int line = doc.cursor_line + c;
+      if (line >= static_cast<int>(doc.lines.size())) break;
+      const int column =
+          std::min<int>(doc.cursor_column, doc.lines[line].size());
+      doc.lines[line].insert(column, text);
+      changes.push_back(
+          {{"range",
+            {{"start", Position(line, column)},
+             {"end", Position(line, column)}}},
+           {"text", text}});
+    }
+    ++doc.cursor_column;
+    return connection_->SendNotification(
+        "textDocument/didChange",
+        {{"textDocument", {{"uri", doc.uri}, {"version", ++doc.version}}},
+         {"contentChanges", changes}});
+  }
+
+  // Move the cursor in a few steps, sometimes to another document; an
+  // editor asks for hover and highlight at each position.
+  bool MoveCursor(Clock::time_point scheduled) {
+    if (rnd_() % 10 == 0) active_document_ = rnd_() % documents_.size();
+    SimulatedDocument &doc = documents_[active_document_];
+    for (int i = 0; i < options_.burst; ++i) {
+      const int line_count = doc.lines.size();
+      doc.cursor_line = std::clamp<int>(
+          doc.cursor_line + static_cast<int>(rnd_() % 21) - 10, 0,
+          line_count - 1);
+      const int length = doc.lines[doc.cursor_line].size();
+      doc.cursor_column = length ? rnd_() % length : 0;
+      const nlohmann::json params = {
+          {"textDocument", {{"uri", doc.uri}}},
+          {"position", Position(doc.cursor_line, doc.cursor_column)}};
+      if (!connection_->SendRequest("textDocument/hover", params, scheduled) ||
+          !connection_->SendRequest("textDocument/documentHighlight", params,
+                                    scheduled)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const LoadOptions &options_;
+  ServerConnection *const connection_;
+  std::mt19937 rnd_;
+  std::vector<SimulatedDocument> documents_;
+  size_t active_document_ = 0;
+};
+
+// Value below which the fraction "p" of the sorted values are.
+static double Percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) return 0;
+  const size_t rank = std::ceil(p * sorted.size());
+  return sorted[std::max<size_t>(rank, 1) - 1];
+}
+
+static void PrintReport(const ServerConnection &connection,
+                        int64_t keystrokes, double seconds) {
+  fprintf(stderr, "%ld keystrokes in %.2fs (%.1f/s), %.1f MiB sent, ",
+          keystrokes, seconds, keystrokes / seconds,
+          connection.bytes_sent() / (1024.0 * 1024));
+  fprintf(stderr, "%ld notifications and %ld errors received.\n",
+          connection.notifications_received(), connection.errors_received());
+  fprintf(stderr, "%-32s %8s %9s %9s %9s %9s\n", "Method", "Count", "QPS",
+          "p50 ms", "p99 ms", "p999 ms");
+  for (auto &[method, latencies] : connection.latencies()) {
+    std::sort(latencies.begin(), latencies.end());
+    fprintf(stderr, "%-32s %8zu %9.1f %9.3f %9.3f %9.3f\n", method.c_str(),
+            latencies.size(), latencies.size() / seconds,
+            1e3 * Percentile(latencies, 0.5), 1e3 * Percentile(latencies, 0.99),
+            1e3 * Percentile(latencies, 0.999));
+  }
+}
+
+static int usage(const char *progname) {
+  const LoadOptions defaults;
+  fprintf(stderr,
+          "Usage: %s [options] [-- <server-options>]\n"
+          "Options:\n"
+          "  --server <binary>     : Server to start. Default %s\n"
+          "  --ndjson              : Talk newline-delimited JSON.\n"
+          "  --shared-memory       : Talk through shared memory instead\n"
+          "                          of pipes.\n"
+          "  --documents <n>       : Documents opened. Default %d\n"
+          "  --lines <n>           : Lines per document. Default %d\n"
+          "  --duration <seconds>  : Duration of the load. Default %.0f\n"
+          "  --typing-rate <n>     : Keystrokes per second. Default %.0f\n"
+          "  --multi-cursor <ratio>: Keystrokes with multiple cursors.\n"
+          "                          Default %.2f\n"
+          "  --cursors <n>         : Cursors of these. Default %d\n"
+          "  --move <ratio>        : Keystrokes followed by moving the\n"
+          "                          cursor. Default %.2f\n"
+          "  --burst <n>           : Hover and highlight requests per move.\n"
+          "                          Default %d\n"
+          "  --seed <n>            : Seed of the random sequence. Default %u\n",
+          progname, defaults.server, defaults.documents,
+          defaults.document_lines, defaults.duration_seconds,
+          defaults.typing_rate, defaults.multi_cursor_ratio, defaults.cursors,
+          defaults.move_ratio, defaults.burst, defaults.seed);
+  return 1;
+}
+
+int main(int argc, char *argv[]) {
+  LoadOptions options;
+  for (int i = 1; i < argc; ++i) {
+    const absl::string_view arg = argv[i];
+    bool ok = true;
+    if (arg == "--") {
+      options.server_args.assign(argv + i + 1, argv + argc);
+      break;
+    } else if (arg == "--ndjson") {
+      options.ndjson = true;
+    } else if (arg == "--shared-memory") {
+      options.shared_memory = true;
+    } else if (i + 1 >= argc) {
+      return usage(argv[0]);
+    } else if (arg == "--server") {
+      options.server = argv[++i];
+    } else if (arg == "--documents") {
+      ok = absl::SimpleAtoi(argv[++i], &options.documents) &&
+           options.documents > 0;
+    } else if (arg == "--lines") {
+      ok = absl::SimpleAtoi(argv[++i], &options.document_lines) &&
+           options.document_lines > 0;
+    } else if (arg == "--duration") {
+      ok = absl::SimpleAtod(argv[++i], &options.duration_seconds);
+    } else if (arg == "--typing-rate") {
+      ok = absl::SimpleAtod(argv[++i], &options.typing_rate) &&
+           options.typing_rate > 0;
+    } else if (arg == "--multi-cursor") {
+      ok = absl::SimpleAtod(argv[++i], &options.multi_cursor_ratio);
+    } else if (arg == "--cursors") {
+      ok = absl::SimpleAtoi(argv[++i], &options.cursors);
+    } else if (arg == "--move") {
+      ok = absl::SimpleAtod(argv[++i], &options.move_ratio);
+    } else if (arg == "--burst") {
+      ok = absl::SimpleAtoi(argv[++i], &options.burst);
+    } else if (arg == "--seed") {
+      ok = absl::SimpleAtoi(argv[++i], &options.seed);
+    } else {
+      ok = false;
+    }
+    if (!ok) return usage(argv[0]);
+  }
+
+  signal(SIGPIPE, SIG_IGN);  // Server going away is reported on write.
+  std::unique_ptr<SharedMemoryTransport> shared_memory;
+  if (options.shared_memory) {
+    if (auto status = SharedMemoryTransport::Create(&shared_memory);
+        !status.ok()) {
+      fprintf(stderr, "%s\n", std::string(status.message()).c_str());
+      return 1;
+    }
+  }
+  int to_server;
+  int from_server;
+  const pid_t server_pid =
+      StartServer(options, shared_memory.get(), &to_server, &from_server);
+  if (server_pid < 0) {
+    perror("Starting server");
+    return 1;
+  }
+
+  int64_t keystrokes = 0;
+  double seconds = 0;
+  {
+    ServerConnection connection(to_server, from_server, options.ndjson,
+                                std::move(shared_memory));
+    LoadGenerator generator(options, &connection);
+    if (generator.Initialize()) {
+      const Clock::time_point start = Clock::now();
+      keystrokes = generator.Run();
+      if (!connection.WaitForResponses(std::chrono::seconds(30))) {
+        fprintf(stderr, "Timeout waiting for responses.\n");
+      }
+      seconds = std::chrono::duration<double>(Clock::now() - start).count();
+      connection.SendRequest("shutdown", nullptr, Clock::now());
+      connection.WaitForResponses(std::chrono::seconds(5));
+      connection.SendNotification("exit", nullptr);
+    }
+    PrintReport(connection, keystrokes, seconds);
+  }
+
+  int status = 0;
+  waitpid(server_pid, &status, 0);
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : 1;
+}
@@ -14,13 +14,39 @@
 
 #include "lsp-text-buffer.h"
 
+#include <algorithm>
+
 EditTextBuffer::EditTextBuffer(absl::string_view initial_text) {
   ReplaceDocument(initial_text);
 }
 
+void EditTextBuffer::ReplaceContent(absl::string_view content) {
+  ReplaceDocument(content);
+}
+
 void EditTextBuffer::ApplyChanges(
     const std::vector<TextDocumentContentChangeEvent> &cc) {
+  const bool own_batch = !batching_changes_;
+  BeginChanges();
   for (const auto &c : cc) ApplyChange(c);
+  if (own_batch) EndChanges();
+}
+
+void EditTextBuffer::EndChanges() {
+  batching_changes_ = false;
+  if (pending_changes_.empty()) return;
+  const ChangeBatch batch = {.version = last_global_version(),
+                             .changes = std::move(pending_changes_)};
+  pending_changes_.clear();
+  for (const ChangeObserverFun &observer : change_observers_) {
+    observer(*this, batch);
+  }
+}
+
+void EditTextBuffer::RecordChange(const Change &change) {
+  if (change_observers_.empty()) return;
+  pending_changes_.push_back(change);
+  if (!batching_changes_) EndChanges();
 }
 
 // Apply a LSP edit operatation.
@@ -31,12 +57,26 @@ bool EditTextBuffer::ApplyChange(const TextDocumentContentChangeEvent &c) {
   }
 
   if (c.range.end.line >= static_cast<int>(lines_.size())) {
-    lines_.emplace_back(new std::string(""));
+    lines_.emplace_back(new Line(""));
+    RecordChange({.first_line = static_cast<int>(lines_.size()) - 1,
+                  .lines_removed = 0,
+                  .lines_inserted = 1,
+                  .bytes_removed = 0,
+                  .bytes_inserted = 0});
   }
 
   if (c.range.start.line == c.range.end.line &&
       c.text.find_first_of('\n') == std::string::npos) {
-    return LineEdit(c, lines_[c.range.start.line].get());  // simple case.
+    Line *const line = lines_[c.range.start.line].get();  // simple case.
+    const int64_t bytes_before = line->text_.length();
+    if (!LineEdit(c, line)) return false;
+    const int64_t bytes_after = line->text_.length();
+    RecordChange({.first_line = c.range.start.line,
+                  .lines_removed = 1,
+                  .lines_inserted = 1,
+                  .bytes_removed = bytes_before,
+                  .bytes_inserted = bytes_after});
+    return true;
   } else {
     return MultiLineEdit(c);
   }
@@ -44,30 +84,46 @@ bool EditTextBuffer::ApplyChange(const TextDocumentContentChangeEvent &c) {
 
 /*static*/ EditTextBuffer::LineVector EditTextBuffer::GenerateLines(
     absl::string_view content) {
+  // Documents can be huge, so avoid re-allocations while building up lines:
+  // size the vector upfront and allocate each line exactly once.
   LineVector result;
+  result.reserve(std::count(content.begin(), content.end(), '\n') + 1);
   for (const absl::string_view s : absl::StrSplit(content, '\n')) {
-    result.emplace_back(new std::string(s));
-    result.back()->append("\n");
+    auto line = std::make_shared<Line>("");
+    line->text_.reserve(s.length() + 1);
+    line->text_.append(s.data(), s.length()).append("\n");
+    result.emplace_back(std::move(line));
   }
 
   // Files that do or do not have a newline file-ending: represent correctly.
   if (!content.empty() && content.back() == '\n') {
     result.pop_back();
   } else {
-    result.back()->pop_back();
+    result.back()->text_.pop_back();
   }
 
   return result;
 }
 
 void EditTextBuffer::ReplaceDocument(absl::string_view content) {
+  const int lines_before = lines_.size();
+  const int64_t bytes_before = document_length_;
   document_length_ = content.length();
-  if (content.empty()) return;
-  lines_ = GenerateLines(content);
+  if (content.empty()) {
+    lines_.clear();  // Not even an empty line.
+  } else {
+    lines_ = GenerateLines(content);
+  }
+  RecordChange({.first_line = 0,
+                .lines_removed = lines_before,
+                .lines_inserted = static_cast<int>(lines_.size()),
+                .bytes_removed = bytes_before,
+                .bytes_inserted = document_length_});
 }
 
 bool EditTextBuffer::LineEdit(const TextDocumentContentChangeEvent &c,
-                              std::string *str) {
+                              Line *line) {
+  std::string *const str = &line->text_;
   int end_char = c.range.end.character;
 
   const int str_end = str->back() == '\n' ? str->length() - 1 : str->length();
@@ -79,15 +135,16 @@ bool EditTextBuffer::LineEdit(const TextDocumentContentChangeEvent &c,
   const auto before = assembly.substr(0, c.range.start.character);
   const auto after = assembly.substr(end_char);
   *str = absl::StrCat(before, c.text, after);
+  line->InvalidateTokens();
   document_length_ += str->length();
   return true;
 }
 
 bool EditTextBuffer::MultiLineEdit(const TextDocumentContentChangeEvent &c) {
-  const absl::string_view start_line = *lines_[c.range.start.line];
+  const absl::string_view start_line = lines_[c.range.start.line]->text_;
   const auto before = start_line.substr(0, c.range.start.character);
 
-  const absl::string_view end_line = *lines_[c.range.end.line];
+  const absl::string_view end_line = lines_[c.range.end.line]->text_;
   const auto after = end_line.substr(c.range.end.character);
 
   // Assemble the full content to replace the range of lines with including
@@ -98,11 +155,12 @@ bool EditTextBuffer::MultiLineEdit(const TextDocumentContentChangeEvent &c) {
   // content and add all in the new content.
   const auto before_begin = lines_.begin() + c.range.start.line;
   const auto before_end = lines_.begin() + c.range.end.line + 1;
-  document_length_ -=
-      std::accumulate(before_begin, before_end, 0,
-                      [](int sum, const LineVector::value_type &line) {
-                        return sum + line->length();
+  const int64_t bytes_removed =
+      std::accumulate(before_begin, before_end, int64_t{0},
+                      [](int64_t sum, const LineVector::value_type &line) {
+                        return sum + line->text_.length();
                       });
+  document_length_ -= bytes_removed;
   document_length_ += new_content.length();
 
   // The new content might include newlines, yielding multiple single lines.
@@ -112,6 +170,11 @@ bool EditTextBuffer::MultiLineEdit(const TextDocumentContentChangeEvent &c) {
   lines_.erase(before_begin, before_end);
   lines_.insert(lines_.begin() + c.range.start.line, regenerated_lines.begin(),
                 regenerated_lines.end());
+  RecordChange({.first_line = c.range.start.line,
+                .lines_removed = c.range.end.line - c.range.start.line + 1,
+                .lines_inserted = static_cast<int>(regenerated_lines.size()),
+                .bytes_removed = bytes_removed,
+                .bytes_inserted = static_cast<int64_t>(new_content.length())});
   return true;
 }
 
@@ -119,55 +182,283 @@ BufferCollection::BufferCollection(JsonRpcDispatcher *dispatcher) {
   // Route notification events from the dispatcher to the buffer collection
   // for them to keep track of what buffers are open and all of their edits
   // they receive.
+  //
+  // Open and change events can carry the full document text, so these are
+  // received as plain json to read the text right where it was parsed instead
+  // of copying it into the typed parameter structs first.
   dispatcher->AddNotificationHandler(
       "textDocument/didOpen",
-      [this](const DidOpenTextDocumentParams &p) { didOpenEvent(p); });
+      [this](const nlohmann::json &p) { didOpenJsonEvent(p); });
   dispatcher->AddNotificationHandler(
       "textDocument/didClose",
       [this](const DidCloseTextDocumentParams &p) { didCloseEvent(p); });
   dispatcher->AddNotificationHandler(
       "textDocument/didChange",
-      [this](const DidChangeTextDocumentParams &p) { didChangeEvent(p); });
+      [this](const nlohmann::json &p) { didChangeJsonEvent(p); });
 }
 
 void BufferCollection::didOpenEvent(const DidOpenTextDocumentParams &o) {
-  auto inserted = buffers_.insert({o.textDocument.uri, nullptr});
-  if (inserted.second) {
-    inserted.first->second.reset(new EditTextBuffer(o.textDocument.text));
-    inserted.first->second->set_last_global_version(++global_version_);
+  OpenBuffer(o.textDocument.uri, o.textDocument.text);
+}
+
+// Shard and bucket within the shard are taken from different bits.
+static size_t UriHash(const std::string &uri) {
+  return std::hash<std::string>()(uri);
+}
+
+BufferCollection::Shard &BufferCollection::ShardFor(const std::string &uri) {
+  return shards_[UriHash(uri) % kShards];
+}
+
+std::shared_ptr<EditTextBuffer> BufferCollection::Lookup(
+    const std::string &uri) const {
+  const size_t hash = UriHash(uri);
+  const Shard &shard = shards_[hash % kShards];
+  const std::shared_ptr<const Bucket> bucket =
+      std::atomic_load(&shard.buckets[hash / kShards % kBucketsPerShard]);
+  if (!bucket) return nullptr;
+  auto found = bucket->find(uri);
+  return found == bucket->end() ? nullptr : found->second;
+}
+
+/*static*/ void BufferCollection::Publish(
+    Shard *shard, const std::string &uri,
+    std::shared_ptr<EditTextBuffer> buffer) {
+  // Copy on write; only happens on open and close, and only copies the
+  // bucket the uri is in.
+  std::shared_ptr<const Bucket> &slot =
+      shard->buckets[UriHash(uri) / kShards % kBucketsPerShard];
+  const std::shared_ptr<const Bucket> current = std::atomic_load(&slot);
+  auto updated = current ? std::make_shared<Bucket>(*current)
+                         : std::make_shared<Bucket>();
+  if (buffer) {
+    (*updated)[uri] = std::move(buffer);
+  } else {
+    updated->erase(uri);
   }
+  std::atomic_store(&slot, std::shared_ptr<const Bucket>(std::move(updated)));
+}
+
+std::shared_ptr<const EditTextBuffer> BufferCollection::findBufferByUri(
+    const std::string &uri) const {
+  return Lookup(uri);
+}
+
+size_t BufferCollection::documents_open() const {
+  size_t result = 0;
+  MapAllBuffers([&](const std::string &, const EditTextBuffer &) {
+    ++result;
+  });
+  return result;
+}
+
+void BufferCollection::OpenBuffer(const std::string &uri,
+                                  absl::string_view text) {
+  Shard &shard = ShardFor(uri);
+  FeatureTier tier;
+  {
+    const std::lock_guard<std::mutex> l(shard.write_mutex);
+    if (Lookup(uri)) return;
+    auto buffer = std::make_shared<EditTextBuffer>(text);
+    ObserveChanges(uri, buffer.get());
+    const bool tier_changed = UpdateTier(&shard, uri, *buffer, &tier);
+    EditTextBuffer *const published = buffer.get();
+    PublishNextVersion(published, [&]() {  // Findable once version is out.
+      Publish(&shard, uri, std::move(buffer));
+    });
+    PublishWholeBuffer(uri, *published, true);
+    if (!tier_changed) return;
+  }
+  NotifyTierChange(uri, tier);
+}
+
+void BufferCollection::PublishNextVersion(
+    EditTextBuffer *buffer, const std::function<void()> &publish) {
+  // Writers of different shards run concurrently, but versions have to
+  // become visible in order: a reader that sees global_version() N and
+  // remembers it must have been able to find all buffers up to version N.
+  const std::lock_guard<std::mutex> l(version_mutex_);
+  const int64_t version = global_version_ + 1;
+  buffer->set_last_global_version(version);
+  if (publish) publish();
+  global_version_ = version;
+}
+
+void BufferCollection::EditBuffer(
+    const std::string &uri,
+    const std::function<void(EditTextBuffer *)> &edit) {
+  Shard &shard = ShardFor(uri);
+  FeatureTier tier;
+  {
+    const std::lock_guard<std::mutex> l(shard.write_mutex);
+    const std::shared_ptr<EditTextBuffer> buffer = Lookup(uri);
+    if (!buffer) return;
+    buffer->BeginChanges();  // Observers get all changes of the event.
+    edit(buffer.get());
+    PublishNextVersion(buffer.get(), nullptr);
+    buffer->EndChanges();
+    if (!UpdateTier(&shard, uri, *buffer, &tier)) return;
+  }
+  NotifyTierChange(uri, tier);
+}
+
+void BufferCollection::didOpenJsonEvent(const nlohmann::json &params) {
+  const nlohmann::json &document = params.at("textDocument");
+  OpenBuffer(document.at("uri").get_ref<const std::string &>(),
+             document.at("text").get_ref<const std::string &>());
+}
+
+void BufferCollection::didChangeJsonEvent(const nlohmann::json &params) {
+  const std::string &uri =
+      params.at("textDocument").at("uri").get_ref<const std::string &>();
+  EditBuffer(uri, [&params](EditTextBuffer *buffer) {
+    for (const nlohmann::json &change : params.at("contentChanges")) {
+      if (change.find("range") == change.end()) {
+        // Full document sync: use text directly from the json.
+        buffer->ReplaceContent(
+            change.at("text").get_ref<const std::string &>());
+      } else {
+        // Incremental edits are small; regular conversion is good enough.
+        buffer->ApplyChange(change.get<TextDocumentContentChangeEvent>());
+      }
+    }
+  });
 }
 
 void BufferCollection::didCloseEvent(const DidCloseTextDocumentParams &o) {
-  buffers_.erase(o.textDocument.uri);
+  Shard &shard = ShardFor(o.textDocument.uri);
+  const std::lock_guard<std::mutex> l(shard.write_mutex);
+  const std::shared_ptr<EditTextBuffer> buffer = Lookup(o.textDocument.uri);
+  if (!buffer) return;
+  Publish(&shard, o.textDocument.uri, nullptr);
+  PublishWholeBuffer(o.textDocument.uri, *buffer, false);
+  shard.tiers.erase(o.textDocument.uri);
+}
+
+void BufferCollection::ObserveChanges(const std::string &uri,
+                                      EditTextBuffer *buffer) {
+  if (!change_listener_) return;
+  buffer->AddChangeObserver(
+      [this, uri](const EditTextBuffer &b,
+                  const EditTextBuffer::ChangeBatch &batch) {
+        change_listener_(uri, b, batch);
+      });
+}
+
+void BufferCollection::PublishWholeBuffer(const std::string &uri,
+                                          const EditTextBuffer &buffer,
+                                          bool inserted) {
+  if (!change_listener_) return;
+  const int lines = buffer.lines();
+  const int64_t bytes = buffer.document_length();
+  change_listener_(uri, buffer,
+                   {.version = buffer.last_global_version(),
+                    .changes = {{.first_line = 0,
+                                 .lines_removed = inserted ? 0 : lines,
+                                 .lines_inserted = inserted ? lines : 0,
+                                 .bytes_removed = inserted ? 0 : bytes,
+                                 .bytes_inserted = inserted ? bytes : 0}}});
 }
 
 void BufferCollection::didChangeEvent(const DidChangeTextDocumentParams &o) {
-  auto found = buffers_.find(o.textDocument.uri);
-  if (found == buffers_.end()) return;
-  EditTextBuffer *const buffer = found->second.get();
-  buffer->ApplyChanges(o.contentChanges);
-  buffer->set_last_global_version(++global_version_);
+  EditBuffer(o.textDocument.uri, [&o](EditTextBuffer *buffer) {
+    buffer->ApplyChanges(o.contentChanges);
+  });
+}
+
+BufferCollection::FeatureTier BufferCollection::TierOf(
+    const EditTextBuffer &buffer) const {
+  const int64_t bytes = buffer.document_length();
+  const size_t lines = buffer.lines();
+  if (bytes > kHugeFactor * thresholds_.large_bytes ||
+      lines > kHugeFactor * thresholds_.large_lines) {
+    return FeatureTier::kHuge;
+  }
+  if (bytes > thresholds_.large_bytes || lines > thresholds_.large_lines) {
+    return FeatureTier::kLarge;
+  }
+  return FeatureTier::kFull;
+}
+
+bool BufferCollection::UpdateTier(Shard *shard, const std::string &uri,
+                                  const EditTextBuffer &buffer,
+                                  FeatureTier *tier) {
+  *tier = TierOf(buffer);
+  auto found = shard->tiers.find(uri);
+  const FeatureTier previous =
+      (found == shard->tiers.end()) ? FeatureTier::kFull : found->second;
+  if (*tier == previous) return false;
+  if (*tier == FeatureTier::kFull) {
+    shard->tiers.erase(found);
+  } else {
+    shard->tiers[uri] = *tier;
+  }
+  return true;
+}
+
+void BufferCollection::NotifyTierChange(const std::string &uri,
+                                        FeatureTier tier) {
+  if (tier_change_listener_) tier_change_listener_(uri, tier);
+}
+
+nlohmann::json BufferCollection::GetState() const {
+  nlohmann::json buffers = nlohmann::json::array();
+  MapAllBuffers([&](const std::string &uri, const EditTextBuffer &buffer) {
+    buffer.RequestContent([&](absl::string_view text) {
+      buffers.push_back({{"uri", uri},
+                         {"version", buffer.last_global_version()},
+                         {"text", text}});
+    });
+  });
+  return {{"global_version", global_version()}, {"buffers", buffers}};
+}
+
+void BufferCollection::RestoreState(const nlohmann::json &state) {
+  for (const nlohmann::json &b : state.at("buffers")) {
+    const std::string &uri = b.at("uri").get_ref<const std::string &>();
+    auto buffer = std::make_shared<EditTextBuffer>(
+        b.at("text").get_ref<const std::string &>());
+    buffer->set_last_global_version(b.at("version").get<int64_t>());
+    Shard &shard = ShardFor(uri);
+    const std::lock_guard<std::mutex> l(shard.write_mutex);
+    ObserveChanges(uri, buffer.get());
+    FeatureTier tier;
+    UpdateTier(&shard, uri, *buffer, &tier);  // Client knows already.
+    const EditTextBuffer *const published = buffer.get();
+    Publish(&shard, uri, std::move(buffer));
+    PublishWholeBuffer(uri, *published, true);
+  }
+  const int64_t restored = state.at("global_version").get<int64_t>();
+  const std::lock_guard<std::mutex> l(version_mutex_);
+  if (restored > global_version_) global_version_ = restored;
 }
 
 int BufferCollection::MapBuffersChangedSince(
-    int64_t last_global_version,
-    const std::function<void(const std::string &uri,
-                             const EditTextBuffer &buffer)> &map_fun) const {
-  if (global_version_ <= last_global_version) return 0;
+    int64_t last_global_version, const BufferMapFun &map_fun) const {
+  if (global_version() <= last_global_version) return 0;
   int count = 0;
-  for (const auto &b : buffers_) {
-    if (b.second->last_global_version() <= last_global_version) continue;
+  MapAllBuffers([&](const std::string &uri, const EditTextBuffer &buffer) {
+    if (buffer.last_global_version() <= last_global_version) return;
     ++count;
-    if (map_fun) map_fun(b.first, *b.second);
-  }
+    if (map_fun) map_fun(uri, buffer);
+  });
   return count;
 }
 
+void BufferCollection::MapAllBuffers(const BufferMapFun &map_fun) const {
+  for (const Shard &shard : shards_) {
+    for (const auto &slot : shard.buckets) {
+      const std::shared_ptr<const Bucket> bucket = std::atomic_load(&slot);
+      if (!bucket) continue;
+      for (const auto &b : *bucket) map_fun(b.first, *b.second);
+    }
+  }
+}
+
 void EditTextBuffer::RequestContent(const ContentProcessFun &processor) const {
   std::string flat_view;
   flat_view.reserve(document_length_);
-  for (const auto &l : lines_) flat_view.append(*l);
+  for (const auto &l : lines_) flat_view.append(l->text_);
   processor(flat_view);
 }
 
@@ -176,6 +467,35 @@ void EditTextBuffer::RequestLine(int line,
   if (line < 0 || line >= static_cast<int>(lines_.size())) {
     processor("");
   } else {
-    processor(*lines_[line]);
+    processor(lines_[line]->text_);
+  }
+}
+
+void EditTextBuffer::RequestTokenizedLines(
+    const LinesProcessFun &processor) const {
+  UpdateTokens(lines_.size());
+  processor(lines_);
+}
+
+void EditTextBuffer::RequestTokenizedLines(
+    int end_line, const LinesProcessFun &processor) const {
+  UpdateTokens(std::clamp(end_line, 0, static_cast<int>(lines_.size())));
+  processor(lines_);
+}
+
+void EditTextBuffer::UpdateTokens(size_t end_line) const {
+  LexerState state = kInitialLexerState;
+  for (size_t i = 0; i < end_line; ++i) {
+    Line *const line = lines_[i].get();
+    // A line needs to be re-tokenized if it has been edited, or if the
+    // previous line now ends in a different lexer state.
+    if (!line->tokens_valid_ || line->start_state_ != state) {
+      line->tokens_.clear();
+      line->start_state_ = state;
+      line->end_state_ = TokenizeLine(line->text_, state, &line->tokens_);
+      line->tokens_valid_ = true;
+      ++stats_lines_tokenized_;
+    }
+    state = line->end_state_;
   }
 }
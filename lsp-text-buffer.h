@@ -15,8 +15,14 @@
 #ifndef LSP_TEXT_BUFFER_H
 #define LSP_TEXT_BUFFER_H
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
 #include <vector>
 
 //
@@ -25,6 +31,7 @@
 #include <absl/strings/string_view.h>
 
 #include "json-rpc-dispatcher.h"
+#include "line-tokenizer.h"
 #include "lsp-protocol.h"
 
 // The EditTextBuffer keeps track of the content of buffers on the client.
@@ -34,7 +41,61 @@
 // process it.
 class EditTextBuffer {
  public:
+  // A line of text including its newline, with the tokens found in it.
+  // Tokens are computed on demand and cached with the line until it is
+  // edited, so that language services don't have to re-tokenize text that
+  // didn't change.
+  class Line {
+   public:
+    explicit Line(absl::string_view text) : text_(text) {}
+    Line(const Line &) = delete;
+
+    const std::string &text() const { return text_; }
+
+    // Tokens of this line. Up-to-date within RequestTokenizedLines().
+    const LineTokens &tokens() const { return tokens_; }
+
+   private:
+    friend class EditTextBuffer;
+
+    // Call after modifying text_.
+    void InvalidateTokens() {
+      tokens_valid_ = false;
+      tokens_.clear();
+    }
+
+    std::string text_;
+    bool tokens_valid_ = false;
+    LexerState start_state_ = kInitialLexerState;  // Tokenized from state
+    LexerState end_state_ = kInitialLexerState;    // Resulting state at EOL
+    LineTokens tokens_;
+  };
+  using LineVector = std::vector<std::shared_ptr<Line>>;
+
   using ContentProcessFun = std::function<void(absl::string_view)>;
+  using LinesProcessFun = std::function<void(const LineVector &lines)>;
+
+  // What an edit did to the lines, so that caches and indexes derived from
+  // the buffer can update in proportion to the edit, not the document:
+  // "lines_removed" lines starting at "first_line" were replaced with
+  // "lines_inserted" new ones; lines after are shifted accordingly.
+  struct Change {
+    int first_line;
+    int lines_removed;
+    int lines_inserted;
+    int64_t bytes_removed;
+    int64_t bytes_inserted;
+  };
+
+  // Changes in the order they were applied, with the buffer version after
+  // the last one.
+  struct ChangeBatch {
+    int64_t version;  // last_global_version()
+    std::vector<Change> changes;
+  };
+
+  using ChangeObserverFun = std::function<void(
+      const EditTextBuffer &buffer, const ChangeBatch &batch)>;
 
   explicit EditTextBuffer(absl::string_view initial_text);
   EditTextBuffer(const EditTextBuffer &) = delete;
@@ -47,12 +108,41 @@ class EditTextBuffer {
   // Same as RequestContent() for a specific line.
   void RequestLine(int line, const ContentProcessFun &processor) const;
 
+  // Call "processor" with all lines of the document with their tokens
+  // up-to-date. Only lines that changed since the last call are tokenized;
+  // re-tokenization continues past a changed line only as long as the lexer
+  // state at the line boundary differs from what was seen before.
+  // The lines are valid for the duration of the call.
+  void RequestTokenizedLines(const LinesProcessFun &processor) const;
+
+  // Same, but only lines before "end_line" are guaranteed to have up-to-date
+  // tokens; lines after are not looked at. For requests that only need to
+  // look at part of a large document.
+  void RequestTokenizedLines(int end_line,
+                             const LinesProcessFun &processor) const;
+
   // Apply a single LSP edit operation.
   bool ApplyChange(const TextDocumentContentChangeEvent &c);
 
   // Apply a sequence of changes.
   void ApplyChanges(const std::vector<TextDocumentContentChangeEvent> &cc);
 
+  // Replace the whole document with the given content. Equivalent to
+  // applying a change without range, but without the need to copy the
+  // content into a TextDocumentContentChangeEvent first.
+  void ReplaceContent(absl::string_view content);
+
+  // Receive the changes applied to this buffer from now on. Called on the
+  // thread editing, right after the change, or at EndChanges().
+  void AddChangeObserver(const ChangeObserverFun &observer) {
+    change_observers_.push_back(observer);
+  }
+
+  // Changes applied until EndChanges() are passed to the observers in one
+  // batch, e.g. all changes of one didChange notification.
+  void BeginChanges() { batching_changes_ = true; }
+  void EndChanges();
+
   // Lines in this document.
   size_t lines() const { return lines_.size(); }
 
@@ -60,31 +150,89 @@ class EditTextBuffer {
   int64_t document_length() const { return document_length_; }
 
   // Last global version number this buffer has edited from.
-  int64_t last_global_version() const { return last_global_version_; }
+  int64_t last_global_version() const { return last_global_version_.load(); }
 
   // Set global version; this typically will be done by the BufferCollection.
   void set_last_global_version(int64_t v) { last_global_version_ = v; }
 
- private:
-  // TODO: this should be unique_ptr, but assignment in the insert() command
-  // will not work. Needs to be formulated with something something std::move ?
-  using LineVector = std::vector<std::shared_ptr<std::string>>;
+  // Number of times a line had to be tokenized. Allows to observe
+  // effectiveness of caching the tokens.
+  int64_t StatLinesTokenized() const { return stats_lines_tokenized_; }
 
+ private:
   static LineVector GenerateLines(absl::string_view content);
   void ReplaceDocument(absl::string_view content);
-  bool LineEdit(const TextDocumentContentChangeEvent &c, std::string *str);
+  bool LineEdit(const TextDocumentContentChangeEvent &c, Line *line);
   bool MultiLineEdit(const TextDocumentContentChangeEvent &c);
+  void UpdateTokens(size_t end_line) const;
+  void RecordChange(const Change &change);
 
-  int64_t last_global_version_ = 0;
+  std::atomic<int64_t> last_global_version_{0};
   int64_t document_length_ = 0;
+  // TODO: this should be unique_ptr, but assignment in the insert() command
+  // will not work. Needs to be formulated with something something std::move ?
   LineVector lines_;
+
+  std::vector<ChangeObserverFun> change_observers_;
+  bool batching_changes_ = false;
+  std::vector<Change> pending_changes_;
+
+  mutable int64_t stats_lines_tokenized_ = 0;
 };
 
 // A buffer collection keeps track of various open text buffers on the
 // client side. Registers new ExitTextBuffers by subscribing to events
 // coming from the client.
+//
+// Buffers can be looked up from any thread. The collection is split into
+// shards by uri, and each shard into buckets that publish an immutable map
+// of their buffers; opening or closing a document replaces that small map.
+// Lookups never take the mutex writers hold, but loading the bucket's
+// shared_ptr may briefly spin on a lock internal to the standard library,
+// so they are lock-free only where that is. Writers only serialize with
+// others on the same shard, apart from briefly publishing the next global
+// version.
+// Edits are applied to a buffer in place, so reading a buffer while it is
+// edited needs to be ordered by the caller.
 class BufferCollection {
  public:
+  // Expensive language features are limited or switched off for buffers
+  // too large to process them in reasonable time.
+  enum class FeatureTier {
+    kFull,   // All features.
+    kLarge,  // Features limited to the region around the cursor.
+    kHuge,   // Only buffer content is tracked, language features are off.
+  };
+
+  // A buffer with more bytes or lines than these is large. One that
+  // exceeds these kHugeFactor times is huge.
+  struct SizeThresholds {
+    int64_t large_bytes = 4 << 20;
+    size_t large_lines = 100000;
+
+    // Largest message to accept from the client: one that opens a huge
+    // document, even if JSON escaping doubled its bytes.
+    int64_t max_message_bytes() const {
+      return std::min<int64_t>(2 * kHugeFactor * large_bytes + (1 << 20),
+                               1 << 30);
+    }
+  };
+  static constexpr int kHugeFactor = 16;
+
+  // Called whenever a buffer changes into another tier, including when it
+  // is opened in a tier other than kFull.
+  using TierChangeFun =
+      std::function<void(const std::string &uri, FeatureTier tier)>;
+
+  // Called with the changes of each edit event of a buffer. Opening a
+  // document is published as inserting all its lines, closing as removing
+  // them; findBufferByUri() already knows about the opened document and
+  // doesn't find the closed one anymore. Called while holding a lock for
+  // writing that document, so must not edit buffers.
+  using ChangeFun = std::function<void(const std::string &uri,
+                                       const EditTextBuffer &buffer,
+                                       const EditTextBuffer::ChangeBatch &)>;
+
   // Create buffer collection and subscribe to buffer events at the dispatcher.
   explicit BufferCollection(JsonRpcDispatcher *dispatcher);
   BufferCollection(const BufferCollection &) = delete;
@@ -98,32 +246,107 @@ class BufferCollection {
   // Handle textDocument/didClose event. Forget about buffer.
   void didCloseEvent(const DidCloseTextDocumentParams &o);
 
-  const EditTextBuffer *findBufferByUri(const std::string &uri) const {
-    auto found = buffers_.find(uri);
-    return found == buffers_.end() ? nullptr : found->second.get();
-  }
+  // Returns the buffer or nullptr if not open. The buffer stays valid as
+  // long as the returned pointer is held, even if closed meanwhile.
+  std::shared_ptr<const EditTextBuffer> findBufferByUri(
+      const std::string &uri) const;
 
   // Edits done on all buffers from all time. Allows to compare a single
   // number if there is any change since last time. Good to remember to get
   // only changed buffers when calling MapBuffersChangedSince()
-  int64_t global_version() const { return global_version_; }
+  int64_t global_version() const { return global_version_.load(); }
+
+  using BufferMapFun = std::function<void(const std::string &uri,
+                                          const EditTextBuffer &buffer)>;
 
   // Calls "map_fun"() on each buffer that has changed since the given version.
   // This allows to only proces changed buffers.
-  // Use 0 (zero) as last version to have the map function receive all buffers.
   // "map_fun" can be nullptr in which case only the number of changed buffers.
   // are returned.
   // Returns number of buffers for which the condition applied.
-  int MapBuffersChangedSince(
-      int64_t last_global_version,
-      const std::function<void(const std::string &uri,
-                               const EditTextBuffer &buffer)> &map_fun) const;
+  int MapBuffersChangedSince(int64_t last_global_version,
+                             const BufferMapFun &map_fun) const;
+
+  // Calls "map_fun"() on each open buffer.
+  void MapAllBuffers(const BufferMapFun &map_fun) const;
+
+  size_t documents_open() const;
+
+  void set_size_thresholds(const SizeThresholds &t) { thresholds_ = t; }
+
+  // Tier a buffer of that size is in.
+  FeatureTier TierOf(const EditTextBuffer &buffer) const;
+
+  void SetTierChangeListener(const TierChangeFun &fun) {
+    tier_change_listener_ = fun;
+  }
+
+  // Set before documents are opened.
+  void SetChangeListener(const ChangeFun &fun) { change_listener_ = fun; }
 
-  size_t documents_open() const { return buffers_.size(); }
+  // Content and versions of all buffers, e.g. to hand over to a restarted
+  // server. RestoreState() takes that back; tiers are re-established
+  // without notifying the listener as the client already knows them.
+  nlohmann::json GetState() const;
+  void RestoreState(const nlohmann::json &state);
 
  private:
-  int64_t global_version_ = 0;
-  std::unordered_map<std::string, std::unique_ptr<EditTextBuffer>> buffers_;
+  static constexpr int kShards = 16;
+  static constexpr int kBucketsPerShard = 64;  // Keeps copy on write cheap.
+  using Bucket =
+      std::unordered_map<std::string, std::shared_ptr<EditTextBuffer>>;
+  struct Shard {
+    std::mutex write_mutex;  // Held while changing buckets or their buffers.
+    // Only via atomic_load/store.
+    std::array<std::shared_ptr<const Bucket>, kBucketsPerShard> buckets;
+    std::unordered_map<std::string, FeatureTier> tiers;  // Only if not kFull
+  };
+
+  Shard &ShardFor(const std::string &uri);
+
+  // The buffer of that uri, or nullptr if not open.
+  std::shared_ptr<EditTextBuffer> Lookup(const std::string &uri) const;
+
+  // Insert or replace buffer. Call with the write_mutex held.
+  static void Publish(Shard *shard, const std::string &uri,
+                      std::shared_ptr<EditTextBuffer> buffer);
+
+  // Update tier with shard write_mutex held. Returns true if the tier
+  // changed; the listener is to be called after releasing the lock.
+  bool UpdateTier(Shard *shard, const std::string &uri,
+                  const EditTextBuffer &buffer, FeatureTier *tier);
+  void NotifyTierChange(const std::string &uri, FeatureTier tier);
+
+  void OpenBuffer(const std::string &uri, absl::string_view text);
+
+  // Assign the next global version to "buffer" and call "publish", if set,
+  // before global_version() reports it. Call with the shard write_mutex of
+  // the buffer held.
+  void PublishNextVersion(EditTextBuffer *buffer,
+                          const std::function<void()> &publish);
+
+  // Pass changes of "buffer" on to the change listener.
+  void ObserveChanges(const std::string &uri, EditTextBuffer *buffer);
+
+  // Publish the whole content of the buffer as inserted or removed.
+  void PublishWholeBuffer(const std::string &uri, const EditTextBuffer &buffer,
+                          bool inserted);
+
+  // Apply "edit" to the buffer if open and bump its version.
+  void EditBuffer(const std::string &uri,
+                  const std::function<void(EditTextBuffer *)> &edit);
+
+  // Receiving events as plain json to avoid copies of potentially large text.
+  void didOpenJsonEvent(const nlohmann::json &params);
+  void didChangeJsonEvent(const nlohmann::json &params);
+
+  std::mutex version_mutex_;  // Held from assigning to publishing a version.
+  std::atomic<int64_t> global_version_{0};
+  std::array<Shard, kShards> shards_;
+
+  SizeThresholds thresholds_;
+  TierChangeFun tier_change_listener_;
+  ChangeFun change_listener_;
 };
 
 #endif  // LSP_TEXT_BUFFER_H
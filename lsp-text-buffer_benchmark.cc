@@ -0,0 +1,180 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Lookup throughput of BufferCollection with a growing number of reader
+// threads while another thread keeps opening, editing and closing
+// documents. For comparison, the same with a single mutex-guarded map.
+// Also, the time it takes to open many documents.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+
+#include "json-rpc-dispatcher.h"
+#include "lsp-text-buffer.h"
+
+static constexpr int kDocuments = 1000;
+static constexpr std::chrono::milliseconds kRunTime(500);
+
+// What we had before: one map, one lock.
+class LockedCollection {
+ public:
+  std::shared_ptr<const EditTextBuffer> findBufferByUri(
+      const std::string &uri) const {
+    const std::lock_guard<std::mutex> l(mutex_);
+    auto found = buffers_.find(uri);
+    return found == buffers_.end() ? nullptr : found->second;
+  }
+  void Open(const std::string &uri, const std::string &text) {
+    const std::lock_guard<std::mutex> l(mutex_);
+    buffers_[uri] = std::make_shared<EditTextBuffer>(text);
+  }
+  void Edit(const std::string &uri, const std::string &text) {
+    const std::lock_guard<std::mutex> l(mutex_);
+    auto found = buffers_.find(uri);
+    if (found != buffers_.end()) found->second->ReplaceContent(text);
+  }
+  void Close(const std::string &uri) {
+    const std::lock_guard<std::mutex> l(mutex_);
+    buffers_.erase(uri);
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<EditTextBuffer>> buffers_;
+};
+
+// The sharded collection with the same interface as above.
+class ShardedCollection {
+ public:
+  ShardedCollection() : dispatcher_([](absl::string_view) {}) {}
+
+  std::shared_ptr<const EditTextBuffer> findBufferByUri(
+      const std::string &uri) const {
+    return collection_.findBufferByUri(uri);
+  }
+  void Open(const std::string &uri, const std::string &text) {
+    DidOpenTextDocumentParams params;
+    params.textDocument.uri = uri;
+    params.textDocument.text = text;
+    collection_.didOpenEvent(params);
+  }
+  void Edit(const std::string &uri, const std::string &text) {
+    DidChangeTextDocumentParams params;
+    params.textDocument.uri = uri;
+    params.contentChanges.emplace_back();
+    params.contentChanges.back().text = text;
+    collection_.didChangeEvent(params);
+  }
+  void Close(const std::string &uri) {
+    DidCloseTextDocumentParams params;
+    params.textDocument.uri = uri;
+    collection_.didCloseEvent(params);
+  }
+
+ private:
+  JsonRpcDispatcher dispatcher_;
+  BufferCollection collection_{&dispatcher_};
+};
+
+struct Result {
+  double lookups_per_second;
+  double writes_per_second;
+};
+
+template <typename Collection>
+static Result RunBenchmark(int reader_threads) {
+  Collection collection;
+  std::vector<std::string> uris;
+  for (int i = 0; i < kDocuments; ++i) {
+    uris.push_back(absl::StrCat("file:///benchmark/doc", i, ".txt"));
+    collection.Open(uris.back(), "Hello\nworld\n");
+  }
+
+  std::atomic<bool> done{false};
+  std::atomic<int64_t> lookups{0};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < reader_threads; ++t) {
+    readers.emplace_back([&, t]() {
+      int64_t count = 0;
+      for (size_t i = t; !done; i = (i + 7) % uris.size()) {
+        const auto buffer = collection.findBufferByUri(uris[i]);
+        count += (buffer != nullptr);
+      }
+      lookups += count;
+    });
+  }
+
+  // Writer: mostly edits; documents are closed and reopened much less
+  // often.
+  int64_t writes = 0;
+  const auto start = std::chrono::steady_clock::now();
+  while (std::chrono::steady_clock::now() - start < kRunTime) {
+    const std::string &uri = uris[writes % uris.size()];
+    if (writes % 100 == 0) {
+      collection.Close(uri);
+      collection.Open(uri, "Reopened\n");
+    } else {
+      collection.Edit(uri, "Edited\n");
+    }
+    ++writes;
+  }
+  done = true;
+  for (auto &t : readers) t.join();
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  return {lookups / seconds, writes / seconds};
+}
+
+// Microseconds per open when opening "documents" one after another.
+static double OpenTime(int documents) {
+  ShardedCollection collection;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < documents; ++i) {
+    collection.Open(absl::StrCat("file:///benchmark/doc", i, ".txt"), "Hi\n");
+  }
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  return seconds * 1e6 / documents;
+}
+
+int main() {
+  const int cores = std::max(1u, std::thread::hardware_concurrency());
+  fprintf(stderr, "%d documents, one writer thread; %d cores.\n", kDocuments,
+          cores);
+  fprintf(stderr, "%8s %18s %18s %18s %18s\n", "Readers", "Sharded lookups/s",
+          "Sharded writes/s", "Locked lookups/s", "Locked writes/s");
+  for (int readers = 1; readers <= std::max(8, 2 * cores); readers *= 2) {
+    const Result sharded = RunBenchmark<ShardedCollection>(readers);
+    const Result locked = RunBenchmark<LockedCollection>(readers);
+    fprintf(stderr, "%8d %18.0f %18.0f %18.0f %18.0f\n", readers,
+            sharded.lookups_per_second, sharded.writes_per_second,
+            locked.lookups_per_second, locked.writes_per_second);
+  }
+
+  fprintf(stderr, "\n%10s %14s\n", "Documents", "us per open");
+  for (int documents : {1000, 10000, 100000}) {
+    fprintf(stderr, "%10d %14.2f\n", documents, OpenTime(documents));
+  }
+}
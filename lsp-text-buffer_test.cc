@@ -16,8 +16,16 @@
 
 #include <absl/strings/str_cat.h>
 
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include "gtest/gtest.h"
 #include "json-rpc-dispatcher.h"
+#include "message-stream-splitter.h"
 
 TEST(TextBufferTest, RecreateEmptyFile) {
   EditTextBuffer buffer("");
@@ -28,6 +36,27 @@ TEST(TextBufferTest, RecreateEmptyFile) {
   });
 }
 
+TEST(TextBufferTest, ReplaceWithEmptyContent) {
+  EditTextBuffer buffer("Foo\nBar\n");
+  std::vector<EditTextBuffer::ChangeBatch> batches;
+  buffer.AddChangeObserver(
+      [&](const EditTextBuffer &, const EditTextBuffer::ChangeBatch &batch) {
+        batches.push_back(batch);
+      });
+  buffer.ReplaceContent("");
+  EXPECT_EQ(buffer.lines(), 0);
+  EXPECT_EQ(buffer.document_length(), 0);
+  buffer.RequestContent([](absl::string_view s) {  //
+    EXPECT_TRUE(s.empty());
+  });
+  ASSERT_EQ(batches.size(), 1);
+  ASSERT_EQ(batches[0].changes.size(), 1);
+  EXPECT_EQ(batches[0].changes[0].lines_removed, 2);
+  EXPECT_EQ(batches[0].changes[0].lines_inserted, 0);
+  EXPECT_EQ(batches[0].changes[0].bytes_removed, 8);
+  EXPECT_EQ(batches[0].changes[0].bytes_inserted, 0);
+}
+
 TEST(TextBufferTest, RequestParticularLine) {
   EditTextBuffer buffer("foo\nbar\nbaz\n");
   EXPECT_EQ(buffer.lines(), 3);
@@ -280,6 +309,127 @@ TEST(TextBufferTest, ChangeApplyMultiLine_RemoveLines) {
   EXPECT_EQ(buffer.document_length(), 8);
 }
 
+TEST(TextBufferTest, ChangesArePublishedToObservers) {
+  EditTextBuffer buffer("Foo\nBar\nBaz\n");
+  std::vector<EditTextBuffer::ChangeBatch> batches;
+  buffer.AddChangeObserver(
+      [&](const EditTextBuffer &, const EditTextBuffer::ChangeBatch &batch) {
+        batches.push_back(batch);
+      });
+
+  // Single change published right away.
+  EXPECT_TRUE(buffer.ApplyChange({.range = {.start = {1, 0}, .end = {1, 3}},
+                                  .has_range = true,
+                                  .text = "Hello"}));
+  ASSERT_EQ(batches.size(), 1);
+  ASSERT_EQ(batches[0].changes.size(), 1);
+  const EditTextBuffer::Change &line_edit = batches[0].changes[0];
+  EXPECT_EQ(line_edit.first_line, 1);
+  EXPECT_EQ(line_edit.lines_removed, 1);
+  EXPECT_EQ(line_edit.lines_inserted, 1);
+  EXPECT_EQ(line_edit.bytes_removed, 4);
+  EXPECT_EQ(line_edit.bytes_inserted, 6);
+
+  // Changes applied together are published together.
+  buffer.set_last_global_version(42);
+  buffer.ApplyChanges({
+      {.range = {.start = {0, 3}, .end = {1, 0}}, .has_range = true,
+       .text = ""},  // Join first two lines.
+      {.range = {.start = {1, 0}, .end = {1, 0}}, .has_range = true,
+       .text = "one\ntwo\n"},
+  });
+  ASSERT_EQ(batches.size(), 2);
+  EXPECT_EQ(batches[1].version, 42);
+  ASSERT_EQ(batches[1].changes.size(), 2);
+  EXPECT_EQ(batches[1].changes[0].first_line, 0);
+  EXPECT_EQ(batches[1].changes[0].lines_removed, 2);
+  EXPECT_EQ(batches[1].changes[0].lines_inserted, 1);
+  EXPECT_EQ(batches[1].changes[1].first_line, 1);
+  EXPECT_EQ(batches[1].changes[1].lines_removed, 1);
+  EXPECT_EQ(batches[1].changes[1].lines_inserted, 3);
+  buffer.RequestContent([](absl::string_view s) {
+    EXPECT_EQ(s, "FooHello\none\ntwo\nBaz\n");
+  });
+
+  buffer.BeginChanges();
+  buffer.ReplaceContent("Bye");
+  EXPECT_EQ(batches.size(), 2);  // Not yet.
+  buffer.EndChanges();
+  ASSERT_EQ(batches.size(), 3);
+  ASSERT_EQ(batches[2].changes.size(), 1);
+  EXPECT_EQ(batches[2].changes[0].lines_removed, 4);
+  EXPECT_EQ(batches[2].changes[0].lines_inserted, 1);
+  EXPECT_EQ(batches[2].changes[0].bytes_removed, 21);
+  EXPECT_EQ(batches[2].changes[0].bytes_inserted, 3);
+}
+
+TEST(TextBufferTest, RequestTokenizedLines) {
+  EditTextBuffer buffer("Hello  world\n\n\tfoo bar\n");
+  buffer.RequestTokenizedLines([](const EditTextBuffer::LineVector &lines) {
+    ASSERT_EQ(lines.size(), 3);
+    EXPECT_EQ(lines[0]->text(), "Hello  world\n");
+    ASSERT_EQ(lines[0]->tokens().size(), 2);
+    EXPECT_EQ(lines[0]->tokens()[1], "world");
+    EXPECT_TRUE(lines[1]->tokens().empty());
+    ASSERT_EQ(lines[2]->tokens().size(), 2);
+    EXPECT_EQ(lines[2]->tokens()[0].data() - lines[2]->text().data(), 1);
+  });
+}
+
+TEST(TextBufferTest, RequestTokenizedLinesUpToLine) {
+  EditTextBuffer buffer("one\ntwo\nthree\nfour\n");
+  buffer.RequestTokenizedLines(2, [](const EditTextBuffer::LineVector &lines) {
+    ASSERT_EQ(lines.size(), 4);  // Access to all lines...
+    EXPECT_EQ(lines[1]->tokens().size(), 1);
+  });
+  EXPECT_EQ(buffer.StatLinesTokenized(), 2);  // ... but only two tokenized.
+
+  // Remaining lines are tokenized once needed.
+  buffer.RequestTokenizedLines(1000, [](const EditTextBuffer::LineVector &) {});
+  EXPECT_EQ(buffer.StatLinesTokenized(), 4);
+}
+
+TEST(TextBufferTest, OnlyChangedLinesAreTokenizedAgain) {
+  EditTextBuffer buffer("one\ntwo\nthree\nfour\n");
+  EXPECT_EQ(buffer.StatLinesTokenized(), 0);  // Only tokenized on demand.
+
+  buffer.RequestTokenizedLines([](const EditTextBuffer::LineVector &) {});
+  EXPECT_EQ(buffer.StatLinesTokenized(), 4);
+
+  // Nothing changed: all tokens are served from cache.
+  buffer.RequestTokenizedLines([](const EditTextBuffer::LineVector &) {});
+  EXPECT_EQ(buffer.StatLinesTokenized(), 4);
+
+  // Single line edit: only that line needs to be tokenized.
+  const TextDocumentContentChangeEvent single_line_change = {
+      .range = {.start = {1, 0}, .end = {1, 3}},
+      .has_range = true,
+      .text = "2 2",
+  };
+  EXPECT_TRUE(buffer.ApplyChange(single_line_change));
+  buffer.RequestTokenizedLines([](const EditTextBuffer::LineVector &lines) {
+    ASSERT_EQ(lines[1]->tokens().size(), 2);
+    EXPECT_EQ(lines[1]->tokens()[1], "2");
+  });
+  EXPECT_EQ(buffer.StatLinesTokenized(), 5);
+
+  // Multi-line edit, joining lines 2 and 3 into one. Line 4 is shifted, but
+  // still has its tokens cached.
+  const TextDocumentContentChangeEvent multi_line_change = {
+      .range = {.start = {2, 5}, .end = {3, 0}},
+      .has_range = true,
+      .text = " ",
+  };
+  EXPECT_TRUE(buffer.ApplyChange(multi_line_change));
+  buffer.RequestTokenizedLines([](const EditTextBuffer::LineVector &lines) {
+    ASSERT_EQ(lines.size(), 3);
+    ASSERT_EQ(lines[2]->tokens().size(), 2);
+    EXPECT_EQ(lines[2]->tokens()[0], "three");
+    EXPECT_EQ(lines[2]->tokens()[1], "four");
+  });
+  EXPECT_EQ(buffer.StatLinesTokenized(), 6);
+}
+
 TEST(BufferCollection, SimulateDocumentLifecycleThroughRPC) {
   // Let's walk a BufferCollection through the lifecycle of a document
   // by sending it the JSON RPC notifications for open, change and close.
@@ -362,3 +512,395 @@ TEST(BufferCollection, SimulateDocumentLifecycleThroughRPC) {
   // No document open anymore
   EXPECT_EQ(collection.documents_open(), 0);
 }
+
+TEST(BufferCollection, FullContentFromJsonIsUnescaped) {
+  // Open and full-content change events are read straight from the json
+  // message; make sure escaped characters arrive as expected in the buffer.
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+
+  rpc_dispatcher.DispatchMessage(R"({
+    "jsonrpc":"2.0",
+    "method":"textDocument/didOpen",
+    "params":{
+        "textDocument":{
+           "uri": "file:///foo.cc",
+           "text": "say \"Hello\"\n\tworld\n",
+           "languageId": "cpp",
+           "version": 1
+         }
+    }})");
+
+  const auto buffer = collection.findBufferByUri("file:///foo.cc");
+  ASSERT_NE(buffer, nullptr);
+  EXPECT_EQ(buffer->lines(), 2);
+  buffer->RequestContent([](absl::string_view s) {
+    EXPECT_EQ(std::string(s), "say \"Hello\"\n\tworld\n");
+  });
+
+  // Full content replacement mixed with an incremental edit.
+  rpc_dispatcher.DispatchMessage(R"({
+    "jsonrpc":"2.0",
+    "method":"textDocument/didChange",
+    "params":{
+        "textDocument":   { "uri": "file:///foo.cc" },
+        "contentChanges": [
+           { "text": "Hello\\World\n" },
+           { "range": { "start": {"line": 0, "character": 5},
+                        "end":   {"line": 0, "character": 6} },
+             "text": ", " }
+        ]
+     }})");
+
+  buffer->RequestContent([](absl::string_view s) {
+    EXPECT_EQ(std::string(s), "Hello, World\n");
+  });
+  EXPECT_EQ(buffer->document_length(), 13);
+}
+
+TEST(BufferCollection, LargeBuffersChangeFeatureTier) {
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+  collection.set_size_thresholds({.large_bytes = 1000, .large_lines = 3});
+
+  std::vector<BufferCollection::FeatureTier> tier_changes;
+  collection.SetTierChangeListener(
+      [&](const std::string &uri, BufferCollection::FeatureTier tier) {
+        EXPECT_EQ(uri, "file:///foo.txt");
+        tier_changes.push_back(tier);
+      });
+
+  rpc_dispatcher.DispatchMessage(R"({
+    "jsonrpc":"2.0",
+    "method":"textDocument/didOpen",
+    "params":{
+        "textDocument":{
+           "uri": "file:///foo.txt",
+           "text": "a\nb\n",
+           "languageId": "text",
+           "version": 1
+         }
+    }})");
+  EXPECT_TRUE(tier_changes.empty());  // Small; all features from the start.
+
+  const auto replace_content = [&](const std::string &text) {
+    const nlohmann::json change = {
+        {"jsonrpc", "2.0"},
+        {"method", "textDocument/didChange"},
+        {"params",
+         {{"textDocument", {{"uri", "file:///foo.txt"}}},
+          {"contentChanges", {{{"text", text}}}}}},
+    };
+    rpc_dispatcher.DispatchMessage(change.dump());
+  };
+
+  replace_content("a\nb\nc\nd\n");  // Too many lines.
+  replace_content("a\nb\nc\nd\ne\n");  // Still the same tier.
+  replace_content(std::string(16001, 'x'));  // Too many bytes.
+  replace_content("a\n");
+  EXPECT_EQ(tier_changes, std::vector<BufferCollection::FeatureTier>(
+                              {BufferCollection::FeatureTier::kLarge,
+                               BufferCollection::FeatureTier::kHuge,
+                               BufferCollection::FeatureTier::kFull}));
+
+  const auto buffer = collection.findBufferByUri("file:///foo.txt");
+  ASSERT_NE(buffer, nullptr);
+  EXPECT_EQ(collection.TierOf(*buffer), BufferCollection::FeatureTier::kFull);
+}
+
+// Documents beyond the large and huge threshold are tiered, not rejected
+// when they arrive from the client; even if JSON escaping doubles them.
+TEST(BufferCollection, LargeDocumentsArriveThroughMessageStream) {
+  const BufferCollection::SizeThresholds thresholds = {.large_bytes = 1 << 20,
+                                                       .large_lines = 100000};
+  MessageStreamSplitter stream_splitter(
+      1 << 16, MessageStreamSplitter::Framing::kContentLength,
+      thresholds.max_message_bytes());
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  stream_splitter.SetMessageProcessor(
+      [&](absl::string_view, absl::string_view body) {
+        rpc_dispatcher.DispatchMessage(body);
+      });
+  BufferCollection collection(&rpc_dispatcher);
+  collection.set_size_thresholds(thresholds);
+  std::map<std::string, BufferCollection::FeatureTier> tiers;
+  collection.SetTierChangeListener(
+      [&](const std::string &uri, BufferCollection::FeatureTier tier) {
+        tiers[uri] = tier;
+      });
+
+  std::string stream;
+  const auto add_open = [&](const std::string &uri, const std::string &text) {
+    const std::string body =
+        nlohmann::json{{"jsonrpc", "2.0"},
+                       {"method", "textDocument/didOpen"},
+                       {"params",
+                        {{"textDocument",
+                          {{"uri", uri},
+                           {"text", text},
+                           {"languageId", "text"},
+                           {"version", 1}}}}}}
+            .dump();
+    absl::StrAppend(&stream, "Content-Length: ", body.size(), "\r\n\r\n",
+                    body);
+  };
+  add_open("file:///large.txt", std::string(5 << 20, 'x'));
+  add_open("file:///huge.txt",
+           std::string(BufferCollection::kHugeFactor * (1 << 20) + 1, '"'));
+
+  size_t read_pos = 0;
+  absl::Status status = absl::OkStatus();
+  while (status.ok()) {
+    status = stream_splitter.PullFrom([&](char *buf, int size) -> int {
+      const size_t chunk = std::min(
+          {stream.size() - read_pos, (size_t)size, (size_t)(1 << 16)});
+      memcpy(buf, stream.data() + read_pos, chunk);
+      read_pos += chunk;
+      return chunk;
+    });
+  }
+  EXPECT_EQ(status.code(), absl::StatusCode::kUnavailable) << status;
+  EXPECT_EQ(collection.documents_open(), 2);
+  EXPECT_EQ(tiers, (std::map<std::string, BufferCollection::FeatureTier>{
+                       {"file:///large.txt",
+                        BufferCollection::FeatureTier::kLarge},
+                       {"file:///huge.txt",
+                        BufferCollection::FeatureTier::kHuge},
+                   }));
+}
+
+TEST(BufferCollection, StateSurvivesRoundTrip) {
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+  collection.set_size_thresholds({.large_bytes = 1000, .large_lines = 3});
+
+  for (const char *uri : {"file:///foo.txt", "file:///bar.txt"}) {
+    const nlohmann::json open = {
+        {"jsonrpc", "2.0"},
+        {"method", "textDocument/didOpen"},
+        {"params",
+         {{"textDocument",
+           {{"uri", uri},
+            {"text", std::string(uri) + "\na\nb\nc\n"},
+            {"languageId", "text"},
+            {"version", 1}}}}},
+    };
+    rpc_dispatcher.DispatchMessage(open.dump());
+  }
+
+  // Hand over the binary representation as we would between processes.
+  const std::vector<uint8_t> state =
+      nlohmann::json::to_cbor(collection.GetState());
+
+  JsonRpcDispatcher other_dispatcher([](absl::string_view) {});
+  BufferCollection restored(&other_dispatcher);
+  restored.set_size_thresholds({.large_bytes = 1000, .large_lines = 3});
+  restored.SetTierChangeListener(
+      [](const std::string &, BufferCollection::FeatureTier) {
+        ADD_FAILURE() << "Client already knows about tiers";
+      });
+  restored.RestoreState(nlohmann::json::from_cbor(state));
+
+  EXPECT_EQ(restored.documents_open(), 2);
+  EXPECT_EQ(restored.global_version(), collection.global_version());
+  for (const char *uri : {"file:///foo.txt", "file:///bar.txt"}) {
+    const auto original = collection.findBufferByUri(uri);
+    const auto buffer = restored.findBufferByUri(uri);
+    ASSERT_NE(buffer, nullptr);
+    EXPECT_EQ(buffer->last_global_version(), original->last_global_version());
+    EXPECT_EQ(restored.TierOf(*buffer), BufferCollection::FeatureTier::kLarge);
+    buffer->RequestContent([&](absl::string_view s) {
+      EXPECT_EQ(std::string(s), std::string(uri) + "\na\nb\nc\n");
+    });
+  }
+
+  // Edits continue to be numbered after the restored versions.
+  other_dispatcher.DispatchMessage(R"({
+    "jsonrpc":"2.0",
+    "method":"textDocument/didChange",
+    "params":{
+        "textDocument":   { "uri": "file:///foo.txt" },
+        "contentChanges": [ {"text":"Hey\na\nb\nc\n"} ]
+     }})");
+  EXPECT_EQ(1, restored.MapBuffersChangedSince(collection.global_version(),
+                                               nullptr));
+}
+
+static DidOpenTextDocumentParams OpenParams(const std::string &uri,
+                                            const std::string &text) {
+  DidOpenTextDocumentParams params;
+  params.textDocument.uri = uri;
+  params.textDocument.text = text;
+  return params;
+}
+
+static DidCloseTextDocumentParams CloseParams(const std::string &uri) {
+  DidCloseTextDocumentParams params;
+  params.textDocument.uri = uri;
+  return params;
+}
+
+TEST(BufferCollection, BufferStaysValidWhileHeldAfterClose) {
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+  collection.didOpenEvent(OpenParams("file:///foo.txt", "Hello\nworld"));
+  const auto buffer = collection.findBufferByUri("file:///foo.txt");
+  ASSERT_NE(buffer, nullptr);
+  collection.didCloseEvent(CloseParams("file:///foo.txt"));
+  EXPECT_EQ(collection.findBufferByUri("file:///foo.txt"), nullptr);
+  EXPECT_EQ(collection.documents_open(), 0);
+  EXPECT_EQ(buffer->document_length(), 11);
+}
+
+TEST(BufferCollection, MapAllBuffersIncludesUnchanged) {
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+  collection.didOpenEvent(OpenParams("file:///foo.txt", "Hello"));
+  collection.didOpenEvent(OpenParams("file:///bar.txt", "world"));
+  EXPECT_EQ(collection.MapBuffersChangedSince(collection.global_version(),
+                                              nullptr),
+            0);
+  std::map<std::string, int64_t> seen;
+  collection.MapAllBuffers(
+      [&](const std::string &uri, const EditTextBuffer &buffer) {
+        seen[uri] = buffer.document_length();
+      });
+  EXPECT_EQ(seen, (std::map<std::string, int64_t>{{"file:///bar.txt", 5},
+                                                  {"file:///foo.txt", 5}}));
+}
+
+TEST(BufferCollection, ManyDocumentsOpenAndClose) {
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+  static constexpr int kDocuments = 5000;  // Many per shard and bucket.
+  auto uri = [](int i) { return absl::StrCat("file:///doc", i, ".txt"); };
+  for (int i = 0; i < kDocuments; ++i) {
+    collection.didOpenEvent(OpenParams(uri(i), std::string(i + 1, 'x')));
+  }
+  EXPECT_EQ(collection.documents_open(), kDocuments);
+  for (int i = 0; i < kDocuments; i += 2) {
+    collection.didCloseEvent(CloseParams(uri(i)));
+  }
+  EXPECT_EQ(collection.documents_open(), kDocuments / 2);
+  for (int i = 0; i < kDocuments; ++i) {
+    const auto buffer = collection.findBufferByUri(uri(i));
+    if (i % 2 == 0) {
+      EXPECT_EQ(buffer, nullptr);
+    } else {
+      ASSERT_NE(buffer, nullptr);
+      EXPECT_EQ(buffer->document_length(), i + 1);
+    }
+  }
+}
+
+TEST(BufferCollection, LookupsWhileOtherThreadOpensAndCloses) {
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+  static constexpr int kDocuments = 100;
+  auto uri = [](int i) { return absl::StrCat("file:///doc", i, ".txt"); };
+  // Each document has a different length to check we got the right one.
+  auto content = [](int i) { return std::string(i + 1, 'x'); };
+
+  std::atomic<bool> done{false};
+  std::thread writer([&]() {
+    for (int round = 0; round < 50; ++round) {
+      for (int i = 0; i < kDocuments; ++i) {
+        collection.didOpenEvent(OpenParams(uri(i), content(i)));
+      }
+      for (int i = 0; i < kDocuments; ++i) {
+        collection.didCloseEvent(CloseParams(uri(i)));
+      }
+    }
+    done = true;
+  });
+
+  // Whether a lookup hits depends on scheduling; but if it does, it must
+  // see the complete buffer.
+  while (!done) {
+    for (int i = 0; i < kDocuments; ++i) {
+      const auto buffer = collection.findBufferByUri(uri(i));
+      if (!buffer) continue;
+      EXPECT_EQ(buffer->document_length(), i + 1);
+    }
+  }
+  writer.join();
+  EXPECT_EQ(collection.documents_open(), 0);
+}
+
+TEST(BufferCollection, ReaderOfChangedBuffersMissesNoneOfConcurrentWriters) {
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+  static constexpr int kWriters = 4;
+  static constexpr int kDocumentsPerWriter = 500;
+
+  std::atomic<int> writers_done{0};
+  std::vector<std::thread> writers;
+  for (int w = 0; w < kWriters; ++w) {
+    writers.emplace_back([&, w]() {
+      for (int i = 0; i < kDocumentsPerWriter; ++i) {
+        collection.didOpenEvent(
+            OpenParams(absl::StrCat("file:///", w, "/", i), "x"));
+      }
+      ++writers_done;
+    });
+  }
+
+  // Remembering the version seen before looking for changes, as the
+  // diagnostics loop does, has to catch every document eventually.
+  std::set<std::string> seen;
+  int64_t last_version = 0;
+  const auto collect_changed = [&]() {
+    const int64_t version = collection.global_version();
+    collection.MapBuffersChangedSince(
+        last_version,
+        [&](const std::string &uri, const EditTextBuffer &) {
+          seen.insert(uri);
+        });
+    last_version = version;
+  };
+  while (writers_done < kWriters) collect_changed();
+  for (std::thread &writer : writers) writer.join();
+  collect_changed();
+  EXPECT_EQ(seen.size(), kWriters * kDocumentsPerWriter);
+}
+
+TEST(BufferCollection, ChangeListenerGetsBatchPerEvent) {
+  JsonRpcDispatcher rpc_dispatcher([](absl::string_view) {});
+  BufferCollection collection(&rpc_dispatcher);
+  std::vector<EditTextBuffer::ChangeBatch> batches;
+  collection.SetChangeListener(
+      [&](const std::string &uri, const EditTextBuffer &,
+          const EditTextBuffer::ChangeBatch &batch) {
+        EXPECT_EQ(uri, "file:///foo.txt");
+        batches.push_back(batch);
+      });
+
+  collection.didOpenEvent(OpenParams("file:///foo.txt", "Hello\nworld\n"));
+  ASSERT_EQ(batches.size(), 1);
+  ASSERT_EQ(batches[0].changes.size(), 1);
+  EXPECT_EQ(batches[0].changes[0].lines_inserted, 2);
+  EXPECT_EQ(batches[0].changes[0].bytes_inserted, 12);
+
+  rpc_dispatcher.DispatchMessage(R"({
+    "jsonrpc":"2.0",
+    "method":"textDocument/didChange",
+    "params":{
+        "textDocument":   { "uri": "file:///foo.txt" },
+        "contentChanges": [
+          {"range":{"start":{"line":0,"character":0},
+                    "end":{"line":0,"character":5}}, "text":"Hey"},
+          {"range":{"start":{"line":1,"character":0},
+                    "end":{"line":1,"character":0}}, "text":"big "}
+        ]
+     }})");
+  ASSERT_EQ(batches.size(), 2);
+  EXPECT_EQ(batches[1].changes.size(), 2);
+  EXPECT_EQ(batches[1].version, collection.global_version());
+  EXPECT_GT(batches[1].version, batches[0].version);
+
+  collection.didCloseEvent(CloseParams("file:///foo.txt"));
+  ASSERT_EQ(batches.size(), 3);
+  ASSERT_EQ(batches[2].changes.size(), 1);
+  EXPECT_EQ(batches[2].changes[0].lines_removed, 2);
+  EXPECT_EQ(batches[2].changes[0].bytes_removed, 14);
+}
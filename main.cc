@@ -1,15 +1,62 @@
 #include <ctype.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <string.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <sstream>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+
+#include "analyzer-workers.h"
+#include "buffer-lint.h"
+#include "debounce-scheduler.h"
 #include "file-event-dispatcher.h"
+#include "flight-recorder.h"
+#include "hot-restart.h"
 #include "json-rpc-dispatcher.h"
+#include "lint-rules.h"
+#include "logger.h"
 #include "lsp-protocol.h"
 #include "lsp-text-buffer.h"
 #include "message-stream-splitter.h"
+#include "metrics-server.h"
+#include "notification-queue.h"
+#include "openmetrics.h"
+#include "query-engine.h"
+#include "sampling-profiler.h"
+#include "shared-memory-transport.h"
+#include "strand-executor.h"
+#include "text-formatting.h"
+#include "text-search.h"
+#include "thread-pool.h"
 
-void PrintStats(const MessageStreamSplitter &source,
-                const JsonRpcDispatcher &server);
+void AppendStats(const MessageStreamSplitter &source,
+                 const JsonRpcDispatcher &server,
+                 const CoalescingNotificationQueue &diagnostics_queue,
+                 std::string *out);
+void AppendDebounceStats(const DebounceScheduler &scheduler, std::string *out);
+void AppendLintRuleStats(const RegexLintRules &rules, std::string *out);
+void AppendLoggerStats(const Logger &logger, std::string *out);
+void AppendAnalyzerWorkerStats(const AnalyzerWorkers &workers,
+                               std::string *out);
+void AppendQueryStats(const QueryEngine &queries, std::string *out);
+std::string CollectMetrics(const MessageStreamSplitter &source,
+                           const JsonRpcDispatcher &server,
+                           const BufferCollection &buffers,
+                           const CoalescingNotificationQueue &diagnostics_queue,
+                           const Logger &logger,
+                           const OpenMetricsText::LabeledValues &messages,
+                           const OpenMetricsText::LabeledHistograms &latency);
 
 // The "initialize" method requests server capabilities.
 InitializeResult InitializeServer(const nlohmann::json params) {
@@ -37,160 +84,320 @@ InitializeResult InitializeServer(const nlohmann::json params) {
   return result;
 }
 
-// Looks at the surroundings of word for surroundings of non-space.
-static absl::string_view ExtractWordAtPos(absl::string_view line, int pos) {
-  if (pos >= (int)line.length()) return {line.data() + line.size() - 1, 0};
+// Handlers of requests with a deadline check it every this many lines.
+static constexpr int kDeadlineCheckLines = 256;
 
-  // TODO: this probably would be nicer with some std::-algorithms.
-  int start = pos;
-  while (start >= 0 && !isspace(line[start])) {
-    --start;
-  }
-  ++start;
+// Limits for buffers in the FeatureTier::kLarge. Features that are usually
+// applied to the whole document only look at this many lines around the
+// cursor; diagnostics are limited to this many.
+static constexpr int kLargeFileViewportLines = 200;
+static constexpr size_t kLargeFileMaxDiagnostics = 1000;
 
-  int end = pos;
-  while (end < (int)line.length() && !isspace(line[end])) {
-    ++end;
+// Find the token the cursor at column "pos" is on (or right behind).
+// Returns an empty string_view if there is none.
+static absl::string_view FindTokenAtPos(const EditTextBuffer::Line &line,
+                                        int pos) {
+  for (absl::string_view token : line.tokens()) {
+    const int start = token.data() - line.text().data();
+    if (pos < start) break;
+    if (pos <= start + (int)token.length()) return token;
   }
-  return line.substr(start, end - start);
+  return {};
 }
 
 // Example of a simple hover request: we just report how long the word
-// is we're hovering over.
+// is we're hovering over. Not available for huge buffers.
 nlohmann::json HandleHoverRequest(const BufferCollection &buffers,
                                   const HoverParams &p) {
-  const EditTextBuffer *buffer = buffers.findBufferByUri(p.textDocument.uri);
+  const auto buffer = buffers.findBufferByUri(p.textDocument.uri);
   if (!buffer) return nullptr;
+  if (buffers.TierOf(*buffer) == BufferCollection::FeatureTier::kHuge) {
+    return nullptr;
+  }
 
-  const int col = p.position.character;
-  int word_length = -1;
-  Hover result;
-  result.range.start.line = result.range.end.line = p.position.line;
-  result.range.start.character = result.range.end.character = col;
-  buffer->RequestLine(
-      p.position.line, [&word_length, &result, col](absl::string_view line) {
-        auto w = ExtractWordAtPos(line, col);
-        result.range.start.character = w.data() - line.data();
-        result.range.end.character = result.range.start.character + w.length();
-        word_length = w.length();
+  nlohmann::json result = nullptr;
+  const int row = p.position.line;
+  buffer->RequestTokenizedLines(
+      row + 1, [&](const EditTextBuffer::LineVector &lines) {
+        if (row < 0 || row >= (int)lines.size()) return;
+        const absl::string_view word =
+            FindTokenAtPos(*lines[row], p.position.character);
+        if (word.empty()) return;
+        const int col = word.data() - lines[row]->text().data();
+        Hover hover;
+        hover.contents.value =
+            "A word with **" + std::to_string(word.length()) + "** letters";
+        hover.range = {{row, col}, {row, col + (int)word.length()}};
+        hover.has_range = true;
+        result = hover;
       });
-  if (word_length < 0) return nullptr;
-
-  result.contents.value =
-      "A word with **" + std::to_string(word_length) + "** letters";
-  result.has_range = true;
-
   return result;
 }
 
-nlohmann::json HandleHighlightRequest(const BufferCollection &buffers,
-                                      const DocumentHighlightParams &p) {
-  const EditTextBuffer *buffer = buffers.findBufferByUri(p.textDocument.uri);
-  if (!buffer) return nullptr;
+// Highlights are emitted one by one, so even documents with a huge number
+// of matches never need the full result list in memory.
+void HandleHighlightRequest(const BufferCollection &buffers,
+                            const JsonRpcDispatcher &dispatcher,
+                            const DocumentHighlightParams &p,
+                            const JsonRpcDispatcher::ElementEmitFun &emit) {
+  const auto buffer = buffers.findBufferByUri(p.textDocument.uri);
+  if (!buffer) return;
+  const BufferCollection::FeatureTier tier = buffers.TierOf(*buffer);
+  if (tier == BufferCollection::FeatureTier::kHuge) return;
 
-  std::vector<DocumentHighlight> result;
-  buffer->RequestContent([&](absl::string_view content) {
-    const std::vector<absl::string_view> lines = absl::StrSplit(content, '\n');
-    // First, let's extract the word we're currently on.
-    if (p.position.line >= (int)lines.size()) return;
-    auto word = ExtractWordAtPos(lines[p.position.line], p.position.character);
-    if (word.empty()) return;
-    for (int row = 0; row < (int)lines.size(); ++row) {
-      const auto &line = lines[row];
-      size_t col = 0;
-      while ((col = line.find(word, col)) != absl::string_view::npos) {
-        const size_t eow = col + word.length();
-        // Only if we're surrounded by space, this is a full word.
-        const bool is_word = ((col == 0 || isspace(line[col - 1])) &&
-                              (eow == line.length() || isspace(line[eow])));
-        if (is_word) {
-          result.emplace_back(DocumentHighlight{
-              .range = {{row, (int)col}, {row, (int)eow}},
-          });
-          col = eow;
-        } else {
-          col += 1;
+  const int cursor_row = p.position.line;
+  const int max_distance = (tier == BufferCollection::FeatureTier::kLarge)
+                               ? kLargeFileViewportLines
+                               : buffer->lines();
+  const int end_line = cursor_row + max_distance + 1;
+  buffer->RequestTokenizedLines(
+      end_line, [&](const EditTextBuffer::LineVector &lines) {
+        // First, let's extract the word we're currently on.
+        const int line_count = lines.size();
+        if (cursor_row < 0 || cursor_row >= line_count) return;
+        const absl::string_view word =
+            FindTokenAtPos(*lines[cursor_row], p.position.character);
+        if (word.empty()) return;
+        const auto highlight_row = [&](int row) {
+          const EditTextBuffer::Line &line = *lines[row];
+          for (absl::string_view token : line.tokens()) {
+            if (token != word) continue;
+            const int col = token.data() - line.text().data();
+            emit(DocumentHighlight{
+                .range = {{row, col}, {row, col + (int)token.length()}},
+            });
+          }
+        };
+
+        // Going outwards from the cursor, so that if we run out of time, the
+        // highlights closest to where the user is looking are there.
+        highlight_row(cursor_row);
+        for (int distance = 1; distance <= max_distance; ++distance) {
+          if (distance % kDeadlineCheckLines == 0 &&
+              dispatcher.DeadlineExceeded()) {
+            return;
+          }
+          if (cursor_row - distance >= 0) highlight_row(cursor_row - distance);
+          if (cursor_row + distance < line_count) {
+            highlight_row(cursor_row + distance);
+          }
         }
-      }
-    }
-  });
-  return result;
+      });
 }
 
-// Formatting example: center text.
-std::vector<TextEdit> HandleFormattingRequest(
-    const BufferCollection &buffers, const DocumentFormattingParams &p) {
-  const EditTextBuffer *buffer = buffers.findBufferByUri(p.textDocument.uri);
-  if (!buffer) return {};
+// Formatting example: center text. Edits are streamed to the client.
+void HandleFormattingRequest(const BufferCollection &buffers,
+                             const DocumentFormattingParams &p,
+                             const JsonRpcDispatcher::ElementEmitFun &emit) {
+  const auto buffer = buffers.findBufferByUri(p.textDocument.uri);
+  if (!buffer) return;
+  // Large files can only be formatted in ranges, huge ones not at all.
+  const BufferCollection::FeatureTier tier = buffers.TierOf(*buffer);
+  if (tier == BufferCollection::FeatureTier::kHuge) return;
+  if (tier == BufferCollection::FeatureTier::kLarge && !p.has_range) return;
 
-  std::vector<TextEdit> result;
-  buffer->RequestContent([&p, &result](absl::string_view content) {
-    const std::vector<absl::string_view> lines = absl::StrSplit(content, '\n');
-    const int start_line = p.has_range ? p.range.start.line : 0;
-    const int end_line = p.has_range ? p.range.end.line : (int)lines.size();
-    int longest_line = 0;
-    for (int i = start_line; i < end_line; ++i) {
-      absl::string_view just_text = absl::StripAsciiWhitespace(lines[i]);
-      longest_line = std::max(longest_line, (int)just_text.length());
-    }
-    for (int i = start_line; i < end_line; ++i) {
-      const absl::string_view line = lines[i];
-      const absl::string_view just_text = absl::StripAsciiWhitespace(line);
-      const int needs_spaces = (longest_line - just_text.length()) / 2;
-      result.emplace_back(TextEdit{
-          .range = {{i, 0}, {i, (int)(just_text.begin() - line.begin())}},
-          .newText = std::string(needs_spaces, ' '),
+  const int line_count = buffer->lines();
+  const int start_line = std::max(p.has_range ? p.range.start.line : 0, 0);
+  const int end_line =
+      std::min(p.has_range ? p.range.end.line : line_count, line_count);
+  buffer->RequestTokenizedLines(
+      end_line, [&](const EditTextBuffer::LineVector &lines) {
+        CenterLines(lines, start_line, end_line,
+                    [&](const TextEdit &edit) { emit(edit); });
       });
-    }
-  });
-  return result;
 }
 
-std::vector<DiagnosticFixPair> RunLint(const EditTextBuffer &buffer) {
-  // We complain about all words that are ... "wrong" :)
-  static constexpr absl::string_view kComplainWord = "wrong";
-  std::vector<DiagnosticFixPair> result;
-  buffer.RequestContent([&](absl::string_view content) {
-    int pos_line = 0;
-    for (absl::string_view line : absl::StrSplit(content, '\n')) {
-      size_t col = 0;
-      while ((col = line.find(kComplainWord, col)) != absl::string_view::npos) {
-        Range r = {{pos_line, (int)col},
-                   {pos_line, (int)(col + kComplainWord.length())}};
-        result.emplace_back(DiagnosticFixPair{
-            .diagnostic =
-                {
-                    .range = r,
-                    .message = "That word is wrong :)",
-                },
-            .fixes = {},
-        });
-        result.back().fixes.emplace_back(
-            TitledFix{.title = "Better Word",
-                      .edit = {{.range = r, .newText = "correct"}}});
-        result.back().fixes.emplace_back(
-            TitledFix{.title = "Ambiguous but same length",
-                      .edit = {{.range = r, .newText = "right"}}});
-        col += kComplainWord.length();
-      }
-      pos_line++;
-    }
-  });
+// Lint of large buffers stops after the findings that are published, so
+// only as much of the document is tokenized and linted as needed for these.
+static LintContext LintContextForTier(const LintContext &lint_context,
+                                      BufferCollection::FeatureTier tier) {
+  LintContext result = lint_context;
+  if (tier == BufferCollection::FeatureTier::kLarge) {
+    result.max_findings = kLargeFileMaxDiagnostics;
+  }
   return result;
 }
 
-void RunDiagnostics(const std::string &uri, const EditTextBuffer &buffer,
-                    JsonRpcDispatcher *dispatcher) {
+// Diagnostics to be published from the lint findings. Also to be
+// published if empty, as this is how the client learns that previous ones
+// are resolved. The diagnostics of large buffers are limited.
+static PublishDiagnosticsParams DiagnosticsFromLint(
+    const std::string &uri, BufferCollection::FeatureTier tier,
+    const std::vector<DiagnosticFixPair> &lint_result) {
   PublishDiagnosticsParams params;
   params.uri = uri;
-  const auto &lint_result = RunLint(buffer);
-  if (lint_result.empty()) return;
   for (const auto &fix_pair : lint_result) {
+    if (tier == BufferCollection::FeatureTier::kLarge &&
+        params.diagnostics.size() >= kLargeFileMaxDiagnostics) {
+      break;
+    }
     params.diagnostics.emplace_back(fix_pair.diagnostic);
   }
-  dispatcher->SendNotification("textDocument/publishDiagnostics", params);
+  return params;
+}
+
+// Lint buffer and return its diagnostics to be published. Huge buffers are
+// not linted.
+PublishDiagnosticsParams CreateDiagnostics(const std::string &uri,
+                                           const EditTextBuffer &buffer,
+                                           BufferCollection::FeatureTier tier,
+                                           const LintContext &lint_context) {
+  if (tier == BufferCollection::FeatureTier::kHuge) {
+    return DiagnosticsFromLint(uri, tier, {});
+  }
+  return DiagnosticsFromLint(
+      uri, tier, RunLint(buffer, LintContextForTier(lint_context, tier)));
 }
 
+// Lint requests to analyzer workers are the tier, the uri length, the uri,
+// then the document text. The text is appended line by line right from
+// the buffer into the shared memory.
+static bool SubmitLintRequest(const std::string &uri,
+                              const EditTextBuffer &buffer,
+                              BufferCollection::FeatureTier tier,
+                              AnalyzerWorkers *workers,
+                              const AnalyzerWorkers::ResultFun &done) {
+  const char tier_byte = static_cast<char>(tier);
+  const uint32_t uri_size = uri.size();
+  std::vector<absl::string_view> parts = {
+      {&tier_byte, 1},
+      {reinterpret_cast<const char *>(&uri_size), sizeof(uri_size)},
+      uri};
+  bool submitted = false;
+  // Lines without tokenizing; the worker does that.
+  buffer.RequestTokenizedLines(0, [&](const EditTextBuffer::LineVector &lines) {
+    parts.reserve(parts.size() + lines.size());
+    for (const auto &line : lines) parts.push_back(line->text());
+    submitted = workers->Submit(parts, done);
+  });
+  return submitted;
+}
+
+// Runs in the analyzer worker: lint and return the diagnostics as json.
+static std::string LintInWorker(absl::string_view request,
+                                const LintContext &lint_context) {
+  uint32_t uri_size;
+  if (request.size() < 1 + sizeof(uri_size)) {
+    throw std::invalid_argument("Short lint request");
+  }
+  const auto tier = static_cast<BufferCollection::FeatureTier>(request[0]);
+  memcpy(&uri_size, request.data() + 1, sizeof(uri_size));
+  request.remove_prefix(1 + sizeof(uri_size));
+  const std::string uri(request.substr(0, uri_size));
+  const EditTextBuffer buffer(request.substr(uri.size()));
+  return nlohmann::json(CreateDiagnostics(uri, buffer, tier, lint_context))
+      .dump();
+}
+
+// Find all regular files below "dir". Hidden files and directories, such as
+// .git, are skipped.
+static std::vector<std::filesystem::path> FindFilesBelow(
+    const std::string &dir, std::error_code *err) {
+  namespace fs = std::filesystem;
+  std::vector<fs::path> files;
+  fs::recursive_directory_iterator it(
+      dir, fs::directory_options::skip_permission_denied, *err);
+  const fs::recursive_directory_iterator end;
+  for (/**/; !*err && it != end; it.increment(*err)) {
+    if (it->path().filename().string()[0] == '.') {
+      it.disable_recursion_pending();
+      continue;
+    }
+    if (it->is_regular_file(*err)) files.push_back(it->path());
+  }
+  return files;
+}
+
+// Headless batch mode: run the lint on all files below "dir" without an
+// editor attached, e.g. in continuous integration. Files are analyzed in
+// parallel on all cores. For each file with findings, a line of json with
+// the same content as a textDocument/publishDiagnostics is printed.
+// Returns the exit code: kBatchClean, kBatchFindings or, if files could not
+// be read, kBatchError.
+static constexpr int kBatchClean = 0;
+static constexpr int kBatchFindings = 1;
+static constexpr int kBatchError = 2;
+int RunBatchAnalysis(const std::string &dir, const RegexLintRules *rules) {
+  namespace fs = std::filesystem;
+  const auto start_time = std::chrono::steady_clock::now();
+
+  std::error_code err;
+  const std::vector<fs::path> files = FindFilesBelow(dir, &err);
+  if (err) {
+    LSP_LOG(kError, dir, ": ", err.message());
+    return kBatchError;
+  }
+
+  // Results are kept by file index to print them in a stable order.
+  std::vector<std::string> results(files.size());
+  std::atomic<int64_t> bytes_processed{0};
+  ThreadPool pool;
+  std::vector<std::future<void>> work;
+  for (size_t i = 0; i < files.size(); ++i) {
+    work.emplace_back(pool.ExecAsync([&, i]() {
+      std::ifstream file(files[i], std::ios::binary);
+      if (!file) throw std::runtime_error("Can't open " + files[i].string());
+      std::stringstream content;
+      content << file.rdbuf();
+      const EditTextBuffer buffer(content.str());
+      bytes_processed += buffer.document_length();
+
+      PublishDiagnosticsParams params;
+      params.uri = "file://" + fs::absolute(files[i]).string();
+      // Files are already processed in parallel, so no parallel chunks
+      // (these would be waiting on the pool we're running on).
+      for (const auto &fix_pair : RunLint(buffer, {.rules = rules})) {
+        params.diagnostics.emplace_back(fix_pair.diagnostic);
+      }
+      if (!params.diagnostics.empty()) {
+        results[i] = nlohmann::json(params).dump();
+      }
+    }));
+  }
+  // All tasks have to finish before we leave, as they write to "results".
+  int failed = 0;
+  for (auto &w : work) {
+    try {
+      w.get();
+    } catch (const std::exception &e) {
+      LSP_LOG(kError, e.what());
+      ++failed;
+    }
+  }
+
+  int files_with_diagnostics = 0;
+  for (const std::string &r : results) {
+    if (r.empty()) continue;
+    std::cout << r << "\n";
+    ++files_with_diagnostics;
+  }
+  std::cout.flush();
+
+  const std::chrono::duration<double> duration =
+      std::chrono::steady_clock::now() - start_time;
+  fprintf(stderr,
+          "%zu files (%.1f MiB) in %.3fs with %d threads: %.1f files/s "
+          "(%.1f MiB/s); %d with diagnostics, %d failed.\n",
+          files.size(), bytes_processed / (1024.0 * 1024), duration.count(),
+          pool.thread_count(), files.size() / duration.count(),
+          bytes_processed / (1024.0 * 1024) / duration.count(),
+          files_with_diagnostics, failed);
+  if (rules) {
+    std::string stats;
+    AppendLintRuleStats(*rules, &stats);
+    fputs(stats.c_str(), stderr);
+  }
+  if (failed > 0) return kBatchError;
+  return files_with_diagnostics > 0 ? kBatchFindings : kBatchClean;
+}
+
+// Data derived from a document, memoized and only computed again after the
+// document changed. Keyed by uri.
+struct DocumentQueries {
+  QueryEngine::Query<std::vector<DiagnosticFixPair>> lint;
+  QueryEngine::Query<std::vector<DocumentSymbol>> symbols;
+};
+
 bool operator<(const Position &a, const Position &b) {
   if (a.line > b.line) return false;
   if (a.line < b.line) return true;
@@ -200,13 +407,35 @@ bool rangeOverlap(const Range &a, const Range &b) {
   return (a.start < b.end && b.start < a.end);
 }
 std::vector<CodeAction> HandleCodeAction(const BufferCollection &buffers,
+                                         QueryEngine *queries,
+                                         const DocumentQueries &query,
+                                         const LintContext &lint_context,
                                          const CodeActionParams &p) {
-  const EditTextBuffer *buffer = buffers.findBufferByUri(p.textDocument.uri);
+  const auto buffer = buffers.findBufferByUri(p.textDocument.uri);
   if (!buffer) return {};
-  const auto &lint_result = RunLint(*buffer);
-  if (lint_result.empty()) return {};
+  if (buffers.TierOf(*buffer) == BufferCollection::FeatureTier::kHuge) {
+    return {};
+  }
+
+  // Typically asked for the diagnostics just published, so the findings
+  // are already known. Unless these came from an analyzer worker or are
+  // not done yet: then only the lines asked for are linted, not the whole
+  // document.
+  auto lint_result = queries->GetIfMemoized(query.lint, p.textDocument.uri);
+  if (!lint_result) {
+    std::vector<DiagnosticFixPair> range_result;
+    buffer->RequestTokenizedLines(
+        p.range.end.line + 1, [&](const EditTextBuffer::LineVector &lines) {
+          const int first = std::max(0, p.range.start.line);
+          const int last = std::min(p.range.end.line + 1, (int)lines.size());
+          if (first >= last) return;
+          LintLines(lines, first, last, lint_context.rules, &range_result);
+        });
+    lint_result = std::make_shared<const std::vector<DiagnosticFixPair>>(
+        std::move(range_result));
+  }
   std::vector<CodeAction> result;
-  for (const auto &fix_pair : lint_result) {
+  for (const auto &fix_pair : *lint_result) {
     if (!rangeOverlap(fix_pair.diagnostic.range, p.range)) continue;
     bool preferred_fix = true;
     for (const auto &fix : fix_pair.fixes) {
@@ -233,25 +462,35 @@ enum class SymbolKind {
   // ...
 };
 
-std::vector<DocumentSymbol> HandleDocumentSymbol(
-    const BufferCollection &buffers, const DocumentSymbolParams &p) {
-  const EditTextBuffer *buffer = buffers.findBufferByUri(p.textDocument.uri);
+// Outline of the document; incomplete if the request runs out of time.
+static std::vector<DocumentSymbol> ComputeDocumentSymbols(
+    const BufferCollection &buffers, const JsonRpcDispatcher &dispatcher,
+    QueryEngine::Context *context, const std::string &uri) {
+  context->ReadInput(uri);
+  const auto buffer = buffers.findBufferByUri(uri);
   if (!buffer) return {};
+  if (buffers.TierOf(*buffer) != BufferCollection::FeatureTier::kFull) {
+    return {};  // Outline of a large file is not of much use anyway.
+  }
   std::vector<DocumentSymbol> result;
-  buffer->RequestContent([&p, &result, buffer](absl::string_view content) {
-    int line_no = 0;
+  buffer->RequestTokenizedLines([&](const EditTextBuffer::LineVector &lines) {
     result.emplace_back(
       DocumentSymbol{.name = "All the things",
         .kind = static_cast<int>(SymbolKind::File),
-        .range = {{0, 0}, {(int)buffer->lines(), 0}},
-        .selectionRange = {{0, 0}, {(int)buffer->lines(), 0}},
+        .range = {{0, 0}, {(int)lines.size(), 0}},
+        .selectionRange = {{0, 0}, {(int)lines.size(), 0}},
         .children = nlohmann::json::array(),
         .has_children = true
       });
     nlohmann::json &append_to = result.back().children;
-    for (absl::string_view line : absl::StrSplit(content, '\n')) {
-      for (absl::string_view word : absl::StrSplit(line, ' ')) {
-        const int col = word.data() - line.data();
+    for (int line_no = 0; line_no < (int)lines.size(); ++line_no) {
+      if (line_no % kDeadlineCheckLines == 0 && dispatcher.DeadlineExceeded()) {
+        context->SetIncomplete();
+        break;  // Out of time; the symbols found so far have to do.
+      }
+      const EditTextBuffer::Line &line = *lines[line_no];
+      for (absl::string_view word : line.tokens()) {
+        const int col = word.data() - line.text().data();
         const int eow = col + word.length();
         if (word == "world") {
           append_to.push_back(
@@ -273,38 +512,583 @@ std::vector<DocumentSymbol> HandleDocumentSymbol(
                 .has_children = false,
               });
         }
-
       }
-      ++line_no;
     }
   });
   return result;
 }
 
+DocumentQueries AddDocumentQueries(const BufferCollection &buffers,
+                                   const JsonRpcDispatcher &dispatcher,
+                                   const LintContext &lint_context,
+                                   QueryEngine *queries) {
+  DocumentQueries result;
+  result.lint = queries->AddQuery<std::vector<DiagnosticFixPair>>(
+      "lint", [&](QueryEngine::Context *context, const std::string &uri) {
+        context->ReadInput(uri);
+        const auto buffer = buffers.findBufferByUri(uri);
+        if (!buffer) return std::vector<DiagnosticFixPair>();
+        const auto tier = buffers.TierOf(*buffer);
+        if (tier == BufferCollection::FeatureTier::kHuge) {
+          return std::vector<DiagnosticFixPair>();
+        }
+        return RunLint(*buffer, LintContextForTier(lint_context, tier));
+      });
+  result.symbols = queries->AddQuery<std::vector<DocumentSymbol>>(
+      "documentSymbol",
+      [&](QueryEngine::Context *context, const std::string &uri) {
+        return ComputeDocumentSymbols(buffers, dispatcher, context, uri);
+      });
+  return result;
+}
+
+// Matches returned by $/bare-lsp/search if the client doesn't limit it.
+static constexpr int kDefaultMaxSearchResults = 1000;
+
+// Custom request $/bare-lsp/search: find text in all open buffers and,
+// if a workspace root is given, in all files below it that are not open.
+// Every buffer and file is searched as separate unit of work in parallel on
+// the thread pool; results are emitted unit by unit in a stable order.
+// With a partialResultToken, the matches of each unit are sent as $/progress
+// notification as soon as they are available and the final result is empty.
+// The search stops once the maximum number of results is reached or the
+// request runs out of time; which matches make it into such truncated
+// result depends on timing.
+void HandleTextSearch(const BufferCollection &buffers, ThreadPool *pool,
+                      const TextSearchParams &p,
+                      const JsonRpcDispatcher::ElementEmitFun &emit,
+                      JsonRpcDispatcher *dispatcher) {
+  namespace fs = std::filesystem;
+  TextSearch search;
+  const absl::Status status =
+      search.Init(p.query, p.has_isRegex && p.isRegex,
+                  !p.has_caseSensitive || p.caseSensitive);
+  if (!status.ok()) throw std::invalid_argument(std::string(status.message()));
+  const int max_results =
+      p.has_maxResults ? p.maxResults : kDefaultMaxSearchResults;
+
+  struct SearchUnit {
+    std::string uri;
+    std::string content;  // Snapshot of the open buffer or ...
+    fs::path file;        // ... file to read content from if not empty.
+    std::vector<TextSearchMatch> matches;
+  };
+  std::vector<SearchUnit> units;
+  buffers.MapAllBuffers(
+      [&](const std::string &uri, const EditTextBuffer &buffer) {
+        SearchUnit &unit = units.emplace_back();
+        unit.uri = uri;
+        buffer.RequestContent([&](absl::string_view content) {
+          unit.content.assign(content.data(), content.size());
+        });
+      });
+  std::sort(units.begin(), units.end(),
+            [](const SearchUnit &a, const SearchUnit &b) {
+              return a.uri < b.uri;
+            });
+  if (p.has_workspaceRoot) {
+    const std::string root(absl::StripPrefix(p.workspaceRoot, "file://"));
+    std::error_code err;
+    for (const fs::path &file : FindFilesBelow(root, &err)) {
+      std::string uri = "file://" + fs::absolute(file).string();
+      if (buffers.findBufferByUri(uri)) continue;  // Already searched.
+      SearchUnit &unit = units.emplace_back();
+      unit.uri = std::move(uri);
+      unit.file = file;
+    }
+    if (err) throw std::invalid_argument(root + ": " + err.message());
+  }
+
+  std::atomic<int> result_count{0};
+  std::atomic<bool> cancelled{false};
+  std::vector<std::future<void>> work;
+  for (SearchUnit &unit : units) {
+    work.emplace_back(pool->ExecAsync([&]() {
+      if (cancelled || result_count >= max_results) return;
+      if (!unit.file.empty()) {
+        std::ifstream file(unit.file, std::ios::binary);
+        std::stringstream content;
+        content << file.rdbuf();
+        unit.content = content.str();
+        // Like grep, don't bother reporting matches in binary files.
+        static constexpr size_t kBinaryCheckLength = 8192;
+        if (memchr(unit.content.data(), '\0',
+                   std::min(unit.content.size(), kBinaryCheckLength))) {
+          unit.content.clear();
+        }
+      }
+      search.Search(unit.content, [&](const TextSearch::Match &m) {
+        if (cancelled || result_count.fetch_add(1) >= max_results) {
+          return false;
+        }
+        TextSearchMatch &match = unit.matches.emplace_back();
+        match.uri = unit.uri;
+        match.range = {{m.line, m.start}, {m.line, m.end}};
+        match.lineText = std::string(absl::StripSuffix(m.line_text, "\r"));
+        return true;
+      });
+      std::string().swap(unit.content);  // Done with snapshot.
+    }));
+  }
+
+  // Units are done in order while we emit their matches; once out of
+  // time, the remaining ones stop early. The tasks refer to our locals, so
+  // whichever way we leave, all of them have to be finished.
+  static constexpr std::chrono::milliseconds kDeadlineCheckInterval(10);
+  try {
+    for (size_t i = 0; i < units.size(); ++i) {
+      while (work[i].wait_for(kDeadlineCheckInterval) !=
+             std::future_status::ready) {
+        if (dispatcher->DeadlineExceeded()) cancelled = true;
+      }
+      work[i].get();
+      const std::vector<TextSearchMatch> &matches = units[i].matches;
+      if (matches.empty()) continue;
+      if (p.has_partialResultToken) {
+        dispatcher->SendNotification(
+            "$/progress",
+            {{"token", p.partialResultToken}, {"value", matches}});
+        std::cout.flush();  // Get partial results to the client right away.
+      } else {
+        for (const TextSearchMatch &match : matches) emit(match);
+      }
+    }
+  } catch (...) {
+    cancelled = true;
+    for (auto &w : work) {
+      if (w.valid()) w.wait();
+    }
+    throw;
+  }
+}
+
+// Content-Types of the binary encodings the JsonRpcDispatcher understands.
+// Tooling clients can choose these instead of JSON text to cut down on
+// serialization overhead; without Content-Type header, JSON is assumed.
+static constexpr absl::string_view kCborContentType = "application/cbor";
+static constexpr absl::string_view kMessagePackContentType =
+    "application/msgpack";
+
+static JsonRpcDispatcher::Encoding EncodingFromHeader(
+    absl::string_view header) {
+  const absl::string_view content_type =
+      MessageStreamSplitter::GetHeaderValue(header, "Content-Type");
+  if (content_type == kCborContentType) {
+    return JsonRpcDispatcher::Encoding::kCbor;
+  }
+  if (content_type == kMessagePackContentType) {
+    return JsonRpcDispatcher::Encoding::kMessagePack;
+  }
+  return JsonRpcDispatcher::Encoding::kJson;
+}
+
+// Message shown to the user when a buffer changes its feature tier.
+static std::string FeatureTierMessage(const std::string &uri,
+                                      BufferCollection::FeatureTier tier) {
+  switch (tier) {
+    case BufferCollection::FeatureTier::kLarge:
+      return uri +
+             ": Large file. Highlights only around cursor, formatting only "
+             "of ranges, no outline, limited number of diagnostics.";
+    case BufferCollection::FeatureTier::kHuge:
+      return uri + ": Huge file. Language features are switched off.";
+    default:
+      return uri + ": All language features available again.";
+  }
+}
+
+// The main loop might wait without timeout; signal handlers setting flags
+// write to this pipe to wake it up.
+static int signal_wakeup_fd = -1;
+static void WakeUpMainLoop() {
+  const int saved_errno = errno;
+  if (signal_wakeup_fd >= 0 && write(signal_wakeup_fd, "", 1) < 0) {
+    // Pipe full: a wakeup is pending anyway.
+  }
+  errno = saved_errno;
+}
+
+// Set by SIGHUP: replace ourselves with the binary found at the original
+// path, handing over state. Acted upon once we're done with the current
+// batch of input.
+static volatile sig_atomic_t hot_restart_requested = 0;
+static void RequestHotRestart(int) {
+  hot_restart_requested = 1;
+  WakeUpMainLoop();
+}
+
+// Set by SIGUSR1: write profile collected so far.
+static volatile sig_atomic_t profile_write_requested = 0;
+static void RequestProfileWrite(int) {
+  profile_write_requested = 1;
+  WakeUpMainLoop();
+}
+
+// Record of recent messages for post-mortem analysis. Truncated payload
+// starting at the parameters if we can find them.
+static void RecordMessage(const JsonRpcDispatcher::MessageTrace &trace,
+                          FlightRecorder *recorder) {
+  const size_t params_pos = trace.message.find("\"params\"");
+  const absl::string_view payload = (params_pos == absl::string_view::npos)
+                                        ? trace.message
+                                        : trace.message.substr(params_pos);
+  recorder->Record({.method = trace.method,
+                    .id = trace.id ? trace.id->dump() : "",
+                    .payload = payload,
+                    .message_bytes = trace.message.size(),
+                    .response_bytes = trace.response_bytes,
+                    .parse_time = trace.parse_time,
+                    .handle_time = trace.handle_time,
+                    .write_time = trace.write_time});
+}
+
+static void WriteProfile(SamplingProfiler *profiler,
+                         const char *profile_file) {
+  std::ofstream out(profile_file);
+  profiler->WriteFolded(&out);
+  if (!out.good()) LSP_LOG(kError, "Can't write profile to ", profile_file);
+}
+
+// Redirects a stream to another buffer while in scope; the original buffer
+// is restored on every way out, before the redirected-to one is gone.
+class ScopedStreamRedirect {
+ public:
+  ScopedStreamRedirect(std::ostream *stream, std::streambuf *buffer)
+      : stream_(stream), original_(stream->rdbuf(buffer)) {}
+  ScopedStreamRedirect(const ScopedStreamRedirect &) = delete;
+  ~ScopedStreamRedirect() { stream_->rdbuf(original_); }
+
+ private:
+  std::ostream *const stream_;
+  std::streambuf *const original_;
+};
+
+static constexpr int kDefaultSlowRequestMs = 2000;
+
+static int usage(const char *progname) {
+  fprintf(stderr,
+          "Usage: %s [options]\n"
+          "Options:\n"
+          "  --ndjson      : Messages framed as newline-delimited JSON\n"
+          "                  instead of Content-Length headers.\n"
+          "                  For scripted clients.\n"
+          "  --batch <dir> : No editor interaction; analyze all files in\n"
+          "                  <dir> and print diagnostics as json lines.\n"
+          "                  Exit code 1 if there are findings, 2 if\n"
+          "                  files could not be read.\n"
+          "  --lint-rules <file> : Additional lint rules. One regular\n"
+          "                  expression per line, followed by tab and the\n"
+          "                  message to report.\n"
+          "  --large-file-bytes <n> : Buffers larger than this are large\n"
+          "                  files with limited features; %d times larger\n"
+          "                  are huge files without language features.\n"
+          "                  Default %ld.\n"
+          "  --large-file-lines <n> : Same, for number of lines.\n"
+          "                  Default %zu.\n"
+          "  --profile <file> : Sample where CPU time goes, attributed to\n"
+          "                  the method handled. Written as folded stacks\n"
+          "                  for flamegraph.pl on exit and on SIGUSR1.\n"
+          "  --flight-recorder <file> : Where to dump the record of recent\n"
+          "                  messages and their timing; on SIGUSR2, slow\n"
+          "                  requests and crash. Default $TMPDIR/bare-lsp-<pid>"
+          ".flight\n"
+          "  --slow-request-ms <n> : Requests taking longer are slow.\n"
+          "                  Default %d.\n"
+          "  --log-file <file> : Log there instead of stderr. Rotated when\n"
+          "                  it gets larger than 10MiB.\n"
+          "  --metrics-socket <path> : Serve OpenMetrics on this unix\n"
+          "                  domain socket, e.g. for a Prometheus scraper.\n"
+          "  --analyzer-workers <n> : Run lint in <n> worker processes, so\n"
+          "                  that a crash in it doesn't end the session.\n"
+          "  --shared-memory <channel> : Exchange messages with a client on\n"
+          "                  the same machine through the shared memory it\n"
+          "                  created, instead of stdin/stdout. Ends when\n"
+          "                  stdin is closed.\n"
+          "Sending SIGHUP restarts the server binary (e.g. after upgrade)\n"
+          "keeping open buffers; uses internal --restore-state <fd>.\n",
+          progname, BufferCollection::kHugeFactor,
+          BufferCollection::SizeThresholds().large_bytes,
+          BufferCollection::SizeThresholds().large_lines,
+          kDefaultSlowRequestMs);
+  return 1;
+}
+
 int main(int argc, char *argv[]) {
-  std::cerr << "Greetings! bare-lsp started.\n";
+  bool newline_delimited = false;
+  const char *batch_dir = nullptr;
+  std::unique_ptr<RegexLintRules> lint_rules;
+  BufferCollection::SizeThresholds size_thresholds;
+  int restore_state_fd = -1;
+  const char *profile_file = nullptr;
+  std::string flight_recorder_file;
+  std::string log_file;
+  std::string metrics_socket;
+  int analyzer_worker_count = 0;
+  std::string analyzer_worker_channel;  // Set if we are a worker.
+  std::string shared_memory_channel;
+  int slow_request_ms = kDefaultSlowRequestMs;
+  std::vector<std::string> restart_args = {argv[0]};  // Without restore fd.
+  for (int i = 1; i < argc; ++i) {
+    const absl::string_view arg = argv[i];
+    if (arg == "--restore-state" && i + 1 < argc) {
+      if (!absl::SimpleAtoi(argv[++i], &restore_state_fd)) {
+        return usage(argv[0]);
+      }
+      continue;
+    }
+    restart_args.push_back(argv[i]);
+    if (arg == "--ndjson") {
+      newline_delimited = true;
+    } else if (arg == "--batch" && i + 1 < argc) {
+      batch_dir = argv[++i];
+    } else if (arg == "--lint-rules" && i + 1 < argc) {
+      const char *rule_file = argv[++i];
+      restart_args.push_back(rule_file);
+      std::ifstream file(rule_file);
+      if (!file.good()) {
+        fprintf(stderr, "Can't read lint rules from %s\n", rule_file);
+        return 1;
+      }
+      std::stringstream content;
+      content << file.rdbuf();
+      if (!lint_rules) lint_rules.reset(new RegexLintRules());
+      if (auto status = lint_rules->ParseRules(content.str()); !status.ok()) {
+        fprintf(stderr, "%s: %s\n", rule_file,
+                std::string(status.message()).c_str());
+        return 1;
+      }
+    } else if (arg == "--profile" && i + 1 < argc) {
+      profile_file = argv[++i];
+      restart_args.push_back(profile_file);
+    } else if (arg == "--log-file" && i + 1 < argc) {
+      log_file = argv[++i];
+      restart_args.push_back(log_file);
+    } else if (arg == "--flight-recorder" && i + 1 < argc) {
+      flight_recorder_file = argv[++i];
+      restart_args.push_back(flight_recorder_file);
+    } else if (arg == "--metrics-socket" && i + 1 < argc) {
+      metrics_socket = argv[++i];
+      restart_args.push_back(metrics_socket);
+    } else if (arg == "--analyzer-workers" && i + 1 < argc) {
+      restart_args.push_back(argv[++i]);
+      if (!absl::SimpleAtoi(argv[i], &analyzer_worker_count)) {
+        return usage(argv[0]);
+      }
+    } else if (arg == "--shared-memory" && i + 1 < argc) {
+      shared_memory_channel = argv[++i];
+      restart_args.push_back(shared_memory_channel);
+    } else if (arg == "--analyzer-worker-channel" && i + 1 < argc) {
+      analyzer_worker_channel = argv[++i];
+    } else if (arg == "--slow-request-ms" && i + 1 < argc) {
+      restart_args.push_back(argv[++i]);
+      if (!absl::SimpleAtoi(argv[i], &slow_request_ms)) {
+        return usage(argv[0]);
+      }
+    } else if (arg == "--large-file-bytes" && i + 1 < argc) {
+      restart_args.push_back(argv[++i]);
+      if (!absl::SimpleAtoi(argv[i], &size_thresholds.large_bytes)) {
+        return usage(argv[0]);
+      }
+    } else if (arg == "--large-file-lines" && i + 1 < argc) {
+      restart_args.push_back(argv[++i]);
+      if (!absl::SimpleAtoi(argv[i], &size_thresholds.large_lines)) {
+        return usage(argv[0]);
+      }
+    } else {
+      return usage(argv[0]);
+    }
+  }
+
+  if (batch_dir) {
+    return RunBatchAnalysis(batch_dir, lint_rules.get());
+  }
+
+  if (!analyzer_worker_channel.empty()) {
+    const LintContext worker_lint_context = {.rules = lint_rules.get(),
+                                             .thread_pool = nullptr};
+    return AnalyzerWorkers::RunWorker(
+        analyzer_worker_channel, [&](absl::string_view request) {
+          return LintInWorker(request, worker_lint_context);
+        });
+  }
+
+  int signal_wakeup_pipe[2];
+  if (pipe2(signal_wakeup_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("pipe2()");
+    return 1;
+  }
+  signal_wakeup_fd = signal_wakeup_pipe[1];
+
+  // Remember now: on restart, the file might be replaced by a new version.
+  const std::string self_binary = CurrentExecutablePath();
+  signal(SIGHUP, RequestHotRestart);
 
-  // Input and output is stdin and stdout
+  // Messages are written by a background thread, so that a storm of
+  // errors can't stall our loop.
+  Logger logger({.path = log_file});
+  Logger::SetDefault(&logger);
+
+  LSP_LOG(kInfo, "Greetings! bare-lsp ",
+          (restore_state_fd >= 0 ? "restarted" : "started"), ".");
+
+  // A co-located client might talk to us through shared memory; same
+  // stream of messages, just no pipe in between. All output goes there.
+  std::unique_ptr<SharedMemoryTransport> shared_memory;
+  std::optional<ScopedStreamRedirect> stdout_redirect;
+  if (!shared_memory_channel.empty()) {
+    const absl::Status status =
+        SharedMemoryTransport::Attach(shared_memory_channel, &shared_memory);
+    if (!status.ok()) {
+      LSP_LOG(kError, "Shared memory: ", status.message());
+      return 1;
+    }
+    stdout_redirect.emplace(&std::cout, shared_memory->output_buffer());
+  }
+
+  // Input and output is stdin and stdout. Output is not flushed per message
+  // but once per batch of input processed (or idle-time diagnostics sent).
   static constexpr int in_fd = STDIN_FILENO;
-  JsonRpcDispatcher::WriteFun write_fun = [](absl::string_view reply) {
+  static constexpr int out_fd = STDOUT_FILENO;
+
+  // Large enough to open documents that end up in the huge tier.
+  MessageStreamSplitter stream_splitter(
+      1 << 20,
+      newline_delimited ? MessageStreamSplitter::Framing::kNewlineDelimited
+                        : MessageStreamSplitter::Framing::kContentLength,
+      size_thresholds.max_message_bytes());
+
+  // Replies are in the encoding the client talked to us last.
+  JsonRpcDispatcher dispatcher([&](absl::string_view reply) {
+    if (newline_delimited) {
+      std::cout << reply;  // Already a single line of compact json.
+      return;
+    }
     // Output formatting as header/body chunk as required by LSP spec.
-    std::cout << "Content-Length: " << reply.size() << "\r\n\r\n";
-    std::cout << reply << std::flush;
-  };
+    std::cout << "Content-Length: " << reply.size() << "\r\n";
+    switch (dispatcher.encoding()) {
+      case JsonRpcDispatcher::Encoding::kCbor:
+        std::cout << "Content-Type: " << kCborContentType << "\r\n";
+        break;
+      case JsonRpcDispatcher::Encoding::kMessagePack:
+        std::cout << "Content-Type: " << kMessagePackContentType << "\r\n";
+        break;
+      default:
+        break;
+    }
+    std::cout << "\r\n" << reply;
+  });
 
-  MessageStreamSplitter stream_splitter(1 << 20);
-  JsonRpcDispatcher dispatcher(write_fun);
+  // Without header, large results can be written while they are produced.
+  if (newline_delimited) {
+    dispatcher.SetChunkWriter([](absl::string_view chunk) {
+      std::cout.write(chunk.data(), chunk.size());
+    });
+  }
 
   // All bodies the stream splitter extracts are pushed to the json dispatcher
   stream_splitter.SetMessageProcessor(
-      [&dispatcher](absl::string_view /*header*/, absl::string_view body) {
-        return dispatcher.DispatchMessage(body);
+      [&](absl::string_view header, absl::string_view body) {
+        return dispatcher.DispatchMessage(body, EncodingFromHeader(header));
       });
 
   // The buffer collection keeps track of all the buffers opened in the editor
   // passes edit events it receives from the dispatcher to it.
   BufferCollection buffers(&dispatcher);
 
+  // Derived data is invalidated with each change of a document; closed
+  // documents are forgotten, including their timing for diagnostics.
+  QueryEngine queries;
+  DebounceScheduler debounce_scheduler;
+  buffers.SetChangeListener(
+      [&](const std::string &uri, const EditTextBuffer &,
+          const EditTextBuffer::ChangeBatch &) {
+        if (buffers.findBufferByUri(uri)) {
+          queries.InputChanged(uri);
+        } else {
+          queries.Forget(uri);  // Closed.
+          debounce_scheduler.Forget(uri);
+        }
+      });
+  buffers.set_size_thresholds(size_thresholds);
+
+  // Let the user know if features are limited due to the size of a file.
+  static constexpr int kMessageTypeInfo = 3;
+  buffers.SetTierChangeListener(
+      [&](const std::string &uri, BufferCollection::FeatureTier tier) {
+        dispatcher.SendNotification(
+            "window/showMessage",
+            ShowMessageParams{.type = kMessageTypeInfo,
+                              .message = FeatureTierMessage(uri, tier)});
+      });
+
+  // Very large buffers are linted and searches are run in parallel on all
+  // cores.
+  ThreadPool thread_pool;
+  const LintContext lint_context = {
+      .rules = lint_rules.get(),
+      .thread_pool = &thread_pool,
+  };
+  const DocumentQueries document_queries =
+      AddDocumentQueries(buffers, dispatcher, lint_context, &queries);
+
+  // Only switched on on request; samples are attributed to the method
+  // handled at the time.
+  std::unique_ptr<SamplingProfiler> profiler;
+  if (profile_file) {
+    profiler = std::make_unique<SamplingProfiler>();
+    if (auto status = profiler->Start(); !status.ok()) {
+      LSP_LOG(kError, status.message());
+      return 1;
+    }
+    dispatcher.SetMethodObserver(&SamplingProfiler::SetTag);
+    signal(SIGUSR1, RequestProfileWrite);
+  }
+
+  // Always keep a record of the recent messages. If a request is slow,
+  // dump it right away, but not more often than every few seconds.
+  if (flight_recorder_file.empty()) {
+    const char *tmpdir = getenv("TMPDIR");
+    flight_recorder_file = absl::StrCat(tmpdir ? tmpdir : "/tmp", "/bare-lsp-",
+                                        getpid(), ".flight");
+  }
+  FlightRecorder flight_recorder;
+  flight_recorder.DumpOnCrash(flight_recorder_file.c_str());
+  flight_recorder.DumpOnSignal(SIGUSR2, flight_recorder_file.c_str());
+  static constexpr std::chrono::seconds kSlowDumpInterval(10);
+  std::chrono::steady_clock::time_point last_slow_dump;
+  // Metrics by registered method only, so that clients can't create an
+  // unbounded number of series.
+  static constexpr char kUnhandledMethod[] = "[unhandled]";
+  OpenMetricsText::LabeledValues messages_handled;
+  OpenMetricsText::LabeledHistograms request_latency;
+  dispatcher.SetMessageTraceListener(
+      [&](const JsonRpcDispatcher::MessageTrace &trace) {
+        RecordMessage(trace, &flight_recorder);
+        const auto duration =
+            trace.parse_time + trace.handle_time + trace.write_time;
+        ++messages_handled[trace.handler ? trace.handler : kUnhandledMethod];
+        if (trace.id && trace.handler) {
+          auto found = request_latency.find(trace.handler);
+          if (found == request_latency.end()) {
+            found = request_latency
+                        .emplace(trace.handler,
+                                 Histogram(Histogram::LatencyBounds()))
+                        .first;
+          }
+          found->second.Observe(
+              std::chrono::duration<double>(duration).count());
+        }
+        if (duration < std::chrono::milliseconds(slow_request_ms)) return;
+        const auto now = std::chrono::steady_clock::now();
+        if (now - last_slow_dump < kSlowDumpInterval) return;
+        last_slow_dump = now;
+        flight_recorder.DumpToFile(flight_recorder_file.c_str());
+        LSP_LOG(kWarning, "Slow ", trace.method, ": ",
+                std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+                    .count(),
+                "ms. Recent messages in ", flight_recorder_file);
+      });
+
   // Exchange of capabilities.
   dispatcher.AddRequestHandler("initialize", InitializeServer);
   bool client_initialized = false;
@@ -330,81 +1114,610 @@ int main(int argc, char *argv[]) {
                                [&buffers](const HoverParams &p) {
                                  return HandleHoverRequest(buffers, p);
                                });
-  dispatcher.AddRequestHandler("textDocument/formatting",
-                               [&buffers](const DocumentFormattingParams &p) {
-                                 return HandleFormattingRequest(buffers, p);
-                               });
-  dispatcher.AddRequestHandler("textDocument/rangeFormatting",
-                               [&buffers](const DocumentFormattingParams &p) {
-                                 return HandleFormattingRequest(buffers, p);
-                               });
-  dispatcher.AddRequestHandler("textDocument/documentHighlight",
-                               [&buffers](const DocumentHighlightParams &p) {
-                                 return HandleHighlightRequest(buffers, p);
-                               });
-  dispatcher.AddRequestHandler("textDocument/codeAction",
-                               [&buffers](const CodeActionParams &p) {
-                                 return HandleCodeAction(buffers, p);
-                               });
-  dispatcher.AddRequestHandler("textDocument/documentSymbol",
-                               [&buffers](const DocumentSymbolParams &p) {
-                                 return HandleDocumentSymbol(buffers, p);
-                               });
+  dispatcher.AddStreamingRequestHandler(
+      "textDocument/formatting",
+      [&buffers](const DocumentFormattingParams &p,
+                 const JsonRpcDispatcher::ElementEmitFun &emit) {
+        HandleFormattingRequest(buffers, p, emit);
+      });
+  dispatcher.AddStreamingRequestHandler(
+      "textDocument/rangeFormatting",
+      [&buffers](const DocumentFormattingParams &p,
+                 const JsonRpcDispatcher::ElementEmitFun &emit) {
+        HandleFormattingRequest(buffers, p, emit);
+      });
+  dispatcher.AddStreamingRequestHandler(
+      "textDocument/documentHighlight",
+      [&](const DocumentHighlightParams &p,
+          const JsonRpcDispatcher::ElementEmitFun &emit) {
+        HandleHighlightRequest(buffers, dispatcher, p, emit);
+      });
+  dispatcher.AddRequestHandler(
+      "textDocument/codeAction",
+      [&](const CodeActionParams &p) {
+        return HandleCodeAction(buffers, &queries, document_queries,
+                                lint_context, p);
+      });
+  dispatcher.AddRequestHandler(
+      "textDocument/documentSymbol", [&](const DocumentSymbolParams &p) {
+        return *queries.Get(document_queries.symbols, p.textDocument.uri);
+      });
+
+  // Requests that block the user interface rather return partial results
+  // than keep the user waiting.
+  static constexpr std::chrono::milliseconds kInteractiveDeadline(50);
+  dispatcher.SetRequestDeadline("textDocument/documentHighlight",
+                                kInteractiveDeadline);
+  dispatcher.SetRequestDeadline("textDocument/documentSymbol",
+                                kInteractiveDeadline);
+  // Searching a large workspace might take a while, but not forever.
+  static constexpr std::chrono::seconds kSearchDeadline(10);
+  dispatcher.SetRequestDeadline("$/bare-lsp/search", kSearchDeadline);
+  dispatcher.AddStreamingRequestHandler(
+      "$/bare-lsp/search",
+      [&](const TextSearchParams &p,
+          const JsonRpcDispatcher::ElementEmitFun &emit) {
+        HandleTextSearch(buffers, &thread_pool, p, emit, &dispatcher);
+      });
 
   /* For the actual processing, we want to do extra diagnostics in idle time
    * whenever we don't get updates for a while (i.e. user stopped typing)
    * and use that to analyze things that don't need immediage attention (e.g.
-   * linting warnings).
+   * linting warnings). How long to wait is decided per buffer by the
+   * DebounceScheduler, depending on typing cadence and cost of linting.
    *
    * Using a simple event manager that watches the input stream and calls
    * on idle is achieving this task and will also allow us to work
    * single-threaded easily.
    */
-  static constexpr int kIdleTimeoutMs = 300;
-  FileEventDispatcher file_multiplexer(kIdleTimeoutMs);
+  FileEventDispatcher file_multiplexer;
 
-  // Whenever there is something to read from stdin, feed our message
-  // to the stream splitter which will in turn call the JSON rpc dispatcher
-  file_multiplexer.RunOnReadable(in_fd, [&]() {
-    auto status = stream_splitter.PullFrom([&](char *buf, int size) -> int {  //
-      return read(in_fd, buf, size);
-    });
-    if (!status.ok()) std::cerr << status.message() << "\n";
-    return status.ok() && !shutdown_requested;
+  // Worker processes are the same binary, started with the channel to
+  // talk to us; the other options tell them e.g. which lint rules to use.
+  AnalyzerWorkers analyzer_workers(
+      analyzer_worker_count, [&](const std::string &channel) {
+        std::vector<std::string> args = restart_args;
+        args.push_back("--analyzer-worker-channel");
+        args.push_back(channel);
+        const absl::Status status = ExecBinary(self_binary, args);
+        fprintf(stderr, "Analyzer worker: %s\n",  // Logger is not forked.
+                std::string(status.message()).c_str());
+        _exit(1);
+      });
+  if (auto status = analyzer_workers.Start(&file_multiplexer); !status.ok()) {
+    LSP_LOG(kError, "Analyzer workers: ", status.message());
+  }
+
+  // Diagnostics are not written right away, but queued and sent one at a
+  // time whenever stdout is ready to take more. So if the client is slow
+  // reading, we don't block on output but continue to receive edits; the
+  // diagnostics of a buffer that are superseded by newer ones while still
+  // waiting in the queue are dropped.
+  CoalescingNotificationQueue diagnostics_queue;
+  bool diagnostics_sending = false;  // Writable handler is registered.
+  const FileEventDispatcher::Handler send_diagnostics = [&]() {
+    if (shutdown_requested) return (diagnostics_sending = false);
+    diagnostics_queue.SendPending(
+        [&](const std::string &method, const nlohmann::json &params) {
+          dispatcher.SendNotification(method, params);
+        });
+    std::cout.flush();
+    return (diagnostics_sending = diagnostics_queue.depth() > 0);
+  };
+  // Through shared memory, no file descriptor tells when the client made
+  // room in the ring. Diagnostics are sent while the ring has plenty of
+  // space; otherwise we check again when idle, every kRingSpacePollMs.
+  static constexpr size_t kDiagnosticsRingSpace =
+      SharedMemoryTransport::kRingCapacity / 2;
+  static constexpr int kRingSpacePollMs = 5;
+  const auto start_sending_diagnostics = [&]() {
+    if (shared_memory) {
+      while (diagnostics_queue.depth() > 0 && !shutdown_requested &&
+             shared_memory->output_space() >= kDiagnosticsRingSpace) {
+        send_diagnostics();
+      }
+      return;
+    }
+    if (!diagnostics_sending && diagnostics_queue.depth() > 0) {
+      diagnostics_sending =
+          file_multiplexer.RunOnWritable(out_fd, send_diagnostics);
+    }
+  };
+
+  // Lint in process runs on a copy of the document in the background, on
+  // the strand of that document, so that edits and requests are handled
+  // meanwhile and the lint runs of a document don't overtake each other.
+  // Separate pool, as lint itself might use the other one. Results are
+  // handed back to be published from our loop, like those of the analyzer
+  // workers.
+  std::mutex lint_done_mutex;
+  std::vector<std::function<void()>> lint_done;  // Guarded by lint_done_mutex
+  int lint_done_pipe[2];
+  if (pipe2(lint_done_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+    perror("pipe2()");
+    return 1;
+  }
+  file_multiplexer.RunOnReadable(lint_done_pipe[0], [&]() {
+    char drain[64];
+    while (read(lint_done_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+    std::vector<std::function<void()>> ready;
+    {
+      const std::lock_guard<std::mutex> l(lint_done_mutex);
+      ready.swap(lint_done);
+    }
+    for (const auto &publish : ready) publish();
+    return true;
   });
+  ThreadPool strand_pool;
+  StrandExecutor document_strands(&strand_pool);  // Before what it uses.
+
+  // Results of lint arrive asynchronously, possibly out of order. Only the
+  // latest request for a document is published.
+  using Clock = DebounceScheduler::Clock;
+  std::unordered_map<std::string, uint64_t> latest_lint;
+  uint64_t lint_count = 0;
+
+  const auto lint_in_process = [&](const std::string &uri) {
+    const auto buffer = buffers.findBufferByUri(uri);
+    if (!buffer) return;
+    const uint64_t request = ++lint_count;
+    latest_lint[uri] = request;
+    const auto tier = buffers.TierOf(*buffer);
+    const int64_t version = buffer->last_global_version();
+    std::string content;  // Huge buffers are not linted.
+    if (tier != BufferCollection::FeatureTier::kHuge) {
+      buffer->RequestContent([&](absl::string_view text) {
+        content.assign(text.data(), text.size());
+      });
+    }
+    document_strands.ExecAsync(uri, [&, uri, request, tier, version,
+                                     content = std::move(content)]() {
+      const Clock::time_point lint_start = Clock::now();
+      std::vector<DiagnosticFixPair> lint_result;
+      std::string error;
+      try {
+        if (tier != BufferCollection::FeatureTier::kHuge) {
+          lint_result = RunLint(EditTextBuffer(content),
+                                LintContextForTier(lint_context, tier));
+        }
+      } catch (const std::exception &e) {
+        error = e.what();
+      }
+      const auto findings =
+          std::make_shared<const std::vector<DiagnosticFixPair>>(
+              std::move(lint_result));
+      const Clock::duration cost = Clock::now() - lint_start;
+      const auto publish = [&, uri, request, tier, version, findings, error,
+                            cost]() {
+        auto latest = latest_lint.find(uri);
+        if (latest == latest_lint.end() || latest->second != request) {
+          return;  // Outdated or closed.
+        }
+        latest_lint.erase(latest);
+        if (!error.empty()) {
+          LSP_LOG(kWarning, "Lint of ", uri, " failed: ", error);
+          return;
+        }
+        // Saves code actions from linting again, unless edited meanwhile.
+        const auto buffer = buffers.findBufferByUri(uri);
+        if (buffer && buffer->last_global_version() == version) {
+          queries.Memoize(document_queries.lint, uri, findings);
+        }
+        debounce_scheduler.RecordLintCost(uri, cost);
+        diagnostics_queue.Enqueue(uri, "textDocument/publishDiagnostics",
+                                  DiagnosticsFromLint(uri, tier, *findings));
+        start_sending_diagnostics();
+      };
+      {
+        const std::lock_guard<std::mutex> l(lint_done_mutex);
+        lint_done.push_back(publish);
+      }
+      if (write(lint_done_pipe[1], "", 1) < 0) {
+        // Pipe full: the loop is about to pick up results anyway.
+      }
+    });
+  };
+
+  const auto lint_in_worker = [&](const std::string &uri) {
+    const auto buffer = buffers.findBufferByUri(uri);
+    const auto tier = buffers.TierOf(*buffer);
+    if (tier == BufferCollection::FeatureTier::kHuge) return false;
+    const uint64_t request = ++lint_count;
+    const Clock::time_point submitted = Clock::now();
+    const auto done = [&, uri, request, submitted](const absl::Status &status,
+                                                   absl::string_view result) {
+      auto latest = latest_lint.find(uri);
+      if (latest == latest_lint.end() || latest->second != request) {
+        return;  // Outdated or closed.
+      }
+      latest_lint.erase(latest);
+      nlohmann::json diagnostics;
+      if (status.ok()) {
+        diagnostics = nlohmann::json::parse(result, nullptr,
+                                            /*allow_exceptions=*/false);
+      }
+      if (!status.ok() || diagnostics.is_discarded()) {
+        LSP_LOG(kWarning, "Lint of ", uri, " in worker failed: ",
+                status.ok() ? "malformed result" : status.message());
+        lint_in_process(uri);
+        return;
+      }
+      debounce_scheduler.RecordLintCost(uri, Clock::now() - submitted);
+      diagnostics_queue.Enqueue(uri, "textDocument/publishDiagnostics",
+                                std::move(diagnostics));
+      start_sending_diagnostics();
+    };
+    if (!SubmitLintRequest(uri, *buffer, tier, &analyzer_workers, done)) {
+      return false;
+    }
+    latest_lint[uri] = request;
+    return true;
+  };
 
-  // Run diagnostics in idle time, but make sure to only look at buffers that
-  // have changed since our last visit.
+  // Let the scheduler know about buffers that have changed since our last
+  // visit, and start diagnostics of those that are due.
   int64_t last_version_processed = 0;
-  file_multiplexer.RunOnIdle([&]() {
-    if (!client_initialized) return true;
+  const auto run_due_diagnostics = [&]() {
+    const Clock::time_point now = Clock::now();
     buffers.MapBuffersChangedSince(
         last_version_processed,
-        [&](const std::string &uri, const EditTextBuffer &buffer) {
-          RunDiagnostics(uri, buffer, &dispatcher);
+        [&](const std::string &uri, const EditTextBuffer &) {
+          debounce_scheduler.RecordEdit(uri, now);
         });
     last_version_processed = buffers.global_version();
+    if (!client_initialized) return;
+
+    for (const std::string &uri : debounce_scheduler.TakeDue(now)) {
+      if (!buffers.findBufferByUri(uri)) {  // Closed in the meantime.
+        debounce_scheduler.Forget(uri);
+        latest_lint.erase(uri);
+        continue;
+      }
+      if (!lint_in_worker(uri)) lint_in_process(uri);
+    }
+  };
+
+  // Hot restart: hand over buffers and input not processed yet to a fresh
+  // instance of our binary that continues on the same stdin/stdout. Token
+  // caches are rebuilt on demand; as all restored buffers count as changed,
+  // diagnostics still queued are re-created and published by the new process.
+  const auto hot_restart = [&]() {
+    hot_restart_requested = 0;
+    std::cout.flush();
+    if (profiler) {
+      // The profiling timer survives exec(), our SIGPROF handler doesn't.
+      profiler->Stop();
+      WriteProfile(profiler.get(), profile_file);
+    }
+    logger.Flush();  // Writer thread is gone after exec().
+    analyzer_workers.Shutdown();  // New process starts its own.
+    const absl::string_view pending = stream_splitter.pending_data();
+    const nlohmann::json state = {
+        {"buffers", buffers.GetState()},
+        {"client_initialized", client_initialized},
+        {"pending_input", nlohmann::json::binary(std::vector<uint8_t>(
+                              pending.begin(), pending.end()))},
+        // Input of the current chunk that went to pending_input already.
+        {"shared_memory_read_offset",
+         shared_memory ? shared_memory->read_offset() : 0},
+    };
+    const std::vector<uint8_t> state_bytes = nlohmann::json::to_cbor(state);
+    int state_fd;
+    absl::Status status = CreateStateMemfd(
+        {reinterpret_cast<const char *>(state_bytes.data()),
+         state_bytes.size()},
+        &state_fd);
+    if (status.ok()) {
+      std::vector<std::string> args = restart_args;
+      args.push_back("--restore-state");
+      args.push_back(std::to_string(state_fd));
+      status = ExecBinary(self_binary, args);  // Only returns on failure.
+      close(state_fd);
+    }
+    LSP_LOG(kError, "Hot restart failed: ", status.message());
+  };
+
+  if (restore_state_fd >= 0) {
+    const auto start = std::chrono::steady_clock::now();
+    std::string state_bytes;
+    if (auto status = ReadStateFromFd(restore_state_fd, &state_bytes);
+        !status.ok()) {
+      LSP_LOG(kError, status.message());
+      return 1;
+    }
+    const nlohmann::json state = nlohmann::json::from_cbor(state_bytes);
+    buffers.RestoreState(state.at("buffers"));
+    client_initialized = state.at("client_initialized");
+    if (shared_memory) {
+      shared_memory->set_read_offset(
+          state.value("shared_memory_read_offset", size_t{0}));
+    }
+    const auto &pending = state.at("pending_input").get_binary();
+    // Feed to splitter as if it was just read, at most as much per call as
+    // the splitter asks for.
+    size_t pending_offset = 0;
+    while (pending_offset < pending.size()) {
+      const absl::Status status =
+          stream_splitter.PullFrom([&](char *buf, int size) -> int {
+            const size_t chunk =
+                std::min(pending.size() - pending_offset, (size_t)size);
+            memcpy(buf, pending.data() + pending_offset, chunk);
+            pending_offset += chunk;
+            return chunk;
+          });
+      if (!status.ok()) {
+        LSP_LOG(kWarning, status.message());
+        break;
+      }
+    }
+    LSP_LOG(kInfo, "Restored ", buffers.documents_open(), " buffers in ",
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start)
+                .count(),
+            "ms");
+  }
+
+  const auto write_requested_dumps = [&]() {
+    if (profile_write_requested && profiler) {
+      profile_write_requested = 0;
+      WriteProfile(profiler.get(), profile_file);
+    }
+  };
+
+  // Metrics are collected only when scraped, so this costs nothing
+  // otherwise.
+  MetricsServer metrics_server([&]() {
+    return CollectMetrics(stream_splitter, dispatcher, buffers,
+                          diagnostics_queue, logger, messages_handled,
+                          request_latency);
+  });
+  if (!metrics_socket.empty()) {
+    if (auto status = metrics_server.Listen(metrics_socket, &file_multiplexer);
+        !status.ok()) {
+      LSP_LOG(kError, status.message());
+    }
+  }
+
+  // After each chunk of input the stream splitter has passed on to the
+  // JSON rpc dispatcher. Returns if we want more.
+  const auto input_processed = [&](const absl::Status &status) {
+    std::cout.flush();
+    if (absl::IsUnavailable(status)) {  // Regular end of input.
+      LSP_LOG(kInfo, status.message());
+    } else if (!status.ok()) {
+      LSP_LOG(kWarning, status.message());
+    }
+    // A client sending without pause would never let us get to idle.
+    run_due_diagnostics();
+    write_requested_dumps();
+    if (hot_restart_requested && status.ok()) hot_restart();
+    const bool output_broken = !std::cout.good();
+    if (output_broken) LSP_LOG(kError, "Can't write to client.");
+    if (!status.ok() || shutdown_requested || output_broken) {
+      file_multiplexer.Stop();  // Metrics socket alone doesn't keep us.
+      return false;
+    }
+    return true;
+  };
+
+  // Whenever there is something to read from stdin, feed our message
+  // to the stream splitter which will in turn call the JSON rpc dispatcher
+  if (!shared_memory) {
+    file_multiplexer.RunOnReadable(in_fd, [&]() {
+      return input_processed(
+          stream_splitter.PullFrom([&](char *buf, int size) -> int {  //
+            return read(in_fd, buf, size);
+          }));
+    });
+  } else {
+    file_multiplexer.RunOnReadable(shared_memory->read_fd(), [&]() {
+      const absl::Status status =
+          stream_splitter.PullFrom([&](char *buf, int size) -> int {  //
+            return shared_memory->Read(buf, size);
+          });
+      shared_memory->WatchInput();
+      return input_processed(status);
+    });
+    shared_memory->WatchInput();
+
+    // The client keeps stdin open while it is there, so we notice if it
+    // goes away without closing the stream.
+    file_multiplexer.RunOnReadable(in_fd, [&]() {
+      char ignored[256];
+      if (read(in_fd, ignored, sizeof(ignored)) > 0) return true;
+      LSP_LOG(kInfo, "Client closed stdin.");
+      file_multiplexer.Stop();
+      return false;
+    });
+  }
+
+  const auto on_idle = [&]() {
+    run_due_diagnostics();
+    if (shared_memory) start_sending_diagnostics();
+    write_requested_dumps();
+    if (hot_restart_requested && !shutdown_requested) hot_restart();
     return true;
+  };
+  file_multiplexer.RunOnIdle(on_idle);
+  file_multiplexer.RunOnReadable(signal_wakeup_pipe[0], [&]() {
+    char drain[64];
+    while (read(signal_wakeup_pipe[0], drain, sizeof(drain)) > 0) {
+    }
+    return on_idle();
+  });
+
+  // Only wake up when the next diagnostics are due; otherwise wait for
+  // input or a signal.
+  file_multiplexer.SetIdleTimeout([&]() {
+    if (buffers.global_version() != last_version_processed) return 0;
+    const int ring_space_poll =  // Diagnostics waiting for the ring.
+        (shared_memory && diagnostics_queue.depth() > 0) ? kRingSpacePollMs
+                                                         : -1;
+    DebounceScheduler::Clock::time_point due;
+    if (!client_initialized || !debounce_scheduler.NextDue(&due)) {
+      return ring_space_poll;
+    }
+    const auto wait = std::chrono::ceil<std::chrono::milliseconds>(
+        due - DebounceScheduler::Clock::now());
+    const int due_ms = std::max(0, (int)wait.count());
+    return ring_space_poll < 0 ? due_ms : std::min(due_ms, ring_space_poll);
   });
 
   file_multiplexer.Loop();
 
-  PrintStats(stream_splitter, dispatcher);
+  if (shared_memory) {
+    if (const absl::Status status = shared_memory->CloseWrite(); !status.ok()) {
+      LSP_LOG(kWarning, "Shared memory: ", status.message());
+    }
+    stdout_redirect.reset();
+  }
+
+  if (profiler) {
+    profiler->Stop();
+    WriteProfile(profiler.get(), profile_file);
+  }
+
+  std::string stats;
+  AppendStats(stream_splitter, dispatcher, diagnostics_queue, &stats);
+  AppendDebounceStats(debounce_scheduler, &stats);
+  if (lint_rules) AppendLintRuleStats(*lint_rules, &stats);
+  AppendLoggerStats(logger, &stats);
+  if (analyzer_worker_count > 0) {
+    AppendAnalyzerWorkerStats(analyzer_workers, &stats);
+  }
+  AppendQueryStats(queries, &stats);
+  LSP_LOG(kInfo, "Statistics\n", stats);
   return 0;
 }
 
-void PrintStats(const MessageStreamSplitter &source,
-                const JsonRpcDispatcher &server) {
-  fprintf(stderr, "--------------- Statistic Counters Stats ---------------\n");
-  fprintf(stderr, "Total bytes : %9ld\n", source.StatTotalBytesRead());
-  fprintf(stderr, "Largest body: %9ld\n", source.StatLargestBodySeen());
+// printf()-style formatting appended to "out".
+static void AppendF(std::string *out, const char *format, ...)
+    __attribute__((format(printf, 2, 3)));
+static void AppendF(std::string *out, const char *format, ...) {
+  char buffer[1024];
+  va_list ap;
+  va_start(ap, format);
+  const int len = vsnprintf(buffer, sizeof(buffer), format, ap);
+  va_end(ap);
+  if (len > 0) out->append(buffer, std::min<int>(len, sizeof(buffer) - 1));
+}
 
-  fprintf(stderr, "\n--- Methods called ---\n");
+void AppendStats(const MessageStreamSplitter &source,
+                 const JsonRpcDispatcher &server,
+                 const CoalescingNotificationQueue &diagnostics_queue,
+                 std::string *out) {
+  AppendF(out, "--------------- Statistic Counters Stats ---------------\n");
+  AppendF(out, "Total bytes : %9ld\n", source.StatTotalBytesRead());
+  AppendF(out, "Largest body: %9ld\n", source.StatLargestBodySeen());
+
+  AppendF(out, "\n--- Methods called ---\n");
   int longest = 0;
   for (const auto &stats : server.GetStatCounters()) {
     longest = std::max(longest, (int)stats.first.length());
   }
   for (const auto &stats : server.GetStatCounters()) {
-    fprintf(stderr, "%*s %9d\n", longest, stats.first.c_str(), stats.second);
+    AppendF(out, "%*s %9d\n", longest, stats.first.c_str(), stats.second);
   }
+
+  AppendF(out, "\n--- Diagnostics queue ---\n");
+  AppendF(out, "Queued    : %9ld\n", diagnostics_queue.StatEnqueued());
+  AppendF(out, "Superseded: %9ld\n", diagnostics_queue.StatSuperseded());
+  AppendF(out, "Max depth : %9zu\n", diagnostics_queue.StatMaxDepth());
+  AppendF(out, "Left over : %9zu\n", diagnostics_queue.depth());
+}
+
+void AppendDebounceStats(const DebounceScheduler &scheduler, std::string *out) {
+  const int64_t lint_runs =
+      scheduler.StatDueRightAway() + scheduler.StatDueAfterPause();
+  AppendF(out, "\n--- Diagnostics debounce ---\n");
+  AppendF(out, "Right away  : %9ld\n", scheduler.StatDueRightAway());
+  AppendF(out, "After pause : %9ld\n", scheduler.StatDueAfterPause());
+  AppendF(out, "Average (ms): %9ld\n",
+          lint_runs ? scheduler.StatTotalDebounce().count() / lint_runs : 0);
+}
+
+void AppendLintRuleStats(const RegexLintRules &rules, std::string *out) {
+  AppendF(out, "\n--- Lint rules ---\n");
+  AppendF(out, "Bytes scanned: %9ld\n", rules.StatBytesScanned());
+  for (size_t i = 0; i < rules.rule_count(); ++i) {
+    AppendF(out, "%9ld %s\n", rules.StatMatchCount(i),
+            rules.pattern(i).c_str());
+  }
+}
+
+void AppendLoggerStats(const Logger &logger, std::string *out) {
+  AppendF(out, "\n--- Logging ---\n");
+  AppendF(out, "Written   : %9lu\n", logger.StatWritten());
+  AppendF(out, "Dropped   : %9lu\n", logger.StatDropped());
+  AppendF(out, "Suppressed: %9lu\n", logger.StatSuppressed());
+}
+
+void AppendAnalyzerWorkerStats(const AnalyzerWorkers &workers,
+                               std::string *out) {
+  AppendF(out, "\n--- Analyzer workers ---\n");
+  AppendF(out, "Completed : %9ld\n", workers.StatCompleted());
+  AppendF(out, "Failed    : %9ld\n", workers.StatFailed());
+  AppendF(out, "Restarts  : %9d\n", workers.StatRestarts());
+  AppendF(out, "Timeouts  : %9ld\n", workers.StatTimeouts());
+}
+
+void AppendQueryStats(const QueryEngine &queries, std::string *out) {
+  AppendF(out, "\n--- Queries (computed / reused) ---\n");
+  for (const auto &stats : queries.GetStats()) {
+    AppendF(out, "%-14s %9ld %9ld\n", stats.first.c_str(),
+            stats.second.computed, stats.second.reused);
+  }
+}
+
+std::string CollectMetrics(const MessageStreamSplitter &source,
+                           const JsonRpcDispatcher &server,
+                           const BufferCollection &buffers,
+                           const CoalescingNotificationQueue &diagnostics_queue,
+                           const Logger &logger,
+                           const OpenMetricsText::LabeledValues &messages,
+                           const OpenMetricsText::LabeledHistograms &latency) {
+  OpenMetricsText metrics;
+  metrics.AddCounter("lsp_input_bytes", "Bytes read from the client.",
+                     source.StatTotalBytesRead());
+  metrics.AddGauge("lsp_largest_message_bytes", "Largest message body seen.",
+                   source.StatLargestBodySeen());
+
+  // Not the human-readable GetStatCounters(), as these contain exception
+  // messages and method names sent by the client.
+  metrics.AddCounter("lsp_messages", "Messages received by method.", "method",
+                     messages);
+  metrics.AddCounter("lsp_exceptions", "Exceptions thrown in handlers.",
+                     server.exception_count());
+  metrics.AddCounter("lsp_degraded_responses",
+                     "Responses cut short by their deadline.",
+                     server.degraded_count());
+  metrics.AddHistogram("lsp_request_duration_seconds",
+                       "Time from receiving a request to its response.",
+                       "method", latency);
+
+  int64_t buffer_bytes = 0;
+  buffers.MapAllBuffers([&](const std::string &, const EditTextBuffer &buffer) {
+    buffer_bytes += buffer.document_length();
+  });
+  metrics.AddGauge("lsp_documents_open", "Open documents.",
+                   buffers.documents_open());
+  metrics.AddGauge("lsp_document_bytes", "Bytes in all open documents.",
+                   buffer_bytes);
+
+  metrics.AddGauge("lsp_diagnostics_queue_depth",
+                   "Diagnostics waiting to be sent.",
+                   diagnostics_queue.depth());
+  metrics.AddCounter("lsp_diagnostics_enqueued", "Diagnostics queued.",
+                     diagnostics_queue.StatEnqueued());
+  metrics.AddCounter("lsp_diagnostics_superseded",
+                     "Diagnostics replaced before being sent.",
+                     diagnostics_queue.StatSuperseded());
+
+  metrics.AddCounter("lsp_log_messages_written", "Log messages written.",
+                     logger.StatWritten());
+  metrics.AddCounter("lsp_log_messages_dropped",
+                     "Log messages dropped as the writer fell behind.",
+                     logger.StatDropped());
+  return metrics.Finish();
 }
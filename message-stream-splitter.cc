@@ -14,6 +14,12 @@
 
 #include "message-stream-splitter.h"
 
+#include <string.h>
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/match.h>
+#include <absl/strings/str_split.h>
+
 absl::Status MessageStreamSplitter::PullFrom(const ReadFun &read_fun) {
   if (!message_processor_) {
     return absl::FailedPreconditionError(
@@ -52,11 +58,25 @@ int MessageStreamSplitter::ParseHeaderGetBodyOffset(absl::string_view data,
   return end_of_header + kEndHeaderMarker.size();
 }
 
+/*static*/ absl::string_view MessageStreamSplitter::GetHeaderValue(
+    absl::string_view header, absl::string_view key) {
+  for (absl::string_view line : absl::StrSplit(header, "\r\n")) {
+    if (line.size() <= key.size() || line[key.size()] != ':') continue;
+    if (!absl::EqualsIgnoreCase(line.substr(0, key.size()), key)) continue;
+    return absl::StripAsciiWhitespace(line.substr(key.size() + 1));
+  }
+  return {};
+}
+
 // Read from data and process all fully available messages found in data.
 // Updates "data" to return the remaining unprocessed data.
 // Returns ok() status encountered a corrupted header.
 absl::Status MessageStreamSplitter::ProcessContainedMessages(
     absl::string_view *data) {
+  if (framing_ == Framing::kNewlineDelimited) {
+    ProcessContainedLines(data);
+    return absl::OkStatus();
+  }
   while (!data->empty()) {
     int body_size = 0;
     const int body_offset = ParseHeaderGetBodyOffset(*data, &body_size);
@@ -67,9 +87,10 @@ absl::Status MessageStreamSplitter::ProcessContainedMessages(
           absl::StrCat("No `Content-Length:` header. '", limited_view, "...'"));
     }
 
-    const int message_size = body_offset + body_size;
-    if (body_offset == kIncompleteHeader ||
-        message_size > static_cast<int>(data->size())) {
+    if (body_offset == kIncompleteHeader) return absl::OkStatus();
+    const size_t message_size = (size_t)body_offset + std::max(0, body_size);
+    if (message_size > data->size()) {
+      incomplete_message_size_ = message_size;
       return absl::OkStatus();  // Only insufficient partial buffer available.
     }
 
@@ -84,9 +105,30 @@ absl::Status MessageStreamSplitter::ProcessContainedMessages(
   return absl::OkStatus();
 }
 
+// Newline delimited messages: each complete line is a message body.
+// Finding the end of line is just a memchr(), which is vectorized in libc.
+void MessageStreamSplitter::ProcessContainedLines(absl::string_view *data) {
+  const char *const end = data->data() + data->size();
+  const char *line_start = data->data();
+  const char *eol;
+  while ((eol = (const char *)memchr(line_start, '\n', end - line_start))) {
+    absl::string_view body(line_start, eol - line_start);
+    if (!body.empty() && body.back() == '\r') body.remove_suffix(1);
+    if (!body.empty()) {  // Be lenient with empty lines in between.
+      message_processor_({}, body);
+      stats_largest_body_ = std::max(stats_largest_body_, body.size());
+    }
+    line_start = eol + 1;
+  }
+  *data = {line_start, static_cast<size_t>(end - line_start)};
+}
+
 // Read from "read_fun", fill internal buffer and call all available
 // complete messages in it.
 absl::Status MessageStreamSplitter::ReadInput(const ReadFun &read_fun) {
+  if (auto status = ResizeReadBufferForPendingData(); !status.ok()) {
+    return status;
+  }
   char *begin_of_read = read_buffer_.get();
   int available_read_space = read_buffer_size_;
 
@@ -120,6 +162,7 @@ absl::Status MessageStreamSplitter::ReadInput(const ReadFun &read_fun) {
   stats_total_bytes_read_ += bytes_read;
 
   absl::string_view data(read_buffer_.get(), pending_data_.size() + bytes_read);
+  incomplete_message_size_ = 0;
   if (auto status = ProcessContainedMessages(&data); !status.ok()) {
     return status;
   }
@@ -128,3 +171,31 @@ absl::Status MessageStreamSplitter::ReadInput(const ReadFun &read_fun) {
 
   return absl::OkStatus();
 }
+
+// Grow the read buffer if the message we're in the middle of doesn't fit;
+// shrink it back once done with large messages.
+absl::Status MessageStreamSplitter::ResizeReadBufferForPendingData() {
+  size_t wanted = read_buffer_size_;
+  if (incomplete_message_size_ > read_buffer_size_) {
+    wanted = incomplete_message_size_;
+  } else if (pending_data_.size() == read_buffer_size_) {
+    // Size not known yet, e.g. still no end of header or line.
+    wanted = std::min(2 * read_buffer_size_, max_read_buffer_size_);
+  } else if (pending_data_.size() < initial_read_buffer_size_ &&
+             incomplete_message_size_ <= initial_read_buffer_size_) {
+    wanted = initial_read_buffer_size_;
+  }
+  if (wanted > max_read_buffer_size_) {
+    return absl::ResourceExhaustedError(
+        absl::StrCat("Message of ", wanted, " bytes exceeds maximum of ",
+                     max_read_buffer_size_, " bytes"));
+  }
+  if (wanted == read_buffer_size_) return absl::OkStatus();
+
+  std::unique_ptr<char[]> resized(new char[wanted]);
+  memcpy(resized.get(), pending_data_.data(), pending_data_.size());
+  pending_data_ = {resized.get(), pending_data_.size()};
+  read_buffer_ = std::move(resized);
+  read_buffer_size_ = wanted;
+  return absl::OkStatus();
+}
@@ -15,6 +15,7 @@
 #ifndef MESSAGE_STREAM_SPLITTER_H
 #define MESSAGE_STREAM_SPLITTER_H
 
+#include <algorithm>
 #include <functional>
 #include <memory>
 #include <string>
@@ -37,8 +38,17 @@
 // The simplest implementation of the "ReadFun" just wraps a system read() call.
 //
 // The header data MUST contain a Content-Length header.
+//
+// Alternatively, for scripted clients, messages can be framed as
+// newline-delimited JSON (NDJSON): one message per line, no header.
 class MessageStreamSplitter {
  public:
+  // How messages are delimited in the stream.
+  enum class Framing {
+    kContentLength,     // Header with Content-Length, then body (LSP default)
+    kNewlineDelimited,  // One message per line. Header passed is empty.
+  };
+
   // A function that reads from some source and writes up to "size" bytes
   // into the buffer. Returns the number of bytes read.
   // Blocks until there is content or returns '0' on end-of-file. Values
@@ -53,10 +63,18 @@ class MessageStreamSplitter {
   using MessageProcessFun =
       std::function<void(absl::string_view header, absl::string_view body)>;
 
-  // Read using an internal buffer of "read_buffer_size", which must be larger
-  // than the largest expected message.
-  explicit MessageStreamSplitter(size_t read_buffer_size)
-      : read_buffer_size_(read_buffer_size),
+  // Read using an internal buffer of "read_buffer_size". It grows for
+  // larger messages up to "max_read_buffer_size", which must be larger than
+  // the largest expected message, and shrinks back once they're processed.
+  // By default, the buffer does not grow.
+  explicit MessageStreamSplitter(size_t read_buffer_size,
+                                 Framing framing = Framing::kContentLength,
+                                 size_t max_read_buffer_size = 0)
+      : initial_read_buffer_size_(read_buffer_size),
+        max_read_buffer_size_(
+            std::max(read_buffer_size, max_read_buffer_size)),
+        framing_(framing),
+        read_buffer_size_(read_buffer_size),
         read_buffer_(new char[read_buffer_size]) {}
   MessageStreamSplitter(const MessageStreamSplitter &) = delete;
 
@@ -81,10 +99,20 @@ class MessageStreamSplitter {
   // Code
   //  - kUnavailable     : regular EOF, no data pending. A 'good' non-ok status.
   //  - kDataloss        : got EOF, but still incomplete data pending.
-  //  - kResourceExhausted: Buffer size chosen in constructor is not sufficient.
+  //  - kResourceExhausted: Message larger than max buffer size in constructor.
   //  - kInvalidargument : stream corrupted, couldn't read header.
   absl::Status PullFrom(const ReadFun &read_fun);
 
+  // Utility function for message processors: find value of header with
+  // given key (such as "Content-Type") in the header block passed to the
+  // MessageProcessFun. Returns empty string_view if not found.
+  static absl::string_view GetHeaderValue(absl::string_view header,
+                                          absl::string_view key);
+
+  // Data already read, but not forming a complete message yet. Valid until
+  // the next call to PullFrom().
+  absl::string_view pending_data() const { return pending_data_; }
+
   // -- Statistical data
 
   size_t StatLargestBodySeen() const { return stats_largest_body_; }
@@ -93,11 +121,20 @@ class MessageStreamSplitter {
  private:
   static int ParseHeaderGetBodyOffset(absl::string_view data, int *body_size);
   absl::Status ProcessContainedMessages(absl::string_view *data);
+  void ProcessContainedLines(absl::string_view *data);
   absl::Status ReadInput(const ReadFun &read_fun);
+  absl::Status ResizeReadBufferForPendingData();
 
-  const size_t read_buffer_size_;
+  const size_t initial_read_buffer_size_;
+  const size_t max_read_buffer_size_;
+  const Framing framing_;
+  size_t read_buffer_size_;
   std::unique_ptr<char[]> read_buffer_;
 
+  // Size of the message pending_data_ starts with, if known from its header
+  // but not complete yet. Zero otherwise.
+  size_t incomplete_message_size_ = 0;
+
   MessageProcessFun message_processor_;
 
   size_t stats_largest_body_ = 0;
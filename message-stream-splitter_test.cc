@@ -20,6 +20,8 @@
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <string>
+#include <vector>
 
 using ::testing::HasSubstr;
 
@@ -104,6 +106,53 @@ TEST(MessageStreamSplitterTest, BufferSizeTooSmall) {
   EXPECT_EQ(processor_call_count, 0);
 }
 
+TEST(MessageStreamSplitterTest, BufferGrowsForLargerMessagesUpToMax) {
+  const std::string large_body(1000, 'x');
+  const std::string small_body = "foo";
+  DataStreamSimulator stream(
+      absl::StrCat("Content-Length: 1000\r\n\r\n", large_body,
+                   "Content-Length: 3\r\n\r\n", small_body,
+                   "Content-Length: 3000\r\n\r\n", std::string(3000, 'y')),
+      100);
+  MessageStreamSplitter s(64, MessageStreamSplitter::Framing::kContentLength,
+                          2000);
+  std::vector<std::string> bodies;
+  s.SetMessageProcessor([&](absl::string_view header, absl::string_view body) {
+    bodies.emplace_back(body);
+  });
+
+  absl::Status status = absl::OkStatus();
+  while (status.ok()) {
+    status =
+        s.PullFrom([&](char *buf, int size) { return stream.read(buf, size); });
+  }
+
+  // Last message exceeds the maximum; known as soon as its header is read.
+  EXPECT_EQ(status.code(), absl::StatusCode::kResourceExhausted);
+  EXPECT_THAT(status.message(), HasSubstr("3024"));
+  EXPECT_EQ(bodies, std::vector<std::string>({large_body, small_body}));
+}
+
+TEST(MessageStreamSplitterTest, NewlineDelimitedBufferGrowsForLongLines) {
+  const std::string long_line(1000, 'x');
+  DataStreamSimulator stream(absl::StrCat(long_line, "\nfoo\n"));
+  MessageStreamSplitter s(
+      64, MessageStreamSplitter::Framing::kNewlineDelimited, 1024);
+  std::vector<std::string> bodies;
+  s.SetMessageProcessor([&](absl::string_view header, absl::string_view body) {
+    bodies.emplace_back(body);
+  });
+
+  absl::Status status = absl::OkStatus();
+  while (status.ok()) {
+    status =
+        s.PullFrom([&](char *buf, int size) { return stream.read(buf, size); });
+  }
+
+  EXPECT_EQ(status.code(), absl::StatusCode::kUnavailable);
+  EXPECT_EQ(bodies, std::vector<std::string>({long_line, "foo"}));
+}
+
 TEST(MessageStreamSplitterTest, StreamDoesNotContainCompleteData) {
   static constexpr absl::string_view kHeader = "Content-Length: 3\r\n\r\n";
   static constexpr absl::string_view kBody = "fo";  // <- too short
@@ -212,3 +261,79 @@ TEST(MessageStreamSplitterTest, GarbledSizeInContentHeader) {
   EXPECT_THAT(status.message(), HasSubstr("header"));
   EXPECT_EQ(processor_call_count, 0);
 }
+
+TEST(MessageStreamSplitterTest, GetHeaderValue) {
+  static constexpr absl::string_view kHeader =
+      "Content-Length: 3\r\n"
+      "content-type:application/cbor \r\n\r\n";
+  EXPECT_EQ(MessageStreamSplitter::GetHeaderValue(kHeader, "Content-Length"),
+            "3");
+  // Keys are case insensitive, surrounding whitespace is removed.
+  EXPECT_EQ(MessageStreamSplitter::GetHeaderValue(kHeader, "Content-Type"),
+            "application/cbor");
+  EXPECT_TRUE(
+      MessageStreamSplitter::GetHeaderValue(kHeader, "Content").empty());
+  EXPECT_TRUE(MessageStreamSplitter::GetHeaderValue(kHeader, "Foo").empty());
+}
+
+TEST(MessageStreamSplitterTest, NewlineDelimitedMessages) {
+  static constexpr absl::string_view kBody[3] = {"foo", "bar", "baz"};
+
+  // Mixed line endings and an empty line in between are fine.
+  DataStreamSimulator stream(
+      absl::StrCat(kBody[0], "\n", kBody[1], "\r\n\n", kBody[2], "\n"));
+  MessageStreamSplitter s(4096,
+                          MessageStreamSplitter::Framing::kNewlineDelimited);
+  int processor_call_count = 0;
+  s.SetMessageProcessor([&](absl::string_view header, absl::string_view body) {
+    EXPECT_TRUE(header.empty());
+    EXPECT_EQ(std::string(body), kBody[processor_call_count]);
+    ++processor_call_count;
+  });
+  auto status =
+      s.PullFrom([&](char *buf, int size) { return stream.read(buf, size); });
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(processor_call_count, 3);
+}
+
+TEST(MessageStreamSplitterTest, NewlineDelimitedMessagesShortRead) {
+  static constexpr absl::string_view kBody[2] = {"foo", "bar"};
+  static constexpr int kTrickleReadSize = 2;
+
+  DataStreamSimulator stream(absl::StrCat(kBody[0], "\n", kBody[1], "\n"),
+                             kTrickleReadSize);
+  MessageStreamSplitter s(4096,
+                          MessageStreamSplitter::Framing::kNewlineDelimited);
+  int processor_call_count = 0;
+  s.SetMessageProcessor([&](absl::string_view header, absl::string_view body) {
+    EXPECT_EQ(std::string(body), kBody[processor_call_count]);
+    ++processor_call_count;
+  });
+
+  absl::Status status = absl::OkStatus();
+  while (status.ok()) {
+    status =
+        s.PullFrom([&](char *buf, int size) { return stream.read(buf, size); });
+  }
+
+  EXPECT_EQ(status.code(), absl::StatusCode::kUnavailable);  // EOF
+  EXPECT_EQ(processor_call_count, 2);
+}
+
+TEST(MessageStreamSplitterTest, NewlineDelimitedIncompleteLastLine) {
+  DataStreamSimulator stream("foo\nbar");  // <- no newline at end.
+  MessageStreamSplitter s(4096,
+                          MessageStreamSplitter::Framing::kNewlineDelimited);
+  int processor_call_count = 0;
+  s.SetMessageProcessor(
+      [&](absl::string_view, absl::string_view) { ++processor_call_count; });
+
+  absl::Status status = absl::OkStatus();
+  while (status.ok()) {
+    status =
+        s.PullFrom([&](char *buf, int size) { return stream.read(buf, size); });
+  }
+
+  EXPECT_EQ(status.code(), absl::StatusCode::kDataLoss);
+  EXPECT_EQ(processor_call_count, 1);
+}
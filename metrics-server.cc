@@ -0,0 +1,121 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "metrics-server.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include <absl/strings/str_cat.h>
+
+static constexpr absl::string_view kContentType =
+    "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+MetricsServer::~MetricsServer() {
+  if (listen_fd_ < 0) return;
+  close(listen_fd_);
+  unlink(path_.c_str());
+  for (const auto &connection : connections_) close(connection.first);
+}
+
+absl::Status MetricsServer::Listen(const std::string &path,
+                                   FileEventDispatcher *dispatcher) {
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path)) {
+    return absl::InvalidArgumentError(
+        absl::StrCat("Socket path too long: ", path));
+  }
+  memcpy(address.sun_path, path.data(), path.size());
+
+  const int fd =
+      socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return absl::InternalError(strerror(errno));
+  unlink(path.c_str());  // Left behind by a previous run.
+  if (bind(fd, reinterpret_cast<struct sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(fd, 16) != 0) {
+    const absl::Status status =
+        absl::InternalError(absl::StrCat(path, ": ", strerror(errno)));
+    close(fd);
+    return status;
+  }
+  listen_fd_ = fd;
+  path_ = path;
+  dispatcher_ = dispatcher;
+  dispatcher_->RunOnReadable(listen_fd_, [this]() { return HandleAccept(); });
+  return absl::OkStatus();
+}
+
+bool MetricsServer::HandleAccept() {
+  const int fd = accept4(listen_fd_, nullptr, nullptr,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+  if (fd < 0) return true;  // Client gone already; keep listening.
+  if (connections_.size() >= kMaxConnections) {
+    close(fd);
+    return true;
+  }
+  connections_[fd];
+  dispatcher_->RunOnReadable(fd, [this, fd]() { return HandleRead(fd); });
+  return true;
+}
+
+bool MetricsServer::HandleRead(int fd) {
+  Connection &connection = connections_[fd];
+  char buffer[1024];
+  const ssize_t r = read(fd, buffer, sizeof(buffer));
+  if (r < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+  if (r <= 0 || connection.request.size() + r > kMaxRequestSize) {
+    CloseConnection(fd);
+    return false;
+  }
+  connection.request.append(buffer, r);
+  if (connection.request.find("\r\n\r\n") == std::string::npos &&
+      connection.request.find("\n\n") == std::string::npos) {
+    return true;  // Wait for rest of request header.
+  }
+
+  // We don't look at the request further: whatever is asked, these are the
+  // metrics we have.
+  const std::string metrics = collect_();
+  connection.response =
+      absl::StrCat("HTTP/1.0 200 OK\r\nContent-Type: ", kContentType,
+                   "\r\nContent-Length: ", metrics.size(),
+                   "\r\nConnection: close\r\n\r\n", metrics);
+  ++scrapes_;
+  dispatcher_->RunOnWritable(fd, [this, fd]() { return HandleWrite(fd); });
+  return false;
+}
+
+bool MetricsServer::HandleWrite(int fd) {
+  Connection &connection = connections_[fd];
+  // No SIGPIPE if the scraper hung up.
+  const ssize_t w =
+      send(fd, connection.response.data() + connection.written,
+           connection.response.size() - connection.written, MSG_NOSIGNAL);
+  if (w < 0 && (errno == EAGAIN || errno == EINTR)) return true;
+  if (w > 0) connection.written += w;
+  if (w > 0 && connection.written < connection.response.size()) return true;
+  CloseConnection(fd);
+  return false;
+}
+
+void MetricsServer::CloseConnection(int fd) {
+  close(fd);
+  connections_.erase(fd);
+}
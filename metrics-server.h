@@ -0,0 +1,71 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef METRICS_SERVER_H
+#define METRICS_SERVER_H
+
+#include <functional>
+#include <map>
+#include <string>
+
+#include <absl/status/status.h>
+
+#include "file-event-dispatcher.h"
+
+// Serves metrics to scrapers connecting to a Unix domain socket, as
+// response to a HTTP GET request (e.g. curl --unix-socket <path> http:/x).
+//
+// All socket operations are non-blocking and driven by the
+// FileEventDispatcher of the main loop, so a slow or stuck scraper never
+// holds up request handling; the metrics text itself is assembled at the
+// time of the request.
+class MetricsServer {
+ public:
+  // Returns the metrics in OpenMetrics text format.
+  using CollectFun = std::function<std::string()>;
+
+  static constexpr size_t kMaxRequestSize = 8192;
+  static constexpr size_t kMaxConnections = 16;
+
+  explicit MetricsServer(const CollectFun &collect) : collect_(collect) {}
+  MetricsServer(const MetricsServer &) = delete;
+  ~MetricsServer();  // Removes the socket file.
+
+  // Create socket at "path", replacing a stale socket left there, and
+  // serve connections from the "dispatcher" loop.
+  absl::Status Listen(const std::string &path, FileEventDispatcher *dispatcher);
+
+  int StatScrapes() const { return scrapes_; }
+
+ private:
+  struct Connection {
+    std::string request;
+    std::string response;
+    size_t written = 0;
+  };
+
+  bool HandleAccept();
+  bool HandleRead(int fd);
+  bool HandleWrite(int fd);
+  void CloseConnection(int fd);
+
+  const CollectFun collect_;
+  FileEventDispatcher *dispatcher_ = nullptr;
+  std::string path_;
+  int listen_fd_ = -1;
+  std::map<int, Connection> connections_;
+  int scrapes_ = 0;
+};
+
+#endif  // METRICS_SERVER_H
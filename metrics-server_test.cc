@@ -0,0 +1,117 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "metrics-server.h"
+
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+// Allow to run the loop step by step.
+class SteppingDispatcher : public FileEventDispatcher {
+ public:
+  using FileEventDispatcher::FileEventDispatcher;
+  using FileEventDispatcher::SingleCycle;
+};
+
+// Connect to "path", send "request" and return everything received until
+// the server closes the connection.
+static std::string Scrape(const std::string &path,
+                          const std::string &request) {
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un address = {};
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+  if (connect(fd, reinterpret_cast<struct sockaddr *>(&address),
+              sizeof(address)) != 0) {
+    close(fd);
+    return "connect failed";
+  }
+  write(fd, request.data(), request.size());
+  std::string result;
+  char buffer[1024];
+  ssize_t r;
+  while ((r = read(fd, buffer, sizeof(buffer))) > 0) result.append(buffer, r);
+  close(fd);
+  return result;
+}
+
+TEST(MetricsServer, ServesMetricsOverUnixSocket) {
+  char dir_template[] = "/tmp/metrics-test-XXXXXX";
+  const std::string path = std::string(mkdtemp(dir_template)) + "/socket";
+
+  SteppingDispatcher loop(10);
+  const std::string large_metrics(1 << 20, 'x');  // Needs multiple writes.
+  int collected = 0;
+  {
+    MetricsServer server([&]() {
+      ++collected;
+      return large_metrics;
+    });
+    ASSERT_TRUE(server.Listen(path, &loop).ok());
+
+    std::atomic<bool> done{false};
+    std::string response;
+    std::thread scraper([&]() {
+      response = Scrape(path, "GET /metrics HTTP/1.0\r\n\r\n");
+      done = true;
+    });
+    while (!done) loop.SingleCycle(10);
+    scraper.join();
+
+    EXPECT_EQ(collected, 1);
+    EXPECT_EQ(server.StatScrapes(), 1);
+    const size_t body = response.find("\r\n\r\n");
+    ASSERT_NE(body, std::string::npos) << response.substr(0, 100);
+    EXPECT_EQ(response.substr(0, 15), "HTTP/1.0 200 OK");
+    EXPECT_NE(response.find("application/openmetrics-text"),
+              std::string::npos);
+    EXPECT_EQ(response.substr(body + 4), large_metrics);
+  }
+  EXPECT_NE(access(path.c_str(), F_OK), 0);  // Socket removed.
+  rmdir(path.substr(0, path.find_last_of('/')).c_str());
+}
+
+TEST(MetricsServer, OversizedRequestIsDropped) {
+  char dir_template[] = "/tmp/metrics-test-XXXXXX";
+  const std::string path = std::string(mkdtemp(dir_template)) + "/socket";
+
+  SteppingDispatcher loop(10);
+  {
+    MetricsServer server([]() { return std::string("metrics"); });
+    ASSERT_TRUE(server.Listen(path, &loop).ok());
+
+    std::atomic<bool> done{false};
+    std::string response;
+    std::thread scraper([&]() {
+      response = Scrape(
+          path, std::string(MetricsServer::kMaxRequestSize + 1, 'x'));
+      done = true;
+    });
+    while (!done) loop.SingleCycle(10);
+    scraper.join();
+
+    EXPECT_EQ(response, "");
+    EXPECT_EQ(server.StatScrapes(), 0);
+  }
+  rmdir(path.substr(0, path.find_last_of('/')).c_str());
+}
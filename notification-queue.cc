@@ -0,0 +1,45 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "notification-queue.h"
+
+#include <algorithm>
+
+void CoalescingNotificationQueue::Enqueue(const std::string &key,
+                                          const std::string &method,
+                                          nlohmann::json params) {
+  ++stats_enqueued_;
+  auto inserted = pending_.insert({key, Notification()});
+  if (inserted.second) {
+    order_.push_back(key);
+    stats_max_depth_ = std::max(stats_max_depth_, order_.size());
+  } else {
+    ++stats_superseded_;
+  }
+  inserted.first->second = {method, std::move(params)};
+}
+
+int CoalescingNotificationQueue::SendPending(const SendFun &send,
+                                             int max_count) {
+  int sent = 0;
+  while (sent < max_count && !order_.empty()) {
+    auto found = pending_.find(order_.front());
+    const Notification notification = std::move(found->second);
+    pending_.erase(found);
+    order_.pop_front();
+    send(notification.method, notification.params);
+    ++sent;
+  }
+  return sent;
+}
@@ -0,0 +1,73 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NOTIFICATION_QUEUE_H
+#define NOTIFICATION_QUEUE_H
+
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+
+#include <nlohmann/json.hpp>
+
+// Queue of outgoing notifications waiting for the client to be ready to
+// read them.
+//
+// Each notification is queued with a key, e.g. the document uri. If there
+// is still a notification with the same key pending, it is replaced by the
+// new one while keeping its place in line: for notifications that convey
+// the current state of something, such as publishDiagnostics, the client
+// only needs the latest. Superseded notifications are dropped before they
+// are ever serialized.
+class CoalescingNotificationQueue {
+ public:
+  using SendFun = std::function<void(const std::string &method,
+                                     const nlohmann::json &params)>;
+
+  CoalescingNotificationQueue() = default;
+  CoalescingNotificationQueue(const CoalescingNotificationQueue &) = delete;
+
+  // Queue notification, replacing a pending one with the same key.
+  void Enqueue(const std::string &key, const std::string &method,
+               nlohmann::json params);
+
+  // Hand up to "max_count" of the oldest pending notifications to "send".
+  // Returns number of notifications sent.
+  int SendPending(const SendFun &send, int max_count = 1);
+
+  // Number of notifications currently pending.
+  size_t depth() const { return order_.size(); }
+
+  // -- Statistical data
+
+  int64_t StatEnqueued() const { return stats_enqueued_; }
+  int64_t StatSuperseded() const { return stats_superseded_; }
+  size_t StatMaxDepth() const { return stats_max_depth_; }
+
+ private:
+  struct Notification {
+    std::string method;
+    nlohmann::json params;
+  };
+
+  std::deque<std::string> order_;  // Keys of pending notifications.
+  std::unordered_map<std::string, Notification> pending_;
+
+  int64_t stats_enqueued_ = 0;
+  int64_t stats_superseded_ = 0;
+  size_t stats_max_depth_ = 0;
+};
+
+#endif  // NOTIFICATION_QUEUE_H
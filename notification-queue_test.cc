@@ -0,0 +1,76 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "notification-queue.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+// Send all pending and return them as "method:params" strings.
+static std::vector<std::string> SendAll(CoalescingNotificationQueue *queue) {
+  std::vector<std::string> result;
+  queue->SendPending(
+      [&](const std::string &method, const nlohmann::json &params) {
+        result.push_back(method + ":" + params.dump());
+      },
+      1000);
+  return result;
+}
+
+TEST(CoalescingNotificationQueueTest, SendInOrder) {
+  CoalescingNotificationQueue queue;
+  queue.Enqueue("a", "foo", 1);
+  queue.Enqueue("b", "bar", 2);
+  EXPECT_EQ(queue.depth(), 2);
+  EXPECT_EQ(SendAll(&queue), std::vector<std::string>({"foo:1", "bar:2"}));
+  EXPECT_EQ(queue.depth(), 0);
+  EXPECT_TRUE(SendAll(&queue).empty());
+}
+
+TEST(CoalescingNotificationQueueTest, NewerReplacesPendingInPlace) {
+  CoalescingNotificationQueue queue;
+  queue.Enqueue("a", "foo", 1);
+  queue.Enqueue("b", "foo", 2);
+  queue.Enqueue("a", "foo", 3);
+  queue.Enqueue("a", "foo", 4);
+  EXPECT_EQ(queue.depth(), 2);
+  EXPECT_EQ(SendAll(&queue), std::vector<std::string>({"foo:4", "foo:2"}));
+
+  EXPECT_EQ(queue.StatEnqueued(), 4);
+  EXPECT_EQ(queue.StatSuperseded(), 2);
+  EXPECT_EQ(queue.StatMaxDepth(), 2);
+}
+
+TEST(CoalescingNotificationQueueTest, SendLimitedNumber) {
+  CoalescingNotificationQueue queue;
+  queue.Enqueue("a", "foo", 1);
+  queue.Enqueue("b", "foo", 2);
+  queue.Enqueue("c", "foo", 3);
+
+  std::vector<nlohmann::json> sent;
+  auto send = [&](const std::string &, const nlohmann::json &params) {
+    sent.push_back(params);
+  };
+  EXPECT_EQ(queue.SendPending(send, 2), 2);
+  EXPECT_EQ(queue.depth(), 1);
+
+  // Sent notifications are not pending anymore, so a new one with the same
+  // key is queued at the end.
+  queue.Enqueue("a", "foo", 4);
+  EXPECT_EQ(queue.SendPending(send, 2), 2);
+  EXPECT_EQ(sent, std::vector<nlohmann::json>({1, 2, 3, 4}));
+  EXPECT_EQ(queue.StatSuperseded(), 0);
+}
@@ -0,0 +1,135 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "openmetrics.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+#include <absl/strings/str_cat.h>
+
+Histogram::Histogram(std::vector<double> upper_bounds)
+    : upper_bounds_(std::move(upper_bounds)), counts_(upper_bounds_.size()) {}
+
+std::vector<double> Histogram::LatencyBounds() {
+  return {0.0001, 0.00025, 0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025,
+          0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+}
+
+void Histogram::Observe(double value) {
+  const auto bucket =
+      std::lower_bound(upper_bounds_.begin(), upper_bounds_.end(), value);
+  if (bucket != upper_bounds_.end()) ++counts_[bucket - upper_bounds_.begin()];
+  ++count_;
+  sum_ += value;
+}
+
+// Label values are quoted; escape what would end the quote or line.
+static std::string EscapeLabelValue(absl::string_view value) {
+  std::string result;
+  for (const char c : value) {
+    switch (c) {
+      case '\\':
+        result.append("\\\\");
+        break;
+      case '"':
+        result.append("\\\"");
+        break;
+      case '\n':
+        result.append("\\n");
+        break;
+      default:
+        result.push_back(c);
+    }
+  }
+  return result;
+}
+
+// Values without loss of precision: integers, such as counts, exactly and
+// everything else with as many digits as needed to read it back the same.
+static std::string FormatValue(double value) {
+  if (std::isnan(value)) return "NaN";
+  if (std::isinf(value)) return value > 0 ? "+Inf" : "-Inf";
+  static constexpr double kMaxExactInteger = 1LL << 53;
+  if (value == std::trunc(value) && std::abs(value) <= kMaxExactInteger) {
+    return absl::StrCat(static_cast<int64_t>(value));
+  }
+  char buffer[32];
+  for (const int precision : {15, 17}) {
+    snprintf(buffer, sizeof(buffer), "%.*g", precision, value);
+    if (strtod(buffer, nullptr) == value) break;
+  }
+  return buffer;
+}
+
+void OpenMetricsText::AddFamily(absl::string_view name, absl::string_view type,
+                                absl::string_view help) {
+  absl::StrAppend(&text_, "# TYPE ", name, " ", type, "\n# HELP ", name, " ",
+                  help, "\n");
+}
+
+void OpenMetricsText::AddCounter(absl::string_view name,
+                                 absl::string_view help, double value) {
+  AddFamily(name, "counter", help);
+  absl::StrAppend(&text_, name, "_total ", FormatValue(value), "\n");
+}
+
+void OpenMetricsText::AddCounter(absl::string_view name,
+                                 absl::string_view help,
+                                 absl::string_view label,
+                                 const LabeledValues &values) {
+  AddFamily(name, "counter", help);
+  for (const auto &[label_value, value] : values) {
+    absl::StrAppend(&text_, name, "_total{", label, "=\"",
+                    EscapeLabelValue(label_value), "\"} ", FormatValue(value),
+                    "\n");
+  }
+}
+
+void OpenMetricsText::AddGauge(absl::string_view name, absl::string_view help,
+                               double value) {
+  AddFamily(name, "gauge", help);
+  absl::StrAppend(&text_, name, " ", FormatValue(value), "\n");
+}
+
+void OpenMetricsText::AddHistogram(absl::string_view name,
+                                   absl::string_view help,
+                                   absl::string_view label,
+                                   const LabeledHistograms &histograms) {
+  AddFamily(name, "histogram", help);
+  for (const auto &[label_value, histogram] : histograms) {
+    const std::string labels =
+        absl::StrCat(label, "=\"", EscapeLabelValue(label_value), "\"");
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < histogram.upper_bounds().size(); ++i) {
+      cumulative += histogram.bucket_counts()[i];
+      absl::StrAppend(&text_, name, "_bucket{", labels, ",le=\"",
+                      FormatValue(histogram.upper_bounds()[i]), "\"} ",
+                      cumulative, "\n");
+    }
+    absl::StrAppend(&text_, name, "_bucket{", labels, ",le=\"+Inf\"} ",
+                    histogram.count(), "\n");
+    absl::StrAppend(&text_, name, "_sum{", labels, "} ",
+                    FormatValue(histogram.sum()), "\n");
+    absl::StrAppend(&text_, name, "_count{", labels, "} ", histogram.count(),
+                    "\n");
+  }
+}
+
+std::string OpenMetricsText::Finish() {
+  text_.append("# EOF\n");
+  return std::move(text_);
+}
@@ -0,0 +1,78 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef OPENMETRICS_H
+#define OPENMETRICS_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <absl/strings/string_view.h>
+
+// Distribution of observed values, e.g. latencies, in buckets with fixed
+// upper bounds.
+class Histogram {
+ public:
+  // Upper bounds in increasing order; values above the last one are only
+  // accounted for in count() and sum().
+  explicit Histogram(std::vector<double> upper_bounds);
+
+  // Bounds suitable for request latencies in seconds; 100us to 10s.
+  static std::vector<double> LatencyBounds();
+
+  void Observe(double value);
+
+  const std::vector<double> &upper_bounds() const { return upper_bounds_; }
+  const std::vector<uint64_t> &bucket_counts() const { return counts_; }
+  uint64_t count() const { return count_; }
+  double sum() const { return sum_; }
+
+ private:
+  std::vector<double> upper_bounds_;
+  std::vector<uint64_t> counts_;  // Not cumulative.
+  uint64_t count_ = 0;
+  double sum_ = 0;
+};
+
+// Assembles metrics in the OpenMetrics text exposition format
+// (https://openmetrics.io). Each metric family is described once with its
+// type and help text; families with a "label" have one sample per label
+// value.
+class OpenMetricsText {
+ public:
+  using LabeledValues = std::map<std::string, double>;
+  using LabeledHistograms = std::map<std::string, Histogram>;
+
+  void AddCounter(absl::string_view name, absl::string_view help,
+                  double value);
+  void AddCounter(absl::string_view name, absl::string_view help,
+                  absl::string_view label, const LabeledValues &values);
+  void AddGauge(absl::string_view name, absl::string_view help, double value);
+  void AddHistogram(absl::string_view name, absl::string_view help,
+                    absl::string_view label,
+                    const LabeledHistograms &histograms);
+
+  // Finish exposition and return the text.
+  std::string Finish();
+
+ private:
+  void AddFamily(absl::string_view name, absl::string_view type,
+                 absl::string_view help);
+
+  std::string text_;
+};
+
+#endif  // OPENMETRICS_H
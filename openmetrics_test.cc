@@ -0,0 +1,84 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "openmetrics.h"
+
+#include "gtest/gtest.h"
+
+TEST(Histogram, ValuesAreCountedInFirstFittingBucket) {
+  Histogram histogram({1, 10, 100});
+  for (const double value : {0.5, 1.0, 5.0, 50.0, 500.0}) {
+    histogram.Observe(value);
+  }
+  EXPECT_EQ(histogram.bucket_counts(), std::vector<uint64_t>({2, 1, 1}));
+  EXPECT_EQ(histogram.count(), 5);
+  EXPECT_DOUBLE_EQ(histogram.sum(), 556.5);
+}
+
+TEST(OpenMetricsText, FamiliesInTextFormat) {
+  OpenMetricsText metrics;
+  metrics.AddCounter("lsp_bytes_read", "Bytes read.", 1234);
+  metrics.AddGauge("lsp_documents_open", "Open documents.", 3);
+  metrics.AddCounter("lsp_calls", "Calls by method.", "method",
+                     {{"hover", 2}, {"say \"hi\"\n", 1}});
+  EXPECT_EQ(metrics.Finish(),
+            "# TYPE lsp_bytes_read counter\n"
+            "# HELP lsp_bytes_read Bytes read.\n"
+            "lsp_bytes_read_total 1234\n"
+            "# TYPE lsp_documents_open gauge\n"
+            "# HELP lsp_documents_open Open documents.\n"
+            "lsp_documents_open 3\n"
+            "# TYPE lsp_calls counter\n"
+            "# HELP lsp_calls Calls by method.\n"
+            "lsp_calls_total{method=\"hover\"} 2\n"
+            "lsp_calls_total{method=\"say \\\"hi\\\"\\n\"} 1\n"
+            "# EOF\n");
+}
+
+TEST(OpenMetricsText, HistogramBucketsAreCumulative) {
+  Histogram histogram({0.1, 1});
+  histogram.Observe(0.05);
+  histogram.Observe(0.5);
+  histogram.Observe(5);
+  OpenMetricsText metrics;
+  metrics.AddHistogram("latency_seconds", "Latency.", "method",
+                       {{"hover", histogram}});
+  EXPECT_EQ(metrics.Finish(),
+            "# TYPE latency_seconds histogram\n"
+            "# HELP latency_seconds Latency.\n"
+            "latency_seconds_bucket{method=\"hover\",le=\"0.1\"} 1\n"
+            "latency_seconds_bucket{method=\"hover\",le=\"1\"} 2\n"
+            "latency_seconds_bucket{method=\"hover\",le=\"+Inf\"} 3\n"
+            "latency_seconds_sum{method=\"hover\"} 5.55\n"
+            "latency_seconds_count{method=\"hover\"} 3\n"
+            "# EOF\n");
+}
+
+TEST(OpenMetricsText, ValuesKeepTheirPrecision) {
+  OpenMetricsText metrics;
+  metrics.AddCounter("big", "Big count.", 123456789);
+  metrics.AddGauge("fraction", "Fraction.", 0.1);
+  metrics.AddGauge("precise", "Precise.", 1.0000001234567);
+  EXPECT_EQ(metrics.Finish(),
+            "# TYPE big counter\n"
+            "# HELP big Big count.\n"
+            "big_total 123456789\n"
+            "# TYPE fraction gauge\n"
+            "# HELP fraction Fraction.\n"
+            "fraction 0.1\n"
+            "# TYPE precise gauge\n"
+            "# HELP precise Precise.\n"
+            "precise 1.0000001234567\n"
+            "# EOF\n");
+}
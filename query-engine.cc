@@ -0,0 +1,162 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "query-engine.h"
+
+void QueryEngine::Context::ReadInput(const std::string &key) {
+  dependencies_.emplace_back(-1, key);
+}
+
+int QueryEngine::AddUntypedQuery(const std::string &name,
+                                 const UntypedComputeFun &compute) {
+  queries_.push_back({.name = name, .compute = compute, .stats = {}});
+  return queries_.size() - 1;
+}
+
+// An input we don't know might have been forgotten; then it changed.
+QueryEngine::KeyState &QueryEngine::StateOf(const std::string &key) {
+  auto inserted = keys_.try_emplace(key);
+  if (inserted.second) inserted.first->second.input_changed = last_forgotten_;
+  return inserted.first->second;
+}
+
+void QueryEngine::InputChanged(const std::string &key) {
+  const std::lock_guard<std::mutex> l(mutex_);
+  StateOf(key).input_changed = ++revision_;
+}
+
+void QueryEngine::Forget(const std::string &key) {
+  const std::lock_guard<std::mutex> l(mutex_);
+  keys_.erase(key);
+  last_forgotten_ = ++revision_;
+}
+
+// Values are computed without holding the lock, so that queries can run in
+// parallel and use other queries. Two threads asking for the same value at
+// the same time might both compute it.
+QueryEngine::Result QueryEngine::Fetch(int query, const std::string &key) {
+  QueryInfo &info = queries_[query];
+  uint64_t revision;
+  Result memoized = {nullptr, 0};
+  uint64_t verified = 0;
+  std::vector<std::pair<int, std::string>> dependencies;
+  {
+    const std::lock_guard<std::mutex> l(mutex_);
+    revision = revision_;
+    auto state = keys_.find(key);
+    if (state != keys_.end()) {
+      auto found = state->second.memos.find(query);
+      if (found != state->second.memos.end()) {
+        const Memo &memo = found->second;
+        if (memo.verified == revision) {
+          ++info.stats.reused;
+          return {memo.value, memo.changed};
+        }
+        memoized = {memo.value, memo.changed};
+        verified = memo.verified;
+        dependencies = memo.dependencies;
+      }
+    }
+  }
+
+  // Something changed since we last looked. Still current if none of the
+  // dependencies changed since.
+  if (memoized.value) {
+    bool current = true;
+    for (const auto &dependency : dependencies) {
+      if (ChangedRevision(dependency) > verified) {
+        current = false;
+        break;
+      }
+    }
+    if (current) {
+      const std::lock_guard<std::mutex> l(mutex_);
+      ++info.stats.reused;
+      auto state = keys_.find(key);
+      if (state == keys_.end()) return memoized;
+      auto found = state->second.memos.find(query);
+      if (found != state->second.memos.end() &&
+          found->second.verified == verified) {
+        found->second.verified = revision;
+      }
+      return memoized;
+    }
+  }
+
+  Context context(this);
+  Value value = info.compute(&context, key);
+  const std::lock_guard<std::mutex> l(mutex_);
+  ++info.stats.computed;
+  if (!context.incomplete_) {
+    StateOf(key).memos[query] = {.value = value,
+                                 .dependencies =
+                                     std::move(context.dependencies_),
+                                 .verified = revision,
+                                 .changed = revision};
+  }
+  return {value, revision};
+}
+
+// Values depending on the old one have to see it changed.
+void QueryEngine::MemoizeUntyped(int query, const std::string &key,
+                                 Value value) {
+  const std::lock_guard<std::mutex> l(mutex_);
+  const uint64_t revision = ++revision_;
+  StateOf(key).memos[query] = {.value = std::move(value),
+                               .dependencies = {{-1, key}},
+                               .verified = revision,
+                               .changed = revision};
+}
+
+uint64_t QueryEngine::ChangedRevision(
+    const std::pair<int, std::string> &dependency) {
+  if (dependency.first >= 0) {
+    return Fetch(dependency.first, dependency.second).changed;
+  }
+  const std::lock_guard<std::mutex> l(mutex_);
+  auto found = keys_.find(dependency.second);
+  return found == keys_.end() ? last_forgotten_ : found->second.input_changed;
+}
+
+// Like the check in Fetch(), but only looking at memoized values.
+QueryEngine::Value QueryEngine::FindCurrentMemo(int query,
+                                                const std::string &key) const {
+  auto state = keys_.find(key);
+  if (state == keys_.end()) return nullptr;
+  auto found = state->second.memos.find(query);
+  if (found == state->second.memos.end()) return nullptr;
+  const Memo &memo = found->second;
+  if (memo.verified == revision_) return memo.value;
+  for (const auto &[dependency, dependency_key] : memo.dependencies) {
+    if (dependency < 0) {
+      auto input = keys_.find(dependency_key);
+      const uint64_t changed = (input == keys_.end())
+                                   ? last_forgotten_
+                                   : input->second.input_changed;
+      if (changed > memo.verified) return nullptr;
+      continue;
+    }
+    if (!FindCurrentMemo(dependency, dependency_key)) return nullptr;
+    const Memo &used = keys_.at(dependency_key).memos.at(dependency);
+    if (used.changed > memo.verified) return nullptr;
+  }
+  return memo.value;
+}
+
+std::map<std::string, QueryEngine::Stats> QueryEngine::GetStats() const {
+  const std::lock_guard<std::mutex> l(mutex_);
+  std::map<std::string, Stats> result;
+  for (const QueryInfo &info : queries_) result[info.name] = info.stats;
+  return result;
+}
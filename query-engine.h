@@ -0,0 +1,193 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef QUERY_ENGINE_H
+#define QUERY_ENGINE_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Demand-driven computation of data derived from documents, such as lint
+// findings, diagnostics or the outline of a document.
+//
+// Each kind of derived data is a query: a function computing a value for a
+// key, typically the uri of a document. Values are memoized. While
+// computing, a query tells which inputs (documents) it reads and which
+// other queries it uses, so after an input changed only what depends on it
+// is computed again, and only once it is asked for. Unchanged results are
+// reused across requests.
+//
+// Thread-safe; queries for different keys can be computed in parallel.
+// A query must not depend on itself.
+class QueryEngine {
+ public:
+  // Handle of a query returning values of type T.
+  template <typename T>
+  class Query {
+   public:
+    Query() = default;
+
+   private:
+    friend class QueryEngine;
+    explicit Query(int id) : id_(id) {}
+    int id_ = -1;
+  };
+
+  // Passed to a query while it computes, to record what it depends on.
+  class Context {
+   public:
+    // The computed value depends on the input "key".
+    void ReadInput(const std::string &key);
+
+    // Value of another query; the computed value depends on it.
+    template <typename T>
+    std::shared_ptr<const T> Get(const Query<T> &query,
+                                 const std::string &key);
+
+    // The computed value is not complete, e.g. the request ran out of
+    // time. It is returned, but not memoized.
+    void SetIncomplete() { incomplete_ = true; }
+
+   private:
+    friend class QueryEngine;
+    explicit Context(QueryEngine *engine) : engine_(engine) {}
+
+    QueryEngine *const engine_;
+    std::vector<std::pair<int, std::string>> dependencies_;  // -1: input
+    bool incomplete_ = false;
+  };
+
+  template <typename T>
+  using ComputeFun =
+      std::function<T(Context *context, const std::string &key)>;
+
+  QueryEngine() = default;
+  QueryEngine(const QueryEngine &) = delete;
+
+  // Add a query named "name" (for statistics) computing its values with
+  // "compute". All queries are to be added before using any.
+  template <typename T>
+  Query<T> AddQuery(const std::string &name, const ComputeFun<T> &compute) {
+    return Query<T>(AddUntypedQuery(
+        name, [compute](Context *context, const std::string &key) -> Value {
+          return std::make_shared<const T>(compute(context, key));
+        }));
+  }
+
+  // Get value of "query" for "key", computing it if not memoized or if
+  // anything it depends on changed since.
+  template <typename T>
+  std::shared_ptr<const T> Get(const Query<T> &query,
+                               const std::string &key) {
+    return std::static_pointer_cast<const T>(Fetch(query.id_, key).value);
+  }
+
+  // Value of "query" for "key" if it is memoized and still current;
+  // nullptr otherwise. Never computes anything, so cheap enough to decide
+  // whether to ask for the value or rather for something less expensive.
+  template <typename T>
+  std::shared_ptr<const T> GetIfMemoized(const Query<T> &query,
+                                         const std::string &key) {
+    const std::lock_guard<std::mutex> l(mutex_);
+    return std::static_pointer_cast<const T>(FindCurrentMemo(query.id_, key));
+  }
+
+  // Memoize "value" as that of "query" for "key", computed elsewhere from
+  // input "key" as it is now, e.g. from a copy of a document not edited
+  // since. So it is not computed again when asked for.
+  template <typename T>
+  void Memoize(const Query<T> &query, const std::string &key,
+               std::shared_ptr<const T> value) {
+    MemoizeUntyped(query.id_, key, std::move(value));
+  }
+
+  // Input "key" changed; everything depending on it is outdated.
+  void InputChanged(const std::string &key);
+
+  // Forget input "key" and the values memoized for it, e.g. a document
+  // closed.
+  void Forget(const std::string &key);
+
+  // -- Statistics by query name.
+  struct Stats {
+    int64_t computed = 0;
+    int64_t reused = 0;
+  };
+  std::map<std::string, Stats> GetStats() const;
+
+ private:
+  using Value = std::shared_ptr<const void>;
+  using UntypedComputeFun =
+      std::function<Value(Context *context, const std::string &key)>;
+
+  // A memoized value is known to be current at "verified" revision, and
+  // was computed at "changed".
+  struct Memo {
+    Value value;
+    std::vector<std::pair<int, std::string>> dependencies;
+    uint64_t verified = 0;
+    uint64_t changed = 0;
+  };
+  struct KeyState {
+    uint64_t input_changed = 0;
+    std::unordered_map<int, Memo> memos;  // By query id.
+  };
+  struct Result {
+    Value value;
+    uint64_t changed;  // Revision the value last changed.
+  };
+
+  int AddUntypedQuery(const std::string &name,
+                      const UntypedComputeFun &compute);
+  Result Fetch(int query, const std::string &key);
+  void MemoizeUntyped(int query, const std::string &key, Value value);
+
+  // Memoized value if it and all it depends on are current, else nullptr.
+  // Call with mutex_ held.
+  Value FindCurrentMemo(int query, const std::string &key) const;
+
+  // Revision at which the dependency last changed, bringing queries
+  // up-to-date on the way.
+  uint64_t ChangedRevision(const std::pair<int, std::string> &dependency);
+
+  // State of "key", created if needed.
+  KeyState &StateOf(const std::string &key);
+
+  struct QueryInfo {
+    std::string name;
+    UntypedComputeFun compute;
+    Stats stats;  // Guarded by mutex_
+  };
+  std::vector<QueryInfo> queries_;
+
+  mutable std::mutex mutex_;
+  uint64_t revision_ = 1;
+  uint64_t last_forgotten_ = 0;  // Change revision of unknown inputs.
+  std::unordered_map<std::string, KeyState> keys_;
+};
+
+template <typename T>
+std::shared_ptr<const T> QueryEngine::Context::Get(const Query<T> &query,
+                                                   const std::string &key) {
+  dependencies_.emplace_back(query.id_, key);
+  return engine_->Get(query, key);
+}
+
+#endif  // QUERY_ENGINE_H
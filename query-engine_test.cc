@@ -0,0 +1,195 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "query-engine.h"
+
+#include <algorithm>
+#include <map>
+#include <string>
+
+#include "gtest/gtest.h"
+
+// Documents are simple strings in these tests.
+class QueryEngineTest : public ::testing::Test {
+ protected:
+  void SetDocument(const std::string &key, const std::string &text) {
+    documents_[key] = text;
+    engine_.InputChanged(key);
+  }
+
+  std::map<std::string, std::string> documents_;
+  QueryEngine engine_;
+};
+
+TEST_F(QueryEngineTest, ValuesAreMemoizedUntilInputChanges) {
+  int computed = 0;
+  const auto length = engine_.AddQuery<size_t>(
+      "length", [&](QueryEngine::Context *context, const std::string &key) {
+        context->ReadInput(key);
+        ++computed;
+        return documents_[key].length();
+      });
+  SetDocument("a", "Hello");
+  SetDocument("b", "World!");
+
+  EXPECT_EQ(*engine_.Get(length, "a"), 5);
+  EXPECT_EQ(*engine_.Get(length, "a"), 5);
+  EXPECT_EQ(computed, 1);
+
+  SetDocument("b", "Other document");
+  EXPECT_EQ(*engine_.Get(length, "a"), 5);
+  EXPECT_EQ(computed, 1);
+
+  SetDocument("a", "Hi");
+  EXPECT_EQ(*engine_.Get(length, "a"), 2);
+  EXPECT_EQ(computed, 2);
+
+  EXPECT_EQ(engine_.GetStats()["length"].computed, 2);
+  EXPECT_EQ(engine_.GetStats()["length"].reused, 2);
+}
+
+TEST_F(QueryEngineTest, DependentQueriesOnlyComputedWhenInputsChanged) {
+  std::map<std::string, int> computed;
+  const auto words = engine_.AddQuery<int>(
+      "words", [&](QueryEngine::Context *context, const std::string &key) {
+        context->ReadInput(key);
+        ++computed["words"];
+        const std::string &text = documents_[key];
+        return text.empty() ? 0 : 1 + (int)std::count(text.begin(),
+                                                       text.end(), ' ');
+      });
+  // Total of words of the documents in the key, separated by comma.
+  const auto total = engine_.AddQuery<int>(
+      "total", [&](QueryEngine::Context *context, const std::string &key) {
+        ++computed["total"];
+        return *context->Get(words, key.substr(0, 1)) +
+               *context->Get(words, key.substr(2, 1));
+      });
+  SetDocument("a", "one two");
+  SetDocument("b", "three");
+  SetDocument("c", "four five six");
+
+  EXPECT_EQ(*engine_.Get(total, "a,b"), 3);
+  EXPECT_EQ(*engine_.Get(total, "b,c"), 4);
+  EXPECT_EQ(computed["words"], 3);
+  EXPECT_EQ(computed["total"], 2);
+
+  SetDocument("c", "seven");  // Only affects the second.
+  EXPECT_EQ(*engine_.Get(total, "a,b"), 3);
+  EXPECT_EQ(*engine_.Get(total, "b,c"), 2);
+  EXPECT_EQ(computed["words"], 4);
+  EXPECT_EQ(computed["total"], 3);
+
+  // A document that nothing uses.
+  SetDocument("d", "unused");
+  EXPECT_EQ(*engine_.Get(total, "a,b"), 3);
+  EXPECT_EQ(*engine_.Get(total, "b,c"), 2);
+  EXPECT_EQ(computed["words"], 4);
+  EXPECT_EQ(computed["total"], 3);
+}
+
+TEST_F(QueryEngineTest, IncompleteValuesAreNotMemoized) {
+  bool out_of_time = true;
+  int computed = 0;
+  const auto text = engine_.AddQuery<std::string>(
+      "text", [&](QueryEngine::Context *context, const std::string &key) {
+        context->ReadInput(key);
+        ++computed;
+        if (out_of_time) {
+          context->SetIncomplete();
+          return documents_[key].substr(0, 3);
+        }
+        return documents_[key];
+      });
+  SetDocument("a", "Hello");
+  EXPECT_EQ(*engine_.Get(text, "a"), "Hel");
+  out_of_time = false;
+  EXPECT_EQ(*engine_.Get(text, "a"), "Hello");
+  EXPECT_EQ(*engine_.Get(text, "a"), "Hello");
+  EXPECT_EQ(computed, 2);
+}
+
+TEST_F(QueryEngineTest, ForgottenInputInvalidatesDependents) {
+  int computed = 0;
+  const auto both = engine_.AddQuery<std::string>(
+      "both", [&](QueryEngine::Context *context, const std::string &) {
+        context->ReadInput("a");
+        context->ReadInput("b");
+        ++computed;
+        return documents_["a"] + documents_["b"];
+      });
+  SetDocument("a", "foo");
+  SetDocument("b", "bar");
+  EXPECT_EQ(*engine_.Get(both, ""), "foobar");
+
+  documents_.erase("b");
+  engine_.Forget("b");
+  EXPECT_EQ(*engine_.Get(both, ""), "foo");
+  EXPECT_EQ(*engine_.Get(both, ""), "foo");
+  EXPECT_EQ(computed, 2);
+}
+
+TEST_F(QueryEngineTest, GetIfMemoizedNeverComputes) {
+  int computed = 0;
+  const auto length = engine_.AddQuery<size_t>(
+      "length", [&](QueryEngine::Context *context, const std::string &key) {
+        context->ReadInput(key);
+        ++computed;
+        return documents_[key].length();
+      });
+  const auto doubled = engine_.AddQuery<size_t>(
+      "doubled", [&](QueryEngine::Context *context, const std::string &key) {
+        return 2 * *context->Get(length, key);
+      });
+  SetDocument("a", "Hello");
+  EXPECT_EQ(engine_.GetIfMemoized(doubled, "a"), nullptr);
+  EXPECT_EQ(computed, 0);
+
+  EXPECT_EQ(*engine_.Get(doubled, "a"), 10);
+  SetDocument("b", "Unrelated");  // Not verified since, but still current.
+  ASSERT_NE(engine_.GetIfMemoized(doubled, "a"), nullptr);
+  EXPECT_EQ(*engine_.GetIfMemoized(doubled, "a"), 10);
+
+  SetDocument("a", "Hi");
+  EXPECT_EQ(engine_.GetIfMemoized(doubled, "a"), nullptr);
+  EXPECT_EQ(engine_.GetIfMemoized(length, "a"), nullptr);
+  EXPECT_EQ(computed, 1);
+}
+
+TEST_F(QueryEngineTest, ValuesComputedElsewhereCanBeMemoized) {
+  int computed = 0;
+  const auto length = engine_.AddQuery<size_t>(
+      "length", [&](QueryEngine::Context *context, const std::string &key) {
+        context->ReadInput(key);
+        ++computed;
+        return documents_[key].length();
+      });
+  const auto doubled = engine_.AddQuery<size_t>(
+      "doubled", [&](QueryEngine::Context *context, const std::string &key) {
+        return 2 * *context->Get(length, key);
+      });
+  SetDocument("a", "Hello");
+  EXPECT_EQ(*engine_.Get(doubled, "a"), 10);
+  EXPECT_EQ(computed, 1);
+
+  // Say, computed on a copy of the document in another thread.
+  engine_.Memoize(length, "a", std::make_shared<const size_t>(42));
+  EXPECT_EQ(*engine_.Get(length, "a"), 42);
+  EXPECT_EQ(*engine_.Get(doubled, "a"), 84);  // Noticed the new value.
+  EXPECT_EQ(computed, 1);
+
+  SetDocument("a", "Hi");
+  EXPECT_EQ(*engine_.Get(doubled, "a"), 4);
+  EXPECT_EQ(computed, 2);
+}
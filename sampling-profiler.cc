@@ -0,0 +1,187 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sampling-profiler.h"
+
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+#include <absl/strings/str_cat.h>
+
+// Frames of the signal handler and the kernel's signal trampoline on top of
+// the interrupted code.
+static constexpr int kSignalFrames = 2;
+
+static std::atomic<SamplingProfiler *> active_profiler{nullptr};
+static std::atomic<const char *> current_tag{nullptr};
+
+// How often samples are collected from the ring.
+static constexpr std::chrono::seconds kCollectInterval(1);
+
+SamplingProfiler::SamplingProfiler(size_t max_samples)
+    : max_samples_(max_samples), samples_(new Sample[max_samples]) {
+  for (size_t i = 0; i < max_samples_; ++i) samples_[i].sequence = i;
+}
+
+SamplingProfiler::~SamplingProfiler() { Stop(); }
+
+absl::Status SamplingProfiler::Start(int frequency) {
+  SamplingProfiler *expected = nullptr;
+  if (!active_profiler.compare_exchange_strong(expected, this)) {
+    return absl::FailedPreconditionError("Another profiler is running");
+  }
+  // The first backtrace() loads the unwinder, which is not something to be
+  // done in a signal handler.
+  void *warm_up[1];
+  backtrace(warm_up, 1);
+
+  {
+    const std::lock_guard<std::mutex> l(mutex_);
+    stopping_ = false;
+  }
+  collector_ = std::thread([this]() { RunCollector(); });
+
+  signal(SIGPROF, &SamplingProfiler::HandleSignal);
+  struct itimerval timer = {};
+  timer.it_interval.tv_usec = 1000000 / std::max(1, frequency);
+  timer.it_value = timer.it_interval;
+  if (setitimer(ITIMER_PROF, &timer, nullptr) != 0) {
+    Stop();
+    return absl::InternalError("Can't set profiling timer");
+  }
+  return absl::OkStatus();
+}
+
+void SamplingProfiler::Stop() {
+  if (active_profiler != this) return;
+  const struct itimerval off = {};
+  setitimer(ITIMER_PROF, &off, nullptr);
+  signal(SIGPROF, SIG_IGN);  // A signal still in flight must not kill us.
+  {
+    const std::lock_guard<std::mutex> l(mutex_);
+    stopping_ = true;
+  }
+  stop_requested_.notify_all();
+  collector_.join();
+  active_profiler = nullptr;
+}
+
+void SamplingProfiler::SetTag(const char *tag) {
+  current_tag.store(tag, std::memory_order_relaxed);
+}
+
+void SamplingProfiler::HandleSignal(int) {
+  SamplingProfiler *const profiler = active_profiler.load();
+  if (!profiler) return;
+  const int saved_errno = errno;
+  // Claim the next free entry; other threads might be doing the same.
+  size_t pos = profiler->write_pos_.load(std::memory_order_relaxed);
+  for (;;) {
+    Sample &sample = profiler->samples_[pos % profiler->max_samples_];
+    const size_t sequence = sample.sequence.load(std::memory_order_acquire);
+    if (sequence == pos) {
+      if (profiler->write_pos_.compare_exchange_weak(
+              pos, pos + 1, std::memory_order_relaxed)) {
+        sample.tag = current_tag.load(std::memory_order_relaxed);
+        sample.depth = backtrace(sample.frames, kMaxDepth);
+        sample.sequence.store(pos + 1, std::memory_order_release);
+        ++profiler->samples_taken_;
+        break;
+      }
+    } else if (sequence < pos) {  // Not collected yet: ring is full.
+      ++profiler->dropped_;
+      break;
+    } else {  // Claimed by another thread meanwhile.
+      pos = profiler->write_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  errno = saved_errno;
+}
+
+void SamplingProfiler::CollectSamples() {
+  for (;;) {
+    Sample &sample = samples_[read_pos_ % max_samples_];
+    // Stop at an entry not taken yet or still being written.
+    if (sample.sequence.load(std::memory_order_acquire) != read_pos_ + 1) {
+      return;
+    }
+    ++stack_counts_[Stack(sample.tag, std::vector<void *>(
+                                          sample.frames,
+                                          sample.frames + sample.depth))];
+    sample.sequence.store(read_pos_ + max_samples_, std::memory_order_release);
+    ++read_pos_;
+  }
+}
+
+void SamplingProfiler::RunCollector() {
+  std::unique_lock<std::mutex> l(mutex_);
+  while (!stopping_) {
+    stop_requested_.wait_for(l, kCollectInterval);
+    CollectSamples();
+  }
+}
+
+static std::string FrameName(void *address) {
+  Dl_info info;
+  if (!dladdr(address, &info)) {
+    return absl::StrCat("0x", absl::Hex(reinterpret_cast<uintptr_t>(address)));
+  }
+  if (info.dli_sname) {
+    int status;
+    char *demangled =
+        abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+    std::string name = (status == 0) ? demangled : info.dli_sname;
+    free(demangled);
+    std::replace(name.begin(), name.end(), ';', ':');  // Frame separator.
+    return name;
+  }
+  const std::string module = info.dli_fname ? info.dli_fname : "?";
+  return absl::StrCat(module.substr(module.find_last_of('/') + 1), "+0x",
+                      absl::Hex(static_cast<const char *>(address) -
+                                static_cast<const char *>(info.dli_fbase)));
+}
+
+void SamplingProfiler::WriteFolded(std::ostream *out) {
+  std::unordered_map<void *, std::string> frame_names;
+  std::map<std::string, size_t> folded_counts;
+  {
+    const std::lock_guard<std::mutex> l(mutex_);
+    CollectSamples();
+    for (const auto &[stack, count] : stack_counts_) {
+      const auto &[tag, frames] = stack;
+      std::string folded = tag ? tag : "[untagged]";
+      for (int f = (int)frames.size() - 1; f >= kSignalFrames; --f) {
+        std::string &name = frame_names[frames[f]];
+        if (name.empty()) name = FrameName(frames[f]);
+        folded.append(";").append(name);
+      }
+      // Different addresses in the same function fold into the same line.
+      folded_counts[folded] += count;
+    }
+  }
+  for (const auto &[folded, count] : folded_counts) {
+    *out << folded << " " << count << "\n";
+  }
+}
@@ -0,0 +1,105 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SAMPLING_PROFILER_H
+#define SAMPLING_PROFILER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <absl/status/status.h>
+
+// Statistical profiler that samples the call stacks of all threads while
+// they consume CPU time (SIGPROF). Cheap enough to be switched on in a
+// production session, where attaching an external profiler to a process
+// started by the editor is not practical.
+//
+// Each sample is attributed to the current tag, typically the JSON-RPC
+// method being handled; work done in other threads meanwhile counts towards
+// the same tag. The profile is written in the folded format understood by
+// flamegraph.pl: one line per distinct stack with the tag and frames
+// (outermost first) separated by ';', followed by the number of samples.
+// Frames without exported symbol are shown as module+offset, to be
+// resolved with addr2line.
+class SamplingProfiler {
+ public:
+  // Samples are taken into a ring of "max_samples" entries, from which a
+  // collector thread aggregates them into stacks once a second. Samples
+  // taken while the ring is full are dropped.
+  explicit SamplingProfiler(size_t max_samples = 1 << 15);
+  SamplingProfiler(const SamplingProfiler &) = delete;
+  ~SamplingProfiler();
+
+  // Start taking samples "frequency" times per second of CPU time consumed.
+  // Only one profiler can be active in a process at a time.
+  absl::Status Start(int frequency = 97);
+  void Stop();
+
+  // Attribute subsequent samples to "tag", which has to outlive this
+  // profiler. nullptr for untagged samples. Async-signal safe.
+  static void SetTag(const char *tag);
+
+  // Write folded stacks of all samples taken so far.
+  void WriteFolded(std::ostream *out);
+
+  size_t StatSamples() const { return samples_taken_; }
+  size_t StatDropped() const { return dropped_; }
+
+ private:
+  static constexpr int kMaxDepth = 48;
+
+  // Ring entry. The signal handler claims the entry at write position "pos"
+  // if its sequence is "pos", and publishes it by setting it to "pos + 1".
+  // After aggregation, the entry is freed for the next round by setting
+  // the sequence to "pos + max_samples".
+  struct Sample {
+    std::atomic<size_t> sequence;
+    const char *tag;
+    int depth;
+    void *frames[kMaxDepth];
+  };
+
+  // Tag and frames, innermost first.
+  using Stack = std::pair<const char *, std::vector<void *>>;
+
+  static void HandleSignal(int);
+
+  // Aggregate samples taken into stack_counts_ and free their entries.
+  // Call with mutex_ held.
+  void CollectSamples();
+  void RunCollector();
+
+  const size_t max_samples_;
+  std::unique_ptr<Sample[]> samples_;
+  std::atomic<size_t> write_pos_{0};
+  std::atomic<size_t> samples_taken_{0};
+  std::atomic<size_t> dropped_{0};
+
+  std::mutex mutex_;
+  size_t read_pos_ = 0;                     // Guarded by mutex_
+  std::map<Stack, size_t> stack_counts_;    // Guarded by mutex_
+  bool stopping_ = false;                   // Guarded by mutex_
+  std::condition_variable stop_requested_;  // Signaled with stopping_
+  std::thread collector_;
+};
+
+#endif  // SAMPLING_PROFILER_H
@@ -0,0 +1,87 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "sampling-profiler.h"
+
+#include <ctime>
+#include <sstream>
+#include <string>
+
+#include <absl/strings/match.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+
+#include "gtest/gtest.h"
+
+// Keep the CPU busy, so that the profiling timer fires.
+static void BurnCpu(double seconds) {
+  const clock_t start = clock();
+  volatile double sink = 0;
+  while (clock() - start < seconds * CLOCKS_PER_SEC) {
+    for (int i = 0; i < 1000; ++i) sink = sink + i;
+  }
+}
+
+TEST(SamplingProfiler, SamplesAreTaggedAndFolded) {
+  SamplingProfiler profiler;
+  ASSERT_TRUE(profiler.Start(1000).ok());
+
+  SamplingProfiler other;
+  EXPECT_FALSE(other.Start().ok());  // Only one at a time.
+
+  SamplingProfiler::SetTag("burn");
+  BurnCpu(0.3);
+  SamplingProfiler::SetTag(nullptr);
+  profiler.Stop();
+  ASSERT_GT(profiler.StatSamples(), 0);
+
+  std::stringstream out;
+  profiler.WriteFolded(&out);
+  size_t total = 0;
+  bool seen_tag = false;
+  for (absl::string_view line :
+       absl::StrSplit(out.str(), '\n', absl::SkipEmpty())) {
+    const size_t space = line.find_last_of(' ');
+    ASSERT_NE(space, absl::string_view::npos) << line;
+    int count;
+    ASSERT_TRUE(absl::SimpleAtoi(line.substr(space + 1), &count)) << line;
+    total += count;
+    seen_tag |= absl::StartsWith(line, "burn;");
+  }
+  EXPECT_EQ(total, profiler.StatSamples());
+  EXPECT_TRUE(seen_tag) << out.str();
+
+  // Now that the first one is stopped, another one can run.
+  EXPECT_TRUE(other.Start().ok());
+}
+
+TEST(SamplingProfiler, SamplesBeyondCapacityAreDropped) {
+  SamplingProfiler profiler(5);
+  ASSERT_TRUE(profiler.Start(1000).ok());
+  BurnCpu(0.2);
+  profiler.Stop();
+  EXPECT_EQ(profiler.StatSamples(), 5);
+  EXPECT_GT(profiler.StatDropped(), 0);
+}
+
+TEST(SamplingProfiler, CollectedSamplesMakeRoomForNewOnes) {
+  SamplingProfiler profiler(5);
+  ASSERT_TRUE(profiler.Start(1000).ok());
+  BurnCpu(0.2);
+  std::stringstream out;
+  profiler.WriteFolded(&out);  // Collects the samples taken so far.
+  BurnCpu(0.2);
+  profiler.Stop();
+  EXPECT_GT(profiler.StatSamples(), 5);
+}
@@ -0,0 +1,208 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shared-memory-transport.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <vector>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_join.h>
+#include <absl/strings/str_split.h>
+
+// A full ring means the other side is busy; no doorbell for space, we
+// just check back shortly.
+static constexpr useconds_t kFullRingBackoffUs = 50;
+
+// Chunks written to the ring. An empty chunk marks the end of stream.
+class SharedMemoryTransport::OutputBuffer : public std::streambuf {
+ public:
+  static constexpr size_t kBufferSize = 1 << 16;
+
+  explicit OutputBuffer(SharedMemoryTransport *transport)
+      : transport_(transport), buffer_(new char[kBufferSize]) {
+    setp(buffer_.get(), buffer_.get() + kBufferSize);
+  }
+
+ protected:
+  int sync() final {
+    bool ok = true;
+    if (pptr() > pbase()) {
+      ok = transport_
+               ->Write({pbase(), static_cast<size_t>(pptr() - pbase())})
+               .ok();
+    }
+    setp(buffer_.get(), buffer_.get() + kBufferSize);
+    return ok ? 0 : -1;
+  }
+
+  int_type overflow(int_type c) final {
+    if (sync() != 0) return traits_type::eof();
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  // Large writes go out directly instead of through the buffer.
+  std::streamsize xsputn(const char *data, std::streamsize size) final {
+    if (size > epptr() - pptr()) {
+      if (sync() != 0) return 0;
+      if (size >= static_cast<std::streamsize>(kBufferSize)) {
+        return transport_->Write({data, static_cast<size_t>(size)}).ok()
+                   ? size
+                   : 0;
+      }
+    }
+    memcpy(pptr(), data, size);
+    pbump(size);
+    return size;
+  }
+
+ private:
+  SharedMemoryTransport *const transport_;
+  std::unique_ptr<char[]> buffer_;
+};
+
+/*static*/ absl::Status SharedMemoryTransport::Create(
+    std::unique_ptr<SharedMemoryTransport> *result) {
+  std::unique_ptr<SharedRing> incoming;
+  std::unique_ptr<SharedRing> outgoing;
+  absl::Status status = SharedRing::Create(kRingCapacity, &incoming);
+  if (status.ok()) status = SharedRing::Create(kRingCapacity, &outgoing);
+  if (!status.ok()) return status;
+  result->reset(
+      new SharedMemoryTransport(std::move(incoming), std::move(outgoing)));
+  return absl::OkStatus();
+}
+
+// The channel lists the rings from the perspective of the attaching side:
+// what it reads first, then what it writes.
+/*static*/ absl::Status SharedMemoryTransport::Attach(
+    const std::string &channel,
+    std::unique_ptr<SharedMemoryTransport> *result) {
+  std::vector<int> fds;
+  for (absl::string_view fd_string : absl::StrSplit(channel, ',')) {
+    int fd;
+    if (!absl::SimpleAtoi(fd_string, &fd)) break;
+    fds.push_back(fd);
+  }
+  if (fds.size() != 4) {
+    return absl::InvalidArgumentError("Expected four file descriptors");
+  }
+  std::unique_ptr<SharedRing> incoming;
+  std::unique_ptr<SharedRing> outgoing;
+  absl::Status status = SharedRing::Attach(fds[0], fds[1], &incoming);
+  if (!status.ok()) {
+    close(fds[2]);
+    close(fds[3]);
+    return status;
+  }
+  status = SharedRing::Attach(fds[2], fds[3], &outgoing);
+  if (!status.ok()) return status;
+  result->reset(
+      new SharedMemoryTransport(std::move(incoming), std::move(outgoing)));
+  return absl::OkStatus();
+}
+
+SharedMemoryTransport::SharedMemoryTransport(
+    std::unique_ptr<SharedRing> incoming, std::unique_ptr<SharedRing> outgoing)
+    : incoming_(std::move(incoming)),
+      outgoing_(std::move(outgoing)),
+      output_buffer_(new OutputBuffer(this)) {}
+
+SharedMemoryTransport::~SharedMemoryTransport() = default;
+
+std::string SharedMemoryTransport::channel() const {
+  const int fds[] = {outgoing_->memory_fd(), outgoing_->doorbell_fd(),
+                     incoming_->memory_fd(), incoming_->doorbell_fd()};
+  return absl::StrJoin(fds, ",");
+}
+
+void SharedMemoryTransport::KeepChannelOpenOnExec() {
+  for (const int fd : {outgoing_->memory_fd(), outgoing_->doorbell_fd(),
+                       incoming_->memory_fd(), incoming_->doorbell_fd()}) {
+    fcntl(fd, F_SETFD, 0);
+  }
+}
+
+// Like read() on a pipe, returns all that is available up to "size", so
+// possibly several chunks. A chunk is only popped once it has been read
+// completely.
+int SharedMemoryTransport::Read(char *buf, int size) {
+  absl::string_view chunk;
+  while (!incoming_->Peek(&chunk)) {
+    if (incoming_->ArmDoorbell()) incoming_->WaitDoorbell(-1);
+  }
+  int count = 0;
+  do {
+    if (chunk.empty()) break;  // End of stream; stays there.
+    read_offset_ = std::min(read_offset_, chunk.size());  // If handed over.
+    chunk.remove_prefix(read_offset_);
+    const size_t n = std::min(chunk.size(), static_cast<size_t>(size - count));
+    memcpy(buf + count, chunk.data(), n);
+    count += n;
+    read_offset_ += n;
+    if (n < chunk.size()) break;
+    incoming_->Pop();
+    read_offset_ = 0;
+  } while (count < size && incoming_->Peek(&chunk));
+  return count;
+}
+
+void SharedMemoryTransport::WatchInput() {
+  incoming_->ResetDoorbell();
+  if (!incoming_->ArmDoorbell()) incoming_->RingDoorbell();
+}
+
+absl::Status SharedMemoryTransport::Push(absl::string_view chunk) {
+  if (write_broken_) {
+    return absl::FailedPreconditionError("Earlier write timed out");
+  }
+  if (outgoing_->Push({chunk})) return absl::OkStatus();
+  const auto give_up = std::chrono::steady_clock::now() + write_timeout_;
+  while (!outgoing_->Push({chunk})) {
+    if (std::chrono::steady_clock::now() >= give_up) {
+      write_broken_ = true;
+      return absl::DeadlineExceededError("Other side doesn't read");
+    }
+    usleep(kFullRingBackoffUs);
+  }
+  return absl::OkStatus();
+}
+
+absl::Status SharedMemoryTransport::Write(absl::string_view data) {
+  const size_t max_chunk = outgoing_->max_message_size();
+  while (!data.empty()) {
+    const absl::string_view chunk = data.substr(0, max_chunk);
+    if (absl::Status status = Push(chunk); !status.ok()) return status;
+    data.remove_prefix(chunk.size());
+  }
+  return absl::OkStatus();
+}
+
+std::streambuf *SharedMemoryTransport::output_buffer() {
+  return output_buffer_.get();
+}
+
+absl::Status SharedMemoryTransport::CloseWrite() {
+  output_buffer_->pubsync();
+  return Push(absl::string_view());  // Fails if pubsync() broke the stream.
+}
@@ -0,0 +1,130 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHARED_MEMORY_TRANSPORT_H
+#define SHARED_MEMORY_TRANSPORT_H
+
+#include <chrono>
+#include <memory>
+#include <streambuf>
+#include <string>
+
+#include <absl/status/status.h>
+#include <absl/strings/string_view.h>
+
+#include "shared-ring.h"
+
+// Byte stream in both directions between a client and the server running
+// on the same machine, as faster replacement of stdin/stdout pipes. Each
+// direction is a SharedRing; chunks written are copied into shared memory
+// and the other side picks them up without a system call as long as it is
+// busy anyway.
+//
+// It transports the same byte stream as the pipes would, so the usual
+// framing applies and MessageStreamSplitter reads from it with Read() as
+// its ReadFun.
+//
+// The client creates the transport and starts the server with the
+// channel() to Attach() to.
+class SharedMemoryTransport {
+ public:
+  static constexpr size_t kRingCapacity = 4 << 20;
+
+  // A ring staying full for that long means the other side is gone or
+  // stuck.
+  static constexpr std::chrono::milliseconds kDefaultWriteTimeout{10000};
+
+  // Client side: create a new transport.
+  static absl::Status Create(std::unique_ptr<SharedMemoryTransport> *result);
+
+  // Server side: attach to the transport "channel" created by Create() in
+  // another process. Takes ownership of the file descriptors.
+  static absl::Status Attach(const std::string &channel,
+                             std::unique_ptr<SharedMemoryTransport> *result);
+
+  SharedMemoryTransport(const SharedMemoryTransport &) = delete;
+  ~SharedMemoryTransport();
+
+  // Description of the file descriptors for the other side to attach to.
+  std::string channel() const;
+
+  // Let the channel file descriptors survive exec(). To be called in the
+  // child before exec()ing the other side.
+  void KeepChannelOpenOnExec();
+
+  // -- Reading
+
+  // Read up to "size" bytes, blocking until some are available; behaves
+  // like read(), so is usable as MessageStreamSplitter::ReadFun. Returns
+  // 0 once the other side closed its end.
+  int Read(char *buf, int size);
+
+  // Bytes already read of the oldest chunk, which is only removed once
+  // read completely. To be handed over to another process attaching to the
+  // same channel, e.g. on hot restart, so that it continues right there.
+  size_t read_offset() const { return read_offset_; }
+  void set_read_offset(size_t offset) { read_offset_ = offset; }
+
+  // For an event loop: file descriptor to wait on to become readable. It
+  // is only signalled after a call to WatchInput().
+  int read_fd() const { return incoming_->doorbell_fd(); }
+
+  // Make read_fd() readable as soon as there is input to Read(), right
+  // away if there is some already. Call before returning to the event
+  // loop, after reading as much as desired.
+  void WatchInput();
+
+  // -- Writing
+
+  // Write all "data". If the other side does not keep up and the ring is
+  // full, waits until there is space, but not longer than the write
+  // timeout. After such a timeout, the stream is broken: the other side
+  // might have missed data, so this and all further writes return an error.
+  absl::Status Write(absl::string_view data);
+
+  // Bytes that can be written right now without waiting for the other side
+  // to read, give or take the overhead of each chunk. There is no file
+  // descriptor signalling space, so an event loop has to check this.
+  size_t output_space() const { return outgoing_->free_space(); }
+
+  void SetWriteTimeout(std::chrono::milliseconds timeout) {
+    write_timeout_ = timeout;
+  }
+
+  // Buffer for a std::ostream, e.g. to be set as rdbuf() of std::cout.
+  // Data is written in chunks when full or on flush(); a failing Write()
+  // sets the stream's badbit.
+  std::streambuf *output_buffer();
+
+  // Signal end of stream to the other side; no more Write() after this.
+  absl::Status CloseWrite();
+
+ private:
+  class OutputBuffer;
+
+  SharedMemoryTransport(std::unique_ptr<SharedRing> incoming,
+                        std::unique_ptr<SharedRing> outgoing);
+
+  // Push "chunk" to the outgoing ring, waiting up to the write timeout.
+  absl::Status Push(absl::string_view chunk);
+
+  const std::unique_ptr<SharedRing> incoming_;
+  const std::unique_ptr<SharedRing> outgoing_;
+  size_t read_offset_ = 0;  // Already read from the current chunk.
+  std::chrono::milliseconds write_timeout_ = kDefaultWriteTimeout;
+  bool write_broken_ = false;
+  std::unique_ptr<OutputBuffer> output_buffer_;
+};
+
+#endif  // SHARED_MEMORY_TRANSPORT_H
@@ -0,0 +1,132 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// One-way transfer of Content-Length framed 1KB messages from a writer
+// thread to a reader that splits them with the MessageStreamSplitter, like
+// the server does with its input. Compares a SharedMemoryTransport with a
+// pipe, the way stdin reaches the server.
+
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_split.h>
+
+#include "message-stream-splitter.h"
+#include "shared-memory-transport.h"
+
+static constexpr int kMessages = 1 << 20;  // 1GiB of bodies.
+static constexpr int kBodySize = 1024;
+
+struct Result {
+  double gigabytes_per_second;
+  double messages_per_second;
+};
+
+// Transfer kMessages from "write_fun" to a splitter reading with
+// "read_fun". The writer runs in its own thread; "close_fun" ends the stream.
+static Result Transfer(const std::function<void(absl::string_view)> &write_fun,
+                       const std::function<void()> &close_fun,
+                       const MessageStreamSplitter::ReadFun &read_fun) {
+  const std::string body(kBodySize, 'x');
+  const std::string message =
+      absl::StrCat("Content-Length: ", body.size(), "\r\n\r\n", body);
+
+  MessageStreamSplitter splitter(1 << 20);
+  int received = 0;
+  splitter.SetMessageProcessor(
+      [&](absl::string_view, absl::string_view) { ++received; });
+
+  const auto start = std::chrono::steady_clock::now();
+  std::thread writer([&]() {
+    for (int i = 0; i < kMessages; ++i) write_fun(message);
+    close_fun();
+  });
+  while (splitter.PullFrom(read_fun).ok()) {
+  }
+  writer.join();
+  const double seconds = std::chrono::duration<double>(
+                             std::chrono::steady_clock::now() - start)
+                             .count();
+  if (received != kMessages) {
+    fprintf(stderr, "Unexpected: received %d of %d messages.\n", received,
+            kMessages);
+  }
+  return {splitter.StatTotalBytesRead() / seconds / 1e9, received / seconds};
+}
+
+static Result TransferThroughPipe() {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    perror("pipe");
+    exit(1);
+  }
+  const Result result = Transfer(
+      [&](absl::string_view data) {
+        while (!data.empty()) {
+          const ssize_t w = write(fds[1], data.data(), data.size());
+          if (w <= 0) return;
+          data.remove_prefix(w);
+        }
+      },
+      [&]() { close(fds[1]); },
+      [&](char *buf, int size) { return read(fds[0], buf, size); });
+  close(fds[0]);
+  return result;
+}
+
+static Result TransferThroughSharedMemory() {
+  std::unique_ptr<SharedMemoryTransport> client;
+  if (!SharedMemoryTransport::Create(&client).ok()) {
+    fprintf(stderr, "Can't create shared memory transport.\n");
+    exit(1);
+  }
+  // The server side attaches to copies of the descriptors, as it would
+  // after inheriting them.
+  std::string channel;
+  for (absl::string_view fd : absl::StrSplit(client->channel(), ',')) {
+    int number;
+    if (!absl::SimpleAtoi(fd, &number)) continue;
+    absl::StrAppend(&channel, channel.empty() ? "" : ",", dup(number));
+  }
+  std::unique_ptr<SharedMemoryTransport> server;
+  if (!SharedMemoryTransport::Attach(channel, &server).ok()) {
+    fprintf(stderr, "Can't attach to shared memory transport.\n");
+    exit(1);
+  }
+  return Transfer(
+      [&](absl::string_view data) { client->Write(data).IgnoreError(); },
+      [&]() { client->CloseWrite().IgnoreError(); },
+      [&](char *buf, int size) { return server->Read(buf, size); });
+}
+
+int main() {
+  fprintf(stderr, "%d messages with %d byte body.\n", kMessages, kBodySize);
+  fprintf(stderr, "%-14s %8s %14s\n", "Transport", "GB/s", "Messages/s");
+  const std::pair<const char *, std::function<Result()>> transports[] = {
+      {"Pipe", TransferThroughPipe},
+      {"Shared memory", TransferThroughSharedMemory}};
+  for (const auto &transport : transports) {
+    const Result r = transport.second();
+    fprintf(stderr, "%-14s %8.2f %14.0f\n", transport.first,
+            r.gigabytes_per_second, r.messages_per_second);
+  }
+}
@@ -0,0 +1,184 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shared-memory-transport.h"
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_join.h>
+#include <absl/strings/str_split.h>
+
+#include "gtest/gtest.h"
+
+// Other end in the same process, on its own copy of the file descriptors.
+static std::unique_ptr<SharedMemoryTransport> AttachCopy(
+    const SharedMemoryTransport &transport) {
+  std::vector<int> fds;
+  for (absl::string_view fd_string : absl::StrSplit(transport.channel(), ',')) {
+    int fd;
+    EXPECT_TRUE(absl::SimpleAtoi(fd_string, &fd));
+    fds.push_back(dup(fd));
+  }
+  std::unique_ptr<SharedMemoryTransport> result;
+  EXPECT_TRUE(
+      SharedMemoryTransport::Attach(absl::StrJoin(fds, ","), &result).ok());
+  return result;
+}
+
+static bool IsReadable(int fd) {
+  struct pollfd pfd = {.fd = fd, .events = POLLIN, .revents = 0};
+  return poll(&pfd, 1, 0) == 1;
+}
+
+static std::string ReadUntilEnd(SharedMemoryTransport *transport) {
+  std::string result;
+  char buffer[4096];
+  int r;
+  while ((r = transport->Read(buffer, sizeof(buffer))) > 0) {
+    result.append(buffer, r);
+  }
+  return result;
+}
+
+TEST(SharedMemoryTransport, StreamOutputIsSentOnFlush) {
+  std::unique_ptr<SharedMemoryTransport> client;
+  ASSERT_TRUE(SharedMemoryTransport::Create(&client).ok());
+  auto server = AttachCopy(*client);
+  ASSERT_TRUE(server);
+
+  std::ostream out(server->output_buffer());
+  out << "Hello";
+  client->WatchInput();
+  EXPECT_FALSE(IsReadable(client->read_fd()));  // Still buffered.
+
+  out << ", world" << std::flush;
+  EXPECT_TRUE(IsReadable(client->read_fd()));
+  char buffer[5];  // Smaller than sent: rest stays for next read.
+  ASSERT_EQ(client->Read(buffer, sizeof(buffer)), 5);
+  EXPECT_EQ(std::string(buffer, 5), "Hello");
+  client->WatchInput();  // Still data pending: readable right away.
+  EXPECT_TRUE(IsReadable(client->read_fd()));
+
+  EXPECT_TRUE(server->CloseWrite().ok());
+  EXPECT_EQ(ReadUntilEnd(client.get()), ", world");
+  EXPECT_EQ(client->Read(buffer, sizeof(buffer)), 0);  // Stays at end.
+}
+
+TEST(SharedMemoryTransport, WritesLargerThanRingMessages) {
+  std::unique_ptr<SharedMemoryTransport> client;
+  ASSERT_TRUE(SharedMemoryTransport::Create(&client).ok());
+  auto server = AttachCopy(*client);
+  ASSERT_TRUE(server);
+
+  std::string sent;
+  for (int i = 0; sent.size() < 3 << 20; ++i) {
+    sent.append(std::to_string(i)).append(" ");
+  }
+  EXPECT_TRUE(client->Write(sent).ok());
+  EXPECT_TRUE(client->CloseWrite().ok());
+  EXPECT_EQ(ReadUntilEnd(server.get()), sent);
+}
+
+TEST(SharedMemoryTransport, EchoFromOtherProcess) {
+  std::unique_ptr<SharedMemoryTransport> client;
+  ASSERT_TRUE(SharedMemoryTransport::Create(&client).ok());
+  const std::string channel = client->channel();
+  const pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0) {
+    std::unique_ptr<SharedMemoryTransport> server;
+    if (!SharedMemoryTransport::Attach(channel, &server).ok()) _exit(1);
+    char buffer[1000];
+    int r;
+    while ((r = server->Read(buffer, sizeof(buffer))) > 0) {
+      if (!server->Write({buffer, static_cast<size_t>(r)}).ok()) _exit(2);
+    }
+    _exit(server->CloseWrite().ok() ? 0 : 2);
+  }
+
+  std::string sent;
+  for (int i = 0; i < 10000; ++i) {
+    const std::string line = "line " + std::to_string(i) + "\n";
+    ASSERT_TRUE(client->Write(line).ok());
+    sent.append(line);
+  }
+  ASSERT_TRUE(client->CloseWrite().ok());
+  EXPECT_EQ(ReadUntilEnd(client.get()), sent);
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
+
+TEST(SharedMemoryTransport, WriteGivesUpIfOtherSideDoesNotRead) {
+  std::unique_ptr<SharedMemoryTransport> client;
+  ASSERT_TRUE(SharedMemoryTransport::Create(&client).ok());
+  client->SetWriteTimeout(std::chrono::milliseconds(10));
+
+  // Nobody attached to read.
+  const std::string chunk(1 << 20, 'x');
+  absl::Status status;
+  for (int i = 0; i < 10 && status.ok(); ++i) status = client->Write(chunk);
+  EXPECT_EQ(status.code(), absl::StatusCode::kDeadlineExceeded);
+
+  // Broken from now on, without waiting again.
+  EXPECT_FALSE(client->Write("more").ok());
+  EXPECT_FALSE(client->CloseWrite().ok());
+  std::ostream out(client->output_buffer());
+  out << "more" << std::flush;
+  EXPECT_TRUE(out.bad());
+}
+
+TEST(SharedMemoryTransport, OutputSpaceIsBackOnceRead) {
+  std::unique_ptr<SharedMemoryTransport> client;
+  ASSERT_TRUE(SharedMemoryTransport::Create(&client).ok());
+  auto server = AttachCopy(*client);
+  ASSERT_TRUE(server);
+  const size_t empty_space = client->output_space();
+  EXPECT_EQ(empty_space, SharedMemoryTransport::kRingCapacity);
+
+  const std::string chunk(1 << 20, 'x');
+  ASSERT_TRUE(client->Write(chunk).ok());
+  EXPECT_LT(client->output_space(), empty_space - chunk.size() + 1);
+
+  std::string received(chunk.size(), '\0');
+  for (size_t got = 0; got < chunk.size(); /**/) {
+    got += server->Read(&received[got], received.size() - got);
+  }
+  EXPECT_EQ(client->output_space(), empty_space);
+}
+
+TEST(SharedMemoryTransport, ReadOffsetCanBeHandedOver) {
+  std::unique_ptr<SharedMemoryTransport> client;
+  ASSERT_TRUE(SharedMemoryTransport::Create(&client).ok());
+  auto server = AttachCopy(*client);
+  ASSERT_TRUE(server);
+  ASSERT_TRUE(client->Write("Hello, world").ok());
+  ASSERT_TRUE(client->CloseWrite().ok());
+
+  char buffer[5];
+  ASSERT_EQ(server->Read(buffer, sizeof(buffer)), 5);
+
+  // Like a restarted server continuing on the same channel.
+  auto restarted = AttachCopy(*client);
+  ASSERT_TRUE(restarted);
+  restarted->set_read_offset(server->read_offset());
+  EXPECT_EQ(ReadUntilEnd(restarted.get()), ", world");
+}
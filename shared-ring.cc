@@ -0,0 +1,237 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shared-ring.h"
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <new>
+
+#include <absl/strings/str_cat.h>
+
+// Positions are byte counts since creation; they only grow, the offset in
+// the data is the position modulo capacity. Each message is an 8 byte
+// record header with its length, followed by the message padded to 8 bytes.
+// A message never wraps around the end; the space left there is skipped
+// with a kWrapMarker record.
+struct SharedRing::Header {
+  alignas(64) std::atomic<uint64_t> write_pos;
+  alignas(64) std::atomic<uint64_t> read_pos;
+  alignas(64) std::atomic<uint32_t> doorbell_armed;
+  uint64_t capacity;
+};
+
+static constexpr uint32_t kWrapMarker = 0xffffffff;
+static constexpr size_t kRecordHeader = 8;
+static constexpr size_t kDataOffset = 256;  // Header rounded up.
+static_assert(sizeof(std::atomic<uint64_t>) == 8 &&
+                  std::atomic<uint64_t>::is_always_lock_free,
+              "Need lock-free atomics to share between processes");
+
+static size_t RecordSize(size_t message_size) {
+  return kRecordHeader + ((message_size + 7) & ~size_t{7});
+}
+
+static absl::Status ErrnoStatus(absl::string_view what) {
+  return absl::InternalError(absl::StrCat(what, ": ", strerror(errno)));
+}
+
+/*static*/ absl::Status SharedRing::Create(size_t capacity,
+                                           std::unique_ptr<SharedRing> *ring) {
+  capacity = (capacity + 7) & ~size_t{7};
+  const int memory_fd = memfd_create("bare-lsp-ring", MFD_CLOEXEC);
+  if (memory_fd < 0) return ErrnoStatus("memfd_create()");
+  const int doorbell_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (doorbell_fd < 0 || ftruncate(memory_fd, kDataOffset + capacity) != 0) {
+    const absl::Status status = ErrnoStatus("Creating ring");
+    close(memory_fd);
+    if (doorbell_fd >= 0) close(doorbell_fd);
+    return status;
+  }
+  return Map(memory_fd, doorbell_fd, capacity, ring);
+}
+
+/*static*/ absl::Status SharedRing::Attach(int memory_fd, int doorbell_fd,
+                                           std::unique_ptr<SharedRing> *ring) {
+  return Map(memory_fd, doorbell_fd, 0, ring);
+}
+
+/*static*/ absl::Status SharedRing::Map(int memory_fd, int doorbell_fd,
+                                        size_t new_capacity,
+                                        std::unique_ptr<SharedRing> *ring) {
+  struct stat st;
+  void *mapping = MAP_FAILED;
+  if (fstat(memory_fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) > kDataOffset) {
+    mapping = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   memory_fd, 0);
+  }
+  if (mapping == MAP_FAILED) {
+    const absl::Status status = ErrnoStatus("Mapping ring");
+    close(memory_fd);
+    close(doorbell_fd);
+    return status;
+  }
+  // The header is writable by the other process, so the capacity is only
+  // read once and checked here, never trusted again later.
+  Header *const header = reinterpret_cast<Header *>(mapping);
+  if (new_capacity) header->capacity = new_capacity;
+  const uint64_t capacity = header->capacity;
+  if (capacity < 2 * RecordSize(1) || capacity % 8 != 0 ||
+      capacity > st.st_size - kDataOffset) {
+    munmap(mapping, st.st_size);
+    close(memory_fd);
+    close(doorbell_fd);
+    return absl::InvalidArgumentError("Ring capacity doesn't fit its memory");
+  }
+  ring->reset(
+      new SharedRing(memory_fd, doorbell_fd, mapping, st.st_size, capacity));
+  return absl::OkStatus();
+}
+
+// A new memfd is all zero, which is a valid empty header.
+SharedRing::SharedRing(int memory_fd, int doorbell_fd, void *mapping,
+                       size_t mapping_size, uint64_t capacity)
+    : memory_fd_(memory_fd),
+      doorbell_fd_(doorbell_fd),
+      mapping_(mapping),
+      mapping_size_(mapping_size),
+      capacity_(capacity),
+      header_(reinterpret_cast<Header *>(mapping)),
+      data_(reinterpret_cast<char *>(mapping) + kDataOffset) {}
+
+SharedRing::~SharedRing() {
+  munmap(mapping_, mapping_size_);
+  close(memory_fd_);
+  close(doorbell_fd_);
+}
+
+// Need to be able to place a message after skipping a wrap.
+size_t SharedRing::max_message_size() const {
+  return capacity_ / 2 - kRecordHeader;
+}
+
+size_t SharedRing::free_space() const {
+  const uint64_t write_pos = header_->write_pos.load(std::memory_order_relaxed);
+  const uint64_t read_pos = header_->read_pos.load(std::memory_order_acquire);
+  const uint64_t used = write_pos - read_pos;
+  return used > capacity_ ? 0 : capacity_ - used;  // Corrupted by consumer.
+}
+
+bool SharedRing::Push(const std::vector<absl::string_view> &parts) {
+  size_t message_size = 0;
+  for (absl::string_view part : parts) message_size += part.size();
+  if (message_size > max_message_size()) return false;
+
+  const uint64_t capacity = capacity_;
+  uint64_t write_pos = header_->write_pos.load(std::memory_order_relaxed);
+  const uint64_t read_pos = header_->read_pos.load(std::memory_order_acquire);
+  if (write_pos % 8 != 0) return false;  // Corrupted by consumer.
+  const size_t record_size = RecordSize(message_size);
+  const size_t room_to_end = capacity - write_pos % capacity;
+  const size_t needed =
+      record_size + (room_to_end < record_size ? room_to_end : 0);
+  if (write_pos + needed - read_pos > capacity) return false;
+
+  if (room_to_end < record_size) {
+    memcpy(data_ + write_pos % capacity, &kWrapMarker, sizeof(kWrapMarker));
+    write_pos += room_to_end;
+  }
+  char *record = data_ + write_pos % capacity;
+  const uint32_t size32 = message_size;
+  memcpy(record, &size32, sizeof(size32));
+  char *out = record + kRecordHeader;
+  for (absl::string_view part : parts) {
+    memcpy(out, part.data(), part.size());
+    out += part.size();
+  }
+  // Publishing the message and checking the doorbell pairs with
+  // ArmDoorbell() doing the opposite; both sequentially consistent, so at
+  // least one of us sees the other.
+  header_->write_pos.store(write_pos + record_size);
+  if (header_->doorbell_armed.exchange(0)) RingDoorbell();
+  return true;
+}
+
+// Positions and records are written by the producer, so everything is
+// checked to be within the data before it is used; a corrupted ring looks
+// empty.
+bool SharedRing::Peek(absl::string_view *message) {
+  const uint64_t capacity = capacity_;
+  uint64_t read_pos = header_->read_pos.load(std::memory_order_relaxed);
+  const uint64_t write_pos = header_->write_pos.load(std::memory_order_acquire);
+  if (read_pos == write_pos) return false;
+  if (read_pos % 8 != 0 || write_pos - read_pos > capacity) return false;
+  uint32_t size;
+  memcpy(&size, data_ + read_pos % capacity, sizeof(size));
+  if (size == kWrapMarker) {
+    const uint64_t wrapped_pos = read_pos + capacity - read_pos % capacity;
+    if (wrapped_pos > write_pos) return false;
+    read_pos = wrapped_pos;
+    header_->read_pos.store(read_pos, std::memory_order_release);
+    if (read_pos == write_pos) return false;
+    memcpy(&size, data_ + read_pos % capacity, sizeof(size));
+  }
+  if (size > max_message_size()) return false;
+  const uint64_t offset = read_pos % capacity;
+  if (offset + RecordSize(size) > capacity ||
+      read_pos + RecordSize(size) > write_pos) {
+    return false;
+  }
+  *message = {data_ + offset + kRecordHeader, size};
+  return true;
+}
+
+void SharedRing::Pop() {
+  absl::string_view message;
+  if (!Peek(&message)) return;
+  header_->read_pos.store(
+      header_->read_pos.load(std::memory_order_relaxed) +
+          RecordSize(message.size()),
+      std::memory_order_release);
+}
+
+bool SharedRing::ArmDoorbell() {
+  header_->doorbell_armed.store(1);
+  return header_->write_pos.load() ==
+         header_->read_pos.load(std::memory_order_relaxed);
+}
+
+void SharedRing::WaitDoorbell(int timeout_ms) {
+  struct pollfd pfd = {.fd = doorbell_fd_, .events = POLLIN, .revents = 0};
+  poll(&pfd, 1, timeout_ms);
+  ResetDoorbell();
+}
+
+void SharedRing::ResetDoorbell() {
+  uint64_t count;
+  (void)!read(doorbell_fd_, &count, sizeof(count));
+}
+
+void SharedRing::RingDoorbell() {
+  const uint64_t one = 1;
+  (void)!write(doorbell_fd_, &one, sizeof(one));
+}
+
+void SharedRing::Reset() {
+  header_->read_pos.store(header_->write_pos.load());
+  header_->doorbell_armed.store(0);
+}
@@ -0,0 +1,111 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SHARED_RING_H
+#define SHARED_RING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include <absl/status/status.h>
+#include <absl/strings/string_view.h>
+
+// Single-producer, single-consumer queue of messages in shared memory to
+// pass data between two processes without copying it through a pipe. The
+// memory is a memfd that the other process inherits and attaches to.
+//
+// An eventfd serves as doorbell to wake up the consumer. It is only rung if
+// the consumer armed it before going to sleep, so as long as the consumer
+// keeps up, the producer does not need any system call.
+class SharedRing {
+ public:
+  // Create a new ring that can hold "capacity" bytes of messages.
+  static absl::Status Create(size_t capacity,
+                             std::unique_ptr<SharedRing> *ring);
+
+  // Attach to a ring created by another process. Takes ownership of the
+  // file descriptors.
+  static absl::Status Attach(int memory_fd, int doorbell_fd,
+                             std::unique_ptr<SharedRing> *ring);
+
+  SharedRing(const SharedRing &) = delete;
+  ~SharedRing();
+
+  int memory_fd() const { return memory_fd_; }
+  int doorbell_fd() const { return doorbell_fd_; }
+
+  // Largest message that fits.
+  size_t max_message_size() const;
+
+  // -- Producer side.
+
+  // Append message concatenated from "parts", so that pieces don't have to
+  // be assembled in a separate buffer first. Returns false if there is not
+  // enough space right now.
+  bool Push(const std::vector<absl::string_view> &parts);
+
+  // Bytes not taken by messages the consumer hasn't removed yet. Records
+  // have some overhead, so the messages that fit are a bit smaller.
+  size_t free_space() const;
+
+  // -- Consumer side.
+
+  // Get the oldest message without copying; "message" points into the
+  // shared memory and is valid until Pop(). Returns false if empty.
+  bool Peek(absl::string_view *message);
+
+  // Remove the oldest message.
+  void Pop();
+
+  // Ask the producer to ring the doorbell on the next Push(). Returns
+  // false if a message arrived meanwhile; no need to wait then.
+  bool ArmDoorbell();
+
+  // Wait until the doorbell rings or "timeout_ms" passes, then reset it.
+  // In an event loop, rather wait for doorbell_fd() to become readable and
+  // call ResetDoorbell().
+  void WaitDoorbell(int timeout_ms);
+  void ResetDoorbell();
+
+  // Ring the doorbell unconditionally, e.g. to be woken up again by the
+  // event loop while messages are still pending.
+  void RingDoorbell();
+
+  // Discard all messages. Only if the other side is gone, e.g. a crashed
+  // process that might have left a message half-written.
+  void Reset();
+
+ private:
+  struct Header;
+
+  // Map the ring memory; if "new_capacity" is non-zero, set up a new ring
+  // with it.
+  static absl::Status Map(int memory_fd, int doorbell_fd, size_t new_capacity,
+                          std::unique_ptr<SharedRing> *ring);
+
+  SharedRing(int memory_fd, int doorbell_fd, void *mapping,
+             size_t mapping_size, uint64_t capacity);
+
+  const int memory_fd_;
+  const int doorbell_fd_;
+  void *const mapping_;
+  const size_t mapping_size_;
+  const uint64_t capacity_;  // Not from the header, the other side can write.
+  Header *const header_;
+  char *const data_;
+};
+
+#endif  // SHARED_RING_H
@@ -0,0 +1,154 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "shared-ring.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+
+TEST(SharedRing, MessagesComeOutInOrder) {
+  std::unique_ptr<SharedRing> ring;
+  ASSERT_TRUE(SharedRing::Create(1024, &ring).ok());
+  absl::string_view message;
+  EXPECT_FALSE(ring->Peek(&message));
+
+  EXPECT_TRUE(ring->Push({"Hello", ", ", "world"}));
+  EXPECT_TRUE(ring->Push({""}));
+  EXPECT_TRUE(ring->Push({"foo"}));
+
+  ASSERT_TRUE(ring->Peek(&message));
+  EXPECT_EQ(message, "Hello, world");
+  ring->Pop();
+  ASSERT_TRUE(ring->Peek(&message));
+  EXPECT_EQ(message, "");
+  ring->Pop();
+  ASSERT_TRUE(ring->Peek(&message));
+  EXPECT_EQ(message, "foo");
+  ring->Pop();
+  EXPECT_FALSE(ring->Peek(&message));
+}
+
+TEST(SharedRing, FullRingRejectsUntilConsumed) {
+  std::unique_ptr<SharedRing> ring;
+  ASSERT_TRUE(SharedRing::Create(256, &ring).ok());
+  EXPECT_FALSE(ring->Push({std::string(ring->max_message_size() + 1, 'x')}));
+
+  const std::string chunk(100, 'x');
+  EXPECT_EQ(ring->free_space(), 256);
+  EXPECT_TRUE(ring->Push({chunk}));
+  EXPECT_TRUE(ring->Push({chunk}));
+  EXPECT_EQ(ring->free_space(), 256 - 2 * (8 + 104));
+  EXPECT_FALSE(ring->Push({chunk}));  // No space.
+  ring->Pop();
+  EXPECT_EQ(ring->free_space(), 256 - (8 + 104));
+  EXPECT_TRUE(ring->Push({chunk}));  // Wraps around.
+
+  absl::string_view message;
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_TRUE(ring->Peek(&message));
+    EXPECT_EQ(message, chunk);
+    ring->Pop();
+  }
+  EXPECT_FALSE(ring->Peek(&message));
+}
+
+TEST(SharedRing, WrapAroundManyTimes) {
+  std::unique_ptr<SharedRing> ring;
+  ASSERT_TRUE(SharedRing::Create(1000, &ring).ok());
+  absl::string_view message;
+  for (int i = 0; i < 10000; ++i) {
+    const std::string sent = std::to_string(i) + std::string(i % 97, 'y');
+    ASSERT_TRUE(ring->Push({sent}));
+    ASSERT_TRUE(ring->Peek(&message));
+    ASSERT_EQ(message, sent);
+    ring->Pop();
+  }
+}
+
+TEST(SharedRing, DoorbellOnlyRingsWhenArmed) {
+  std::unique_ptr<SharedRing> ring;
+  ASSERT_TRUE(SharedRing::Create(1024, &ring).ok());
+  uint64_t count;
+  ASSERT_TRUE(ring->Push({"not armed"}));
+  EXPECT_LT(read(ring->doorbell_fd(), &count, sizeof(count)), 0);
+
+  EXPECT_FALSE(ring->ArmDoorbell());  // Message pending.
+  ring->Pop();
+  EXPECT_TRUE(ring->ArmDoorbell());
+  ASSERT_TRUE(ring->Push({"armed"}));
+  EXPECT_EQ(read(ring->doorbell_fd(), &count, sizeof(count)),
+            (ssize_t)sizeof(count));
+}
+
+TEST(SharedRing, GarbageWrittenByOtherSideIsNotTrusted) {
+  std::unique_ptr<SharedRing> ring;
+  ASSERT_TRUE(SharedRing::Create(1024, &ring).ok());
+  ASSERT_TRUE(ring->Push({"hello"}));
+  const size_t max_message_size = ring->max_message_size();
+
+  // Other side overwrites header and data, including the capacity.
+  struct stat st;
+  ASSERT_EQ(fstat(ring->memory_fd(), &st), 0);
+  void *other = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     ring->memory_fd(), 0);
+  ASSERT_NE(other, MAP_FAILED);
+  memset(other, 0xff, st.st_size);
+  munmap(other, st.st_size);
+
+  absl::string_view message;
+  EXPECT_FALSE(ring->Peek(&message));
+  EXPECT_FALSE(ring->Push({"world"}));
+  EXPECT_EQ(ring->max_message_size(), max_message_size);
+}
+
+TEST(SharedRing, PassMessagesToOtherProcess) {
+  static constexpr int kMessages = 10000;
+  std::unique_ptr<SharedRing> ring;
+  ASSERT_TRUE(SharedRing::Create(4096, &ring).ok());
+  const pid_t child = fork();
+  ASSERT_GE(child, 0);
+  if (child == 0) {
+    // The child attaches on its own, as it would after exec().
+    std::unique_ptr<SharedRing> producer;
+    if (!SharedRing::Attach(dup(ring->memory_fd()), dup(ring->doorbell_fd()),
+                            &producer)
+             .ok()) {
+      _exit(1);
+    }
+    for (int i = 0; i < kMessages; ++i) {
+      const std::string message = "message " + std::to_string(i);
+      while (!producer->Push({message})) usleep(100);
+    }
+    _exit(0);
+  }
+
+  absl::string_view message;
+  for (int i = 0; i < kMessages; ++i) {
+    while (!ring->Peek(&message)) {
+      if (ring->ArmDoorbell()) ring->WaitDoorbell(1000);
+    }
+    ASSERT_EQ(message, "message " + std::to_string(i));
+    ring->Pop();
+  }
+  int status;
+  ASSERT_EQ(waitpid(child, &status, 0), child);
+  EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+}
@@ -0,0 +1,61 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "strand-executor.h"
+
+std::future<void> StrandExecutor::ExecAsync(const std::string &key,
+                                            const std::function<void()> &fun) {
+  std::packaged_task<void()> task(fun);
+  std::future<void> result = task.get_future();
+  bool start_strand;
+  {
+    const std::lock_guard<std::mutex> l(lock_);
+    auto &queue = strands_[key];
+    start_strand = queue.empty();  // Otherwise already running.
+    queue.emplace_back(std::move(task));
+  }
+  if (start_strand) pool_->ExecAsync([this, key]() { RunNext(key); });
+  return result;
+}
+
+void StrandExecutor::RunNext(const std::string &key) {
+  std::packaged_task<void()> task;
+  {
+    const std::lock_guard<std::mutex> l(lock_);
+    task = std::move(strands_[key].front());
+  }
+  task();  // Exceptions are passed on in the future.
+
+  bool more_work;
+  {
+    const std::lock_guard<std::mutex> l(lock_);
+    auto found = strands_.find(key);
+    found->second.pop_front();
+    more_work = !found->second.empty();
+    if (!more_work) strands_.erase(found);
+    if (strands_.empty()) idle_.notify_all();
+  }
+  // Back of the pool queue, to give other strands a turn.
+  if (more_work) pool_->ExecAsync([this, key]() { RunNext(key); });
+}
+
+void StrandExecutor::WaitIdle() {
+  std::unique_lock<std::mutex> l(lock_);
+  idle_.wait(l, [this]() { return strands_.empty(); });
+}
+
+size_t StrandExecutor::active_strands() const {
+  const std::lock_guard<std::mutex> l(lock_);
+  return strands_.size();
+}
@@ -0,0 +1,69 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STRAND_EXECUTOR_H
+#define STRAND_EXECUTOR_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "thread-pool.h"
+
+// Runs work on a thread pool in strands: work scheduled with the same key
+// (e.g. a document uri) is executed one at a time in the order scheduled,
+// while work for different keys runs in parallel.
+//
+// A strand only exists while it has pending work, so the cost depends on
+// the number of documents currently busy, not the number open. Each strand
+// gives up its thread after every item of work, so a document with a lot
+// of work queued can't starve others.
+class StrandExecutor {
+ public:
+  // Run on "pool", which needs to outlive this executor.
+  explicit StrandExecutor(ThreadPool *pool) : pool_(pool) {}
+  StrandExecutor(const StrandExecutor &) = delete;
+
+  // Finishes all work still pending before returning.
+  ~StrandExecutor() { WaitIdle(); }
+
+  // Schedule "fun" on the strand of "key". The returned future can be
+  // waited on for completion.
+  std::future<void> ExecAsync(const std::string &key,
+                              const std::function<void()> &fun);
+
+  // Wait until all work scheduled so far is done.
+  void WaitIdle();
+
+  // Number of keys with work pending or running.
+  size_t active_strands() const;
+
+ private:
+  // Pool task: run next work item of that strand.
+  void RunNext(const std::string &key);
+
+  ThreadPool *const pool_;
+
+  mutable std::mutex lock_;
+  std::condition_variable idle_;
+  // Pending work by key. The front is the one currently running.
+  std::unordered_map<std::string, std::deque<std::packaged_task<void()>>>
+      strands_;
+};
+
+#endif  // STRAND_EXECUTOR_H
@@ -0,0 +1,79 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "strand-executor.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+TEST(StrandExecutorTest, SameKeyRunsInOrderOneAtATime) {
+  static constexpr int kWorkItems = 1000;
+  ThreadPool pool(4);
+  StrandExecutor executor(&pool);
+  std::atomic<int> running{0};
+  std::vector<int> order;  // Only one at a time, so no lock needed.
+  for (int i = 0; i < kWorkItems; ++i) {
+    executor.ExecAsync("file:///a", [&, i]() {
+      EXPECT_EQ(++running, 1);
+      order.push_back(i);
+      --running;
+    });
+  }
+  executor.WaitIdle();
+  ASSERT_EQ(order.size(), kWorkItems);
+  for (int i = 0; i < kWorkItems; ++i) EXPECT_EQ(order[i], i);
+  EXPECT_EQ(executor.active_strands(), 0);
+}
+
+TEST(StrandExecutorTest, DifferentKeysRunInParallel) {
+  ThreadPool pool(2);
+  StrandExecutor executor(&pool);
+  // Work on "a" waits for work on "b" to run; would never finish if "b"
+  // was queued behind it.
+  std::promise<void> b_ran;
+  auto a = executor.ExecAsync("file:///a", [&]() {
+    EXPECT_EQ(b_ran.get_future().wait_for(std::chrono::seconds(10)),
+              std::future_status::ready);
+  });
+  executor.ExecAsync("file:///b", [&]() { b_ran.set_value(); });
+  a.get();
+}
+
+TEST(StrandExecutorTest, BusyStrandDoesNotStarveOthers) {
+  ThreadPool pool(1);
+  StrandExecutor executor(&pool);
+  std::vector<std::string> order;
+  for (int i = 0; i < 3; ++i) {
+    executor.ExecAsync("file:///a", [&]() { order.push_back("a"); });
+  }
+  executor.ExecAsync("file:///b", [&]() { order.push_back("b"); });
+  executor.WaitIdle();
+  EXPECT_EQ(order, std::vector<std::string>({"a", "b", "a", "a"}));
+}
+
+TEST(StrandExecutorTest, ExceptionIsReportedInFutureStrandContinues) {
+  ThreadPool pool(2);
+  StrandExecutor executor(&pool);
+  auto failed = executor.ExecAsync(
+      "file:///a", []() { throw std::runtime_error("oops"); });
+  bool next_ran = false;
+  auto next = executor.ExecAsync("file:///a", [&]() { next_ran = true; });
+  EXPECT_THROW(failed.get(), std::runtime_error);
+  next.get();
+  EXPECT_TRUE(next_ran);
+}
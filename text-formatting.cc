@@ -0,0 +1,54 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "text-formatting.h"
+
+#include <algorithm>
+#include <string>
+
+#include <absl/strings/match.h>
+
+// The text of a line is everything from its first to its last token.
+struct TextExtent {
+  int start;
+  int length;
+};
+static TextExtent GetTextExtent(const EditTextBuffer::Line &line) {
+  const LineTokens &tokens = line.tokens();
+  if (tokens.empty()) {  // Whitespace only. Extent is at end of line.
+    absl::string_view text = line.text();
+    if (absl::EndsWith(text, "\n")) text.remove_suffix(1);
+    if (absl::EndsWith(text, "\r")) text.remove_suffix(1);
+    return {(int)text.length(), 0};
+  }
+  return {(int)(tokens.front().data() - line.text().data()),
+          (int)(tokens.back().end() - tokens.front().begin())};
+}
+
+void CenterLines(const EditTextBuffer::LineVector &lines, int first_line,
+                 int last_line,
+                 const std::function<void(const TextEdit &)> &emit) {
+  int longest_line = 0;
+  for (int i = first_line; i < last_line; ++i) {
+    longest_line = std::max(longest_line, GetTextExtent(*lines[i]).length);
+  }
+  for (int i = first_line; i < last_line; ++i) {
+    const TextExtent extent = GetTextExtent(*lines[i]);
+    const int needs_spaces = (longest_line - extent.length) / 2;
+    emit(TextEdit{
+        .range = {{i, 0}, {i, extent.start}},
+        .newText = std::string(needs_spaces, ' '),
+    });
+  }
+}
@@ -0,0 +1,32 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TEXT_FORMATTING_H
+#define TEXT_FORMATTING_H
+
+#include <functional>
+
+#include "lsp-protocol.h"
+#include "lsp-text-buffer.h"
+
+// Formatting example: center the text of lines [first_line, last_line)
+// relative to the longest text among them. Emits one edit per line that
+// replaces its leading whitespace, or all of it in a whitespace-only line.
+// Formatting a second time results in the same text.
+// Lines need to be tokenized, i.e. called within RequestTokenizedLines().
+void CenterLines(const EditTextBuffer::LineVector &lines, int first_line,
+                 int last_line,
+                 const std::function<void(const TextEdit &)> &emit);
+
+#endif  // TEXT_FORMATTING_H
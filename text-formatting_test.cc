@@ -0,0 +1,51 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "text-formatting.h"
+
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+// Center all lines of the buffer and return the resulting text.
+static std::string Format(EditTextBuffer *buffer) {
+  std::vector<TextEdit> edits;
+  buffer->RequestTokenizedLines([&](const EditTextBuffer::LineVector &lines) {
+    CenterLines(lines, 0, lines.size(),
+                [&](const TextEdit &edit) { edits.push_back(edit); });
+  });
+  // One edit per line, so they don't interfere with each other.
+  for (const TextEdit &edit : edits) {
+    EXPECT_TRUE(buffer->ApplyChange({.range = edit.range,
+                                     .has_range = true,
+                                     .text = edit.newText}));
+  }
+  std::string result;
+  buffer->RequestContent(
+      [&](absl::string_view content) { result = std::string(content); });
+  return result;
+}
+
+TEST(TextFormatting, CenterLines) {
+  EditTextBuffer buffer("Hello\n  Hello World\n");
+  EXPECT_EQ(Format(&buffer), "   Hello\nHello World\n");
+}
+
+TEST(TextFormatting, FormattingTwiceResultsInSameText) {
+  EditTextBuffer buffer("Hello World\n      \n\nfoo\n  \r\n");
+  const std::string formatted = Format(&buffer);
+  EXPECT_EQ(formatted, "Hello World\n     \n     \n    foo\n     \r\n");
+  EXPECT_EQ(Format(&buffer), formatted);
+}
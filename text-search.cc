@@ -0,0 +1,117 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "text-search.h"
+
+#include <string.h>
+
+#include <absl/strings/str_cat.h>
+
+static re2::StringPiece ToStringPiece(absl::string_view s) {
+  return {s.data(), s.size()};
+}
+
+absl::Status TextSearch::Init(absl::string_view query, bool is_regex,
+                              bool case_sensitive) {
+  if (query.empty()) return absl::InvalidArgumentError("Empty search query");
+  if (!is_regex && query.find('\n') != absl::string_view::npos) {
+    return absl::InvalidArgumentError("Search query spans multiple lines");
+  }
+  if (!is_regex && case_sensitive) {
+    literal_ = std::string(query);
+    regex_.reset();
+    return absl::OkStatus();
+  }
+
+  // Case-insensitive literal search is best left to the regex engine.
+  const std::string pattern =
+      is_regex ? std::string(query) : RE2::QuoteMeta(ToStringPiece(query));
+  RE2::Options options;
+  options.set_log_errors(false);
+  if (is_regex) {  // Check as given to report errors in terms of the query.
+    const RE2 check(pattern, options);
+    if (!check.ok()) {
+      return absl::InvalidArgumentError(
+          absl::StrCat("Search pattern '", query, "': ", check.error()));
+    }
+  }
+  options.set_case_sensitive(case_sensitive);
+  options.set_never_nl(true);  // Matches never span lines...
+  regex_.reset(new RE2("(?m)" + pattern, options));  // ... ^ and $ per line.
+  if (!regex_->ok()) {  // Only if the flag prefix pushes it over the edge.
+    regex_.reset();
+    return absl::InvalidArgumentError("Search pattern too complex");
+  }
+  return absl::OkStatus();
+}
+
+bool TextSearch::Search(absl::string_view text,
+                        const MatchFun &on_match) const {
+  const char *const text_end = text.data() + text.size();
+
+  // Matches come in ascending order, so the line we're on only needs to be
+  // advanced by counting newlines between subsequent matches.
+  int line_number = 0;
+  const char *line_start = text.data();
+  const char *line_end = nullptr;  // Only known once we have a match.
+
+  size_t pos = 0;
+  while (pos <= text.size()) {
+    size_t match_start;
+    size_t match_length;
+    if (regex_) {
+      re2::StringPiece found;
+      if (!regex_->Match(ToStringPiece(text), pos, text.size(),
+                         RE2::UNANCHORED, &found, 1)) {
+        break;
+      }
+      match_start = found.data() - text.data();
+      match_length = found.size();
+    } else {
+      const void *found = memmem(text.data() + pos, text.size() - pos,
+                                 literal_.data(), literal_.size());
+      if (!found) break;
+      match_start = static_cast<const char *>(found) - text.data();
+      match_length = literal_.size();
+    }
+
+    const char *const match = text.data() + match_start;
+    if (!line_end || match > line_end) {
+      if (line_end) {  // Skip lines between previous and this match.
+        line_start = line_end + 1;
+        ++line_number;
+      }
+      const char *newline;
+      while ((newline = static_cast<const char *>(
+                  memchr(line_start, '\n', match - line_start)))) {
+        line_start = newline + 1;
+        ++line_number;
+      }
+      line_end = static_cast<const char *>(
+          memchr(match, '\n', text_end - match));
+      if (!line_end) line_end = text_end;
+    }
+
+    const int start = match - line_start;
+    const Match m = {
+        .line = line_number,
+        .start = start,
+        .end = start + static_cast<int>(match_length),
+        .line_text = {line_start, static_cast<size_t>(line_end - line_start)},
+    };
+    if (!on_match(m)) return false;
+    pos = match_start + (match_length ? match_length : 1);
+  }
+  return true;
+}
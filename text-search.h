@@ -0,0 +1,71 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef TEXT_SEARCH_H
+#define TEXT_SEARCH_H
+
+#include <functional>
+#include <memory>
+#include <string>
+
+//
+#include <absl/status/status.h>
+#include <absl/strings/string_view.h>
+#include <re2/re2.h>
+
+// Search for all occurrences of a literal string or regular expression
+// in a text. Matches never span lines.
+//
+// The whole text is searched in one go instead of line by line, so the
+// bulk of non-matching text is skipped at memory bandwidth: literal
+// queries with memmem(), regular expressions by RE2 which skips ahead to
+// candidate positions with memchr() on the required prefix.
+// Line numbers are only determined for the matches found.
+//
+// Once initialized, searching is thread-safe.
+class TextSearch {
+ public:
+  // Match in columns [start, end) of zero-based line number "line".
+  // The line text is given without its newline and is valid for as long as
+  // the searched text is.
+  struct Match {
+    int line;
+    int start;
+    int end;
+    absl::string_view line_text;
+  };
+
+  // Called for each match in order. Return false to stop searching.
+  using MatchFun = std::function<bool(const Match &match)>;
+
+  TextSearch() = default;
+  TextSearch(const TextSearch &) = delete;
+
+  // Set up to search for "query", either literally or as regular expression.
+  // Returns kInvalidArgument status on an empty or multi-line query or an
+  // invalid expression.
+  absl::Status Init(absl::string_view query, bool is_regex,
+                    bool case_sensitive);
+
+  // Search "text" and call "on_match" for every match.
+  // Returns false if the search was stopped by "on_match".
+  bool Search(absl::string_view text, const MatchFun &on_match) const;
+
+ private:
+  // Literal query if regex_ is not set.
+  std::string literal_;
+  std::unique_ptr<RE2> regex_;
+};
+
+#endif  // TEXT_SEARCH_H
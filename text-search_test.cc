@@ -0,0 +1,92 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "text-search.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+#include <absl/strings/str_cat.h>
+
+// Search and return all matches as "line:start-end:line_text" strings.
+static std::vector<std::string> SearchAll(const TextSearch &search,
+                                          absl::string_view text) {
+  std::vector<std::string> result;
+  search.Search(text, [&](const TextSearch::Match &m) {
+    result.push_back(absl::StrCat(m.line, ":", m.start, "-", m.end, ":",
+                                  m.line_text));
+    return true;
+  });
+  return result;
+}
+
+TEST(TextSearchTest, InvalidQueries) {
+  TextSearch search;
+  EXPECT_EQ(search.Init("", false, true).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(search.Init("a\nb", false, true).code(),
+            absl::StatusCode::kInvalidArgument);
+  EXPECT_EQ(search.Init("a(b", true, true).code(),
+            absl::StatusCode::kInvalidArgument);
+}
+
+TEST(TextSearchTest, LiteralSearch) {
+  TextSearch search;
+  ASSERT_TRUE(search.Init("foo", false, true).ok());
+  EXPECT_EQ(SearchAll(search, "foo bar foo\n\nbar\n  Foo foo"),
+            std::vector<std::string>({"0:0-3:foo bar foo", "0:8-11:foo bar foo",
+                                      "3:6-9:  Foo foo"}));
+  EXPECT_TRUE(SearchAll(search, "").empty());
+  EXPECT_TRUE(SearchAll(search, "no match\n").empty());
+}
+
+TEST(TextSearchTest, LiteralSearchIsNotARegex) {
+  TextSearch search;
+  ASSERT_TRUE(search.Init("a.c", false, true).ok());
+  EXPECT_EQ(SearchAll(search, "abc\na.c\n"),
+            std::vector<std::string>({"1:0-3:a.c"}));
+}
+
+TEST(TextSearchTest, CaseInsensitiveLiteralSearch) {
+  TextSearch search;
+  ASSERT_TRUE(search.Init("a.c", false, false).ok());
+  EXPECT_EQ(SearchAll(search, "abc\nA.C\n"),
+            std::vector<std::string>({"1:0-3:A.C"}));
+}
+
+TEST(TextSearchTest, RegexMatchesNeverSpanLines) {
+  TextSearch search;
+  ASSERT_TRUE(search.Init("a[^x]*b", true, true).ok());
+  EXPECT_EQ(SearchAll(search, "a\nb\nxazb\n"),
+            std::vector<std::string>({"2:1-4:xazb"}));
+}
+
+TEST(TextSearchTest, RegexAnchorsApplyPerLine) {
+  TextSearch search;
+  ASSERT_TRUE(search.Init("^fo+$", true, true).ok());
+  EXPECT_EQ(SearchAll(search, "foo\nfoo bar\r\nfooo"),
+            std::vector<std::string>({"0:0-3:foo", "2:0-4:fooo"}));
+}
+
+TEST(TextSearchTest, StopSearch) {
+  TextSearch search;
+  ASSERT_TRUE(search.Init("x", false, true).ok());
+  int count = 0;
+  EXPECT_FALSE(search.Search("x\nx\nx\n", [&](const TextSearch::Match &) {
+    return ++count < 2;
+  }));
+  EXPECT_EQ(count, 2);
+}
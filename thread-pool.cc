@@ -0,0 +1,62 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thread-pool.h"
+
+ThreadPool::ThreadPool(int thread_count) {
+  if (thread_count <= 0) thread_count = std::thread::hardware_concurrency();
+  if (thread_count <= 0) thread_count = 1;  // Unknown number of cores.
+  for (int i = 0; i < thread_count; ++i) {
+    threads_.emplace_back(&ThreadPool::Runner, this);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::unique_lock<std::mutex> l(lock_);
+    exiting_ = true;
+  }
+  cv_.notify_all();
+  for (std::thread &t : threads_) t.join();
+}
+
+std::future<void> ThreadPool::ExecAsync(const std::function<void()> &fun) {
+  std::packaged_task<void()> task(fun);
+  std::future<void> result = task.get_future();
+  {
+    std::unique_lock<std::mutex> l(lock_);
+    work_queue_.emplace_back(std::move(task));
+  }
+  cv_.notify_one();
+  return result;
+}
+
+void ThreadPool::Runner() {
+  for (;;) {
+    std::packaged_task<void()> task;
+    {
+      std::unique_lock<std::mutex> l(lock_);
+      cv_.wait(l, [this]() { return exiting_ || !work_queue_.empty(); });
+      if (work_queue_.empty()) return;  // Only exiting once work is done.
+      task = std::move(work_queue_.front());
+      work_queue_.pop_front();
+    }
+    task();
+  }
+}
+
+void WaitAll(std::vector<std::future<void>> *work) {
+  for (auto &w : *work) w.wait();
+  for (auto &w : *work) w.get();  // Throws the first exception.
+}
@@ -0,0 +1,59 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A simple fixed-size pool of threads executing functions handed to it.
+class ThreadPool {
+ public:
+  // Create a pool with "thread_count" threads. If zero, use as many threads
+  // as there are cores available.
+  explicit ThreadPool(int thread_count = 0);
+  ThreadPool(const ThreadPool &) = delete;
+
+  // Finishes all work still pending before returning.
+  ~ThreadPool();
+
+  // Schedule "fun" to be executed on one of the threads. The returned
+  // future can be waited on for completion.
+  std::future<void> ExecAsync(const std::function<void()> &fun);
+
+  int thread_count() const { return threads_.size(); }
+
+ private:
+  void Runner();
+
+  std::vector<std::thread> threads_;
+
+  std::mutex lock_;
+  std::condition_variable cv_;
+  std::deque<std::packaged_task<void()>> work_queue_;
+  bool exiting_ = false;
+};
+
+// Wait for all of "work" to finish, then rethrow the first exception
+// reported, if any. Unlike calling get() on each in turn, this doesn't
+// return while tasks still run that might refer to state of the caller.
+void WaitAll(std::vector<std::future<void>> *work);
+
+#endif  // THREAD_POOL_H
@@ -0,0 +1,66 @@
+// Copyright 2021 Henner Zeller <h.zeller@acm.org>
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "thread-pool.h"
+
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+#include "gtest/gtest.h"
+
+TEST(ThreadPoolTest, AllScheduledWorkIsExecuted) {
+  static constexpr int kWorkItems = 1000;
+  std::atomic<int> executed{0};
+  std::vector<std::future<void>> results;
+  ThreadPool pool(4);
+  EXPECT_EQ(pool.thread_count(), 4);
+  for (int i = 0; i < kWorkItems; ++i) {
+    results.emplace_back(pool.ExecAsync([&executed]() { ++executed; }));
+  }
+  for (auto &r : results) r.wait();
+  EXPECT_EQ(executed, kWorkItems);
+}
+
+TEST(ThreadPoolTest, DestructorFinishesPendingWork) {
+  std::atomic<int> executed{0};
+  {
+    ThreadPool pool(1);
+    for (int i = 0; i < 100; ++i) {
+      pool.ExecAsync([&executed]() { ++executed; });
+    }
+  }
+  EXPECT_EQ(executed, 100);
+}
+
+TEST(ThreadPoolTest, ExceptionIsReportedInFuture) {
+  ThreadPool pool(2);
+  auto result = pool.ExecAsync([]() { throw std::runtime_error("oops"); });
+  EXPECT_THROW(result.get(), std::runtime_error);
+}
+
+TEST(ThreadPoolTest, WaitAllFinishesAllWorkBeforeRethrowing) {
+  ThreadPool pool(2);
+  std::atomic<int> executed{0};
+  std::vector<std::future<void>> work;
+  work.push_back(pool.ExecAsync([]() { throw std::runtime_error("oops"); }));
+  for (int i = 0; i < 10; ++i) {
+    work.push_back(pool.ExecAsync([&executed]() {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      ++executed;
+    }));
+  }
+  EXPECT_THROW(WaitAll(&work), std::runtime_error);
+  EXPECT_EQ(executed, 10);
+}